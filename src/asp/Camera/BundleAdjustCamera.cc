@@ -27,6 +27,7 @@
 #include <vw/Cartography/CameraBBox.h>
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/FileIO/KML.h>
+#include <vw/Core/Settings.h>
 #include <asp/Camera/CameraResectioning.h>
 
 #include <string>
@@ -959,12 +960,19 @@ void asp::saveMapprojOffsets(std::string                       const& mapproj_of
   ofs << "# Percentiles of distances between mapprojected matching pixels in an "
       << "image and the others.\n";
   ofs << "# image_name 25% 50% 75% 85% 95% count\n";
-  for (size_t image_it = 0; image_it < imageFiles.size(); image_it++) {
+
+  // Sorting is the expensive part, so do it in parallel
+  int num_images = imageFiles.size();
+  int num_threads = vw::vw_settings().default_num_threads();
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+  for (int image_it = 0; image_it < num_images; image_it++)
+    std::sort(mapprojOffsetsPerCam[image_it].begin(), mapprojOffsetsPerCam[image_it].end());
+  
+  for (int image_it = 0; image_it < num_images; image_it++) {
     auto & vals = mapprojOffsetsPerCam[image_it]; // alias
     int len = vals.size();
     float val25 = -1.0, val50 = -1.0, val75 = -1.0, val85 = -1.0, val95 = -1.0, count = 0;
     if (!vals.empty()) {
-      std::sort(vals.begin(), vals.end());
       val25 = vals[0.25 * len];
       val50 = vals[0.50 * len];
       val75 = vals[0.75 * len];
@@ -997,12 +1005,14 @@ void asp::saveMapprojOffsets(std::string                       const& mapproj_of
   ofs << "# lon, lat, height_above_datum, mapproj_ip_dist_meters\n";
   ofs << "# " << mapproj_dem_georef.datum() << std::endl;
 
-  // Write all the points to the file
-  for (size_t it = 0; it < mapprojPoints.size(); it++) {
+  // Write all the points to the file. Format them in parallel.
+  size_t rows_per_block = 100000;
+  asp::write_rows_in_parallel(ofs, mapprojPoints.size(), rows_per_block, num_threads,
+                              [&](size_t it, std::ostream & os) {
     Vector3 llh = subvector(mapprojPoints[it], 0, 3);
-    ofs << llh[0] << ", " << llh[1] <<", " << llh[2] << ", "
-         << mapprojPoints[it][3] << std::endl;
-  }
+    os << llh[0] << ", " << llh[1] <<", " << llh[2] << ", "
+       << mapprojPoints[it][3] << "\n";
+  });
   
   ofs.close();
   
@@ -1041,6 +1051,14 @@ void asp::matchFilesProcessing(vw::ba::ControlNetwork       const& cnet,
   int num_cameras = opt.image_files.size();
   mapprojOffsetsPerCam.resize(num_cameras);
 
+  // The convergence angles are found in parallel, unless the cameras
+  // are not thread-safe
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw::vw_settings().default_num_threads();
+  if (opt.single_threaded_cameras)
+    num_threads = 1;
+
   // Iterate over the control network, and, for each inlier pair of matches,
   // remember what pair it is from. Needed only if there is outlier filtering.
   // TODO(oalexan1): This uses a lot of memory. Need to keep just indices, somehow, not
@@ -1105,7 +1123,7 @@ void asp::matchFilesProcessing(vw::ba::ControlNetwork       const& cnet,
 
     if (!remove_outliers) {
       asp::convergence_angles(optimized_cams[left_index].get(), optimized_cams[right_index].get(),
-                              orig_left_ip, orig_right_ip, sorted_angles);
+                              orig_left_ip, orig_right_ip, sorted_angles, num_threads);
       convAngle.populate(left_index, right_index, sorted_angles);
 
       if (save_mapproj_match_points_offsets) {
@@ -1189,7 +1207,7 @@ void asp::matchFilesProcessing(vw::ba::ControlNetwork       const& cnet,
 
     // Find convergence angles based on clean ip
     asp::convergence_angles(optimized_cams[left_index].get(), optimized_cams[right_index].get(),
-                            left_ip, right_ip, sorted_angles);
+                            left_ip, right_ip, sorted_angles, num_threads);
     convAngle.populate(left_index, right_index, sorted_angles);
     
     if (save_mapproj_match_points_offsets) {
@@ -0,0 +1,346 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/CameraStateCache.h>
+#include <asp/Camera/RPC_XML.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Log.h>
+
+#include <boost/filesystem.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+namespace asp {
+
+namespace {
+
+// Increment this when the format or the parsing logic changes, so
+// that stale cache entries are ignored.
+const std::uint32_t CAMERA_STATE_VERSION = 1;
+const char CAMERA_STATE_MAGIC[] = "ASPCAMST";
+const std::uint32_t DG_CAMERA_STATE_TYPE = 1;
+
+// Path to the cache file for given hash and camera type
+std::string camera_state_path(std::string const& hash, std::string const& ext) {
+  return camera_state_cache_dir() + "/" + hash + ext;
+}
+
+// Helpers for writing and reading the state. Numbers are written in
+// the native binary form, as the cache is meant for the machine that
+// created it.
+
+template<class T>
+void write_pod(std::ostream & os, T const& val) {
+  os.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template<class T>
+void read_pod(std::istream & is, T & val) {
+  is.read(reinterpret_cast<char*>(&val), sizeof(T));
+  if (!is.good())
+    vw::vw_throw(vw::IOErr() << "Truncated camera state file.\n");
+}
+
+void write_str(std::ostream & os, std::string const& str) {
+  write_pod(os, std::uint64_t(str.size()));
+  os.write(str.data(), str.size());
+}
+
+void read_str(std::istream & is, std::string & str) {
+  std::uint64_t len = 0;
+  read_pod(is, len);
+  str.resize(len);
+  if (len > 0)
+    is.read(&str[0], len);
+  if (!is.good())
+    vw::vw_throw(vw::IOErr() << "Truncated camera state file.\n");
+}
+
+// A vw::Vector is stored as its fixed number of doubles
+template<class VecT>
+void write_vec(std::ostream & os, VecT const& v) {
+  for (size_t i = 0; i < v.size(); i++)
+    write_pod(os, double(v[i]));
+}
+
+template<class VecT>
+void read_vec(std::istream & is, VecT & v) {
+  for (size_t i = 0; i < v.size(); i++) {
+    double val = 0;
+    read_pod(is, val);
+    v[i] = val;
+  }
+}
+
+// A std::vector of vw::Vector or of numbers
+template<class ElemT>
+void write_array(std::ostream & os, std::vector<ElemT> const& arr) {
+  write_pod(os, std::uint64_t(arr.size()));
+  for (size_t i = 0; i < arr.size(); i++)
+    write_vec(os, arr[i]);
+}
+
+template<class ElemT>
+void read_array(std::istream & is, std::vector<ElemT> & arr) {
+  std::uint64_t len = 0;
+  read_pod(is, len);
+  arr.resize(len);
+  for (size_t i = 0; i < arr.size(); i++)
+    read_vec(is, arr[i]);
+}
+
+template<class T>
+void write_pod_array(std::ostream & os, std::vector<T> const& arr) {
+  write_pod(os, std::uint64_t(arr.size()));
+  if (!arr.empty())
+    os.write(reinterpret_cast<const char*>(&arr[0]), arr.size() * sizeof(T));
+}
+
+template<class T>
+void read_pod_array(std::istream & is, std::vector<T> & arr) {
+  std::uint64_t len = 0;
+  read_pod(is, len);
+  arr.resize(len);
+  if (len > 0)
+    is.read(reinterpret_cast<char*>(&arr[0]), len * sizeof(T));
+  if (!is.good())
+    vw::vw_throw(vw::IOErr() << "Truncated camera state file.\n");
+}
+
+void write_quat(std::ostream & os, vw::Quat const& q) {
+  write_pod(os, q.w()); write_pod(os, q.x()); write_pod(os, q.y()); write_pod(os, q.z());
+}
+
+void read_quat(std::istream & is, vw::Quat & q) {
+  double w = 0, x = 0, y = 0, z = 0;
+  read_pod(is, w); read_pod(is, x); read_pod(is, y); read_pod(is, z);
+  q = vw::Quat(w, x, y, z);
+}
+
+// Write the header. The hash is stored as well, to guard against
+// a file being renamed.
+void write_header(std::ostream & os, std::uint32_t type, std::string const& hash) {
+  os.write(CAMERA_STATE_MAGIC, sizeof(CAMERA_STATE_MAGIC) - 1);
+  write_pod(os, CAMERA_STATE_VERSION);
+  write_pod(os, type);
+  write_str(os, hash);
+}
+
+// Return false if the header does not match
+bool read_header(std::istream & is, std::uint32_t type, std::string const& hash) {
+  std::string magic(sizeof(CAMERA_STATE_MAGIC) - 1, ' ');
+  is.read(&magic[0], magic.size());
+  if (!is.good() || magic != CAMERA_STATE_MAGIC)
+    return false;
+  std::uint32_t version = 0, file_type = 0;
+  read_pod(is, version);
+  read_pod(is, file_type);
+  std::string file_hash;
+  read_str(is, file_hash);
+  return (version == CAMERA_STATE_VERSION && file_type == type && file_hash == hash);
+}
+
+} // end anonymous namespace
+
+std::string camera_state_cache_dir() {
+  char * dir = getenv("ASP_CAMERA_CACHE_DIR");
+  if (dir == NULL)
+    return "";
+  return std::string(dir);
+}
+
+std::string file_content_hash(std::string const& path) {
+  std::ifstream ifs(path.c_str(), std::ios::binary);
+  if (!ifs.good())
+    return "";
+  
+  std::uint64_t hash = 14695981039346656037ULL; // FNV offset basis
+  const std::uint64_t prime = 1099511628211ULL;
+  std::vector<char> buf(1 << 16);
+  while (ifs) {
+    ifs.read(&buf[0], buf.size());
+    std::streamsize count = ifs.gcount();
+    for (std::streamsize i = 0; i < count; i++) {
+      hash ^= static_cast<unsigned char>(buf[i]);
+      hash *= prime;
+    }
+  }
+  
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return os.str();
+}
+
+bool read_dg_camera_state(std::string const& hash,
+                          GeometricXML & geo, AttitudeXML & att,
+                          EphemerisXML & eph, ImageXML & img,
+                          vw::BBox3 & llh_box) {
+
+  if (camera_state_cache_dir().empty() || hash.empty())
+    return false;
+
+  std::string path = camera_state_path(hash, ".dg_state");
+  std::ifstream is(path.c_str(), std::ios::binary);
+  if (!is.good())
+    return false;
+
+  try {
+    if (!read_header(is, DG_CAMERA_STATE_TYPE, hash))
+      return false;
+
+    read_pod(is, geo.principal_distance);
+    read_pod(is, geo.optical_polyorder);
+    read_vec(is, geo.perspective_center);
+    read_quat(is, geo.camera_attitude);
+    read_vec(is, geo.detector_origin);
+    read_pod(is, geo.detector_rotation);
+    read_pod(is, geo.detector_pixel_pitch);
+
+    read_str(is, att.start_time);
+    read_pod(is, att.time_interval);
+    read_array(is, att.satellite_quat_vec);
+    read_pod_array(is, att.satellite_quat_cov);
+
+    read_str(is, eph.start_time);
+    read_pod(is, eph.time_interval);
+    read_array(is, eph.satellite_position_vec);
+    read_pod_array(is, eph.satellite_pos_cov);
+    read_array(is, eph.velocity_vec);
+
+    read_str(is, img.tlc_start_time);
+    read_str(is, img.first_line_start_time);
+    std::uint64_t num_tlc = 0;
+    read_pod(is, num_tlc);
+    img.tlc_vec.resize(num_tlc);
+    for (size_t i = 0; i < img.tlc_vec.size(); i++) {
+      read_pod(is, img.tlc_vec[i].first);
+      read_pod(is, img.tlc_vec[i].second);
+    }
+    read_str(is, img.sat_id);
+    read_str(is, img.band_id);
+    read_str(is, img.scan_direction);
+    read_pod(is, img.tdi);
+    read_pod_array(is, img.tdi_multi);
+    read_pod(is, img.avg_line_rate);
+    read_vec(is, img.image_size);
+
+    std::uint8_t box_empty = 1;
+    read_pod(is, box_empty);
+    llh_box = vw::BBox3();
+    if (!box_empty) {
+      vw::Vector3 box_min, box_max;
+      read_vec(is, box_min);
+      read_vec(is, box_max);
+      llh_box = vw::BBox3(box_min, box_max);
+    }
+  } catch (...) {
+    vw::vw_out(vw::WarningMessage) << "Ignoring invalid camera state file: " << path << "\n";
+    return false;
+  }
+  
+  return true;
+}
+
+void write_dg_camera_state(std::string const& hash,
+                           GeometricXML const& geo, AttitudeXML const& att,
+                           EphemerisXML const& eph, ImageXML const& img,
+                           vw::BBox3 const& llh_box) {
+  
+  if (camera_state_cache_dir().empty() || hash.empty())
+    return;
+
+  std::string path = camera_state_path(hash, ".dg_state");
+  
+  // Write to a temporary file, then rename it, so that other processes
+  // never see a partially written file.
+  std::string tmp_path;
+  try {
+    tmp_path = fs::unique_path(path + ".tmp-%%%%-%%%%-%%%%").string();
+
+    fs::create_directories(camera_state_cache_dir());
+
+    std::ofstream os(tmp_path.c_str(), std::ios::binary);
+    if (!os.good())
+      return;
+
+    write_header(os, DG_CAMERA_STATE_TYPE, hash);
+
+    write_pod(os, geo.principal_distance);
+    write_pod(os, geo.optical_polyorder);
+    write_vec(os, geo.perspective_center);
+    write_quat(os, geo.camera_attitude);
+    write_vec(os, geo.detector_origin);
+    write_pod(os, geo.detector_rotation);
+    write_pod(os, geo.detector_pixel_pitch);
+
+    write_str(os, att.start_time);
+    write_pod(os, att.time_interval);
+    write_array(os, att.satellite_quat_vec);
+    write_pod_array(os, att.satellite_quat_cov);
+
+    write_str(os, eph.start_time);
+    write_pod(os, eph.time_interval);
+    write_array(os, eph.satellite_position_vec);
+    write_pod_array(os, eph.satellite_pos_cov);
+    write_array(os, eph.velocity_vec);
+
+    write_str(os, img.tlc_start_time);
+    write_str(os, img.first_line_start_time);
+    write_pod(os, std::uint64_t(img.tlc_vec.size()));
+    for (size_t i = 0; i < img.tlc_vec.size(); i++) {
+      write_pod(os, img.tlc_vec[i].first);
+      write_pod(os, img.tlc_vec[i].second);
+    }
+    write_str(os, img.sat_id);
+    write_str(os, img.band_id);
+    write_str(os, img.scan_direction);
+    write_pod(os, img.tdi);
+    write_pod_array(os, img.tdi_multi);
+    write_pod(os, img.avg_line_rate);
+    write_vec(os, img.image_size);
+
+    write_pod(os, std::uint8_t(llh_box.empty()));
+    if (!llh_box.empty()) {
+      write_vec(os, llh_box.min());
+      write_vec(os, llh_box.max());
+    }
+
+    os.close();
+    if (!os.good()) {
+      fs::remove(tmp_path);
+      return;
+    }
+    
+    fs::rename(tmp_path, path);
+  } catch (...) {
+    // The cache is just an optimization, so failing to write is not fatal
+    boost::system::error_code ec;
+    if (!tmp_path.empty())
+      fs::remove(tmp_path, ec);
+  }
+}
+  
+} // end namespace asp
@@ -0,0 +1,68 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file CameraStateCache.h
+///
+/// A binary cache of the data parsed from XML camera files, so that
+/// repeated loading of the same camera, by many tools and processes,
+/// does not have to parse the XML each time. The cache is enabled by
+/// setting the ASP_CAMERA_CACHE_DIR environment variable to a
+/// writable directory. Each entry is named after the hash of the
+/// contents of the XML file, so changes to that file are detected.
+
+#ifndef __STEREO_CAMERA_CAMERA_STATE_CACHE_H__
+#define __STEREO_CAMERA_CAMERA_STATE_CACHE_H__
+
+#include <vw/Math/BBox.h>
+
+#include <string>
+
+namespace asp {
+
+  class GeometricXML;
+  class AttitudeXML;
+  class EphemerisXML;
+  class ImageXML;
+
+  /// The directory having the cached camera states, from the
+  /// ASP_CAMERA_CACHE_DIR environment variable. Return the empty
+  /// string if not set, in which case caching is disabled.
+  std::string camera_state_cache_dir();
+
+  /// A 64-bit FNV-1a hash of the file contents, as a hex string.
+  std::string file_content_hash(std::string const& path);
+
+  /// Read the cached state of a DigitalGlobe XML camera file, given
+  /// the hash of its contents. Return false if caching is disabled,
+  /// there is no cache entry, or it is from an incompatible version.
+  bool read_dg_camera_state(std::string const& hash,
+                            GeometricXML & geo, AttitudeXML & att,
+                            EphemerisXML & eph, ImageXML & img,
+                            vw::BBox3 & llh_box);
+
+  /// Save the state of a DigitalGlobe XML camera file to the cache,
+  /// if caching is enabled. Failures are not fatal, as the cache is
+  /// only an optimization.
+  void write_dg_camera_state(std::string const& hash,
+                             GeometricXML const& geo, AttitudeXML const& att,
+                             EphemerisXML const& eph, ImageXML const& img,
+                             vw::BBox3 const& llh_box);
+  
+} // end namespace asp
+
+#endif//__STEREO_CAMERA_CAMERA_STATE_CACHE_H__
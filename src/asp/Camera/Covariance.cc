@@ -25,6 +25,8 @@
 #include <vw/Math/LinearAlgebra.h>
 
 #include <iostream>
+#include <map>
+#include <algorithm>
 
 using namespace vw::camera;
 
@@ -91,6 +93,37 @@ int numCamsForCovariance() {
   return 15; 
 }
 
+// Find the DG camera behind a possibly adjusted camera. Check that
+// the perturbed cameras exist.
+DGCameraModel const* dgCamera(vw::camera::CameraModel const* cam) {
+
+  DGCameraModel const* dg_cam = dynamic_cast<DGCameraModel const*>(unadjusted_model(cam));
+  if (dg_cam == NULL) 
+    vw::vw_throw(vw::ArgumentErr() << "Expecting DG cameras.\n");
+
+  // Numerical differences will be used. Camera models with deltaPosition and deltaQuat
+  // perturbations have already been created in LinescanDGModel.cc using the positionDelta()
+  // and quatDelta() functions from above.
+  if (dg_cam->m_perturbed_cams.empty()) 
+    vw::vw_throw(vw::ArgumentErr() << "The perturbed cameras were not set up.\n");
+
+  return dg_cam;
+}
+
+// Find the camera center and direction for the unperturbed DG
+// camera, and for the perturbed versions, before any adjustments.
+void dgCameraRays(DGCameraModel const* dg_cam, vw::Vector2 const& pix,
+                  std::vector<vw::Vector3> & dirs, std::vector<vw::Vector3> & ctrs) {
+  dirs.clear();
+  ctrs.clear();
+  dirs.push_back(dg_cam->pixel_to_vector(pix));
+  ctrs.push_back(dg_cam->camera_center(pix));
+  for (size_t it = 0; it < dg_cam->m_perturbed_cams.size(); it++) {
+    dirs.push_back(dg_cam->m_perturbed_cams[it]->pixel_to_vector(pix));
+    ctrs.push_back(dg_cam->m_perturbed_cams[it]->camera_center(pix));
+  }
+}
+
 // Given two DG cameras and a pixel in each camera image, consider the
 // following transform. Go from the perturbed joint vector of
 // satellite positions and quaternions for this pixel pair to the
@@ -109,11 +142,15 @@ int numCamsForCovariance() {
 // when we multiply by the actual covariances, which are huge, so
 // those will be pre-multiplied by the squares of deltaPosition and
 // deltaQuat, with the same final result.
+// The rays for the unperturbed and perturbed cameras are as found by
+// dgCameraRays(). They are modified in place if the cameras are adjusted.
 void scaledDGTriangulationJacobian(vw::cartography::Datum const& datum,
                                    vw::camera::CameraModel const* cam1,
                                    vw::camera::CameraModel const* cam2,
-                                   vw::Vector2 const& pix1,
-                                   vw::Vector2 const& pix2,
+                                   std::vector<vw::Vector3> & cam1_dirs,
+                                   std::vector<vw::Vector3> & cam1_ctrs,
+                                   std::vector<vw::Vector3> & cam2_dirs,
+                                   std::vector<vw::Vector3> & cam2_ctrs,
                                    vw::Matrix<double> & J) {
   
   // Handle adjusted cameras
@@ -136,37 +173,11 @@ void scaledDGTriangulationJacobian(vw::cartography::Datum const& datum,
     cam1_shift = vw::Vector3(cam1_adj(0, 3), cam1_adj(1, 3), cam1_adj(2, 3));
     cam2_shift = vw::Vector3(cam2_adj(0, 3), cam2_adj(1, 3), cam2_adj(2, 3));
   }
-  
-  DGCameraModel const* dg_cam1 = dynamic_cast<DGCameraModel const*>(unadjusted_model(cam1));
-  DGCameraModel const* dg_cam2 = dynamic_cast<DGCameraModel const*>(unadjusted_model(cam2));
-  if (dg_cam1 == NULL || dg_cam2 == NULL) 
-    vw::vw_throw(vw::ArgumentErr() << "Expecting DG cameras.\n");
 
-  // Numerical differences will be used. Camera models with deltaPosition and deltaQuat
-  // perturbations have already been created in LinescanDGModel.cc using the positionDelta()
-  // and quatDelta() functions from above.
-  if (dg_cam1->m_perturbed_cams.empty() || dg_cam2->m_perturbed_cams.empty()) 
-    vw::vw_throw(vw::ArgumentErr() << "The perturbed cameras were not set up.\n");
-  
-  if (dg_cam1->m_perturbed_cams.size() != dg_cam2->m_perturbed_cams.size())
+  if (cam1_dirs.size() != cam2_dirs.size())
     vw::vw_throw(vw::ArgumentErr()
                  << "The number of perturbations in the two cameras do not agree.\n");
 
-  // Find the camera center and direction for first unperturbed
-  // camera, and for the perturbed versions. Same for the second
-  // camera.
-  std::vector<vw::Vector3> cam1_dirs, cam1_ctrs, cam2_dirs, cam2_ctrs;
-  cam1_dirs.push_back(dg_cam1->pixel_to_vector(pix1));
-  cam1_ctrs.push_back(dg_cam1->camera_center(pix1));
-  cam2_dirs.push_back(dg_cam2->pixel_to_vector(pix2));
-  cam2_ctrs.push_back(dg_cam2->camera_center(pix2));
-  for (size_t it = 0; it < dg_cam1->m_perturbed_cams.size(); it++) {
-    cam1_dirs.push_back(dg_cam1->m_perturbed_cams[it]->pixel_to_vector(pix1));
-    cam1_ctrs.push_back(dg_cam1->m_perturbed_cams[it]->camera_center(pix1));
-    cam2_dirs.push_back(dg_cam2->m_perturbed_cams[it]->pixel_to_vector(pix2));
-    cam2_ctrs.push_back(dg_cam2->m_perturbed_cams[it]->camera_center(pix2));
-  }
-
   // Apply adjustments
   if (adjusted_cameras) {
     for (size_t it = 0; it < cam1_dirs.size(); it++) {
@@ -260,6 +271,21 @@ void scaledDGTriangulationJacobian(vw::cartography::Datum const& datum,
   return;
 }
 
+// As above, but find the rays first
+void scaledDGTriangulationJacobian(vw::cartography::Datum const& datum,
+                                   vw::camera::CameraModel const* cam1,
+                                   vw::camera::CameraModel const* cam2,
+                                   vw::Vector2 const& pix1,
+                                   vw::Vector2 const& pix2,
+                                   vw::Matrix<double> & J) {
+  
+  std::vector<vw::Vector3> cam1_dirs, cam1_ctrs, cam2_dirs, cam2_ctrs;
+  dgCameraRays(dgCamera(cam1), pix1, cam1_dirs, cam1_ctrs);
+  dgCameraRays(dgCamera(cam2), pix2, cam2_dirs, cam2_ctrs);
+  scaledDGTriangulationJacobian(datum, cam1, cam2, cam1_dirs, cam1_ctrs,
+                                cam2_dirs, cam2_ctrs, J);
+}
+
 // Given upper-right values in a symmetric matrix of given size, find
 // the lower-left values by reflection, and insert them as a block
 // starting at the desired row and column. Used to populate the joint
@@ -459,6 +485,97 @@ void triangulationJacobian(vw::cartography::Datum const& datum,
   return;
 }
 
+// Find J * C * J^T, where J has 3 rows and C is symmetric and
+// block-diagonal, with blocks of given sizes. Only the blocks of C
+// are visited, and the result is accumulated in a fixed-size matrix.
+vw::Matrix3x3 propagateBlockDiagonal(vw::Matrix<double> const& J,
+                                     vw::Matrix<double> const& C,
+                                     std::vector<int> const& block_sizes) {
+  vw::Matrix3x3 P; // this is 0
+  int start = 0;
+  for (size_t b = 0; b < block_sizes.size(); b++) {
+    int end = start + block_sizes[b];
+    for (int col = start; col < end; col++) {
+      // Column 'col' of J * C
+      double jc[3] = {0.0, 0.0, 0.0};
+      for (int k = start; k < end; k++) {
+        for (int row = 0; row < 3; row++)
+          jc[row] += J(row, k) * C(k, col);
+      }
+      for (int row = 0; row < 3; row++) {
+        for (int c = 0; c < 3; c++)
+          P(row, c) += jc[row] * J(c, col);
+      }
+    }
+    start = end;
+  }
+
+  if (start != int(J.cols()) || start != int(C.rows()))
+    vw::vw_throw(vw::ArgumentErr() << "Book-keeping failure in covariance propagation.\n");
+  
+  return P;
+}
+
+// The horizontal and vertical stddev from the propagated covariance
+vw::Vector2 stddevFromCovariance(vw::Matrix3x3 const& P) {
+  
+#if 0
+  // Useful debug code
+  std::cout << "NED covariance " << P << std::endl;
+  vw::Vector<std::complex<double>> e;
+  vw::math::eigen(P, e);
+  std::cout << "Eigenvalues: " << e << std::endl;
+#endif
+  
+  // Horizontal component is the square root of the determinant of the
+  // upper-left 2x2 block (horizontal plane component), which is the
+  // same as the square root of the product of eigenvalues of this
+  // matrix.  Intuitively, the area of an ellipse is the product of
+  // semi-axes, which is the product of eigenvalues. Then, a circle
+  // with radius which is the square root of the product of semi-axes
+  // has the same area.
+  vw::Matrix2x2 H = submatrix(P, 0, 0, 2, 2);
+  vw::Vector2 ans;
+  ans[0] = sqrt(det(H));
+
+  // Vertical component is the z variance
+  ans[1] = P(2, 2);
+
+  // Check for NaN. Then the caller will return the zero vector, which
+  // signifies that the there is no valid data
+  if (ans != ans) 
+    vw::vw_throw(vw::ArgumentErr() << "Could not compute the covariance.\n");
+
+  // Take the square root, so return the standard deviation
+  return vw::Vector2(sqrt(ans[0]), sqrt(ans[1]));
+}
+
+// The user-set horizontal variances, if positive
+vw::Vector2 horizontalVariance() {
+  vw::Vector2 const& stddev = asp::stereo_settings().horizontal_stddev; // alias
+  vw::Vector2 variance;
+  for (int s = 0; s < 2; s++)
+    variance[s] = stddev[s] * stddev[s]; // square these to create variances  
+  return variance;
+}
+
+// The covariance when the user set the horizontal stddev. 
+void horizontalCovariance(vw::Vector2 const& variance, vw::Matrix<double> & C) {
+  C = vw::math::identity_matrix(4);
+  // The first two covariances are the left camera horizontal square stddev,
+  // and last two are for the right camera.
+  C(0, 0) = variance[0]; C(1, 1) = variance[0];
+  C(2, 2) = variance[1]; C(3, 3) = variance[1];
+}
+
+// The blocks of the DG satellite covariance, per scaledDGSatelliteCovariance().
+std::vector<int> dgCovarianceBlocks() {
+  std::vector<int> blocks;
+  blocks.push_back(3); blocks.push_back(4); // cam1 position and orientation
+  blocks.push_back(3); blocks.push_back(4); // cam2 position and orientation
+  return blocks;
+}
+
 // Propagate the covariances. Return stddev. See the .h file for more info.
 vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
                                 vw::cartography::Datum const& datum,
@@ -473,20 +590,14 @@ vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
     vw::vw_throw(vw::ArgumentErr() << "Could not compute the covariance.\n");
 
   vw::Matrix<double> J, C;
-
-  vw::Vector2 const& stddev = asp::stereo_settings().horizontal_stddev; // alias
-  vw::Vector2 variance;
-  for (int s = 0; s < 2; s++)
-    variance[s] = stddev[s] * stddev[s]; // square these to create variances  
+  std::vector<int> blocks;
   
+  vw::Vector2 variance = horizontalVariance();
   if (variance[0] > 0 && variance[1] > 0) {
     // The user set horizontal stddev
     triangulationJacobian(datum, tri_nominal, cam1, cam2, pix1, pix2, J);
-    C = vw::math::identity_matrix(4);
-    // The first two covariances are the left camera horizontal square stddev,
-    // and last two are for the right camera.
-    C(0, 0) = variance[0]; C(1, 1) = variance[0];
-    C(2, 2) = variance[1]; C(3, 3) = variance[1];
+    horizontalCovariance(variance, C);
+    blocks.push_back(4);
   } else {
     // Will arrive here only for DG cameras and if the user did not
     // set --horizontal-stddev.  The Jacobian of the transform from
@@ -496,42 +607,148 @@ vw::Vector2 propagateCovariance(vw::Vector3 const& tri_nominal,
     
     // The input covariance, divided by the square of the above scale factor.
     asp::scaledDGSatelliteCovariance(cam1, cam2, pix1, pix2, C);
+    blocks = dgCovarianceBlocks();
   }
   
   // Propagate the covariance
   // Per: https://en.wikipedia.org/wiki/Propagation_of_uncertainty#Non-linear_combinations
-  vw::Matrix<double> JT = transpose(J);
-  vw::Matrix<double> P = J * C * JT;
+  vw::Matrix3x3 P = propagateBlockDiagonal(J, C, blocks);
 
-#if 0
-  // Useful debug code
-  std::cout << "NED covariance " << P << std::endl;
-  vw::Vector<std::complex<double>> e;
-  vw::math::eigen(P, e);
-  std::cout << "Eigenvalues: " << e << std::endl;
-#endif
+  return stddevFromCovariance(P);
+}
+
+// Spacing of the grid on which the perturbations of the DG camera
+// rays are tabulated, in pixels. The perturbations change very slowly
+// across the image, so they are bilinearly interpolated on this grid.
+// See the CovariancePropagator test for the accuracy.
+const int COV_GRID_SPACING = 32;
+
+// Do not let the tabulated perturbations grow beyond this many grid nodes
+// per camera. Normally a tile needs far fewer.
+const size_t COV_GRID_MAX_NODES = 10000;
   
-  // Horizontal component is the square root of the determinant of the
-  // upper-left 2x2 block (horizontal plane component), which is the
-  // same as the square root of the product of eigenvalues of this
-  // matrix.  Intuitively, the area of an ellipse is the product of
-  // semi-axes, which is the product of eigenvalues. Then, a circle
-  // with radius which is the square root of the product of semi-axes
-  // has the same area.
-  vw::Matrix2x2 H = submatrix(P, 0, 0, 2, 2);
-  vw::Vector2 ans;
-  ans[0] = sqrt(det(H));
+CovariancePropagator::CovariancePropagator(vw::cartography::Datum const& datum,
+                                           vw::camera::CameraModel const* cam1,
+                                           vw::camera::CameraModel const* cam2):
+  m_datum(datum), m_cam1(cam1), m_cam2(cam2) {
+  vw::Vector2 variance = horizontalVariance();
+  m_use_dg = !(variance[0] > 0 && variance[1] > 0);
+  m_dg_cams[0] = NULL;
+  m_dg_cams[1] = NULL;
+  if (m_use_dg) {
+    try {
+      m_dg_cams[0] = dgCamera(cam1);
+      m_dg_cams[1] = dgCamera(cam2);
+    } catch (...) {
+      // Let propagateCovariance() fail for each pixel, as without this class
+      m_use_dg = false;
+    }
+  }
+}
 
-  // Vertical component is the z variance
-  ans[1] = P(2, 2);
+// The pixel at the given grid node. The last row and column of nodes
+// are moved to the image boundary, so all nodes are in the image.
+vw::Vector2 CovariancePropagator::gridNode(int cam_index, int col, int row) const {
+  vw::Vector2i size = m_dg_cams[cam_index]->get_image_size();
+  return vw::Vector2(std::min(col * COV_GRID_SPACING, std::max(size[0] - 1, 0)),
+                     std::min(row * COV_GRID_SPACING, std::max(size[1] - 1, 0)));
+}
 
-  // Check for NaN. Then the caller will return the zero vector, which
-  // signifies that the there is no valid data
-  if (ans != ans) 
+// Look up or compute the differences between the perturbed and
+// nominal rays at a grid node
+std::vector<vw::Vector3> const&
+CovariancePropagator::nodeDeltas(int cam_index, int col, int row) {
+
+  std::map<std::pair<int, int>, std::vector<vw::Vector3>> & nodes = m_nodes[cam_index];
+  auto key = std::make_pair(col, row);
+  auto it = nodes.find(key);
+  if (it != nodes.end())
+    return it->second;
+
+  vw::Vector2 pix = gridNode(cam_index, col, row);
+  std::vector<vw::Vector3> dirs, ctrs;
+  dgCameraRays(m_dg_cams[cam_index], pix, dirs, ctrs);
+
+  // Store the direction differences, then the center differences
+  int num = dirs.size() - 1;
+  std::vector<vw::Vector3> & deltas = nodes[key];
+  deltas.resize(2 * num);
+  for (int k = 0; k < num; k++) {
+    deltas[k]       = dirs[k + 1] - dirs[0];
+    deltas[num + k] = ctrs[k + 1] - ctrs[0];
+  }
+  
+  return deltas;
+}
+
+// The nominal rays at the given pixel, and the perturbed ones, found by
+// adding to the nominal rays the bilinearly interpolated differences.
+void CovariancePropagator::perturbedRays(int cam_index, vw::Vector2 const& pix,
+                                         std::vector<vw::Vector3> & dirs,
+                                         std::vector<vw::Vector3> & ctrs) {
+
+  DGCameraModel const* dg_cam = m_dg_cams[cam_index];
+  int num = dg_cam->m_perturbed_cams.size();
+  
+  dirs.resize(num + 1);
+  ctrs.resize(num + 1);
+  dirs[0] = dg_cam->pixel_to_vector(pix);
+  ctrs[0] = dg_cam->camera_center(pix);
+
+  // Clear the table before the lookups below, as that would
+  // invalidate the references they return
+  if (m_nodes[cam_index].size() + 4 > COV_GRID_MAX_NODES)
+    m_nodes[cam_index].clear();
+  
+  // Find the grid cell having the pixel. For pixels outside the
+  // image, use the nearest cell in the image and extrapolate.
+  vw::Vector2i size = dg_cam->get_image_size();
+  int col = int(floor(pix.x() / COV_GRID_SPACING));
+  int row = int(floor(pix.y() / COV_GRID_SPACING));
+  col = std::max(std::min(col, (size[0] - 2) / COV_GRID_SPACING), 0);
+  row = std::max(std::min(row, (size[1] - 2) / COV_GRID_SPACING), 0);
+  vw::Vector2 p0 = gridNode(cam_index, col, row);
+  vw::Vector2 p1 = gridNode(cam_index, col + 1, row + 1);
+  double wx = 0.0, wy = 0.0;
+  if (p1.x() > p0.x())
+    wx = (pix.x() - p0.x()) / (p1.x() - p0.x());
+  if (p1.y() > p0.y())
+    wy = (pix.y() - p0.y()) / (p1.y() - p0.y());
+  std::vector<vw::Vector3> const& d00 = nodeDeltas(cam_index, col,     row);
+  std::vector<vw::Vector3> const& d10 = nodeDeltas(cam_index, col + 1, row);
+  std::vector<vw::Vector3> const& d01 = nodeDeltas(cam_index, col,     row + 1);
+  std::vector<vw::Vector3> const& d11 = nodeDeltas(cam_index, col + 1, row + 1);
+  double w00 = (1.0 - wx) * (1.0 - wy), w10 = wx * (1.0 - wy);
+  double w01 = (1.0 - wx) * wy,         w11 = wx * wy;
+
+  for (int k = 0; k < num; k++) {
+    dirs[k + 1] = dirs[0] + w00 * d00[k] + w10 * d10[k] + w01 * d01[k] + w11 * d11[k];
+    ctrs[k + 1] = ctrs[0] + w00 * d00[num + k] + w10 * d10[num + k]
+      + w01 * d01[num + k] + w11 * d11[num + k];
+  }
+}
+
+vw::Vector2 CovariancePropagator::operator()(vw::Vector3 const& tri_nominal,
+                                             vw::Vector2 const& pix1,
+                                             vw::Vector2 const& pix2) {
+
+  // The horizontal stddev case is cheap, and there is nothing to reuse
+  if (!m_use_dg)
+    return propagateCovariance(tri_nominal, m_datum, m_cam1, m_cam2, pix1, pix2);
+
+  if (tri_nominal == vw::Vector3(0, 0, 0) || tri_nominal != tri_nominal) 
     vw::vw_throw(vw::ArgumentErr() << "Could not compute the covariance.\n");
 
-  // Take the square root, so return the standard deviation
-  return vw::Vector2(sqrt(ans[0]), sqrt(ans[1]));
+  perturbedRays(0, pix1, m_cam1_dirs, m_cam1_ctrs);
+  perturbedRays(1, pix2, m_cam2_dirs, m_cam2_ctrs);
+
+  vw::Matrix<double> J, C;
+  scaledDGTriangulationJacobian(m_datum, m_cam1, m_cam2, m_cam1_dirs, m_cam1_ctrs,
+                                m_cam2_dirs, m_cam2_ctrs, J);
+  scaledDGSatelliteCovariance(m_cam1, m_cam2, pix1, pix2, C);
+  
+  vw::Matrix3x3 P = propagateBlockDiagonal(J, C, dgCovarianceBlocks());
+  return stddevFromCovariance(P);
 }
   
 } // end namespace asp
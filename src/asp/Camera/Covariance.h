@@ -26,15 +26,15 @@
 #include <vw/Math/Vector.h>
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/CameraModel.h>
+#include <vw/Cartography/Datum.h>
 
-namespace vw {
-  namespace cartography {
-    class Datum;
-  }
-}
+#include <map>
+#include <vector>
 
 namespace asp {
 
+  class DGCameraModel;
+  
   // Given 0 <= num < 15, return a perturbation in position. The
   // starting one is the zero perturbation, then perturb first
   // coordinate in the positive and then negative direction, then same
@@ -61,6 +61,43 @@ namespace asp {
                                   vw::Vector2 const& pix1,
                                   vw::Vector2 const& pix2);
 
+  // Propagate covariances as above, for many pixels of the same two
+  // cameras, such as in a tile. For DG cameras, the changes in rays
+  // caused by perturbing the satellite positions and orientations
+  // vary slowly across the image. They are found on a coarse grid of
+  // pixels, and interpolated. Then only the nominal rays are computed
+  // at each pixel, rather than the nominal and the 14 perturbed ones.
+  // This is not thread-safe. Use one instance per tile.
+  class CovariancePropagator {
+  public:
+    CovariancePropagator(vw::cartography::Datum const& datum,
+                         vw::camera::CameraModel const* cam1,
+                         vw::camera::CameraModel const* cam2);
+
+    // Same as propagateCovariance()
+    vw::Vector2 operator()(vw::Vector3 const& triPt,
+                           vw::Vector2 const& pix1,
+                           vw::Vector2 const& pix2);
+  private:
+    vw::Vector2 gridNode(int cam_index, int col, int row) const;
+    std::vector<vw::Vector3> const& nodeDeltas(int cam_index, int col, int row);
+    void perturbedRays(int cam_index, vw::Vector2 const& pix,
+                       std::vector<vw::Vector3> & dirs,
+                       std::vector<vw::Vector3> & ctrs);
+
+    vw::cartography::Datum m_datum;
+    vw::camera::CameraModel const* m_cam1;
+    vw::camera::CameraModel const* m_cam2;
+    DGCameraModel const* m_dg_cams[2];
+    bool m_use_dg;
+
+    // Per camera and grid node, the differences of perturbed and
+    // nominal ray directions, followed by those for camera centers
+    std::map<std::pair<int, int>, std::vector<vw::Vector3>> m_nodes[2];
+
+    // Work buffers
+    std::vector<vw::Vector3> m_cam1_dirs, m_cam1_ctrs, m_cam2_dirs, m_cam2_ctrs;
+  };
   
 } // end namespace asp
 
@@ -20,6 +20,7 @@
 #include <asp/Core/StereoSettings.h>
 #include <asp/Camera/CsmModel.h>
 #include <asp/Camera/Covariance.h>
+#include <asp/Camera/CameraStateCache.h>
 
 #include <usgscsm/UsgsAstroLsSensorModel.h>
 #include <usgscsm/Utilities.h>
@@ -53,14 +54,25 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
   ImageXML     img;
   RPCXML       rpc;
 
-  try {
-    read_xml(path, geo, att, eph, img, rpc);
-  } catch (const std::exception& e){
-    vw::vw_throw(vw::ArgumentErr() << "Invalid Digital Globe XML file: " << path << ". "
-                 << "If you are not using Digital Globe images, you may "
-                 << "need to specify the session type, such as -t rpc, "
-                 << "-t rpcmaprpc, -t aster, etc.\n"
-		 << e.what() << "\n");
+  // If caching is enabled, try to use the data saved from an earlier
+  // parsing of the same XML file, as XML parsing is slow.
+  vw::BBox3 bbox;
+  std::string hash;
+  if (!camera_state_cache_dir().empty())
+    hash = file_content_hash(path);
+  
+  if (!read_dg_camera_state(hash, geo, att, eph, img, bbox)) {
+    try {
+      read_xml(path, geo, att, eph, img, rpc);
+    } catch (const std::exception& e){
+      vw::vw_throw(vw::ArgumentErr() << "Invalid Digital Globe XML file: " << path << ". "
+                   << "If you are not using Digital Globe images, you may "
+                   << "need to specify the session type, such as -t rpc, "
+                   << "-t rpcmaprpc, -t aster, etc.\n"
+                   << e.what() << "\n");
+    }
+    bbox = rpc.get_lon_lat_height_box();
+    write_dg_camera_state(hash, geo, att, eph, img, bbox);
   }
 
   if (stereo_settings().dg_use_csm) 
@@ -69,7 +81,6 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
   // Get an estimate of the surface elevation from the corners specified in the file.
   // - Not every file has this information, in which case we will just use zero.
   double mean_ground_elevation = 0.0;
-  vw::BBox3 bbox = rpc.get_lon_lat_height_box();
   if (!bbox.empty())
     mean_ground_elevation = (bbox.min()[2] + bbox.max()[2]) / 2.0;
   
@@ -150,8 +161,15 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
   vw::CamPtr nominal_cam;
   std::vector<vw::CamPtr> perturbed_cams;
   int num_cams = 1;
-  if (asp::stereo_settings().propagate_errors)
+  if (asp::stereo_settings().propagate_errors) {
     num_cams = numCamsForCovariance();
+    // Need at least two covariance samples to interpolate in
+    if (eph.satellite_pos_cov.size() < 2 * SAT_POS_COV_SIZE ||
+        att.satellite_quat_cov.size() < 2 * SAT_QUAT_COV_SIZE)
+      vw::vw_throw(vw::ArgumentErr() << "The satellite position or quaternion "
+                   << "covariances are missing from: " << path << ". "
+                   << "Cannot use --propagate-errors.\n");
+  }
 
   for (int cam_it = 0; cam_it < num_cams; cam_it++) {
     vw::Vector<double, 3> dp = asp::positionDelta(cam_it);
@@ -189,6 +207,8 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
                          geo.principal_distance, mean_ground_elevation,
                          stereo_settings().enable_correct_velocity_aberration,
                          stereo_settings().enable_correct_atmospheric_refraction));
+    ((DGCameraModel*)cam_ptr.get())->setSampleTables(camera_position_vec, eph.velocity_vec,
+                                                      et0, edt, camera_quat_vec, at0, adt);
 
     if (cam_it == 0) 
       nominal_cam = cam_ptr;
@@ -205,8 +225,12 @@ vw::CamPtr load_dg_camera_model_from_xml(std::string const& path) {
   cam->m_satellite_quat_dt = adt;
   if (asp::stereo_settings().propagate_errors) {
     cam->m_perturbed_cams = perturbed_cams; 
-    cam->m_satellite_pos_cov = eph.satellite_pos_cov;
-    cam->m_satellite_quat_cov = att.satellite_quat_cov;
+    cam->m_satellite_pos_cov_table.set(eph.satellite_pos_cov.size() / SAT_POS_COV_SIZE,
+                                       SAT_POS_COV_SIZE, &eph.satellite_pos_cov[0],
+                                       et0, edt);
+    cam->m_satellite_quat_cov_table.set(att.satellite_quat_cov.size() / SAT_QUAT_COV_SIZE,
+                                        SAT_QUAT_COV_SIZE, &att.satellite_quat_cov[0],
+                                        at0, adt);
   }
   
   return nominal_cam;
@@ -412,7 +436,23 @@ vw::Vector3 DGCameraModel::get_camera_center_at_time(double time) const {
     return vw::Vector3(ecef.x, ecef.y, ecef.z);
   }
   
-  return m_position_func(time);
+  if (m_position_table.num_samples() == 0)
+    return m_position_func(time);
+
+  // Same as PiecewiseAPositionInterpolation. Integrate the velocity,
+  // which changes linearly in each interval.
+  int i = 0;
+  double u = 0.0;
+  m_position_table.locate(time, i, u);
+  double nt = u * m_position_table.dt();
+  double c = nt * nt / (2.0 * m_velocity_table.dt());
+  vw::Vector3 pos;
+  for (int d = 0; d < 3; d++) {
+    double const* p = m_position_table.component(d);
+    double const* v = m_velocity_table.component(d);
+    pos[d] = p[i] + v[i] * nt + (v[i + 1] - v[i]) * c;
+  }
+  return pos;
 }
 
 vw::Vector3 DGCameraModel::get_camera_velocity_at_time(double time) const {
@@ -420,12 +460,55 @@ vw::Vector3 DGCameraModel::get_camera_velocity_at_time(double time) const {
     csm::EcefVector ecef = m_ls_model->getSensorVelocity(time);
     return vw::Vector3(ecef.x, ecef.y, ecef.z);
   }
-  
-  return m_velocity_func(time);
+
+  if (m_velocity_table.num_samples() == 0)
+    return m_velocity_func(time);
+
+  // Same as LinearPiecewisePositionInterpolation
+  int i = 0;
+  double u = 0.0;
+  m_velocity_table.locate(time, i, u);
+  vw::Vector3 vel;
+  for (int d = 0; d < 3; d++) {
+    double const* v = m_velocity_table.component(d);
+    vel[d] = v[i] + (v[i + 1] - v[i]) * u;
+  }
+  return vel;
 }
 
-// Function to interpolate quaternions with the CSM model. This is used
-// for CSM model validation but not in production.
+void DGCameraModel::setSampleTables(std::vector<vw::Vector3> const& positions,
+                                    std::vector<vw::Vector3> const& velocities,
+                                    double pos_t0, double pos_dt,
+                                    std::vector<vw::Quat> const& quaternions,
+                                    double quat_t0, double quat_dt) {
+
+  if (positions.size() != velocities.size())
+    vw::vw_throw(vw::ArgumentErr() << "Expecting as many satellite positions "
+                 << "as velocities.\n");
+
+  std::vector<double> p(3 * positions.size()), v(3 * velocities.size());
+  for (size_t i = 0; i < positions.size(); i++) {
+    for (int d = 0; d < 3; d++) {
+      p[3*i + d] = positions[i][d];
+      v[3*i + d] = velocities[i][d];
+    }
+  }
+  m_position_table.set(positions.size(), 3, &p[0], pos_t0, pos_dt);
+  m_velocity_table.set(velocities.size(), 3, &v[0], pos_t0, pos_dt);
+
+  // Store the quaternions in the order w, x, y, z
+  std::vector<double> q(4 * quaternions.size());
+  for (size_t i = 0; i < quaternions.size(); i++) {
+    q[4*i + 0] = quaternions[i].w();
+    q[4*i + 1] = quaternions[i].x();
+    q[4*i + 2] = quaternions[i].y();
+    q[4*i + 3] = quaternions[i].z();
+  }
+  m_quat_table.set(quaternions.size(), 4, &q[0], quat_t0, quat_dt);
+}
+
+// Function to interpolate quaternions with the CSM model. The samples
+// are read in place, as they can change, such as in jitter_solve.
 // TODO(oalexan1): Move this to a new CsmModelUtils.cc file and call it from here.
 void DGCameraModel::getQuaternions(const double& time, double q[4]) const {
 
@@ -440,38 +523,12 @@ void DGCameraModel::getQuaternions(const double& time, double q[4]) const {
   if (m_ls_model->m_numQuaternions/4 < 6 && nOrder == 8)
     nOrderQuat = 4;
 
-  lagrangeInterp(m_ls_model->m_numQuaternions / 4,
-                 &m_ls_model->m_quaternions[0],
-                 m_ls_model->m_t0Quat, m_ls_model->m_dtQuat,
-                 time, 4, nOrderQuat, q);
+  uniformLagrange(m_ls_model->m_numQuaternions / 4, 4,
+                  &m_ls_model->m_quaternions[0],
+                  m_ls_model->m_t0Quat, m_ls_model->m_dtQuat,
+                  time, nOrderQuat, q);
 }
 
-// Nearest neighbor interpolation into a sequence of vectors of length
-// vectorLength, stored one after another in valueArray. The result
-// goes in valueVector.
-// TODO(oalexan1): Move this to some utilities.
-void nearestNeibInterp(const int &numTimes, const double *valueArray,
-                       const double &startTime, const double &delTime,
-                       const double &time, const int &vectorLength,
-                       double *valueVector) {
-  
-  if (numTimes < 1)
-    vw::vw_throw(vw::ArgumentErr() << "Cannot interpolate into a vector of zero length.\n");
-  
-  // Compute index
-  int index = round((time - startTime) / delTime);
-  if (index < 0) 
-    index = 0;
-  if (index >= numTimes)
-    index = numTimes - 1;
-
-  int start = index * vectorLength;
-  for (int i = 0; i < vectorLength; i++)
-    valueVector[i] = valueArray[start + i];
-
-  return;
-}
-  
 // Interpolate the satellite position covariance at given pixel
 void DGCameraModel::interpSatellitePosCov(vw::Vector2 const& pix,
                                           double p_cov[SAT_POS_COV_SIZE]) const {
@@ -482,16 +539,11 @@ void DGCameraModel::interpSatellitePosCov(vw::Vector2 const& pix,
 
   double time = get_time_at_line(pix.y());
 
-  int numCov = m_satellite_pos_cov.size() / SAT_POS_COV_SIZE;
-
   int nOrder = 8;
   if (m_ls_model->m_platformFlag == 0)
     nOrder = 4;
 
-  lagrangeInterp(numCov, &m_satellite_pos_cov[0], m_satellite_pos_t0, m_satellite_pos_dt,
-                 time, SAT_POS_COV_SIZE, nOrder, p_cov);
-  //nearestNeibInterp(numCov, &m_satellite_pos_cov[0], m_satellite_pos_t0, m_satellite_pos_dt,
-  //                  time, SAT_POS_COV_SIZE, p_cov);
+  m_satellite_pos_cov_table.lagrange(time, nOrder, p_cov);
 }
 
 // Interpolate the satellite quaternion covariance at given pixel
@@ -503,19 +555,7 @@ void DGCameraModel::interpSatelliteQuatCov(vw::Vector2 const& pix,
                  << "interpSatelliteQuatCov: It was expected that the CSM model was used.\n");
 
   double time = get_time_at_line(pix.y());
-  int numCov = m_satellite_quat_cov.size() / SAT_QUAT_COV_SIZE;
-  
-  int nOrder = 8;
-  if (m_ls_model->m_platformFlag == 0)
-    nOrder = 4;
-  int nOrderQuat = nOrder;
-  if (numCov < 6 && nOrder == 8)
-    nOrderQuat = 4;
-
-  //lagrangeInterp(numCov, &m_satellite_quat_cov[0], m_satellite_quat_t0, m_satellite_quat_dt,
-  //               time, SAT_QUAT_COV_SIZE, nOrderQuat, q_cov);
-  nearestNeibInterp(numCov, &m_satellite_quat_cov[0], m_satellite_quat_t0, m_satellite_quat_dt,
-                    time, SAT_QUAT_COV_SIZE, q_cov);
+  m_satellite_quat_cov_table.nearest(time, q_cov);
 }
 
 vw::Quat DGCameraModel::get_camera_pose_at_time(double time) const {
@@ -524,8 +564,20 @@ vw::Quat DGCameraModel::get_camera_pose_at_time(double time) const {
     getQuaternions(time, q);
     return vw::Quat(q[3], q[0], q[1], q[2]); // go from (x, y, z, w) to (w, x, y, z)
   }
-  
-  return m_pose_func(time);
+
+  if (m_quat_table.num_samples() == 0)
+    return m_pose_func(time);
+
+  // Same as SLERPPoseInterpolation
+  int i = 0;
+  double u = 0.0;
+  m_quat_table.locate(time, i, u);
+  double const* w = m_quat_table.component(0);
+  double const* x = m_quat_table.component(1);
+  double const* y = m_quat_table.component(2);
+  double const* z = m_quat_table.component(3);
+  vw::Quat q0(w[i], x[i], y[i], z[i]), q1(w[i + 1], x[i + 1], y[i + 1], z[i + 1]);
+  return vw::math::slerp(u, q0, q1, 0);
 }
   
 // Gives a pointing vector in the world coordinates.
@@ -551,16 +603,6 @@ vw::Vector3 DGCameraModel::get_local_pixel_vector(vw::Vector2 const& pix) const
   return normalize(local_vec);
 }
 
-// See the .h file for the documentation.
-double DGCameraModel::errorFunc(double y, vw::Vector3 const& point) const {
-
-  double t = get_time_at_line(y);
-  vw::Quat q = get_camera_pose_at_time(t);
-  vw::Vector3 pt = inverse(q).rotate(point - get_camera_center_at_time(t));
-
-  return pt.y() / pt.z() - m_detector_origin[1] / m_focal_length;
-}
-  
 // Point to pixel with no initial guess
 vw::Vector2 DGCameraModel::point_to_pixel(vw::Vector3 const& point) const {
   if (stereo_settings().dg_use_csm) {
@@ -582,86 +624,24 @@ vw::Vector2 DGCameraModel::point_to_pixel(vw::Vector3 const& point) const {
     vw::Vector2 asp_pix;
     asp::fromCsmPixel(asp_pix, csm_pix);
     
-#if 0
-    // This logic is from UsgsAstroLsSensorModel, with fixes to make
-    // it more robust for DG cameras. Not used yet.
-    
-    // TODO(oalexan1): Use this logic
-    // with non-CSM cameras.  Should be much faster than the current
-    // approach of solving a minimization problem.  Do not set
-    // desired_precision to less than 1e-8 as then the algorithm will
-    // produce junk due to numerical precision issues with the large
-    // DG focal length.
-
-    // For non-CSM logic, need to start iterating from sensor
-    // midpoint.  asp_pix[1] = m_image_size.y()/2;
-    
-    double L0 = 0.0; // Line increment
-    double lineErr0 = errorFunc(L0 + asp_pix[1], point);
-    double L1 = 0.1;
-    double lineErr1 = errorFunc(L1 + asp_pix[1], point);
-    
-    for (int count = 0; count < 15; count++) {
-      
-      if (lineErr1 == lineErr0)
-        break; // avoid division by 0
-      
-      // Secant method update
-      // https://en.wikipedia.org/wiki/Secant_method
-      double increment = lineErr1 * (L1 - L0) / (lineErr1 - lineErr0);
-      double L2 = L1 - increment;
-      double lineErr2 = errorFunc(L2 + asp_pix[1], point);
-      
-      // Update for the next step
-      L0 = L1; lineErr0 = lineErr1;
-      L1 = L2; lineErr1 = lineErr2;
-      
-      // If the solution changes by less than this, we achieved the desired line precision
-      if (increment < m_csm_model->m_desired_precision) 
-        break;
-    }
-    
-    asp_pix[1] += L1;
-    
-    // Solve for sample location now that we know the correct line
-    double t = get_time_at_line(asp_pix[1]);
-    vw::Quat q = get_camera_pose_at_time(t);
-    vw::Vector3 pt = inverse(q).rotate(point - get_camera_center_at_time(t));
-    pt *= m_focal_length / pt.z();
-    asp_pix = vw::Vector2(pt.x() - m_detector_origin[0], asp_pix[1]);
-#endif
-
     return asp_pix;
   }
   
   // Non-CSM version
-  return vw::camera::LinescanModel::point_to_pixel(point);
+  return point_to_pixel(point, -1);
 
 }
   
-// TODO(oalexan1): Wipe this and use the logic above, after much testing.  
+// Point to pixel with an optional initial guess for the line
 vw::Vector2 DGCameraModel::point_to_pixel(vw::Vector3 const& point, double starty) const {
 
   if (stereo_settings().dg_use_csm)
     vw::vw_throw(vw::ArgumentErr()
                  << "point_to_pixel(point, starty): Cannot be called in CSM mode.\n");
-    
-  // Use the uncorrected function to get a fast but good starting seed.
-  vw::camera::CameraGenericLMA model(this, point);
-  int status = -1;
-  vw::Vector2 start = point_to_pixel_uncorrected(point, starty);
-  
-  // Run the solver
-  vw::Vector3 objective(0, 0, 0);
-  const double ABS_TOL = 1e-16;
-  const double REL_TOL = 1e-16;
-  const int    MAX_ITERATIONS = 1e+5;
-  vw::Vector2 solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>
-    (model, start, objective, status,
-     ABS_TOL, REL_TOL, MAX_ITERATIONS);
-  VW_ASSERT(status > 0,
-            vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model.");
-  return solution;
+
+  return asp::linescanPointToPixelWithFallback(*this, point, starty,
+                                               vw::Vector2(m_image_size),
+                                               -1, "LinescanDG");
 }
   
 // Camera pose
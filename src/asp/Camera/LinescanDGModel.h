@@ -25,6 +25,8 @@
 #define __STEREO_CAMERA_LINESCAN_DG_MODEL_H__
 
 #include <asp/Camera/TimeProcessing.h>
+#include <asp/Camera/LinescanUtils.h>
+#include <asp/Camera/SampleTable.h>
 
 #include <vw/Camera/CameraSolve.h>
 #include <vw/Camera/LinescanModel.h>
@@ -115,22 +117,9 @@ namespace asp {
     
     // Override this implementation with a faster, more specialized implementation.
     virtual vw::Vector2 point_to_pixel(vw::Vector3 const& point, double starty) const {
-      // Use the uncorrected function to get a fast but good starting seed.
-      vw::camera::CameraGenericLMA model(this, point);
-      int status;
-      vw::Vector2 start = point_to_pixel_uncorrected(point, starty);
-      
-      // Run the solver
-      vw::Vector3 objective(0, 0, 0);
-      const double ABS_TOL = 1e-16;
-      const double REL_TOL = 1e-16;
-      const int    MAX_ITERATIONS = 1e+5;
-      vw::Vector2 solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>
-        (model, start, objective, status,
-         ABS_TOL, REL_TOL, MAX_ITERATIONS);
-      VW_ASSERT(status > 0,
-                vw::camera::PointToPixelErr() << "Unable to project point into LinescanDG model.");
-      return solution;
+      return asp::linescanPointToPixelWithFallback(*this, point, starty,
+                                                   vw::Vector2(m_image_size),
+                                                   -1, "LinescanDG");
     }
     
     // Camera pose
@@ -175,38 +164,6 @@ namespace asp {
     vw::camera::TLCTimeInterpolation
     const& get_time_func() const {return m_time_func;} 
 
-  protected: // Functions
-  
-    /// Low accuracy function used by point_to_pixel to get a good solver starting seed.
-    vw::Vector2 point_to_pixel_uncorrected(vw::Vector3 const& point, double starty) const {
-      // Solve for the correct line number to use
-      LinescanLMA model(this, point);
-      int status;
-      vw::Vector<double> objective(1), start(1);
-      start[0] = m_image_size.y()/2; 
-      // Use a refined guess, if available, otherwise the center line.
-      if (starty >= 0)
-        start[0] = starty;
-
-      // Run the solver
-      const double ABS_TOL = 1e-16;
-      const double REL_TOL = 1e-16;
-      const int    MAX_ITERATIONS = 1e+5;
-      vw::Vector<double> solution = vw::math::levenberg_marquardt(model, start, objective, status,
-                                                                  ABS_TOL, REL_TOL, MAX_ITERATIONS);
-
-      VW_ASSERT(status > 0, vw::camera::PointToPixelErr()
-                << "Unable to project point into LinescanDG model.");
-
-      // Solve for sample location now that we know the correct line
-      double t = m_time_func(solution[0]);
-      // TODO(oalexan1): Replace inverse with transpose if it is a rotation matrix?
-      vw::Vector3 pt = inverse(m_pose_func(t)).rotate(point - m_position_func(t));
-      pt *= m_focal_length / pt.z();
-
-      return vw::Vector2(pt.x() - m_detector_origin[0], solution[0]);
-    }
-
   protected: // Variables
     
     // Extrinsics
@@ -222,41 +179,6 @@ namespace asp {
     /// - Stored internally in pixels.
     vw::Vector2  m_detector_origin; 
     double       m_focal_length;  ///< The focal length, also stored in pixels.
-
-    // Levenberg Marquardt solver for linescan number
-    //
-    // We solve for the line number of the image that position the
-    // camera so that the projection into the camera model actually
-    // hits the detector. The detector is normally offset in the y
-    // direction on the optical plane. Once we have the line we don't
-    // need to use a solver to compute the sample.
-    // - This solver is used by the point_to_pixel_uncorrected function.
-    class LinescanLMA : public vw::math::LeastSquaresModelBase<LinescanLMA> {
-      const LinescanDGModel* m_model;
-      vw::Vector3 m_point;
-    public:
-      typedef vw::Vector<double> result_type;   // 1D error on the optical plane.
-      typedef result_type        domain_type;   // 1D linescan number
-      typedef vw::Matrix<double> jacobian_type;
-
-      LinescanLMA(const LinescanDGModel* model, const vw::Vector3& pt):
-        m_model(model), m_point(pt) {}
-
-        inline result_type operator()(domain_type const& y) const {
-          double       t        = m_model->get_time_at_line(y[0]);
-          vw::Quat     pose     = m_model->get_camera_pose_at_time(t);
-          vw::Vector3  position = m_model->m_position_func(t);
-          
-          // Get point in camera's frame and rescale to pixel units
-          vw::Vector3 pt = vw::camera::point_to_camera_coord(position, pose, m_point);
-          pt *= m_model->m_focal_length / pt.z();
-          result_type result(1);
-
-          // Error against the location of the detector
-          result[0] = pt.y() - m_model->m_detector_origin[1]; 
-          return result;
-        }
-    };
     
   }; // End class LinescanDGModel
   
@@ -320,28 +242,36 @@ namespace asp {
 
     // For error propagation
     std::vector<vw::CamPtr> m_perturbed_cams;
-    std::vector<double> m_satellite_pos_cov, m_satellite_quat_cov;
     double m_satellite_pos_t0, m_satellite_pos_dt;
     double m_satellite_quat_t0, m_satellite_quat_dt;
+    // The satellite position and quaternion covariances
+    UniformSampleTable m_satellite_pos_cov_table, m_satellite_quat_cov_table;
 
     // Interpolate the satellite position covariance at given pixel
     void interpSatellitePosCov(vw::Vector2 const& pix, double p_cov[SAT_POS_COV_SIZE]) const;
 
     // Interpolate the satellite quaternion covariance at given pixel
     void interpSatelliteQuatCov(vw::Vector2 const& pix, double q_cov[SAT_QUAT_COV_SIZE]) const;
+
+    // Copy the camera position, velocity, and quaternion samples
+    // to tables which are used in place of the VW functors in the
+    // non-CSM mode. These are queried at each iteration of
+    // ground-to-image, so should be fast.
+    void setSampleTables(std::vector<vw::Vector3> const& positions,
+                         std::vector<vw::Vector3> const& velocities,
+                         double pos_t0, double pos_dt,
+                         std::vector<vw::Quat> const& quaternions,
+                         double quat_t0, double quat_dt);
     
   private:
+    // The position, velocity, and quaternion samples. If not set,
+    // the VW functors are used instead.
+    UniformSampleTable m_position_table, m_velocity_table, m_quat_table;
+
     // Function to interpolate quaternions with the CSM model. This is used
     // for validation of the CSM model but not in production.  
     void getQuaternions(const double& time, double q[4]) const;
 
-    // For a given line, find the projection of a ground point 'point'
-    // in the sensor using the rotation matrix for that line. Find its
-    // y component. Subtract m_detector_origin[1] / m_focal_length.
-    // This will be zero precisely when the point projects at the
-    // given line. This is analogous to LinescanLMA logic.
-    double errorFunc(double y, vw::Vector3 const& point) const;
-
     // Digital Globe implementation using CSM. Eventually this will
     // replace LinescanDGModel, and the class
     // PiecewiseAdjustedLinescanModel will go away as well.  Note that the
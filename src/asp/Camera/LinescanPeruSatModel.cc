@@ -17,6 +17,7 @@
 
 #include <vw/Camera/CameraSolve.h>
 #include <asp/Core/StereoSettings.h>
+#include <asp/Camera/LinescanUtils.h>
 #include <asp/Camera/PeruSatXML.h>
 #include <asp/Camera/LinescanPeruSatModel.h>
 
@@ -30,35 +31,15 @@ static bool perusat_correction_note_printed = false;
 using vw::Vector3;
 using vw::Matrix3x3;
 
-// TODO: Port these changes to the base class
-
 vw::Vector2 PeruSatCameraModel::point_to_pixel(Vector3 const& point, double starty) const {
 
-  // Use the generic solver to find the pixel 
-  // - This method will be slower but works for more complicated geometries
-  vw::camera::CameraGenericLMA model(this, point);
-  int status;
-  vw::Vector2 start = m_image_size / 2.0; // Use the center as the initial guess
-  if (starty >= 0) // If the user provided a line number guess, use it.
-    start[1] = starty;
-
-  // Solver constants
-  const double ABS_TOL = 1e-16;
-  const double REL_TOL = 1e-16;
-  const int    MAX_ITERATIONS = 1e+5;
+  // Use the fast line solver, with Levenberg-Marquardt as fallback.
+  // If the error is too high then the solver probably got stuck at
+  // the edge of the image.
   const double MAX_ERROR = 0.01;
-
-  Vector3 objective(0, 0, 0);
-  vw::Vector2 solution = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2,3>
-    (model, start, objective, status, ABS_TOL, REL_TOL, MAX_ITERATIONS);
-
-  double  error = norm_2(model(solution));
-
-  VW_ASSERT( (status > 0) && (error < MAX_ERROR),
-             vw::camera::PointToPixelErr()
-             << "Unable to project point into LinescanPeruSat model" );
-
-  return solution;
+  return asp::linescanPointToPixelWithFallback(*this, point, starty,
+                                               vw::Vector2(m_image_size),
+                                               MAX_ERROR, "LinescanPeruSat");
 }
 
 void PeruSatCameraModel::check_time(double time, std::string const& location) const {
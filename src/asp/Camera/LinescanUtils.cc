@@ -0,0 +1,189 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Camera/LinescanUtils.h>
+
+#include <vw/Camera/CameraSolve.h>
+#include <vw/Camera/LinescanModel.h>
+#include <vw/Math/LevenbergMarquardt.h>
+
+#include <cmath>
+
+using namespace vw;
+
+namespace asp {
+
+// The error of projecting a point into the camera at the given pixel,
+// with the full model, so including the velocity aberration and
+// refraction corrections, if enabled. Both the point and the pixel ray
+// are expressed in the camera frame at the pixel line and projected
+// onto the z = 1 plane. The x component is the cross-track error and
+// the y component is the along-track error.
+static vw::Vector2 sensorPlaneError(vw::camera::LinescanModel const& model,
+                                    vw::Vector3 const& point, vw::Vector2 const& pix) {
+  double t = model.get_time_at_line(pix[1]);
+  vw::Quat q_inv = inverse(model.get_camera_pose_at_time(t));
+  vw::Vector3 pt  = q_inv.rotate(point - model.camera_center(pix));
+  vw::Vector3 dir = q_inv.rotate(model.pixel_to_vector(pix));
+  return vw::Vector2(pt.x() / pt.z() - dir.x() / dir.z(),
+                     pt.y() / pt.z() - dir.y() / dir.z());
+}
+
+// Vary the given coordinate of 'pix' until the same component of the
+// sensor plane error is zero, using the secant method. For a linear
+// error this converges in one step. Return false on failure.
+static bool secantSolve(vw::camera::LinescanModel const& model,
+                        vw::Vector3 const& point, int coord, double precision,
+                        vw::Vector2 & pix) {
+
+  const int max_iter = 20;
+  
+  vw::Vector2 pix0 = pix, pix1 = pix;
+  pix1[coord] += 1.0;
+  double err0 = sensorPlaneError(model, point, pix0)[coord];
+  if (err0 == 0)
+    return true; // already there
+  double err1 = sensorPlaneError(model, point, pix1)[coord];
+  
+  for (int iter = 0; iter < max_iter; iter++) {
+    
+    if (err1 == err0 || err1 != err1) // avoid division by 0 and check for NaN
+      return false;
+    
+    // https://en.wikipedia.org/wiki/Secant_method
+    double increment = err1 * (pix1[coord] - pix0[coord]) / (err1 - err0);
+    vw::Vector2 pix2 = pix1;
+    pix2[coord] -= increment;
+
+    pix0 = pix1; err0 = err1;
+    pix1 = pix2;
+
+    if (std::abs(increment) < precision) {
+      pix = pix1;
+      return true;
+    }
+
+    err1 = sensorPlaneError(model, point, pix1)[coord];
+    if (err1 == 0) {
+      pix = pix1;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+// See the .h file for the documentation.
+bool linescanPointToPixel(vw::camera::LinescanModel const& model,
+                          vw::Vector3 const& point,
+                          vw::Vector2 & pix,
+                          double precision,
+                          double max_pix_err) {
+  
+  // The sample changes little after the first pass, and the line even
+  // less, as the sensor is close to being a straight line.
+  const int max_passes = 10;
+
+  vw::Vector2 sol = pix;
+  bool converged = false;
+  try {
+    for (int pass = 0; pass < max_passes; pass++) {
+      vw::Vector2 prev = sol;
+      if (!secantSolve(model, point, 1, precision, sol)) // line
+        return false;
+      if (!secantSolve(model, point, 0, precision, sol)) // sample
+        return false;
+      if (norm_2(sol - prev) < precision) {
+        converged = true;
+        break;
+      }
+    }
+  } catch (...) {
+    // Some models throw when going out of the time range
+    return false;
+  }
+
+  if (!converged)
+    return false;
+  
+  pix = sol;
+
+  // Check against the full model. The angle subtended by one pixel is
+  // used to convert the ray error to pixels.
+  vw::Vector3 dir = model.pixel_to_vector(pix);
+  vw::Vector3 pix_dir = model.pixel_to_vector(pix + vw::Vector2(1, 0));
+  double pix_angle = norm_2(pix_dir - dir);
+  if (!(pix_angle > 0))
+    return false;
+  vw::Vector3 pt_dir = normalize(point - model.camera_center(pix));
+  double err = norm_2(pt_dir - dir) / pix_angle;
+  
+  return (err <= max_pix_err);
+}
+
+// See the .h file for the documentation.
+bool linescanPointToPixelLM(vw::camera::LinescanModel const& model,
+                            vw::Vector3 const& point, double max_error,
+                            vw::Vector2 & pix) {
+
+  vw::camera::CameraGenericLMA lma_model(&model, point);
+  int status = -1;
+  const double ABS_TOL = 1e-16;
+  const double REL_TOL = 1e-16;
+  const int    MAX_ITERATIONS = 1e+5;
+  vw::Vector3 objective(0, 0, 0);
+  vw::Vector2 solution
+    = vw::math::levenberg_marquardtFixed<vw::camera::CameraGenericLMA, 2, 3>
+    (lma_model, pix, objective, status, ABS_TOL, REL_TOL, MAX_ITERATIONS);
+  pix = solution;
+
+  // Check the error - If it is too high then the solver probably got
+  // stuck at the edge of the image.
+  bool good = (status > 0);
+  if (good && max_error > 0)
+    good = (norm_2(lma_model(solution)) < max_error);
+
+  return good;
+}
+
+// See the .h file for the documentation.
+vw::Vector2 linescanPointToPixelWithFallback(vw::camera::LinescanModel const& model,
+                                             vw::Vector3 const& point, double starty,
+                                             vw::Vector2 const& image_size,
+                                             double max_error,
+                                             std::string const& model_name) {
+  
+  vw::Vector2 start = image_size / 2.0; // Use the center as the initial guess
+  if (starty >= 0) // If the user provided a line number guess, use it.
+    start[1] = starty;
+
+  vw::Vector2 pix = start;
+  if (linescanPointToPixel(model, point, pix))
+    return pix;
+
+  // Use the general solver. It will start from the solution of the
+  // line solver if that one converged but was not accurate enough.
+  bool good = linescanPointToPixelLM(model, point, max_error, pix);
+  
+  VW_ASSERT(good, vw::camera::PointToPixelErr()
+            << "Unable to project point into " << model_name << " model.");
+  
+  return pix;
+}
+  
+} // end namespace asp
@@ -0,0 +1,86 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file LinescanUtils.h
+///
+/// Shared ground-to-image logic for the ASP linescan models.
+
+#ifndef __STEREO_CAMERA_LINESCAN_UTILS_H__
+#define __STEREO_CAMERA_LINESCAN_UTILS_H__
+
+#include <vw/Math/Vector.h>
+
+#include <string>
+
+namespace vw {
+  namespace camera {
+    class LinescanModel;
+  }
+}
+
+namespace asp {
+
+  /// Project a point into a linescan camera without a general 2D
+  /// minimization. The line is found with the secant method applied
+  /// to the along-track error, that is, the offset of the point from
+  /// the sensor plane, in the camera frame, at a given line. Then the
+  /// sample is found from the cross-track error at that line, which
+  /// takes a single step for detectors that are linear in the
+  /// sample. The two are alternated until both change by less than
+  /// 'precision' pixels.
+  ///
+  /// On input 'pix' is the initial guess and on output the solution.
+  /// The errors are computed with the full model, including the
+  /// velocity aberration and atmospheric refraction corrections. The
+  /// result is verified by the ray error. If it is off by more than
+  /// 'max_pix_err' pixels, return false, with 'pix' set to the
+  /// solution, which the caller can then refine with a general solver.
+  /// If the iterations fail to converge, return false with 'pix'
+  /// unchanged.
+  bool linescanPointToPixel(vw::camera::LinescanModel const& model,
+                            vw::Vector3 const& point,
+                            vw::Vector2 & pix,
+                            double precision = 1e-8,
+                            double max_pix_err = 1e-3);
+
+  /// Project a point into a linescan camera with Levenberg-Marquardt
+  /// on the full model. On input 'pix' is the initial guess and on
+  /// output the solution. Return false if the solver failed, or, if
+  /// 'max_error' is positive, if the ray error of the solution is
+  /// larger than that.
+  bool linescanPointToPixelLM(vw::camera::LinescanModel const& model,
+                              vw::Vector3 const& point, double max_error,
+                              vw::Vector2 & pix);
+
+  /// Project a point into a linescan camera. First try the fast line
+  /// solver above, then, if needed, refine its result, or start from
+  /// scratch if it failed, using Levenberg-Marquardt on the full
+  /// model. If 'starty' is non-negative it is used as the initial
+  /// line, otherwise the image center is used. If 'max_error' is
+  /// positive, the Levenberg-Marquardt solution is rejected if its
+  /// ray error is larger than that. Throws vw::camera::PointToPixelErr
+  /// on failure.
+  vw::Vector2 linescanPointToPixelWithFallback(vw::camera::LinescanModel const& model,
+                                               vw::Vector3 const& point, double starty,
+                                               vw::Vector2 const& image_size,
+                                               double max_error,
+                                               std::string const& model_name);
+  
+} // end namespace asp
+
+#endif//__STEREO_CAMERA_LINESCAN_UTILS_H__
@@ -16,6 +16,7 @@
 // __END_LICENSE__
 
 #include <vw/Math/Vector.h>
+#include <vw/Math/LinearAlgebra.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/FileIO/FileUtils.h>
 #include <vw/Cartography/Datum.h>
@@ -29,6 +30,8 @@
 #include <boost/smart_ptr/scoped_ptr.hpp>
 #include <boost/smart_ptr/shared_ptr.hpp>
 
+#include <cmath>
+
 using namespace vw;
 
 namespace asp {
@@ -68,6 +71,7 @@ namespace asp {
     m_sample_num_coeff = CoeffVec(gdal_rpc.adfSAMP_NUM_COEFF);
     m_sample_den_coeff = CoeffVec(gdal_rpc.adfSAMP_DEN_COEFF);
 
+    fit_inverse();
   }
 
   RPCModel::RPCModel(std::string const& filename) {
@@ -75,6 +79,7 @@ namespace asp {
     // Initialize to 0
     m_err_bias = 0.0;
     m_err_rand = 0.0;
+    m_has_inverse = false;
 
     std::string ext = get_extension(filename);
     if (ext == ".rpb") {
@@ -95,6 +100,7 @@ namespace asp {
   }
 
   RPCModel::RPCModel(DiskImageResourceGDAL* resource ) {
+    m_has_inverse = false;
     initialize(resource);
   }
 
@@ -118,7 +124,10 @@ namespace asp {
     m_xy_scale(xy_scale), 
     m_lonlatheight_offset(lonlatheight_offset),
     m_lonlatheight_scale(lonlatheight_scale),
-    m_err_bias(err_bias), m_err_rand(err_rand) {}
+    m_has_inverse(false),
+    m_err_bias(err_bias), m_err_rand(err_rand) {
+    fit_inverse();
+  }
 
   void RPCModel::load_rpb_file(std::string const& filename) {
     //vw_out() << "Reading RPC model from RPB file, defaulting to WGS84 datum.\n";
@@ -214,6 +223,82 @@ namespace asp {
     if (max_coeff_index != 20)
       vw_throw(ArgumentErr() << "Error reading file " << filename
                << ", loaded wrong number of coefficients!");
+
+    fit_inverse();
+  }
+
+  // Fit a cubic polynomial going from normalized sample, line, and
+  // height to normalized lon and lat, by sampling the RPC model on a
+  // grid in its domain. This takes on the order of a millisecond, so
+  // it is done on loading rather than cached to disk.
+  void RPCModel::fit_inverse() {
+
+    m_has_inverse = false;
+    m_inv_lon_coeff = CoeffVec();
+    m_inv_lat_coeff = CoeffVec();
+
+    const int num_xy = 11, num_z = 5;
+    std::vector<double> lon, lat, height;
+    for (int i = 0; i < num_xy; i++) {
+      for (int j = 0; j < num_xy; j++) {
+        for (int k = 0; k < num_z; k++) {
+          lon.push_back   (-1.0 + 2.0 * i / (num_xy - 1.0));
+          lat.push_back   (-1.0 + 2.0 * j / (num_xy - 1.0));
+          height.push_back(-1.0 + 2.0 * k / (num_z  - 1.0));
+        }
+      }
+    }
+    size_t num_pts = lon.size();
+    std::vector<double> sample(num_pts), line(num_pts);
+    normalized_geodetic_to_normalized_pixel_batch(num_pts, &lon[0], &lat[0], &height[0],
+                                                  &sample[0], &line[0]);
+
+    // Skip points which project badly, such as near a pole of the
+    // rational function.
+    const double max_pix = 2.0;
+    std::vector<size_t> good;
+    for (size_t i = 0; i < num_pts; i++) {
+      if (std::abs(sample[i]) <= max_pix && std::abs(line[i]) <= max_pix)
+        good.push_back(i);
+    }
+    if (good.size() < 2 * 20)
+      return; // Not enough points to fit, will do without the inverse
+
+    Matrix<double> A(good.size(), 20);
+    Vector<double> b_lon(good.size()), b_lat(good.size());
+    for (size_t r = 0; r < good.size(); r++) {
+      size_t i = good[r];
+      select_row(A, r) = calculate_terms(Vector3(sample[i], line[i], height[i]));
+      b_lon[r] = lon[i];
+      b_lat[r] = lat[i];
+    }
+
+    try {
+      m_inv_lon_coeff = least_squares(A, b_lon);
+      m_inv_lat_coeff = least_squares(A, b_lat);
+    } catch (...) {
+      return;
+    }
+
+    m_has_inverse = (m_inv_lon_coeff == m_inv_lon_coeff &&
+                     m_inv_lat_coeff == m_inv_lat_coeff); // NaN check
+  }
+
+  Vector2 RPCModel::normalized_lonlat_guess(Vector2 const& normalized_pixel,
+                                            double normalized_height) const {
+    if (!m_has_inverse)
+      return Vector2(0.0, 0.0);
+
+    CoeffVec term = calculate_terms(Vector3(normalized_pixel[0], normalized_pixel[1],
+                                            normalized_height));
+    Vector2 guess(dot_prod(term, m_inv_lon_coeff), dot_prod(term, m_inv_lat_coeff));
+
+    // The inverse is not reliable far outside the domain
+    double len = norm_2(guess);
+    if (len != len || len > 1.5)
+      return Vector2(0.0, 0.0);
+
+    return guess;
   }
 
   // All of these implementations are largely inspired by the GDAL
@@ -262,6 +347,141 @@ namespace asp {
                                                    m_sample_den_coeff);
   }
 
+  // The RPC terms as in calculate_terms(), and optionally their
+  // partial derivatives as in terms_Jacobian3(), using plain arrays
+  // so that these can be inlined in vectorized loops.
+  inline void rpc_terms(double x, double y, double z, double t[20]) {
+    t[ 0] = 1.0;   t[ 1] = x;     t[ 2] = y;     t[ 3] = z;     t[ 4] = x*y;
+    t[ 5] = x*z;   t[ 6] = y*z;   t[ 7] = x*x;   t[ 8] = y*y;   t[ 9] = z*z;
+    t[10] = x*y*z; t[11] = x*x*x; t[12] = x*y*y; t[13] = x*z*z; t[14] = x*x*y;
+    t[15] = y*y*y; t[16] = y*z*z; t[17] = x*x*z; t[18] = y*y*z; t[19] = z*z*z;
+  }
+  
+  inline void rpc_terms_Jacobian(double x, double y, double z,
+                                 double dx[20], double dy[20], double dz[20]) {
+    dx[ 0] = 0.0;     dy[ 0] = 0.0;     dz[ 0] = 0.0;
+    dx[ 1] = 1.0;     dy[ 1] = 0.0;     dz[ 1] = 0.0;
+    dx[ 2] = 0.0;     dy[ 2] = 1.0;     dz[ 2] = 0.0;
+    dx[ 3] = 0.0;     dy[ 3] = 0.0;     dz[ 3] = 1.0;
+    dx[ 4] = y;       dy[ 4] = x;       dz[ 4] = 0.0;
+    dx[ 5] = z;       dy[ 5] = 0.0;     dz[ 5] = x;
+    dx[ 6] = 0.0;     dy[ 6] = z;       dz[ 6] = y;
+    dx[ 7] = 2.0*x;   dy[ 7] = 0.0;     dz[ 7] = 0.0;
+    dx[ 8] = 0.0;     dy[ 8] = 2.0*y;   dz[ 8] = 0.0;
+    dx[ 9] = 0.0;     dy[ 9] = 0.0;     dz[ 9] = 2.0*z;
+    dx[10] = y*z;     dy[10] = x*z;     dz[10] = x*y;
+    dx[11] = 3.0*x*x; dy[11] = 0.0;     dz[11] = 0.0;
+    dx[12] = y*y;     dy[12] = 2.0*x*y; dz[12] = 0.0;
+    dx[13] = z*z;     dy[13] = 0.0;     dz[13] = 2.0*x*z;
+    dx[14] = 2.0*x*y; dy[14] = x*x;     dz[14] = 0.0;
+    dx[15] = 0.0;     dy[15] = 3.0*y*y; dz[15] = 0.0;
+    dx[16] = 0.0;     dy[16] = z*z;     dz[16] = 2.0*y*z;
+    dx[17] = 2.0*x*z; dy[17] = 0.0;     dz[17] = x*x;
+    dx[18] = 0.0;     dy[18] = 2.0*y*z; dz[18] = y*y;
+    dx[19] = 0.0;     dy[19] = 0.0;     dz[19] = 3.0*z*z;
+  }
+
+  void RPCModel::normalized_geodetic_to_normalized_pixel_batch
+  (size_t num_points, double const* lon, double const* lat, double const* height,
+   RPCModel::CoeffVec const& line_num_coeff,
+   RPCModel::CoeffVec const& line_den_coeff,
+   RPCModel::CoeffVec const& sample_num_coeff,
+   RPCModel::CoeffVec const& sample_den_coeff,
+   double * sample, double * line, double * jacobian) {
+
+    // Copy the coefficients to plain arrays, so that the compiler can
+    // keep them in registers across the loop.
+    double ln[20], ld[20], sn[20], sd[20];
+    for (int k = 0; k < 20; k++) {
+      ln[k] = line_num_coeff[k];   ld[k] = line_den_coeff[k];
+      sn[k] = sample_num_coeff[k]; sd[k] = sample_den_coeff[k];
+    }
+
+    if (jacobian == NULL) {
+#pragma omp simd
+      for (size_t i = 0; i < num_points; i++) {
+        double t[20];
+        rpc_terms(lon[i], lat[i], height[i], t);
+        double snv = 0.0, sdv = 0.0, lnv = 0.0, ldv = 0.0;
+        for (int k = 0; k < 20; k++) {
+          snv += sn[k] * t[k]; sdv += sd[k] * t[k];
+          lnv += ln[k] * t[k]; ldv += ld[k] * t[k];
+        }
+        sample[i] = snv / sdv;
+        line[i]   = lnv / ldv;
+      }
+      return;
+    }
+
+#pragma omp simd
+    for (size_t i = 0; i < num_points; i++) {
+      double x = lon[i], y = lat[i], z = height[i];
+      double t[20], dx[20], dy[20], dz[20];
+      rpc_terms(x, y, z, t);
+      rpc_terms_Jacobian(x, y, z, dx, dy, dz);
+
+      // Values and derivatives of the four polynomials
+      double snv = 0.0, sdv = 0.0, lnv = 0.0, ldv = 0.0;
+      double snx = 0.0, sny = 0.0, snz = 0.0, sdx = 0.0, sdy = 0.0, sdz = 0.0;
+      double lnx = 0.0, lny = 0.0, lnz = 0.0, ldx = 0.0, ldy = 0.0, ldz = 0.0;
+      for (int k = 0; k < 20; k++) {
+        snv += sn[k] * t[k];  sdv += sd[k] * t[k];
+        lnv += ln[k] * t[k];  ldv += ld[k] * t[k];
+        snx += sn[k] * dx[k]; sny += sn[k] * dy[k]; snz += sn[k] * dz[k];
+        sdx += sd[k] * dx[k]; sdy += sd[k] * dy[k]; sdz += sd[k] * dz[k];
+        lnx += ln[k] * dx[k]; lny += ln[k] * dy[k]; lnz += ln[k] * dz[k];
+        ldx += ld[k] * dx[k]; ldy += ld[k] * dy[k]; ldz += ld[k] * dz[k];
+      }
+
+      double s = snv / sdv, l = lnv / ldv;
+      sample[i] = s;
+      line[i]   = l;
+
+      // The quotient rule: (n/d)' = (n' - (n/d) * d') / d
+      double * J = jacobian + 6 * i;
+      J[0] = (snx - s * sdx) / sdv;
+      J[1] = (sny - s * sdy) / sdv;
+      J[2] = (snz - s * sdz) / sdv;
+      J[3] = (lnx - l * ldx) / ldv;
+      J[4] = (lny - l * ldy) / ldv;
+      J[5] = (lnz - l * ldz) / ldv;
+    }
+  }
+
+  void RPCModel::normalized_geodetic_to_normalized_pixel_batch
+  (size_t num_points, double const* lon, double const* lat, double const* height,
+   double * sample, double * line, double * jacobian) const {
+    normalized_geodetic_to_normalized_pixel_batch(num_points, lon, lat, height,
+                                                  m_line_num_coeff, m_line_den_coeff,
+                                                  m_sample_num_coeff, m_sample_den_coeff,
+                                                  sample, line, jacobian);
+  }
+
+  void RPCModel::points_to_pixels(std::vector<Vector3> const& points,
+                                  std::vector<Vector2>      & pixels) const {
+
+    size_t num_points = points.size();
+    pixels.resize(num_points);
+    
+    // Normalize the geodetics, and put them in structure-of-arrays form
+    std::vector<double> lon(num_points), lat(num_points), height(num_points);
+    for (size_t i = 0; i < num_points; i++) {
+      Vector3 llh = m_datum.cartesian_to_geodetic(points[i]);
+      lon[i]    = (llh[0] - m_lonlatheight_offset[0]) / m_lonlatheight_scale[0];
+      lat[i]    = (llh[1] - m_lonlatheight_offset[1]) / m_lonlatheight_scale[1];
+      height[i] = (llh[2] - m_lonlatheight_offset[2]) / m_lonlatheight_scale[2];
+    }
+
+    std::vector<double> sample(num_points), line(num_points);
+    if (num_points > 0)
+      normalized_geodetic_to_normalized_pixel_batch(num_points, &lon[0], &lat[0], &height[0],
+                                                    &sample[0], &line[0]);
+
+    for (size_t i = 0; i < num_points; i++)
+      pixels[i] = Vector2(sample[i] * m_xy_scale[0] + m_xy_offset[0],
+                          line[i]   * m_xy_scale[1] + m_xy_offset[1]);
+  }
+  
   RPCModel::CoeffVec RPCModel::calculate_terms(vw::Vector3 const& normalized_geodetic) {
 
     double x = normalized_geodetic.x(); // normalized lon
@@ -400,16 +620,20 @@ namespace asp {
 
     Vector3 normalized_geodetic = elem_quot(geodetic - m_lonlatheight_offset, m_lonlatheight_scale);
 
-    CoeffVec term = calculate_terms(normalized_geodetic);
-
-    CoeffVec Qs = quotient_Jacobian(sample_num_coeff(), sample_den_coeff(), term);
-    CoeffVec Ql = quotient_Jacobian(line_num_coeff(),   line_den_coeff(),   term);
-    Matrix<double, 20, 3> MN = terms_Jacobian3(normalized_geodetic) *
-      normalization_Jacobian(m_lonlatheight_scale);
+    // Use the batch logic, which avoids forming the 20x3 matrix of
+    // term derivatives. This is called for every point in triangulation.
+    double sample = 0.0, line = 0.0, jac[6];
+    normalized_geodetic_to_normalized_pixel_batch(1, &normalized_geodetic[0],
+                                                  &normalized_geodetic[1],
+                                                  &normalized_geodetic[2],
+                                                  &sample, &line, jac);
 
+    // Undo the normalization
     Matrix<double, 2, 3> J;
-    select_row(J, 0) = m_xy_scale[0] * transpose(Qs) * MN;
-    select_row(J, 1) = m_xy_scale[1] * transpose(Ql) * MN;
+    for (int row = 0; row < 2; row++) {
+      for (int col = 0; col < 3; col++)
+        J(row, col) = jac[3*row + col] * m_xy_scale[row] / m_lonlatheight_scale[col];
+    }
 
     return J;
   }
@@ -471,12 +695,17 @@ namespace asp {
 
     Vector2 normalized_pixel = elem_quot(pixel - m_xy_offset, m_xy_scale);
 
-    // Initial guess for the normalized lon and lat
-    if (lonlat_guess == Vector2(0.0, 0.0))
-      lonlat_guess = subvector(m_lonlatheight_offset, 0, 2);
+    double normalized_height = (height - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
 
-    Vector2 normalized_lonlat = elem_quot(lonlat_guess - subvector(m_lonlatheight_offset, 0, 2),
-                                          subvector(m_lonlatheight_scale, 0, 2));
+    // Initial guess for the normalized lon and lat. If not provided,
+    // use the approximate inverse, which is usually accurate enough
+    // that Newton's method converges in one or two steps.
+    Vector2 normalized_lonlat;
+    if (lonlat_guess == Vector2(0.0, 0.0))
+      normalized_lonlat = normalized_lonlat_guess(normalized_pixel, normalized_height);
+    else
+      normalized_lonlat = elem_quot(lonlat_guess - subvector(m_lonlatheight_offset, 0, 2),
+                                    subvector(m_lonlatheight_scale, 0, 2));
     double len = norm_2(normalized_lonlat);
     if (len != len || len > 1.5){
       // If the input guess is NaN or unreasonable, use 0 as initial guess
@@ -489,7 +718,7 @@ namespace asp {
       Vector3 normalized_geodetic;
       normalized_geodetic[0] = normalized_lonlat[0];
       normalized_geodetic[1] = normalized_lonlat[1];
-      normalized_geodetic[2] = (height - m_lonlatheight_offset[2])/m_lonlatheight_scale[2];
+      normalized_geodetic[2] = normalized_height;
 
       Vector2              p = normalized_geodetic_to_normalized_pixel(normalized_geodetic);
       Matrix<double, 2, 2> J = normalized_geodetic_to_pixel_Jacobian(normalized_geodetic);
@@ -532,11 +761,10 @@ namespace asp {
     double  height_up = m_lonlatheight_offset[2] + m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
     double  height_dn = m_lonlatheight_offset[2] - m_lonlatheight_scale[2]*VERT_SCALE_FACTOR;
 
-    // Given the pixel and elevation, estimate lon-lat.
-    // Use m_lonlatheight_offset as initial guess for lonlat_up,
-    // and then use lonlat_up as initial guess for lonlat_dn.
-    Vector2 lonlat_up = image_to_ground(pix, height_up, subvector(m_lonlatheight_offset, 0, 2));
-    Vector2 lonlat_dn = image_to_ground(pix, height_dn, lonlat_up);
+    // Given the pixel and elevation, estimate lon-lat. The initial
+    // guess comes from the approximate inverse.
+    Vector2 lonlat_up = image_to_ground(pix, height_up);
+    Vector2 lonlat_dn = image_to_ground(pix, height_dn);
 
     Vector3 geo_up = Vector3(lonlat_up[0], lonlat_up[1], height_up);
     Vector3 geo_dn = Vector3(lonlat_dn[0], lonlat_dn[1], height_dn);
@@ -36,6 +36,7 @@
 #include <vw/Cartography/Datum.h>
 
 #include <string>
+#include <vector>
 #include <ostream>
 
 namespace vw {
@@ -95,6 +96,28 @@ namespace asp {
 
     vw::Vector2 geodetic_to_pixel( vw::Vector3 const& geodetic ) const;
 
+    /// Evaluate the RPC polynomials at many normalized geodetics at
+    /// once. The inputs and outputs are in structure-of-arrays form,
+    /// which lets the compiler vectorize the loop. If 'jacobian' is
+    /// not NULL, it must have room for 6 values per point, which will
+    /// be the partial derivatives of the normalized sample and line
+    /// (in this order) in respect to the normalized lon, lat, and
+    /// height, in row-major order.
+    static void normalized_geodetic_to_normalized_pixel_batch
+      (size_t num_points, double const* lon, double const* lat, double const* height,
+       CoeffVec const& line_num_coeff,   CoeffVec const& line_den_coeff,
+       CoeffVec const& sample_num_coeff, CoeffVec const& sample_den_coeff,
+       double * sample, double * line, double * jacobian = NULL);
+
+    void normalized_geodetic_to_normalized_pixel_batch
+      (size_t num_points, double const* lon, double const* lat, double const* height,
+       double * sample, double * line, double * jacobian = NULL) const;
+
+    /// Project many points at once. Same as calling point_to_pixel()
+    /// for each, but faster.
+    void points_to_pixels(std::vector<vw::Vector3> const& points,
+                          std::vector<vw::Vector2>      & pixels) const;
+
     // Access to constants
     vw::cartography::Datum const& datum   () const { return m_datum;               }
     CoeffVec    const& line_num_coeff     () const { return m_line_num_coeff;      }
@@ -145,7 +168,22 @@ namespace asp {
     vw::Vector3 m_lonlatheight_offset;
     vw::Vector3 m_lonlatheight_scale;
 
+    // Approximate inverse, a cubic polynomial in the normalized sample,
+    // line, and height, giving the normalized lon and lat. Used as
+    // initial guess in image_to_ground().
+    CoeffVec    m_inv_lon_coeff, m_inv_lat_coeff;
+    bool        m_has_inverse;
+
     void initialize( vw::DiskImageResourceGDAL* resource );
+
+    /// Fit the approximate inverse. Must be called after the
+    /// coefficients are set.
+    void fit_inverse();
+
+    /// Initial guess for the normalized lon and lat, given the
+    /// normalized pixel and height.
+    vw::Vector2 normalized_lonlat_guess(vw::Vector2 const& normalized_pixel,
+                                        double normalized_height) const;
   };
 
   std::ostream& operator<<(std::ostream& os, const RPCModel& rpc);
@@ -20,6 +20,9 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/Geometry.h>
 
+#include <algorithm>
+#include <cmath>
+
 using namespace vw;
 
 namespace asp {
@@ -156,20 +159,180 @@ namespace asp {
     return status;
   }
 
-  void gen_rpc(// Inputs
-               double penalty_weight,
-               std::string    const& output_prefix,
-               Vector<double> const& normalized_geodetics,
-               Vector<double> const& normalized_pixels,
-               Vector3 const& llh_scale,
-               Vector3 const& llh_offset,
-               Vector2 const& uv_scale,
-               Vector2 const& uv_offset,
-               // Outputs
-               RPCModel::CoeffVec & line_num,
-               RPCModel::CoeffVec & line_den,
-               RPCModel::CoeffVec & samp_num,
-               RPCModel::CoeffVec & samp_den){
+  namespace {
+
+    // How many rows of the design matrix are folded into the
+    // triangular factor at a time in BlockedLeastSquares.
+    const int LSQ_BLOCK_SIZE = 256;
+
+    /// Solve an over-determined linear system A*x = b in the least
+    /// squares sense with a Householder QR factorization, consuming
+    /// the rows of A in blocks. Only the upper-triangular factor R of
+    /// the augmented matrix [A b] is kept, together with one block of
+    /// pending rows, so the memory use does not depend on the number
+    /// of rows, and each block is processed while it is still in cache.
+    class BlockedLeastSquares {
+    public:
+      BlockedLeastSquares(int num_unknowns):
+        m_n(num_unknowns), m_num_pending(0),
+        m_work(num_unknowns + 1 + LSQ_BLOCK_SIZE, num_unknowns + 1) {
+        m_work.set_zero();
+      }
+
+      /// Append the row a (of length num_unknowns) with right-hand side b.
+      void add_row(double const* a, double b) {
+        int r = m_n + 1 + m_num_pending;
+        for (int k = 0; k < m_n; k++)
+          m_work(r, k) = a[k];
+        m_work(r, m_n) = b;
+        m_num_pending++;
+        if (m_num_pending == LSQ_BLOCK_SIZE)
+          fold();
+      }
+
+      /// Find the solution and the norm of the residual. Return false
+      /// if the system is rank-deficient.
+      bool solve(Vector<double> & x, double & residual_norm) {
+        fold();
+
+        double max_diag = 0.0;
+        for (int i = 0; i < m_n; i++)
+          max_diag = std::max(max_diag, std::abs(m_work(i, i)));
+        for (int i = 0; i < m_n; i++) {
+          if (!(std::abs(m_work(i, i)) > 1e-12 * max_diag))
+            return false;
+        }
+
+        // Back-substitution
+        x.set_size(m_n);
+        for (int i = m_n - 1; i >= 0; i--) {
+          double s = m_work(i, m_n);
+          for (int k = i + 1; k < m_n; k++)
+            s -= m_work(i, k) * x[k];
+          x[i] = s / m_work(i, i);
+        }
+
+        // The last diagonal entry of the augmented factor is the
+        // part of b orthogonal to the range of A.
+        residual_norm = std::abs(m_work(m_n, m_n));
+        return true;
+      }
+
+    private:
+
+      // Stack the pending rows under R and make the result
+      // upper-triangular again with Householder reflections. The rows
+      // of R below the diagonal of a given column are zero in that
+      // column, so each reflection only involves the diagonal row of
+      // R and the pending rows.
+      void fold() {
+        int first = m_n + 1, last = m_n + 1 + m_num_pending;
+        for (int j = 0; j <= m_n; j++) {
+
+          double sigma = 0.0;
+          for (int i = first; i < last; i++)
+            sigma += m_work(i, j) * m_work(i, j);
+          if (sigma == 0.0)
+            continue;
+
+          double alpha = m_work(j, j);
+          double norm  = std::sqrt(alpha * alpha + sigma);
+          double beta  = (alpha > 0) ? -norm : norm;
+          double v0    = alpha - beta;
+          double vtv   = v0 * v0 + sigma;
+
+          m_work(j, j) = beta;
+          for (int k = j + 1; k <= m_n; k++) {
+            double s = v0 * m_work(j, k);
+            for (int i = first; i < last; i++)
+              s += m_work(i, j) * m_work(i, k);
+            double f = 2.0 * s / vtv;
+            m_work(j, k) -= f * v0;
+            for (int i = first; i < last; i++)
+              m_work(i, k) -= f * m_work(i, j);
+          }
+          for (int i = first; i < last; i++)
+            m_work(i, j) = 0.0;
+        }
+        m_num_pending = 0;
+      }
+
+      int m_n, m_num_pending;
+      Matrix<double> m_work; // R on top, pending rows below
+    };
+
+    /// Fit one pixel coordinate as a ratio of RPC polynomials by
+    /// minimizing the linearized error num(P) - pix * den(P), with
+    /// the same penalty on the higher-order terms as in RpcSolveLMA.
+    /// The coordinate is 0 for the sample and 1 for the line.
+    bool linear_rpc_fit(Vector<double> const& normalized_geodetics,
+                        Vector<double> const& normalized_pixels,
+                        double penalty_weight, int coord,
+                        RPCModel::CoeffVec & num, RPCModel::CoeffVec & den) {
+
+      const int num_terms = RPCModel::CoeffVec().size(); // 20
+      const int num_unknowns = 2 * num_terms - 1; // den[0] = 1
+      int numPts = normalized_geodetics.size() / RPCModel::GEODETIC_COORD_SIZE;
+      if (numPts < num_unknowns)
+        return false;
+
+      BlockedLeastSquares lsq(num_unknowns);
+      std::vector<double> row(num_unknowns);
+      for (int p = 0; p < numPts; p++) {
+        Vector3 llh = subvector(normalized_geodetics,
+                                RPCModel::GEODETIC_COORD_SIZE * p,
+                                RPCModel::GEODETIC_COORD_SIZE);
+        double pix = normalized_pixels[RPCModel::IMAGE_COORD_SIZE * p + coord];
+        RPCModel::CoeffVec terms = RPCModel::calculate_terms(llh);
+        for (int k = 0; k < num_terms; k++)
+          row[k] = terms[k];
+        for (int k = 1; k < num_terms; k++)
+          row[num_terms + k - 1] = -pix * terms[k];
+        lsq.add_row(&row[0], pix);
+      }
+
+      // Penalize the coefficients of degree 2 and 3
+      Vector<int, 20> coeff_order = RPCModel::get_coeff_order();
+      for (int k = 4; k < num_terms; k++) {
+        double wt = penalty_weight * (coeff_order[k] - 1);
+        std::fill(row.begin(), row.end(), 0.0);
+        row[k] = wt;
+        lsq.add_row(&row[0], 0.0);
+        std::fill(row.begin(), row.end(), 0.0);
+        row[num_terms + k - 1] = wt;
+        lsq.add_row(&row[0], 0.0);
+      }
+
+      Vector<double> x;
+      double residual_norm = 0.0;
+      if (!lsq.solve(x, residual_norm))
+        return false;
+
+      den[0] = 1.0;
+      for (int k = 0; k < num_terms; k++)
+        num[k] = x[k];
+      for (int k = 1; k < num_terms; k++)
+        den[k] = x[num_terms + k - 1];
+
+      return true;
+    }
+
+  } // end anonymous namespace
+
+  double gen_rpc(// Inputs
+                 double penalty_weight,
+                 std::string    const& output_prefix,
+                 Vector<double> const& normalized_geodetics,
+                 Vector<double> const& normalized_pixels,
+                 Vector3 const& llh_scale,
+                 Vector3 const& llh_offset,
+                 Vector2 const& uv_scale,
+                 Vector2 const& uv_offset,
+                 // Outputs
+                 RPCModel::CoeffVec & line_num,
+                 RPCModel::CoeffVec & line_den,
+                 RPCModel::CoeffVec & samp_num,
+                 RPCModel::CoeffVec & samp_den){
   
     VW_ASSERT( penalty_weight >= 0, ArgumentErr()
                << "The RPC penalty weight must be non-negative.\n" );
@@ -239,6 +402,26 @@ namespace asp {
     // for (size_t i = 0; i < startGuess.size(); i++) startGuess[i] = 0.0; // start with zero
     packCoeffs(line_num, line_den, samp_num, samp_den, startGuess);
 
+    // A linearized fit of the full rational model is usually a much
+    // better seed than the affine one, and saves many L-M iterations.
+    // Keep whichever of the two fits the data better.
+    RPCModel::CoeffVec lin_line_num, lin_line_den, lin_samp_num, lin_samp_den;
+    if (linear_rpc_fit(normalized_geodetics, normalized_pixels, penalty_adjustment,
+                       0, lin_samp_num, lin_samp_den) &&
+        linear_rpc_fit(normalized_geodetics, normalized_pixels, penalty_adjustment,
+                       1, lin_line_num, lin_line_den)) {
+      Vector<double> linGuess;
+      packCoeffs(lin_line_num, lin_line_den, lin_samp_num, lin_samp_den, linGuess);
+      double affine_error = norm_2(lma_model.difference(lma_model(startGuess),
+                                                        normalized_pixels));
+      double linear_error = norm_2(lma_model.difference(lma_model(linGuess),
+                                                        normalized_pixels));
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: affine seed error = " << affine_error
+                                  << ", linear seed error = " << linear_error << std::endl;
+      if (linear_error < affine_error) 
+        startGuess = linGuess;
+    }
+
     VW_OUT(DebugMessage, "asp") << "Initial guess for RPC coeffs: " << startGuess << std::endl;
     
     // Use the L-M solver to optimize the RPC model coefficient values.
@@ -256,6 +439,20 @@ namespace asp {
     // experiment with multiple starting seeds!
 
     unpackCoeffs(solution, line_num, line_den, samp_num, samp_den);
+
+    // The RMS error of the fit in pixels. The penalty terms at the
+    // end of the residual vector are not included.
+    Vector<double> final_error = lma_model.difference(lma_model(solution), normalized_pixels);
+    double sum_sq = 0.0;
+    for (int p = 0; p < numPts; p++) {
+      double ds = final_error[RPCModel::IMAGE_COORD_SIZE*p + 0] * uv_scale[0];
+      double dl = final_error[RPCModel::IMAGE_COORD_SIZE*p + 1] * uv_scale[1];
+      sum_sq += ds*ds + dl*dl;
+    }
+    double rms_error = (numPts > 0) ? std::sqrt(sum_sq / numPts) : 0.0;
+    VW_OUT(DebugMessage, "asp") << "rpc_gen: RMS error in pixels = " << rms_error << std::endl;
+
+    return rms_error;
   }
   
   
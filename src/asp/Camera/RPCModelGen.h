@@ -23,6 +23,8 @@
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/LevenbergMarquardt.h>
 
+#include <vector>
+
 namespace asp {
 
   /// Unpack the 78 RPC coefficients from one long vector into four seperate vectors.
@@ -45,6 +47,10 @@ namespace asp {
     vw::Vector<double> m_normalizedGeodetics, 
                        m_normalizedPixels; ///< Also contains the extra penalty terms
     double             m_wt; ///< The penalty weight, k in the reference paper.
+
+    /// The normalized geodetics in structure-of-arrays form, for
+    /// batch evaluation.
+    std::vector<double> m_lon, m_lat, m_height;
     
   public:
    
@@ -62,7 +68,15 @@ namespace asp {
                  ) :
       m_normalizedGeodetics(normalizedGeodetics),
       m_normalizedPixels(normalizedPixels),
-      m_wt(penaltyWeight){}
+      m_wt(penaltyWeight){
+      int numPts = m_normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+      m_lon.resize(numPts); m_lat.resize(numPts); m_height.resize(numPts);
+      for (int i = 0; i < numPts; i++) {
+        m_lon[i]    = m_normalizedGeodetics[RPCModel::GEODETIC_COORD_SIZE*i + 0];
+        m_lat[i]    = m_normalizedGeodetics[RPCModel::GEODETIC_COORD_SIZE*i + 1];
+        m_height[i] = m_normalizedGeodetics[RPCModel::GEODETIC_COORD_SIZE*i + 2];
+      }
+    }
 
     /// Given a set of RPC coefficients, compute the projected pixels.
     inline result_type operator()( domain_type const& C ) const {
@@ -83,17 +97,18 @@ namespace asp {
       result_type result;
       result.set_size(m_normalizedPixels.size());
       
-      // Loop through each test point
+      // Project all normalized geodetics into the RPC camera at once
+      // to get the normalized pixels.
+      std::vector<double> samp(numPts), line(numPts);
+      if (numPts > 0)
+        RPCModel::normalized_geodetic_to_normalized_pixel_batch
+          (numPts, &m_lon[0], &m_lat[0], &m_height[0],
+           lineNum, lineDen, sampNum, sampDen, &samp[0], &line[0]);
+      
+      // Pack the normalized pixels into the output result vector
       for (int i = 0; i < numPts; i++){
-        // Unpack the normalized Geodetic coordinate
-        vw::Vector3 G = subvector(m_normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i, RPCModel::GEODETIC_COORD_SIZE);
-        
-        // Project the normalized geodetic coordinate into the RPC camera to get a normalized pixel
-        vw::Vector2 pxn = RPCModel::normalized_geodetic_to_normalized_pixel(G, lineNum, lineDen, sampNum, sampDen);
-             
-        // Pack the normalized pixel into the output result vector
-        subvector(result, RPCModel::IMAGE_COORD_SIZE*i, RPCModel::IMAGE_COORD_SIZE) = pxn;
-
+        result[RPCModel::IMAGE_COORD_SIZE*i + 0] = samp[i];
+        result[RPCModel::IMAGE_COORD_SIZE*i + 1] = line[i];
       }
 
       // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
@@ -135,20 +150,24 @@ namespace asp {
                               vw::Vector<double>      & final_params,
                               double              & norm_error);
   
-  void gen_rpc(// Inputs
-               double penalty_weight,
-               std::string    const& output_prefix,
-               vw::Vector<double> const& normalized_geodetics,
-               vw::Vector<double> const& normalized_pixels,
-               vw::Vector3 const& llh_scale,
-               vw::Vector3 const& llh_offset,
-               vw::Vector2 const& uv_scale,
-               vw::Vector2 const& uv_offset,
-               // Outputs
-               RPCModel::CoeffVec & line_num,
-               RPCModel::CoeffVec & line_den,
-               RPCModel::CoeffVec & samp_num,
-               RPCModel::CoeffVec & samp_den);
+  /// Fit the RPC coefficients to the given normalized geodetics and
+  /// pixels. The fit is seeded with the better of an affine and a
+  /// linearized rational least squares solution, then refined with
+  /// Levenberg-Marquardt. Return the RMS error of the fit, in pixels.
+  double gen_rpc(// Inputs
+                 double penalty_weight,
+                 std::string    const& output_prefix,
+                 vw::Vector<double> const& normalized_geodetics,
+                 vw::Vector<double> const& normalized_pixels,
+                 vw::Vector3 const& llh_scale,
+                 vw::Vector3 const& llh_offset,
+                 vw::Vector2 const& uv_scale,
+                 vw::Vector2 const& uv_offset,
+                 // Outputs
+                 RPCModel::CoeffVec & line_num,
+                 RPCModel::CoeffVec & line_den,
+                 RPCModel::CoeffVec & samp_num,
+                 RPCModel::CoeffVec & samp_den);
 }
 
 #endif //__STEREO_CAMERA_RPC_MODEL_GEN_H__
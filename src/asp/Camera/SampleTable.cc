@@ -0,0 +1,187 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SampleTable.cc
+///
+
+#include <asp/Camera/SampleTable.h>
+
+#include <vw/Core/Exception.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace asp {
+
+namespace {
+
+  const int MAX_LAGRANGE_ORDER = 8;
+
+  // The inverses of the Lagrange denominators for nodes 0, ..., order - 1,
+  // which are the same for any uniformly spaced stencil. Stored for
+  // orders 2, 4, 6, 8, at row order/2 - 1.
+  struct LagrangeDenominators {
+    double inv[MAX_LAGRANGE_ORDER/2][MAX_LAGRANGE_ORDER];
+    LagrangeDenominators() {
+      for (int order = 2; order <= MAX_LAGRANGE_ORDER; order += 2) {
+        for (int j = 0; j < order; j++) {
+          double den = 1.0;
+          for (int m = 0; m < order; m++) {
+            if (m != j)
+              den *= double(j - m);
+          }
+          inv[order/2 - 1][j] = 1.0 / den;
+        }
+      }
+    }
+  };
+
+  LagrangeDenominators const& lagrangeDenominators() {
+    static const LagrangeDenominators den;
+    return den;
+  }
+
+  // Find the Lagrange stencil and weights at the normalized time s,
+  // in units of the sample spacing from the first sample. Near the ends
+  // the order is reduced, keeping the stencil centered. Return the
+  // order used. The first sample in the stencil goes in 'first'.
+  int lagrangeStencil(int num_samples, double s, int order, int & first,
+                      double w[MAX_LAGRANGE_ORDER]) {
+
+    if (num_samples < 2)
+      vw::vw_throw(vw::ArgumentErr() << "Cannot interpolate in an empty table.\n");
+    if (order < 2 || order > MAX_LAGRANGE_ORDER || order % 2 != 0)
+      vw::vw_throw(vw::ArgumentErr() << "Unsupported Lagrange interpolation order: "
+                   << order << ".\n");
+
+    // The interval containing s, clamped to the table, without a search
+    int index = std::min(std::max(int(std::floor(s)), 0), num_samples - 2);
+    double u = s - index;
+
+    int half = order/2;
+    while (half > 1 && (index - half + 1 < 0 || index + half > num_samples - 1))
+      half--;
+    order = 2 * half;
+    first = index - half + 1;
+
+    // The weights, as products of (u - k) over the other nodes k, with
+    // the products to the left and right accumulated separately.
+    double x[MAX_LAGRANGE_ORDER];
+    for (int j = 0; j < order; j++)
+      x[j] = u - double(j - half + 1);
+    double left = 1.0;
+    for (int j = 0; j < order; j++) {
+      w[j] = left;
+      left *= x[j];
+    }
+    double right = 1.0;
+    double const* inv = lagrangeDenominators().inv[half - 1];
+    for (int j = order - 1; j >= 0; j--) {
+      w[j] *= right * inv[j];
+      right *= x[j];
+    }
+
+    return order;
+  }
+
+} // end anonymous namespace
+
+UniformSampleTable::UniformSampleTable():
+  m_num_samples(0), m_dim(0), m_t0(0.0), m_dt(1.0), m_inv_dt(1.0) {}
+
+UniformSampleTable::UniformSampleTable(int num_samples, int dim, double const* values,
+                                       double t0, double dt) {
+  set(num_samples, dim, values, t0, dt);
+}
+
+void UniformSampleTable::set(int num_samples, int dim, double const* values,
+                             double t0, double dt) {
+  if (num_samples < 2 || dim < 1)
+    vw::vw_throw(vw::ArgumentErr() << "Expecting at least two samples "
+                 << "with at least one value each.\n");
+  if (dt <= 0.0)
+    vw::vw_throw(vw::ArgumentErr() << "Expecting a positive time spacing.\n");
+
+  m_num_samples = num_samples;
+  m_dim         = dim;
+  m_t0          = t0;
+  m_dt          = dt;
+  m_inv_dt      = 1.0 / dt;
+
+  // Transpose to one component at a time
+  m_values.resize(m_num_samples * m_dim);
+  for (int i = 0; i < m_num_samples; i++) {
+    for (int d = 0; d < m_dim; d++)
+      m_values[d * m_num_samples + i] = values[i * m_dim + d];
+  }
+}
+
+void UniformSampleTable::lagrange(double t, int order, double * out) const {
+
+  int first = 0;
+  double w[MAX_LAGRANGE_ORDER];
+  order = lagrangeStencil(m_num_samples, (t - m_t0) * m_inv_dt, order, first, w);
+
+  for (int d = 0; d < m_dim; d++) {
+    double const* v = &m_values[d * m_num_samples + first];
+    double sum = 0.0;
+    for (int j = 0; j < order; j++)
+      sum += w[j] * v[j];
+    out[d] = sum;
+  }
+}
+
+void uniformLagrange(int num_samples, int dim, double const* values,
+                     double t0, double dt, double t, int order, double * out) {
+
+  int first = 0;
+  double w[MAX_LAGRANGE_ORDER];
+  order = lagrangeStencil(num_samples, (t - t0) / dt, order, first, w);
+
+  for (int d = 0; d < dim; d++)
+    out[d] = 0.0;
+  for (int j = 0; j < order; j++) {
+    double const* v = &values[(first + j) * dim];
+    for (int d = 0; d < dim; d++)
+      out[d] += w[j] * v[d];
+  }
+}
+
+void UniformSampleTable::nearest(double t, double * out) const {
+
+  if (m_num_samples < 1)
+    vw::vw_throw(vw::ArgumentErr() << "Cannot interpolate in an empty table.\n");
+
+  int index = int(std::floor((t - m_t0) * m_inv_dt + 0.5));
+  index = std::min(std::max(index, 0), m_num_samples - 1);
+  for (int d = 0; d < m_dim; d++)
+    out[d] = m_values[d * m_num_samples + index];
+}
+
+void UniformSampleTable::locate(double t, int & index, double & u) const {
+
+  double s = (t - m_t0) * m_inv_dt;
+  if (m_num_samples < 2 || s < 0.0 || s > double(m_num_samples - 1))
+    vw::vw_throw(vw::ArgumentErr() << "Time " << t << " is outside the range of "
+                 << "the sample table.\n");
+
+  // The last sample is the end of the last interval
+  index = std::min(int(std::floor(s)), m_num_samples - 2);
+  u = s - index;
+}
+
+} // end namespace asp
@@ -0,0 +1,92 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+/// \file SampleTable.h
+///
+/// Interpolation in uniformly sampled ephemeris and attitude tables.
+
+#ifndef __STEREO_CAMERA_SAMPLE_TABLE_H__
+#define __STEREO_CAMERA_SAMPLE_TABLE_H__
+
+#include <vector>
+
+namespace asp {
+
+  /// A table of vector-valued samples at uniformly spaced times,
+  /// such as satellite positions or quaternions. The samples are
+  /// stored one component at a time (structure of arrays), so the
+  /// values that are combined in an interpolation are contiguous.
+  /// Given the uniform spacing, the sample index is found with
+  /// arithmetic rather than a search, and the Lagrange weights use
+  /// precomputed denominators.
+  class UniformSampleTable {
+  public:
+    UniformSampleTable();
+
+    /// Create the table from 'num_samples' samples, each with 'dim'
+    /// values, stored one sample after another in 'values'. This is
+    /// the layout used by UsgsAstroLsSensorModel.
+    UniformSampleTable(int num_samples, int dim, double const* values,
+                       double t0, double dt);
+
+    void set(int num_samples, int dim, double const* values,
+             double t0, double dt);
+
+    int    num_samples() const { return m_num_samples; }
+    int    dim()         const { return m_dim; }
+    double t0()          const { return m_t0; }
+    double dt()          const { return m_dt; }
+
+    /// The values of the given component, for all samples
+    double const* component(int d) const { return &m_values[d * m_num_samples]; }
+
+    /// Lagrange interpolation of the given even order (2, 4, 6, or 8)
+    /// at time t. Near the ends of the table the order is reduced so
+    /// that the interpolation stencil is centered. This gives the same
+    /// result as lagrangeInterp() in CSM. Times slightly outside the
+    /// table are extrapolated with the nearest stencil.
+    void lagrange(double t, int order, double * out) const;
+
+    /// Linear interpolation at time t
+    void linear(double t, double * out) const {
+      lagrange(t, 2, out);
+    }
+
+    /// The sample nearest to time t
+    void nearest(double t, double * out) const;
+
+    /// Find the sample interval [index, index + 1] containing time t,
+    /// and the fraction u in [0, 1] of the way through it. Throw an
+    /// error if t is outside the table, rather than extrapolating.
+    void locate(double t, int & index, double & u) const;
+
+  private:
+    int m_num_samples, m_dim;
+    double m_t0, m_dt, m_inv_dt;
+    std::vector<double> m_values; // m_dim blocks of m_num_samples values
+  };
+
+  /// Lagrange interpolation as in UniformSampleTable::lagrange(), but
+  /// directly in samples stored one after another, without a copy.
+  /// This is for samples which may change later, such as the
+  /// quaternions of a linescan model being optimized.
+  void uniformLagrange(int num_samples, int dim, double const* values,
+                       double t0, double dt, double t, int order, double * out);
+
+} // end namespace asp
+
+#endif//__STEREO_CAMERA_SAMPLE_TABLE_H__
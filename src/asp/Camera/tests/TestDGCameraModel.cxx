@@ -17,13 +17,20 @@
 
 
 #include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/CameraStateCache.h>
+#include <asp/Camera/Covariance.h>
+#include <asp/Camera/LinescanUtils.h>
+#include <asp/Camera/SampleTable.h>
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/XMLBase.h>
 #include <asp/Camera/RPCModel.h>
+#include <asp/Core/StereoSettings.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/filesystem.hpp>
 #include <test/Helpers.h>
 
 #include <vw/Stereo/StereoModel.h>
+#include <vw/Camera/CameraSolve.h>
 
 #include <vw/Cartography/GeoTransform.h>
 
@@ -161,3 +168,252 @@ TEST(DGCameraModel, CreateCamera) {
   XMLPlatformUtils::Terminate();
 }
 
+
+// Write the parsed state of a DG camera to the binary cache, read it
+// back, and check that nothing changed. Then load the camera twice
+// with the cache enabled, so the second time it comes from the cache,
+// and compare the two.
+TEST(DGCameraModel, CameraStateCache) {
+
+  XMLPlatformUtils::Initialize();
+
+  boost::filesystem::path cache_dir = boost::filesystem::temp_directory_path() /
+    boost::filesystem::unique_path("asp-camera-cache-%%%%-%%%%");
+  setenv("ASP_CAMERA_CACHE_DIR", cache_dir.string().c_str(), 1);
+
+  GeometricXML geo;
+  AttitudeXML  att;
+  EphemerisXML eph;
+  ImageXML     img;
+  RPCXML       rpc;
+  read_xml("dg_example1.xml", geo, att, eph, img, rpc);
+  BBox3 llh_box(Vector3(-105.3, 39.9, -100), Vector3(-105.1, 40.1, 3000));
+
+  std::string hash = file_content_hash("dg_example1.xml");
+  ASSERT_FALSE(hash.empty());
+  write_dg_camera_state(hash, geo, att, eph, img, llh_box);
+
+  GeometricXML geo2;
+  AttitudeXML  att2;
+  EphemerisXML eph2;
+  ImageXML     img2;
+  BBox3 llh_box2;
+  EXPECT_FALSE(read_dg_camera_state(hash + "0", geo2, att2, eph2, img2, llh_box2));
+  ASSERT_TRUE(read_dg_camera_state(hash, geo2, att2, eph2, img2, llh_box2));
+
+  EXPECT_EQ(geo.principal_distance,   geo2.principal_distance);
+  EXPECT_EQ(geo.optical_polyorder,    geo2.optical_polyorder);
+  EXPECT_EQ(geo.perspective_center,   geo2.perspective_center);
+  EXPECT_EQ(geo.camera_attitude.w(),  geo2.camera_attitude.w());
+  EXPECT_EQ(geo.camera_attitude.z(),  geo2.camera_attitude.z());
+  EXPECT_EQ(geo.detector_origin,      geo2.detector_origin);
+  EXPECT_EQ(geo.detector_rotation,    geo2.detector_rotation);
+  EXPECT_EQ(geo.detector_pixel_pitch, geo2.detector_pixel_pitch);
+
+  EXPECT_EQ(att.start_time,    att2.start_time);
+  EXPECT_EQ(att.time_interval, att2.time_interval);
+  ASSERT_EQ(att.satellite_quat_vec.size(), att2.satellite_quat_vec.size());
+  for (size_t i = 0; i < att.satellite_quat_vec.size(); i++)
+    EXPECT_EQ(att.satellite_quat_vec[i], att2.satellite_quat_vec[i]);
+  EXPECT_TRUE(att.satellite_quat_cov == att2.satellite_quat_cov);
+
+  EXPECT_EQ(eph.start_time,    eph2.start_time);
+  EXPECT_EQ(eph.time_interval, eph2.time_interval);
+  ASSERT_EQ(eph.satellite_position_vec.size(), eph2.satellite_position_vec.size());
+  ASSERT_EQ(eph.velocity_vec.size(), eph2.velocity_vec.size());
+  for (size_t i = 0; i < eph.satellite_position_vec.size(); i++) {
+    EXPECT_EQ(eph.satellite_position_vec[i], eph2.satellite_position_vec[i]);
+    EXPECT_EQ(eph.velocity_vec[i], eph2.velocity_vec[i]);
+  }
+  EXPECT_TRUE(eph.satellite_pos_cov == eph2.satellite_pos_cov);
+
+  EXPECT_EQ(img.tlc_start_time,        img2.tlc_start_time);
+  EXPECT_EQ(img.first_line_start_time, img2.first_line_start_time);
+  EXPECT_TRUE(img.tlc_vec == img2.tlc_vec);
+  EXPECT_EQ(img.sat_id,                img2.sat_id);
+  EXPECT_EQ(img.band_id,               img2.band_id);
+  EXPECT_EQ(img.scan_direction,        img2.scan_direction);
+  EXPECT_EQ(img.tdi,                   img2.tdi);
+  EXPECT_TRUE(img.tdi_multi == img2.tdi_multi);
+  EXPECT_EQ(img.avg_line_rate,         img2.avg_line_rate);
+  EXPECT_EQ(img.image_size,            img2.image_size);
+
+  EXPECT_EQ(llh_box.min(), llh_box2.min());
+  EXPECT_EQ(llh_box.max(), llh_box2.max());
+
+  // The first load may write the cache entry, the second one reads it
+  boost::filesystem::remove_all(cache_dir);
+  vw::CamPtr cam1 = load_dg_camera_model_from_xml("dg_example1.xml");
+  vw::CamPtr cam2 = load_dg_camera_model_from_xml("dg_example1.xml");
+  EXPECT_TRUE(boost::filesystem::exists(cache_dir / (hash + ".dg_state")));
+  for (size_t i = 0; i < 30000; i += 5000) {
+    for (size_t j = 0; j < 24000; j += 5000) {
+      Vector2 pix(i, j);
+      EXPECT_EQ(cam1->camera_center(pix),   cam2->camera_center(pix));
+      EXPECT_EQ(cam1->pixel_to_vector(pix), cam2->pixel_to_vector(pix));
+    }
+  }
+
+  unsetenv("ASP_CAMERA_CACHE_DIR");
+  boost::filesystem::remove_all(cache_dir);
+  XMLPlatformUtils::Terminate();
+}
+
+// Compare the fast line solver with Levenberg-Marquardt on the full model
+TEST(DGCameraModel, LineSolver) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  vw::CamPtr cam = vw::CamPtr(load_dg_camera_model_from_xml("dg_example1.xml"));
+  vw::camera::LinescanModel * ls_cam
+    = dynamic_cast<vw::camera::LinescanModel*>(cam.get());
+  ASSERT_TRUE(ls_cam != NULL);
+
+  Vector2 image_size(35170, 23708);
+  for (size_t i = 0; i < 30000; i += 500) {
+    for (size_t j = 0; j < 24000; j += 500) {
+      Vector2 pix(i, j);
+      Vector3 point = cam->camera_center(pix) + 2e4 * cam->pixel_to_vector(pix);
+
+      Vector2 line_pix = image_size / 2.0;
+      ASSERT_TRUE(asp::linescanPointToPixel(*ls_cam, point, line_pix));
+      EXPECT_VECTOR_NEAR(pix, line_pix, 1e-4);
+
+      Vector2 lm_pix = image_size / 2.0;
+      ASSERT_TRUE(asp::linescanPointToPixelLM(*ls_cam, point, -1, lm_pix));
+      EXPECT_VECTOR_NEAR(lm_pix, line_pix, 1e-1);
+    }
+  }
+  
+  XMLPlatformUtils::Terminate();
+}
+
+// The sample tables used in ground-to-image must agree with the VW
+// functors they replace.
+TEST(DGCameraModel, SampleTables) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  vw::CamPtr cam = vw::CamPtr(load_dg_camera_model_from_xml("dg_example1.xml"));
+  DGCameraModel * dg_cam = dynamic_cast<DGCameraModel*>(cam.get());
+  ASSERT_TRUE(dg_cam != NULL);
+
+  for (size_t j = 0; j < 24000; j += 250) {
+    double t = dg_cam->get_time_at_line(j);
+    Vector3 pos = dg_cam->get_position_func()(t);
+    EXPECT_VECTOR_NEAR(pos, dg_cam->get_camera_center_at_time(t), 1e-6);
+    Vector3 vel = dg_cam->get_velocity_func()(t);
+    EXPECT_VECTOR_NEAR(vel, dg_cam->get_camera_velocity_at_time(t), 1e-9);
+    Quat q1 = dg_cam->get_pose_func()(t), q2 = dg_cam->get_camera_pose_at_time(t);
+    EXPECT_NEAR(q1.w(), q2.w(), 1e-14);
+    EXPECT_NEAR(q1.x(), q2.x(), 1e-14);
+    EXPECT_NEAR(q1.y(), q2.y(), 1e-14);
+    EXPECT_NEAR(q1.z(), q2.z(), 1e-14);
+  }
+
+  XMLPlatformUtils::Terminate();
+}
+
+// The covariances found with the perturbations interpolated on a
+// grid must agree with those from perturbing the cameras at each
+// pixel. Include pixels at the image edge, where the grid is clamped.
+TEST(DGCameraModel, CovariancePropagator) {
+
+  xercesc::XMLPlatformUtils::Initialize();
+
+  bool prev_propagate_errors = stereo_settings().propagate_errors;
+  bool prev_dg_use_csm = stereo_settings().dg_use_csm;
+  Vector2 prev_horizontal_stddev = stereo_settings().horizontal_stddev;
+  stereo_settings().propagate_errors = true;
+  stereo_settings().dg_use_csm = true;
+  stereo_settings().horizontal_stddev = Vector2(0, 0);
+  
+  vw::CamPtr cam1 = vw::CamPtr(load_dg_camera_model_from_xml("dg_example1.xml"));
+  vw::CamPtr cam2 = vw::CamPtr(load_dg_camera_model_from_xml("dg_example2.xml"));
+  vw::cartography::Datum datum("WGS84");
+  
+  Vector2 m1(27728, 10702), m2(30090, 10366);
+  stereo::StereoModel sm(cam1.get(), cam2.get());
+  double error = 0.0;
+  Vector3 pos = sm(m1, m2, error);
+  double range = norm_2(pos - cam1->camera_center(m1));
+  
+  Vector2i size = dynamic_cast<DGCameraModel*>(cam1.get())->get_image_size();
+  std::vector<Vector2> pixels;
+  for (int k = 0; k < 10; k++)
+    pixels.push_back(m1 + Vector2(37.3 * k, -21.7 * k));
+  pixels.push_back(Vector2(size[0] - 1, 5000.5));
+  pixels.push_back(Vector2(size[0] - 3.5, size[1] - 1));
+  pixels.push_back(Vector2(0, 0));
+  
+  CovariancePropagator propagator(datum, cam1.get(), cam2.get());
+  for (size_t it = 0; it < pixels.size(); it++) {
+    Vector2 pix1 = pixels[it];
+    Vector3 point = cam1->camera_center(pix1) + range * cam1->pixel_to_vector(pix1);
+    Vector2 pix2 = cam2->point_to_pixel(point);
+    Vector3 tri = sm(pix1, pix2, error);
+    
+    Vector2 grid_stddev = propagator(tri, pix1, pix2);
+    Vector2 stddev = propagateCovariance(tri, datum, cam1.get(), cam2.get(), pix1, pix2);
+    EXPECT_GT(stddev[0], 0.0);
+    EXPECT_GT(stddev[1], 0.0);
+    EXPECT_NEAR(grid_stddev[0], stddev[0], 1e-3 * stddev[0]);
+    EXPECT_NEAR(grid_stddev[1], stddev[1], 1e-3 * stddev[1]);
+  }
+
+  stereo_settings().propagate_errors = prev_propagate_errors;
+  stereo_settings().dg_use_csm = prev_dg_use_csm;
+  stereo_settings().horizontal_stddev = prev_horizontal_stddev;
+  XMLPlatformUtils::Terminate();
+}
+
+TEST(UniformSampleTable, Interpolation) {
+
+  // Two components, a cubic and a line, stored one sample after another
+  int num = 10;
+  double t0 = 100.0, dt = 0.5;
+  std::vector<double> values;
+  for (int i = 0; i < num; i++) {
+    double t = t0 + i * dt;
+    values.push_back(t*t*t - 2*t + 1);
+    values.push_back(3*t - 5);
+  }
+  UniformSampleTable table(num, 2, &values[0], t0, dt);
+  EXPECT_EQ(table.num_samples(), num);
+  EXPECT_EQ(table.dim(), 2);
+
+  // Orders 4 and up reproduce the cubic, including near the ends,
+  // where the order is reduced, as long as it stays at least 4.
+  double out[2];
+  for (double t = t0 + dt; t <= t0 + (num - 2) * dt; t += 0.137) {
+    for (int order = 4; order <= 8; order += 2) {
+      table.lagrange(t, order, out);
+      EXPECT_NEAR(out[0], t*t*t - 2*t + 1, 1e-8);
+      EXPECT_NEAR(out[1], 3*t - 5, 1e-10);
+    }
+    table.linear(t, out);
+    EXPECT_NEAR(out[1], 3*t - 5, 1e-10);
+  }
+
+  // Samples are reproduced exactly
+  table.lagrange(t0 + 4 * dt, 8, out);
+  EXPECT_NEAR(out[0], values[8], 1e-10);
+  table.lagrange(t0 + (num - 1) * dt, 8, out);
+  EXPECT_NEAR(out[1], values[2*num - 1], 1e-10);
+
+  table.nearest(t0 + 2.4 * dt, out);
+  EXPECT_EQ(out[0], values[4]);
+  table.nearest(t0 - dt, out);
+  EXPECT_EQ(out[0], values[0]);
+
+  // Interpolating in place in the original samples gives the same result
+  double out2[2];
+  for (double t = t0; t <= t0 + (num - 1) * dt; t += 0.113) {
+    for (int order = 2; order <= 8; order += 2) {
+      table.lagrange(t, order, out);
+      uniformLagrange(num, 2, &values[0], t0, dt, t, order, out2);
+      EXPECT_NEAR(out[0], out2[0], 1e-10);
+      EXPECT_NEAR(out[1], out2[1], 1e-10);
+    }
+  }
+}
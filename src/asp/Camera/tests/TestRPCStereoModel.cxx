@@ -28,6 +28,7 @@
 #include <asp/Camera/RPC_XML.h>
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/RPCModel.h>
+#include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCStereoModel.h>
 #include <asp/Core/StereoSettings.h>
 #include <xercesc/util/PlatformUtils.hpp>
@@ -105,6 +106,61 @@ TEST(RPCModel, rpb) {
 #endif
 }
 
+TEST(RPCModelGen, FitRational) {
+
+  // A mildly non-linear RPC model
+  RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+  for (int i = 0; i < 20; i++) {
+    line_num[i] = 0.0; line_den[i] = 0.0; samp_num[i] = 0.0; samp_den[i] = 0.0;
+  }
+  samp_num[0] = 0.01; samp_num[1] = 0.9;  samp_num[2] = 0.05; samp_num[3] = 0.02;
+  samp_num[4] = 0.001; samp_num[7] = 0.002;
+  line_num[0] = -0.02; line_num[1] = 0.03; line_num[2] = 0.95; line_num[3] = 0.01;
+  line_num[5] = 0.001;
+  samp_den[0] = 1.0; samp_den[1] = 0.001; samp_den[3] = 0.002;
+  line_den[0] = 1.0; line_den[2] = 0.002;
+
+  // Sample it on a grid
+  const int n = 8;
+  Vector<double> normalized_llh(RPCModel::GEODETIC_COORD_SIZE*n*n*n);
+  Vector<double> normalized_pix(RPCModel::IMAGE_COORD_SIZE*n*n*n
+                                + RpcSolveLMA::NUM_PENALTY_TERMS);
+  normalized_pix.set_zero();
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      for (int k = 0; k < n; k++) {
+        Vector3 llh(-1.0 + 2.0*i/(n-1), -1.0 + 2.0*j/(n-1), -1.0 + 2.0*k/(n-1));
+        Vector2 pix = RPCModel::normalized_geodetic_to_normalized_pixel
+          (llh, line_num, line_den, samp_num, samp_den);
+        subvector(normalized_llh, RPCModel::GEODETIC_COORD_SIZE*count,
+                  RPCModel::GEODETIC_COORD_SIZE) = llh;
+        subvector(normalized_pix, RPCModel::IMAGE_COORD_SIZE*count,
+                  RPCModel::IMAGE_COORD_SIZE) = pix;
+        count++;
+      }
+    }
+  }
+
+  // Fit the model back, with no penalty, and check the reported error
+  RPCModel::CoeffVec out_line_num, out_line_den, out_samp_num, out_samp_den;
+  Vector2 uv_scale(1000, 1000);
+  double rms_error = gen_rpc(0.0, "", normalized_llh, normalized_pix,
+                             Vector3(1, 1, 1), Vector3(0, 0, 0), uv_scale, Vector2(0, 0),
+                             out_line_num, out_line_den, out_samp_num, out_samp_den);
+  EXPECT_LT(rms_error, 1e-4);
+
+  for (int c = 0; c < count; c++) {
+    Vector3 llh = subvector(normalized_llh, RPCModel::GEODETIC_COORD_SIZE*c,
+                            RPCModel::GEODETIC_COORD_SIZE);
+    Vector2 pix = RPCModel::normalized_geodetic_to_normalized_pixel
+      (llh, out_line_num, out_line_den, out_samp_num, out_samp_den);
+    Vector2 ref = subvector(normalized_pix, RPCModel::IMAGE_COORD_SIZE*c,
+                            RPCModel::IMAGE_COORD_SIZE);
+    EXPECT_VECTOR_NEAR(pix, ref, 1e-7);
+  }
+}
+
 TEST(RPCXML, ReadRPC) {
   xercesc::XMLPlatformUtils::Initialize();
 
@@ -180,6 +236,41 @@ TEST( StereoSessionRPC, InstantiateTest ) {
   Vector2 pix_out = model.geodetic_to_pixel(Vector3(lonlat[0], lonlat[1], h));
   EXPECT_LT( norm_2(pix - pix_out), 1.0e-9 );
 
+  // The same for pixels across the image, each starting from the
+  // approximate inverse
+  for (int i = 0; i < 5; i++) {
+    pix = Vector2(5000.0*i, 3000.0*i);
+    lonlat  = model.image_to_ground(pix, h);
+    pix_out = model.geodetic_to_pixel(Vector3(lonlat[0], lonlat[1], h));
+    EXPECT_LT( norm_2(pix - pix_out), 1.0e-9 );
+  }
+
+  // The batch evaluation must agree with the one point at a time logic
+  std::vector<Vector3> points;
+  for (int i = 0; i < 5; i++) {
+    Vector3 llh = location + Vector3(0.01*i, -0.01*i, 50.0*i);
+    points.push_back(model.datum().geodetic_to_cartesian(llh));
+  }
+  std::vector<Vector2> pixels;
+  model.points_to_pixels(points, pixels);
+  ASSERT_EQ(points.size(), pixels.size());
+  for (size_t i = 0; i < points.size(); i++)
+    EXPECT_VECTOR_NEAR(model.point_to_pixel(points[i]), pixels[i], 1e-8);
+
+  // Same for the Jacobian, in normalized coordinates
+  Vector3 nllh = elem_quot(location - model.lonlatheight_offset(),
+                           model.lonlatheight_scale());
+  double samp = 0, line = 0, jac[6];
+  model.normalized_geodetic_to_normalized_pixel_batch(1, &nllh[0], &nllh[1], &nllh[2],
+                                                      &samp, &line, jac);
+  EXPECT_VECTOR_NEAR(model.normalized_geodetic_to_normalized_pixel(nllh),
+                     Vector2(samp, line), 1e-12);
+  Matrix<double, 2, 3> Jb;
+  for (int r = 0; r < 2; r++)
+    for (int c = 0; c < 3; c++)
+      Jb(r, c) = jac[3*r + c] * model.xy_scale()[r] / model.lonlatheight_scale()[c];
+  EXPECT_LT(max(abs(Jn-Jb))/max(abs(Jn)), 1e-5);
+  
   // Verify that nothing segfaults or has a run time error.
   EXPECT_NO_THROW( model.calculate_terms( location ) );
   EXPECT_NO_THROW( model.terms_Jacobian3( location ) );
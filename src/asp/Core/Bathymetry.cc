@@ -418,6 +418,107 @@ namespace asp {
     return true;
   }
   
+  // Recompute the Jacobians of the water surface frame when the ray
+  // meets the water farther than this from where they were computed.
+  // This keeps the error in the ray directions from using the
+  // Jacobians at a nearby point at a few parts per million.
+  const double WATER_FRAME_RADIUS = 50.0; // meters
+
+  // Compute the Jacobian of the projection at the given point, with
+  // centered differences, and its inverse.
+  void update_water_frame(vw::cartography::GeoReference const& projection,
+                          Vector3 const& xyz, WaterSurfaceFrame & frame) {
+    double h = 1.0; // meters
+    for (int col = 0; col < 3; col++) {
+      Vector3 delta;
+      delta[col] = h;
+      Vector3 diff = (proj_point(projection, xyz + delta) -
+                      proj_point(projection, xyz - delta)) / (2.0 * h);
+      for (int row = 0; row < 3; row++)
+        frame.proj_jac(row, col) = diff[row];
+    }
+    frame.unproj_jac = inverse(frame.proj_jac);
+    frame.ecef_ctr = xyz;
+    frame.valid = true;
+  }
+  
+  // See the .h file for more info
+  bool snells_law_curved_local(Vector3 const& in_xyz, Vector3 const& in_dir,
+                               std::vector<double> const& plane,
+                               vw::cartography::GeoReference const& water_surface_projection,
+                               double refraction_index, WaterSurfaceFrame & frame,
+                               Vector3 & out_xyz, Vector3 & out_dir) {
+
+    // Start from where the previous ray met the water. For the first
+    // ray, intersect with the mean water surface, as in snells_law_curved().
+    double t = frame.ray_param;
+    if (t <= 0.0) {
+      double mean_ht = -plane[3] / plane[2];
+      double major_radius = water_surface_projection.datum().semi_major_axis() + mean_ht;
+      double minor_radius = water_surface_projection.datum().semi_minor_axis() + mean_ht;
+      Vector3 guess_xyz = vw::cartography::datum_intersection(major_radius, minor_radius,
+                                                              in_xyz, in_dir);
+      if (guess_xyz == Vector3())
+        return false;
+      t = dot_prod(guess_xyz - in_xyz, in_dir);
+    }
+
+    Vector3 xyz = in_xyz + t * in_dir;
+    if (!frame.valid || norm_2(xyz - frame.ecef_ctr) > WATER_FRAME_RADIUS)
+      update_water_frame(water_surface_projection, xyz, frame);
+
+    // Newton's method for the signed distance to the plane, in
+    // projected coordinates, as a function of the position on the
+    // ray. Its derivative is found with the Jacobian.
+    Vector3 normal(plane[0], plane[1], plane[2]);
+    double dn = dot_prod(normal, frame.proj_jac * in_dir);
+    if (dn >= 0.0)
+      return false; // the ray must descend to the water
+    
+    Vector3 proj_xyz;
+    bool converged = false;
+    int max_iter = 10;
+    double tol = 1e-6; // meters
+    for (int iter = 0; iter < max_iter; iter++) {
+      proj_xyz = proj_point(water_surface_projection, xyz);
+      double step = signed_dist_to_plane(plane, proj_xyz) / dn;
+      t -= step;
+      xyz = in_xyz + t * in_dir;
+      if (std::abs(step) < tol) {
+        converged = true;
+        break;
+      }
+    }
+
+    // If this failed, use the slower approach
+    if (!converged) {
+      frame.ray_param = -1.0;
+      return snells_law_curved(in_xyz, in_dir, plane, water_surface_projection,
+                               refraction_index, out_xyz, out_dir);
+    }
+
+    // The Jacobians must be accurate where the ray meets the water
+    if (norm_2(xyz - frame.ecef_ctr) > WATER_FRAME_RADIUS)
+      update_water_frame(water_surface_projection, xyz, frame);
+    
+    // Snell's law in projected coordinates. Only the outgoing
+    // direction is used, and that does not depend on proj_xyz.
+    Vector3 in_proj_dir = frame.proj_jac * in_dir;
+    in_proj_dir /= norm_2(in_proj_dir);
+    Vector3 out_proj_xyz, out_proj_dir;
+    if (!snells_law(proj_xyz, in_proj_dir, plane, refraction_index,
+                    out_proj_xyz, out_proj_dir))
+      return false;
+
+    // Back to ECEF. The intersection point is already known in ECEF.
+    out_xyz = xyz;
+    out_dir = frame.unproj_jac * out_proj_dir;
+    out_dir /= norm_2(out_dir);
+
+    frame.ray_param = t;
+    return true;
+  }
+  
   // Settings used for bathymetry correction
   void BathyStereoModel::set_bathy(double refraction_index,
                                    std::vector<BathyPlaneSettings> const& bathy_set) {
@@ -575,11 +676,11 @@ namespace asp {
           
           for (size_t it = 0; it < 2; it++) {
             // Bend each ray at the surface according to Snell's law.
-            bool ans = snells_law_curved(camCtrs[it], camDirs[it],
-                                         m_bathy_set[it].bathy_plane,  
-                                         m_bathy_set[it].water_surface_projection,
-                                         m_refraction_index,
-                                         waterCtrs[it], waterDirs[it]);
+            bool ans = snells_law_curved_local(camCtrs[it], camDirs[it],
+                                               m_bathy_set[it].bathy_plane,  
+                                               m_bathy_set[it].water_surface_projection,
+                                               m_refraction_index, m_water_frames[it],
+                                               waterCtrs[it], waterDirs[it]);
             if (!ans) {
               did_bathy = false;
               return uncorr_tri_pt;
@@ -609,11 +710,11 @@ namespace asp {
       } else {
         for (size_t it = 0; it < 2; it++) {
           // Bend each ray at the surface according to Snell's law.
-          bool ans = snells_law_curved(camCtrs[it], camDirs[it],
-                                       m_bathy_set[it].bathy_plane,  
-                                       m_bathy_set[it].water_surface_projection,
-                                       m_refraction_index,
-                                       waterCtrs[it], waterDirs[it]);
+          bool ans = snells_law_curved_local(camCtrs[it], camDirs[it],
+                                             m_bathy_set[it].bathy_plane,  
+                                             m_bathy_set[it].water_surface_projection,
+                                             m_refraction_index, m_water_frames[it],
+                                             waterCtrs[it], waterDirs[it]);
           if (!ans)
             return uncorr_tri_pt;
         }
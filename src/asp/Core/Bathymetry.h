@@ -23,6 +23,7 @@
 #define __ASP_CORE_BATHYMETRY_H__
 
 #include <vw/Math/Vector.h>
+#include <vw/Math/Matrix.h>
 #include <vw/Stereo/StereoModel.h>
 #include <vw/Cartography/GeoReference.h>
 
@@ -52,6 +53,45 @@ namespace asp {
                   std::vector<double> const& plane, double refraction_index,
                            vw::Vector3 & out_xyz, vw::Vector3 & out_dir);
   
+  // As snells_law(), but for a water surface which is a plane only in
+  // a local stereographic projection. See the .cc file for details.
+  bool snells_law_curved(vw::Vector3 const& in_xyz, vw::Vector3 const& in_dir,
+                         std::vector<double> const& plane,
+                         vw::cartography::GeoReference const& water_surface_projection,
+                         double refraction_index, 
+                         vw::Vector3 & out_xyz, vw::Vector3 & out_dir);
+  
+  // A local linear approximation of the map from ECEF to the
+  // projected coordinates in which a curved water surface is a plane,
+  // and where the last ray met that surface. Rays for nearby pixels
+  // meet the water at nearby points, so this is reused from one
+  // pixel to the next.
+  struct WaterSurfaceFrame {
+    bool        valid;      // if the Jacobians below were computed
+    vw::Vector3 ecef_ctr;   // where the Jacobians were computed
+    vw::Matrix3x3 proj_jac; // d(projected)/d(ECEF)
+    vw::Matrix3x3 unproj_jac; // its inverse
+    double      ray_param;  // position along the last ray where it met the water
+
+    WaterSurfaceFrame(): valid(false), ray_param(-1.0) {}
+  };
+
+  // As snells_law(), but for a water surface which is a plane only in
+  // a local stereographic projection. The point where the ray meets
+  // the surface is found with Newton's method, starting from where
+  // the previous ray met the surface, per 'frame'. The ray directions
+  // are converted to and from projected coordinates with the Jacobians
+  // in 'frame', which get recomputed when the ray meets the water
+  // too far from where they were computed.
+  bool snells_law_curved_local(vw::Vector3 const& in_xyz, vw::Vector3 const& in_dir,
+                               std::vector<double> const& plane,
+                               vw::cartography::GeoReference const& water_surface_projection,
+                               double refraction_index, WaterSurfaceFrame & frame,
+                               vw::Vector3 & out_xyz, vw::Vector3 & out_dir);
+  
+  // This is not thread-safe, as it caches the water surface frames
+  // per camera. Use a separate copy per thread, as done in stereo_tri,
+  // which makes a copy for each tile.
   class BathyStereoModel: public vw::stereo::StereoModel {
   public:
     
@@ -99,6 +139,7 @@ namespace asp {
     bool m_single_bathy_plane;                   // if the left and right images use same plane 
     double m_refraction_index;                   // Water refraction index
     std::vector<BathyPlaneSettings> m_bathy_set; // Bathy plane settings
+    mutable WaterSurfaceFrame m_water_frames[2]; // Per camera, for a curved water surface
   };
   
 } // end namespace asp
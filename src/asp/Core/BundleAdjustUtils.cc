@@ -29,6 +29,8 @@
 #include <asp/Core/BundleAdjustUtils.h>
 
 #include <string>
+#include <map>
+#include <limits>
 
 using namespace vw;
 using namespace vw::camera;
@@ -680,3 +682,121 @@ std::string asp::csmStateFile(std::string const& adjustFile) {
 }
 
   
+
+// Partition cameras into spatially compact groups (submaps) by k-means
+// clustering of the camera centers. Use farthest-point seeding, so that
+// the result does not depend on a random number generator.
+int asp::partition_cameras_spatially(std::vector<vw::Vector3> const& camera_centers,
+                                     int submap_size,
+                                     std::vector<int> & submap_ids) {
+
+  int num_cams = camera_centers.size();
+  submap_ids.assign(num_cams, 0);
+  if (num_cams == 0 || submap_size <= 0)
+    return 0;
+
+  int num_submaps = (num_cams + submap_size - 1) / submap_size; // round up
+  if (num_submaps <= 1)
+    return 1;
+  
+  // Seed the first center with the first camera, and each next one
+  // with the camera farthest from all centers chosen so far.
+  std::vector<vw::Vector3> centers;
+  centers.push_back(camera_centers[0]);
+  std::vector<double> min_dist(num_cams, std::numeric_limits<double>::max());
+  while ((int)centers.size() < num_submaps) {
+    int best_cam = 0;
+    double best_dist = -1.0;
+    for (int icam = 0; icam < num_cams; icam++) {
+      min_dist[icam] = std::min(min_dist[icam], norm_2(camera_centers[icam] - centers.back()));
+      if (min_dist[icam] > best_dist) {
+        best_dist = min_dist[icam];
+        best_cam = icam;
+      }
+    }
+    centers.push_back(camera_centers[best_cam]);
+  }
+
+  // Lloyd iterations
+  int max_iter = 50;
+  for (int iter = 0; iter < max_iter; iter++) {
+
+    bool changed = (iter == 0);
+    for (int icam = 0; icam < num_cams; icam++) {
+      int best_submap = 0;
+      double best_dist = std::numeric_limits<double>::max();
+      for (int isub = 0; isub < num_submaps; isub++) {
+        double dist = norm_2(camera_centers[icam] - centers[isub]);
+        if (dist < best_dist) {
+          best_dist = dist;
+          best_submap = isub;
+        }
+      }
+      if (submap_ids[icam] != best_submap) {
+        submap_ids[icam] = best_submap;
+        changed = true;
+      }
+    }
+    
+    if (!changed)
+      break;
+
+    // Recompute the centers. Leave in place any that lost all cameras.
+    std::vector<vw::Vector3> sums(num_submaps, vw::Vector3(0, 0, 0));
+    std::vector<int> counts(num_submaps, 0);
+    for (int icam = 0; icam < num_cams; icam++) {
+      sums[submap_ids[icam]] += camera_centers[icam];
+      counts[submap_ids[icam]]++;
+    }
+    for (int isub = 0; isub < num_submaps; isub++) {
+      if (counts[isub] > 0)
+        centers[isub] = sums[isub] / double(counts[isub]);
+    }
+  }
+
+  // Renumber the submaps so that there are no empty ones
+  std::map<int, int> renumber;
+  for (int icam = 0; icam < num_cams; icam++) {
+    if (renumber.find(submap_ids[icam]) == renumber.end()) {
+      int new_id = renumber.size();
+      renumber[submap_ids[icam]] = new_id;
+    }
+    submap_ids[icam] = renumber[submap_ids[icam]];
+  }
+  
+  return renumber.size();
+}
+
+// Find the points seen in more than one submap, and the cameras seeing them
+void asp::find_submap_separators(std::vector<std::vector<int>> const& cam_points,
+                                 std::vector<int> const& submap_ids,
+                                 int num_points,
+                                 std::vector<bool> & sep_points,
+                                 std::set<int> & sep_cams) {
+
+  int num_cams = cam_points.size();
+  if ((int)submap_ids.size() != num_cams)
+    vw::vw_throw(vw::ArgumentErr() << "Expecting as many submap indices as cameras.\n");
+
+  std::vector<int> point_submap(num_points, -1);
+  sep_points.assign(num_points, false);
+  for (int icam = 0; icam < num_cams; icam++) {
+    for (size_t it = 0; it < cam_points[icam].size(); it++) {
+      int ipt = cam_points[icam][it];
+      if (point_submap[ipt] < 0)
+        point_submap[ipt] = submap_ids[icam];
+      else if (point_submap[ipt] != submap_ids[icam])
+        sep_points[ipt] = true;
+    }
+  }
+
+  sep_cams.clear();
+  for (int icam = 0; icam < num_cams; icam++) {
+    for (size_t it = 0; it < cam_points[icam].size(); it++) {
+      if (sep_points[cam_points[icam][it]]) {
+        sep_cams.insert(icam);
+        break;
+      }
+    }
+  }
+}
@@ -189,6 +189,23 @@ namespace asp{
   
   // Manufacture a CSM state file from an adjust file
   std::string csmStateFile(std::string const& adjustFile);
+
+  // Partition cameras into spatially compact groups (submaps) of
+  // roughly submap_size cameras each, by k-means clustering of the
+  // camera centers. The initialization is deterministic. Returns the
+  // number of submaps. Each camera gets a submap index in submap_ids.
+  int partition_cameras_spatially(std::vector<vw::Vector3> const& camera_centers,
+                                  int submap_size,
+                                  std::vector<int> & submap_ids);
+
+  // Given the points seen by each camera and the submap of each camera,
+  // flag the points seen in more than one submap (separator points), and
+  // find the cameras seeing such points (separator cameras).
+  void find_submap_separators(std::vector<std::vector<int>> const& cam_points,
+                              std::vector<int> const& submap_ids,
+                              int num_points,
+                              std::vector<bool> & sep_points,
+                              std::set<int> & sep_cams);
 }
 
 #endif // __BUNDLE_ADJUST_UTILS_H__
@@ -337,6 +337,13 @@ double asp::get_rounding_error(vw::Vector3 const& shift, double rounding_error){
     return rounding_error;
 }
 
+vw::Vector2 asp::get_compact_cloud_quanta(vw::Vector3 const& shift, double rounding_error) {
+  double user_quantum  = get_rounding_error(shift, rounding_error);
+  double point_quantum = std::max(user_quantum, get_rounding_error(shift, 0.0));
+  double error_quantum = std::max(user_quantum, point_quantum / 1024.0);
+  return vw::Vector2(point_quantum, error_quantum);
+}
+
 // Run a system command and append the output to a given file
 void asp::run_cmd_app_to_file(std::string cmd, std::string file){
   std::string full_cmd;
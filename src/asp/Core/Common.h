@@ -48,6 +48,7 @@
 
 #include <map>
 #include <string>
+#include <limits>
 
 namespace vw {
   struct GdalWriteOptions;
@@ -153,6 +154,14 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String we use in point cloud files saved in the compact format to store
+  /// the quantum of the point coordinates and of the error channels.
+  const std::string ASP_POINT_QUANTUM_TAG_STR = "POINT_QUANTUM";
+
+  /// Invalid points in a compact point cloud have all channels set to this
+  /// value, which is also the no-data value of such a file.
+  const vw::int32 ASP_COMPACT_CLOUD_NODATA = std::numeric_limits<vw::int32>::min();
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -200,6 +209,56 @@ namespace asp {
   }
 
 
+  /// Encode a point cloud pixel as integers, for the compact point cloud
+  /// format. The first 3 components become the number of point quanta
+  /// in their offset from the shift, and the remaining ones (triangulation
+  /// error and stddev) the number of error quanta. Invalid points, which
+  /// are (0, 0, 0), and points too far from the shift, are set to no-data.
+  template <class VecT>
+  struct QuantizePoint:
+    public vw::ReturnFixedType<vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value>> {
+    typedef vw::Vector<vw::int32, vw::math::VectorSize<VecT>::value> OutT;
+    vw::Vector3 m_shift;
+    vw::Vector2 m_quanta;
+    QuantizePoint(vw::Vector3 const& shift, vw::Vector2 const& quanta):
+      m_shift(shift), m_quanta(quanta) {
+      VW_ASSERT(m_quanta[0] > 0.0 && m_quanta[1] > 0.0,
+                vw::ArgumentErr() << "The point cloud quanta must be positive.");
+    }
+    OutT operator() (VecT const& pt) const {
+      OutT out;
+      for (size_t it = 0; it < out.size(); it++)
+        out[it] = ASP_COMPACT_CLOUD_NODATA;
+      if (pt[0] == 0 && pt[1] == 0 && pt[2] == 0)
+        return out;
+      
+      const double max_val = std::numeric_limits<vw::int32>::max();
+      for (size_t it = 0; it < 3; it++) {
+        double val = round((pt[it] - m_shift[it]) / m_quanta[0]);
+        if (!(std::abs(val) < max_val)) { // this also catches NaN
+          for (size_t jt = 0; jt < out.size(); jt++)
+            out[jt] = ASP_COMPACT_CLOUD_NODATA;
+          return out;
+        }
+        out[it] = vw::int32(val);
+      }
+      for (size_t it = 3; it < out.size(); it++) {
+        double val = round(pt[it] / m_quanta[1]);
+        if (val != val)
+          val = max_val; // NaN error, make it large
+        out[it] = vw::int32(std::max(-max_val, std::min(max_val, val)));
+      }
+      return out;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizePoint<typename ImageT::pixel_type> >
+  inline quantize_point_cloud(vw::ImageViewBase<ImageT> const& image,
+                              vw::Vector3 const& shift, vw::Vector2 const& quanta) {
+    return vw::UnaryPerPixelView<ImageT, QuantizePoint<typename ImageT::pixel_type> >
+      (image.impl(), QuantizePoint<typename ImageT::pixel_type>(shift, quanta));
+  }
+
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
   const double APPROX_ONE_MM = 1.0/1024.0;
@@ -213,6 +272,44 @@ namespace asp {
   /// inverse power of 2, 1/2^10 for Earth and proportionally less for smaller bodies.
   double get_rounding_error(vw::Vector3 const& shift, double rounding_error);
 
+  /// Quanta of the point coordinates and of the error channels in a compact
+  /// point cloud. The point quantum is given by get_rounding_error(), but it is
+  /// never finer than the default, so that points within 2000 km of the
+  /// shift fit in 32-bit integers on Earth. The error quantum is also given by
+  /// get_rounding_error(), as for the float format, but it is never finer than
+  /// 1/1024 of the point quantum, so errors up to 2 km fit.
+  vw::Vector2 get_compact_cloud_quanta(vw::Vector3 const& shift, double rounding_error);
+
+  /// Block write a point cloud in the compact format. The points are saved
+  /// as 32-bit integers, in multiples of a quantum, relative to the
+  /// shift. See QuantizePoint.
+  template <class ImageT>
+  void block_write_compact_gdal_image(const std::string &filename,
+                                      vw::Vector3 const& shift,
+                                      double rounding_error,
+                                      vw::ImageViewBase<ImageT> const& image,
+                                      bool has_georef,
+                                      vw::cartography::GeoReference const& georef,
+                                      vw::GdalWriteOptions const& opt,
+                                      vw::ProgressCallback const& progress_callback
+                                      = vw::ProgressCallback::dummy_instance(),
+                                      std::map<std::string, std::string> const& keywords =
+                                      std::map<std::string, std::string>() );
+
+  /// Single-threaded write of a point cloud in the compact format.
+  template <class ImageT>
+  void write_compact_gdal_image(const std::string &filename,
+                                vw::Vector3 const& shift,
+                                double rounding_error,
+                                vw::ImageViewBase<ImageT> const& image,
+                                bool has_georef,
+                                vw::cartography::GeoReference const& georef,
+                                vw::GdalWriteOptions const& opt,
+                                vw::ProgressCallback const& progress_callback
+                                = vw::ProgressCallback::dummy_instance(),
+                                std::map<std::string, std::string> const& keywords =
+                                std::map<std::string, std::string>() );
+
   /// Block write image while subtracting a given value from all pixels
   /// and casting the result to float, while rounding to nearest mm.
   template <class ImageT>
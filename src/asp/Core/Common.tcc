@@ -92,6 +92,68 @@ namespace asp {
     }
   }
 
+  // Prepare the options and keywords for writing a compact point cloud.
+  // The horizontal differencing predictor makes integer data compress well.
+  inline void compact_cloud_write_setup(vw::Vector3 const& shift,
+                                        vw::Vector2 const& quanta,
+                                        vw::GdalWriteOptions const& opt,
+                                        std::map<std::string, std::string> const& keywords,
+                                        vw::GdalWriteOptions & local_opt,
+                                        std::map<std::string, std::string> & local_keywords) {
+    local_opt = opt;
+    local_opt.gdal_options["PREDICTOR"] = "2";
+    local_keywords = keywords;
+    local_keywords[ASP_POINT_OFFSET_TAG_STR]  = vw::vec_to_str(shift);
+    local_keywords[ASP_POINT_QUANTUM_TAG_STR] = vw::vec_to_str(quanta);
+  }
+  
+  // Block write a point cloud as 32-bit integers, in multiples of a
+  // quantum, relative to the shift.
+  template <class ImageT>
+  void block_write_compact_gdal_image(const std::string &filename,
+                                      vw::Vector3 const& shift,
+                                      double rounding_error,
+                                      vw::ImageViewBase<ImageT> const& image,
+                                      bool has_georef,
+                                      vw::cartography::GeoReference const& georef,
+                                      vw::GdalWriteOptions const& opt,
+                                      vw::ProgressCallback const& progress_callback,
+                                      std::map<std::string, std::string> const& keywords) {
+
+    vw::Vector2 quanta = get_compact_cloud_quanta(shift, rounding_error);
+    vw::GdalWriteOptions local_opt;
+    std::map<std::string, std::string> local_keywords;
+    compact_cloud_write_setup(shift, quanta, opt, keywords, local_opt, local_keywords);
+
+    bool has_nodata = true;
+    block_write_gdal_image(filename, quantize_point_cloud(image.impl(), shift, quanta),
+                           has_georef, georef, has_nodata, ASP_COMPACT_CLOUD_NODATA,
+                           local_opt, progress_callback, local_keywords);
+  }
+
+  // Single-threaded write of a point cloud as 32-bit integers.
+  template <class ImageT>
+  void write_compact_gdal_image(const std::string &filename,
+                                vw::Vector3 const& shift,
+                                double rounding_error,
+                                vw::ImageViewBase<ImageT> const& image,
+                                bool has_georef,
+                                vw::cartography::GeoReference const& georef,
+                                vw::GdalWriteOptions const& opt,
+                                vw::ProgressCallback const& progress_callback,
+                                std::map<std::string, std::string> const& keywords) {
+
+    vw::Vector2 quanta = get_compact_cloud_quanta(shift, rounding_error);
+    vw::GdalWriteOptions local_opt;
+    std::map<std::string, std::string> local_keywords;
+    compact_cloud_write_setup(shift, quanta, opt, keywords, local_opt, local_keywords);
+
+    bool has_nodata = true;
+    write_gdal_image(filename, quantize_point_cloud(image.impl(), shift, quanta),
+                     has_georef, georef, has_nodata, ASP_COMPACT_CLOUD_NODATA,
+                     local_opt, progress_callback, local_keywords);
+  }
+
   // Often times, we'd like to save an image to disk by using big
   // blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
@@ -88,6 +88,67 @@ void random_pc_subsample(std::int64_t m, DoubleMatrix& points){
   points.conservativeResize(Eigen::NoChange, m);
 }
 
+// Load a CSV file whose format was set by the user. The file is parsed in
+// parallel into columns, and the picked points are converted in parallel.
+void load_csv_columns(std::string const& file_name, std::int64_t num_points_to_load,
+                      double load_ratio, vw::BBox2 const& lonlat_box,
+                      bool calc_shift, vw::Vector3 & shift,
+                      vw::cartography::GeoReference const& geo, CsvConv const& csv_conv,
+                      std::vector<double> & longitudes, DoubleMatrix & data) {
+
+  CsvConv::CsvColumns columns;
+  csv_conv.read_csv_file(file_name, columns);
+
+  // Randomly pick points with probability load_ratio
+  CsvConv::CsvColumns picked;
+  for (size_t it = 0; it < columns.size(); it++) {
+    double r = (double)std::rand()/(double)RAND_MAX;
+    if (r <= load_ratio)
+      picked.push_back(columns.record(it));
+  }
+  columns = CsvConv::CsvColumns(); // release the memory
+
+  std::vector<vw::Vector3> xyz;
+  csv_conv.csv_to_cartesian(picked, geo, xyz);
+
+  std::int64_t points_count = 0;
+  for (size_t it = 0; it < xyz.size(); it++) {
+
+    if (points_count >= num_points_to_load)
+      break;
+
+    // Decide if the point is in the box. Also save for the future
+    // the longitude of the point, we'll use it to compute the mean longitude.
+    vw::Vector2 lonlat = csv_conv.csv_to_lonlat(picked.record(it), geo);
+    double lon = lonlat[0], lat = lonlat[1];
+
+    // Skip points outside the given box
+    if (!lonlat_box.empty() && !lonlat_box.contains(lonlat)
+                            && !lonlat_box.contains(lonlat+vw::Vector2(360,0))
+                            && !lonlat_box.contains(lonlat-vw::Vector2(360,0))) {
+      continue;
+    }
+
+    if (calc_shift && points_count == 0)
+      shift = xyz[it];
+
+    for (std::int64_t row = 0; row < DIM; row++)
+      data(row, points_count) = xyz[it][row] - shift[row];
+    data(DIM, points_count) = 1;
+
+    points_count++;
+    longitudes.push_back(lon);
+
+    if (std::abs(lat) > 90.0)
+      vw_throw(vw::ArgumentErr() << "Invalid latitude value: "
+               << lat << " in " << file_name << "\n");
+    if (lon < -360.0 || lon > 2*360.0)
+      vw_throw(vw::ArgumentErr() << "Invalid longitude value: "
+               << lon << " in " << file_name << "\n");
+  }
+  data.conservativeResize(Eigen::NoChange, points_count);
+}
+
 std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_to_load,
                           vw::BBox2 const& lonlat_box,
                           bool calc_shift, vw::Vector3 & shift,
@@ -116,6 +177,17 @@ std::int64_t load_csv_aux(std::string const& file_name, std::int64_t num_points_
 
   data.conservativeResize(DIM+1, std::min(num_points_to_load, num_total_points));
 
+  if (csv_conv.is_configured()) {
+    std::vector<double> longitudes;
+    load_csv_columns(file_name, num_points_to_load, load_ratio, lonlat_box,
+                     calc_shift, shift, geo, csv_conv, longitudes, data);
+    median_longitude = 0.0;
+    std::sort(longitudes.begin(), longitudes.end());
+    if (!longitudes.empty())
+      median_longitude = longitudes[longitudes.size()/2];
+    return num_total_points;
+  }
+
   // Peek at the first valid line and see how many elements it has
   std::string line;
   while ( getline(file, line, '\n') ) {
@@ -18,10 +18,12 @@
 #ifndef __CORE_FILE_UTILS_H__
 #define __CORE_FILE_UTILS_H__
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <vw/Math/Vector.h>
 
@@ -117,6 +119,41 @@ namespace asp {
     read_matrix_from_stream(str, ifs, mat);
   }
 
+  // Write num_rows rows of text to a stream. Blocks of rows_per_block
+  // rows are formatted in parallel, then written out in order, so
+  // the output is the same as when done serially. At most num_threads
+  // blocks are kept in memory at any time. The functor must have the
+  // signature format_row(size_t row, std::ostream & os), and must be
+  // safe to call from multiple threads.
+  template<class FormatRow>
+  void write_rows_in_parallel(std::ostream & os, size_t num_rows, size_t rows_per_block,
+                              int num_threads, FormatRow format_row) {
+
+    rows_per_block = std::max(rows_per_block, size_t(1));
+    num_threads = std::max(num_threads, 1);
+    std::streamsize precision = os.precision();
+    std::vector<std::string> blocks(num_threads);
+
+    for (size_t beg = 0; beg < num_rows; beg += rows_per_block * num_threads) {
+      
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+      for (int block_it = 0; block_it < num_threads; block_it++) {
+        size_t block_beg = beg + block_it * rows_per_block;
+        size_t block_end = std::min(block_beg + rows_per_block, num_rows);
+        std::ostringstream oss;
+        oss.precision(precision);
+        for (size_t row = block_beg; row < block_end; row++)
+          format_row(row, oss);
+        blocks[block_it] = oss.str();
+      }
+      
+      for (int block_it = 0; block_it < num_threads; block_it++) {
+        os << blocks[block_it];
+        blocks[block_it].clear();
+      }
+    }
+  }
+
 } //end namespace asp
 
 #endif//__CORE_FILE_UTILS_H__
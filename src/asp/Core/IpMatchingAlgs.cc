@@ -20,6 +20,10 @@
 #include <vw/InterestPoint/Matcher.h>
 #include <vw/Camera/CameraModel.h>
 #include <boost/filesystem.hpp>
+
+#include <limits>
+#include <algorithm>
+#include <cmath>
 using namespace vw;
 namespace fs = boost::filesystem;
 
@@ -185,26 +189,29 @@ void convergence_angles(vw::camera::CameraModel const * left_cam,
                         vw::camera::CameraModel const * right_cam,
                         std::vector<vw::ip::InterestPoint> const& left_ip,
                         std::vector<vw::ip::InterestPoint> const& right_ip,
-                        std::vector<double> & sorted_angles) {
+                        std::vector<double> & sorted_angles,
+                        int num_threads) {
 
+  // Each angle goes in its own slot, so the result does not depend on
+  // the number of threads. Failed projections are marked with NaN.
   int num_ip = left_ip.size();
-  sorted_angles.clear();
+  std::vector<double> angles(num_ip, std::numeric_limits<double>::quiet_NaN());
+#pragma omp parallel for num_threads(std::max(num_threads, 1)) schedule(static)
   for (int ip_it = 0; ip_it < num_ip; ip_it++) {
     Vector2 lip(left_ip[ip_it].x,  left_ip[ip_it].y);
     Vector2 rip(right_ip[ip_it].x, right_ip[ip_it].y);
-    double angle = 0.0;
     try {
-      angle = (180.0 / M_PI) * acos(dot_prod(left_cam->pixel_to_vector(lip),
-                                             right_cam->pixel_to_vector(rip)));
+      angles[ip_it] = (180.0 / M_PI) * acos(dot_prod(left_cam->pixel_to_vector(lip),
+                                                     right_cam->pixel_to_vector(rip)));
     } catch(...) {
       // Projection into camera may not always succeed
-      continue;
     }
-      
-    if (std::isnan(angle)) 
-      continue;
-      
-    sorted_angles.push_back(angle);
+  }
+
+  sorted_angles.clear();
+  for (int ip_it = 0; ip_it < num_ip; ip_it++) {
+    if (!std::isnan(angles[ip_it]))
+      sorted_angles.push_back(angles[ip_it]);
   }
   
   std::sort(sorted_angles.begin(), sorted_angles.end());
@@ -81,12 +81,14 @@ std::string match_filename(std::string const& clean_match_files_prefix,
 std::string unwarped_disp_file(std::string const& prefix, std::string const& left_image,
                                std::string const& right_image);
 
-// Find and sort the convergence angles for given cameras and interest points
+// Find and sort the convergence angles for given cameras and interest
+// points. Use the given number of threads, if the cameras are thread-safe.
 void convergence_angles(vw::camera::CameraModel const * left_cam,
                         vw::camera::CameraModel const * right_cam,
                         std::vector<vw::ip::InterestPoint> const& left_ip,
                         std::vector<vw::ip::InterestPoint> const& right_ip,
-                        std::vector<double> & sorted_angles);
+                        std::vector<double> & sorted_angles,
+                        int num_threads = 1);
 
 // Find all match files stored on disk having this prefix
 void listExistingMatchFiles(std::string const& prefix,
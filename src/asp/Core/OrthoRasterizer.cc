@@ -28,6 +28,7 @@
 #include <vw/Image/Algorithms.h>
 #include <vw/Image/BlockRasterize.h>
 #include <vw/Core/ThreadPool.h>
+#include <vw/Core/Settings.h>
 #include <vw/Math/Vector.h>
 #include <vw/Math/BBox.h>
 #include <vw/Math/Statistics.h>
@@ -40,6 +41,8 @@
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
 #include <valarray>
+#include <algorithm>
+#include <cmath>
 
 namespace asp{
 
@@ -252,11 +255,14 @@ namespace asp{
               image.rows() == error_copy.rows(),
               ArgumentErr() << "Size mis-match in remove_outliers().");
 
-    for (int col = 0; col < image.cols(); col++){
-      for (int row = 0; row < image.rows(); row++){
-        if ( error_copy(col, row) > error_cutoff ){
-          image(col, row).z() = nan;
-        }
+    // Visit the pixels in memory order
+    int nc = image.cols(), nr = image.rows(); // shorten
+    for (int row = 0; row < nr; row++){
+      Vector3     * pt  = &image(0, row);
+      float const * err = &error_copy(0, row);
+      for (int col = 0; col < nc; col++){
+        if (err[col] > error_cutoff)
+          pt[col].z() = nan;
       }
     }
 
@@ -268,6 +274,14 @@ namespace asp{
     // than the given threshold from the median of heights in the
     // window of given size centered at the point, remove it as an outlier.
 
+    // The median is found with a histogram of heights which slides along
+    // each row, so adding or removing a column of the window costs as many
+    // operations as the window height, and the median bin is tracked
+    // incrementally. The bins are a small fraction of the threshold. Where
+    // the quantized median is too close to the threshold to decide, or it
+    // falls in a clamped bin, the exact median is computed, so the result
+    // is the same as with a brute force median.
+
     int    half   = median_filter_params[0]/2; // half window size
     double thresh = median_filter_params[1];
     if (half <= 0 || thresh <= 0)
@@ -276,30 +290,143 @@ namespace asp{
     int nc = image.cols(), nr = image.rows(); // shorten
     double nan = std::numeric_limits<double>::quiet_NaN();
 
-    ImageView<Vector3> image_out = copy(image);
-
-    for (int col = 0; col < image.cols(); col++){
-      for (int row = 0; row < image.rows(); row++){
+    // Find the height range. Cap the number of bins. If that makes them
+    // too coarse, center the bins at the mean height and clamp the rest.
+    double min_z = std::numeric_limits<double>::max(), max_z = -min_z;
+    double sum_z = 0.0;
+    vw::int64 num_valid = 0;
+    for (int row = 0; row < nr; row++){
+      Vector3 const* pt = &image(0, row);
+      for (int col = 0; col < nc; col++){
+        double z = pt[col].z();
+        if (boost::math::isnan(z))
+          continue;
+        min_z = std::min(min_z, z);
+        max_z = std::max(max_z, z);
+        sum_z += z;
+        num_valid++;
+      }
+    }
+    if (num_valid == 0)
+      return;
 
-        if (boost::math::isnan(image(col, row).z()))
+    const int MAX_NUM_BINS = 1 << 16;
+    double bin_len = thresh / 64.0;
+    int num_bins = (int)std::min(double(MAX_NUM_BINS), (max_z - min_z) / bin_len + 1.0);
+    bool clamped = ((max_z - min_z) / bin_len + 1.0 > MAX_NUM_BINS);
+    double start_z = min_z;
+    if (clamped)
+      start_z = sum_z / num_valid - 0.5 * num_bins * bin_len;
+
+    // The bin of each height, or -1 for invalid heights
+    ImageView<int> bins(nc, nr);
+    for (int row = 0; row < nr; row++){
+      Vector3 const* pt = &image(0, row);
+      int * bin = &bins(0, row);
+      for (int col = 0; col < nc; col++){
+        double z = pt[col].z();
+        if (boost::math::isnan(z)){
+          bin[col] = -1;
           continue;
+        }
+        double b = floor((z - start_z) / bin_len);
+        bin[col] = (int)std::max(0.0, std::min(double(num_bins - 1), b));
+      }
+    }
 
-        std::vector<double> vals;
+    // Brute force median of heights in the window centered at (col, row)
+    std::vector<double> vals;
+    auto exact_median = [&](int col, int row) {
+      vals.clear();
+      for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
         for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
-          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
-            if (boost::math::isnan(image(c, r).z()))
-              continue;
+          if (bins(c, r) >= 0)
             vals.push_back(image(c, r).z());
-          }
         }
-        double median = vw::math::destructive_median(vals);
-        if (fabs(median - image(col, row).z()) > thresh){
-          image_out(col, row).z() = nan;
+      }
+      return vw::math::destructive_median(vals);
+    };
+
+    // The histogram is empty after each row, so the median bin carries over
+    std::vector<int> hist(num_bins, 0);
+    int count = 0, med_bin = 0, below = 0;
+    ImageView<unsigned char> is_outlier(nc, nr);
+    for (int row = 0; row < nr; row++){
+
+      int beg_row = std::max(row-half, 0), end_row = std::min(row+half, nr-1);
+
+      // Add to or remove from the histogram the given window column.
+      // The count of values below the current median bin is kept up to date.
+      auto update = [&](int c, int sign) {
+        for (int r = beg_row; r <= end_row; r++){
+          int b = bins(c, r);
+          if (b < 0)
+            continue;
+          hist[b] += sign;
+          count   += sign;
+          if (b < med_bin)
+            below += sign;
+        }
+      };
+
+      for (int c = 0; c <= std::min(half, nc-1); c++)
+        update(c, 1);
+
+      for (int col = 0; col < nc; col++){
+
+        if (col > 0){
+          if (col - half - 1 >= 0)
+            update(col - half - 1, -1);
+          if (col + half <= nc - 1)
+            update(col + half, 1);
+        }
+
+        is_outlier(col, row) = 0;
+        if (bins(col, row) < 0 || count == 0)
+          continue;
+
+        // Move the median bin until it holds the value of rank (count-1)/2
+        int rank = (count - 1) / 2;
+        while (below > rank){
+          med_bin--;
+          below -= hist[med_bin];
+        }
+        while (below + hist[med_bin] <= rank){
+          below += hist[med_bin];
+          med_bin++;
         }
+
+        // For an even count, the median is the mean of two values
+        int med_bin2 = med_bin;
+        if (count % 2 == 0 && below + hist[med_bin] <= rank + 1){
+          med_bin2++;
+          while (hist[med_bin2] == 0)
+            med_bin2++;
+        }
+
+        double median = start_z + bin_len * (0.5 * (med_bin + med_bin2) + 0.5);
+        double z = image(col, row).z();
+        bool on_edge = clamped && (med_bin == 0 || med_bin2 == num_bins - 1);
+        if (on_edge || std::abs(std::abs(median - z) - thresh) <= bin_len)
+          median = exact_median(col, row);
+
+        if (fabs(median - z) > thresh)
+          is_outlier(col, row) = 1;
       }
+
+      // Empty the histogram for the next row
+      for (int c = std::max(nc - 1 - half, 0); c <= nc - 1; c++)
+        update(c, -1);
     }
 
-    image = copy(image_out);
+    for (int row = 0; row < nr; row++){
+      Vector3 * pt = &image(0, row);
+      unsigned char const* outlier = &is_outlier(0, row);
+      for (int col = 0; col < nc; col++){
+        if (outlier[col])
+          pt[col].z() = nan;
+      }
+    }
   }
 
   // TODO: This function should live somewhere else!
@@ -309,55 +436,61 @@ namespace asp{
     if (erode_len <= 0) // No erode, we are finished!
       return;
 
-    int    nc      = image.cols(), 
-           nr      = image.rows(); // shorten
-    double nan     = std::numeric_limits<double>::quiet_NaN();
-    int    max_col = nc - 1;
-    int    max_row = nr - 1;
-
-    // Create a buffer to modify and a pointer to allow easy
-    //  swapping of which image we are writing to.
-    // - The first write is to the input image, so we don't have to do extra copies with one pass.
-    ImageView<Vector3>  buffer = copy(image);
-    ImageView<Vector3>* read_ptr  = &buffer; 
-    ImageView<Vector3>* write_ptr = &image; 
-    ImageView<Vector3>* temp_ptr = 0;
-    
-    // One pass per erode length    
-    for (int pass = 0; pass < erode_len; pass++){
+    // This is the same as erode_len passes of removing pixels with an
+    // invalid neighbor in the 3x3 window, that is, removing pixels within
+    // Chebyshev distance erode_len of an invalid pixel. That is done
+    // separably, with two sweeps along the rows and then along the
+    // columns, in time independent of erode_len.
 
-      // Loop through the entire image
+    int    nc  = image.cols(),
+           nr  = image.rows(); // shorten
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    const int far = std::numeric_limits<int>::max() / 2;
+
+    // For each pixel, find if there is an invalid pixel in its row within erode_len
+    ImageView<unsigned char> near_row(nc, nr);
+    for (int row = 0; row < nr; row++){
+      Vector3 const* pt = &image(0, row);
+      unsigned char* near = &near_row(0, row);
+      int last = -far; // last invalid column on the left
       for (int col = 0; col < nc; col++){
-        int start_col = std::max(col-1, 0      );
-        int stop_col  = std::min(col+1, max_col);
-        for (int row = 0; row < nr; row++){
-          int start_row = std::max(row-1, 0      );
-          int stop_row  = std::min(row+1, max_row);
-
-          // Loop through bounds checked border 1 region around this pixel
-          for (int c = start_col; c <= stop_col; c++){
-            for (int r = start_row; r <= stop_row; r++){
-              // If any of these pixels are bad, throw out this pixel
-              if (boost::math::isnan(read_ptr->operator()(c, r).z()))
-                write_ptr->operator()(col, row).z() = nan;
-            }
-          } // End inner erode double loop
-          
-        }
-      } // End double loop through image pixels
+        if (boost::math::isnan(pt[col].z()))
+          last = col;
+        near[col] = (col - last <= erode_len);
+      }
+      last = far; // last invalid column on the right
+      for (int col = nc - 1; col >= 0; col--){
+        if (boost::math::isnan(pt[col].z()))
+          last = col;
+        if (last - col <= erode_len)
+          near[col] = 1;
+      }
+    }
 
-      // Swap the read and write buffer pointers for the next pass
-      // - No need to make copies each time, the nan regions will just keep expanding.
-      temp_ptr  = write_ptr;
-      write_ptr = read_ptr;
-      read_ptr  = temp_ptr;
-      
-    } // end passes
-    
-    // If we had an even number of erode passes, the last write was to the temp
-    //  buffer and we need to copy it back to the input image.
-    if ((erode_len % 2) == 0)
-      image = copy(buffer);
+    // Do the same along the columns, going over whole rows at a time
+    std::vector<int> last(nc, -far);
+    ImageView<unsigned char> near_both(nc, nr);
+    for (int row = 0; row < nr; row++){
+      unsigned char const* near = &near_row(0, row);
+      unsigned char * out = &near_both(0, row);
+      for (int col = 0; col < nc; col++){
+        if (near[col])
+          last[col] = row;
+        out[col] = (row - last[col] <= erode_len);
+      }
+    }
+    std::fill(last.begin(), last.end(), far);
+    for (int row = nr - 1; row >= 0; row--){
+      unsigned char const* near = &near_row(0, row);
+      unsigned char * out = &near_both(0, row);
+      Vector3 * pt = &image(0, row);
+      for (int col = 0; col < nc; col++){
+        if (near[col])
+          last[col] = row;
+        if (out[col] || last[col] - row <= erode_len)
+          pt[col].z() = nan;
+      }
+    }
   }
 
 
@@ -419,7 +552,8 @@ namespace asp{
     m_median_filter_params(median_filter_params), m_erode_len(erode_len),
     m_default_grid_size_multiplier(default_grid_size_multiplier),
     m_num_invalid_pixels(num_invalid_pixels),
-    m_count_mutex(count_mutex){
+    m_count_mutex(count_mutex),
+    m_grid_cols(0), m_grid_rows(0){
 
     *m_num_invalid_pixels = 0; // Init counter
     set_texture(texture.impl());
@@ -488,6 +622,8 @@ namespace asp{
     if ( m_bbox.empty() )
       vw_throw( ArgumentErr() << "OrthoRasterize: Input point cloud is empty!\n" );
 
+    build_boundary_grid();
+
     // Override with user's projwin, if specified
     if (m_projwin != BBox2()){
       subvector(m_bbox.min(), 0, 2) = m_projwin.min();
@@ -626,6 +762,149 @@ namespace asp{
 
   } // End function initialize_spacing()
 
+  // Index the boundaries with a uniform grid in x and y, so that each
+  // output tile needs to examine only the boundaries near it, rather
+  // than all of them. For clouds merged from many stereo tiles, or
+  // for LAS files, there can be millions of boundaries.
+  void OrthoRasterizerView::build_boundary_grid() {
+
+    // A boundary covering more than this many grid cells is checked
+    // for each tile instead of being added to the grid.
+    const int MAX_CELLS_PER_BOUNDARY = 64;
+
+    int num = m_point_image_boundaries.size();
+    m_snapped_blocks.resize(num);
+    m_grid_box = BBox2();
+    m_grid_cols = 0;
+    m_grid_rows = 0;
+    m_grid_start.clear();
+    m_grid_items.clear();
+    m_grid_oversized.clear();
+
+    std::vector<bool> in_grid(num, false);
+    int num_in_grid = 0;
+    for (int i = 0; i < num; i++) {
+      BBox2i const& pc_block = m_point_image_boundaries[i].second;
+      BBox2i & snapped_block = m_snapped_blocks[i];
+      snapped_block.min() = m_block_size*floor(pc_block.min()/double(m_block_size));
+      snapped_block.max() = m_block_size*ceil( pc_block.max()/double(m_block_size));
+
+      BBox3 const& b = m_point_image_boundaries[i].first;
+      if (std::isfinite(b.min().x()) && std::isfinite(b.min().y()) &&
+          std::isfinite(b.max().x()) && std::isfinite(b.max().y())) {
+        in_grid[i] = true;
+        num_in_grid++;
+        m_grid_box.grow(Vector2(b.min().x(), b.min().y()));
+        m_grid_box.grow(Vector2(b.max().x(), b.max().y()));
+      } else {
+        m_grid_oversized.push_back(i);
+      }
+    }
+
+    if (num_in_grid == 0)
+      return; // Nothing to grid
+
+    // Use about as many cells as there are boundaries, with the cells
+    // having roughly the same size in x and y.
+    const int MAX_NUM_CELLS = 1 << 22;
+    int num_cells = std::max(1, std::min(num, MAX_NUM_CELLS));
+    double width = m_grid_box.width(), height = m_grid_box.height();
+    if (width > 0 && height > 0) {
+      m_grid_cols = (int)round(sqrt(num_cells * width / height));
+      m_grid_cols = std::min(std::max(m_grid_cols, 1), num_cells);
+      m_grid_rows = std::max(num_cells / m_grid_cols, 1);
+    } else {
+      m_grid_cols = (width  > 0) ? num_cells : 1;
+      m_grid_rows = (height > 0) ? num_cells : 1;
+    }
+    m_grid_cell_size = Vector2(width  > 0 ? width  / m_grid_cols : 1.0,
+                               height > 0 ? height / m_grid_rows : 1.0);
+
+    // Count how many boundaries overlap each cell, then fill in the
+    // boundary indices.
+    m_grid_start.assign(m_grid_cols * m_grid_rows + 1, 0);
+    for (int pass = 0; pass < 2; pass++) {
+
+      std::vector<int> pos;
+      if (pass == 1) {
+        for (size_t k = 1; k < m_grid_start.size(); k++)
+          m_grid_start[k] += m_grid_start[k-1];
+        m_grid_items.resize(m_grid_start.back());
+        pos.assign(m_grid_start.begin(), m_grid_start.end() - 1);
+      }
+
+      for (int i = 0; i < num; i++) {
+        if (!in_grid[i])
+          continue;
+        int c0, c1, r0, r1;
+        grid_cell_range(m_point_image_boundaries[i].first, c0, c1, r0, r1);
+        if ((c1 - c0 + 1) * (r1 - r0 + 1) > MAX_CELLS_PER_BOUNDARY) {
+          if (pass == 0)
+            m_grid_oversized.push_back(i);
+          continue;
+        }
+        for (int r = r0; r <= r1; r++) {
+          for (int c = c0; c <= c1; c++) {
+            int cell = r * m_grid_cols + c;
+            if (pass == 0)
+              m_grid_start[cell + 1]++;
+            else
+              m_grid_items[pos[cell]++] = i;
+          }
+        }
+      }
+    }
+
+  } // End function build_boundary_grid()
+
+  // The range of grid cells overlapping the x-y extent of a box, clamped
+  // to the grid.
+  void OrthoRasterizerView::grid_cell_range(BBox3 const& box,
+                                            int & c0, int & c1, int & r0, int & r1) const {
+    double x0 = (box.min().x() - m_grid_box.min().x()) / m_grid_cell_size.x();
+    double x1 = (box.max().x() - m_grid_box.min().x()) / m_grid_cell_size.x();
+    double y0 = (box.min().y() - m_grid_box.min().y()) / m_grid_cell_size.y();
+    double y1 = (box.max().y() - m_grid_box.min().y()) / m_grid_cell_size.y();
+    c0 = (int)std::max(0.0, std::min(floor(x0), m_grid_cols - 1.0));
+    c1 = (int)std::max(0.0, std::min(floor(x1), m_grid_cols - 1.0));
+    r0 = (int)std::max(0.0, std::min(floor(y0), m_grid_rows - 1.0));
+    r1 = (int)std::max(0.0, std::min(floor(y1), m_grid_rows - 1.0));
+  }
+
+  // Find the indices of the boundaries intersecting the given box, in
+  // increasing order.
+  void OrthoRasterizerView::find_boundaries(BBox3 const& box,
+                                            std::vector<int> & indices) const {
+    indices.clear();
+
+    if (m_grid_cols > 0 && m_grid_rows > 0 &&
+        box.max().x() >= m_grid_box.min().x() && box.min().x() <= m_grid_box.max().x() &&
+        box.max().y() >= m_grid_box.min().y() && box.min().y() <= m_grid_box.max().y()) {
+      int c0, c1, r0, r1;
+      grid_cell_range(box, c0, c1, r0, r1);
+      for (int r = r0; r <= r1; r++) {
+        for (int c = c0; c <= c1; c++) {
+          int cell = r * m_grid_cols + c;
+          for (int k = m_grid_start[cell]; k < m_grid_start[cell + 1]; k++)
+            indices.push_back(m_grid_items[k]);
+        }
+      }
+    }
+
+    // A boundary spanning several cells was found more than once
+    indices.insert(indices.end(), m_grid_oversized.begin(), m_grid_oversized.end());
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+    // Keep only the boundaries which actually intersect the box
+    size_t num_kept = 0;
+    for (size_t k = 0; k < indices.size(); k++) {
+      if (box.intersects(m_point_image_boundaries[indices[k]].first))
+        indices[num_kept++] = indices[k];
+    }
+    indices.resize(num_kept);
+  }
+
   // Function to convert pixel coordinates to the point domain
   BBox3 OrthoRasterizerView::pixel_to_point_bbox( BBox2 const& inbox ) const {
     BBox3 outbox = m_snapped_bbox;
@@ -641,71 +920,35 @@ namespace asp{
     return outbox;
   }
 
-  /// \cond INTERNAL
-  OrthoRasterizerView::prerasterize_type
-  OrthoRasterizerView::prerasterize(BBox2i const& bbox) const {
-
-    BBox2i bbox_1 = bbox;
-    
-    // bugfix, ensure we see enough beyond current tile
-    bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
-
-    // Used to find which polygons are actually in the draw space.
-    BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
-
-    ImageView<float > render_buffer;
-    ImageView<double> d_buffer, weights;
-    if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
-    }
-
-    // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(), bbox_1.height(),
-                                          &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-                     local_3d_bbox.min().y(), local_3d_bbox.max().y());
-
-    // Given a DEM grid point, search for cloud points within the
-    // circular region of radius equal to grid size. As such, a
-    // given cloud point may contribute to multiple DEM points, but
-    // with different weights (set by Gaussian). We make this radius
-    // no smaller than the default DEM spacing. Search radius can be
-    // over-ridden by user.
-    double search_radius;
+  // Given a DEM grid point, search for cloud points within the
+  // circular region of radius equal to grid size. As such, a
+  // given cloud point may contribute to multiple DEM points, but
+  // with different weights (set by Gaussian). We make this radius
+  // no smaller than the default DEM spacing. Search radius can be
+  // over-ridden by user.
+  double OrthoRasterizerView::search_radius() const {
     if (m_search_radius_factor <= 0.0)
-      search_radius = std::max(m_spacing, m_default_spacing);
-    else
-      search_radius = m_spacing*m_search_radius_factor;
-    asp::Point2Grid point2grid(bbox_1.width(),
-                               bbox_1.height(),
-                               d_buffer, weights,
-                               local_3d_bbox.min().x(),
-                               local_3d_bbox.min().y(),
-                               m_spacing, m_default_spacing,
-                               search_radius, m_sigma_factor,
-                               m_filter, m_percentile);
-    
-    // Set up the default color value
-    double min_val = 0.0;
-    if (m_use_alpha) {
-      // use this dummy value to denote transparency
-      min_val = std::numeric_limits<float>::min();
-    } else if (m_minz_as_default) {
-      min_val = m_snapped_bbox.min().z();
-    } else {
-      min_val = m_default_value;
-    }
+      return std::max(m_spacing, m_default_spacing);
+    return m_spacing*m_search_radius_factor;
+  }
 
+  // Add the cloud points in the blocks intersecting the given box to
+  // the renderer or to the grid, as appropriate. If error_grid is not
+  // null, add to it the given error texture at the same points. Return
+  // false if no blocks intersect the box.
+  bool OrthoRasterizerView::add_points(BBox3 const& local_3d_bbox,
+                                       vw::stereo::SoftwareRenderer * renderer,
+                                       Point2Grid * point2grid,
+                                       Point2Grid * error_grid,
+                                       ImageViewRef<float> const& error_texture) const {
+    
     std::valarray<float> vertices(10), intensities(5);
 
     if (m_use_surface_sampling){
       static const int NUM_COLOR_COMPONENTS  = 1;  // We only need gray scale
       static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-    }else{
-      point2grid.Clear(min_val);
+      renderer->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+      renderer->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -716,15 +959,12 @@ namespace asp{
     typedef std::map<BBox2i, BBox2i, compare_bboxes> BlockMapType;
     typedef BlockMapType::iterator MapIterType;
     BlockMapType blocks_map;
-    BOOST_FOREACH( BBoxPair const& boundary, m_point_image_boundaries ) {
-      if (! local_3d_bbox.intersects(boundary.first) )
-        continue;
+    std::vector<int> boundary_indices;
+    find_boundaries(local_3d_bbox, boundary_indices);
+    for (size_t k = 0; k < boundary_indices.size(); k++) {
 
-      BBox2i pc_block = boundary.second;
-
-      BBox2i snapped_block;
-      snapped_block.min() = m_block_size*floor(pc_block.min()/double(m_block_size));
-      snapped_block.max() = m_block_size*ceil( pc_block.max()/double(m_block_size));
+      BBox2i const& pc_block      = m_point_image_boundaries[boundary_indices[k]].second;
+      BBox2i const& snapped_block = m_snapped_blocks[boundary_indices[k]];
       MapIterType it = blocks_map.find(snapped_block);
       if (it != blocks_map.end() ){
         (it->second).grow(pc_block);
@@ -734,23 +974,8 @@ namespace asp{
 
     }
 
-    if ( blocks_map.empty() ){
-      // TODO: Don't include these pixels in the total?
-      { // Lock and update the total number of invalid pixels in this tile.
-        vw::Mutex::Lock lock(*m_count_mutex);
-        // Care here, convert to int64_t before multiplication, to avoid
-        // int32 overflow.
-        (*m_num_invalid_pixels) += std::int64_t(bbox.width())*std::int64_t(bbox.height());
-      }
-      
-      if (m_use_surface_sampling){
-        return prerasterize_type(render_buffer, BBox2i(-bbox_1.min().x(),
-                                                       -bbox_1.min().y(), cols(), rows()));
-      }else{
-        return prerasterize_type(d_buffer, BBox2i(-bbox_1.min().x(),
-                                                  -bbox_1.min().y(), cols(), rows()) );
-      }
-    }
+    if ( blocks_map.empty() )
+      return false;
 
     // This is very important. When doing surface sampling, for each
     // pixel we need to see its next up and right neighbors.
@@ -779,6 +1004,9 @@ namespace asp{
       point_copy = crop(point_copy, block - biased_block.min());
 
       ImageView<float> texture_copy = crop(m_texture, block );
+      ImageView<float> error_copy;
+      if (error_grid != NULL)
+        error_copy = crop(error_texture, block);
 
       typedef ImageView<Vector3>::pixel_accessor PointAcc;
       PointAcc row_acc = point_copy.origin();
@@ -816,11 +1044,11 @@ namespace asp{
 
               if (!boost::math::isnan((*point_ll).z())) {
                 // triangle 1 is: UL LL LR
-                renderer.DrawPolygon(0, 3);
+                renderer->DrawPolygon(0, 3);
               }
               if (!boost::math::isnan((*point_ur).z())) {
                 // triangle 2 is: LR, UR, UL
-                renderer.DrawPolygon(2, 3);
+                renderer->DrawPolygon(2, 3);
               }
             }
 
@@ -828,9 +1056,13 @@ namespace asp{
             // The new engine
             if ( !boost::math::isnan(point_copy(col, row).z()) &&
                  local_3d_bbox.contains(point_copy(col, row))){
-              point2grid.AddPoint(point_copy(col, row).x(),
-                                  point_copy(col, row).y(),
-                                  texture_copy(col,  row));
+              point2grid->AddPoint(point_copy(col, row).x(),
+                                   point_copy(col, row).y(),
+                                   texture_copy(col,  row));
+              if (error_grid != NULL)
+                error_grid->AddPoint(point_copy(col, row).x(),
+                                     point_copy(col, row).y(),
+                                     error_copy(col,  row));
             }
           }
           point_ul.next_col();
@@ -840,6 +1072,99 @@ namespace asp{
 
     }
 
+    return true;
+  }
+
+  /// \cond INTERNAL
+  OrthoRasterizerView::prerasterize_type
+  OrthoRasterizerView::prerasterize(BBox2i const& bbox) const {
+
+    BBox2i bbox_1 = bbox;
+    
+    // bugfix, ensure we see enough beyond current tile
+    bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
+
+    // Used to find which polygons are actually in the draw space.
+    BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
+
+    ImageView<float > render_buffer;
+    ImageView<double> d_buffer, weights;
+    if (m_use_surface_sampling){
+      render_buffer.set_size(bbox_1.width(), bbox_1.height());
+    }
+
+    // Setup a software renderer and the orthographic view matrix
+    vw::stereo::SoftwareRenderer renderer(bbox_1.width(), bbox_1.height(),
+                                          &render_buffer(0,0) );
+    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                     local_3d_bbox.min().y(), local_3d_bbox.max().y());
+    renderer.SetUseEdgeFunctions(true);
+
+    // The output tiles are rendered in parallel, so usually each draws its
+    // triangles right away. If the DEM has fewer tiles than threads, the
+    // spare threads rasterize bands of rows of each tile. The result is the
+    // same for any number of threads.
+    if (m_use_surface_sampling) {
+      int tile_size = std::max(vw_settings().default_tile_size(), 1);
+      std::int64_t num_tiles
+        = std::int64_t((cols() + tile_size - 1) / tile_size) *
+          std::int64_t((rows() + tile_size - 1) / tile_size);
+      int num_threads = vw_settings().default_num_threads();
+      int tile_threads = int(std::max(std::int64_t(1),
+                                      std::int64_t(num_threads) /
+                                      std::max(num_tiles, std::int64_t(1))));
+      if (tile_threads > 1)
+        renderer.SetDeferred(true, tile_threads);
+    }
+
+    asp::Point2Grid point2grid(bbox_1.width(),
+                               bbox_1.height(),
+                               d_buffer, weights,
+                               local_3d_bbox.min().x(),
+                               local_3d_bbox.min().y(),
+                               m_spacing, m_default_spacing,
+                               search_radius(), m_sigma_factor,
+                               m_filter, m_percentile);
+    
+    // Set up the default color value
+    double min_val = 0.0;
+    if (m_use_alpha) {
+      // use this dummy value to denote transparency
+      min_val = std::numeric_limits<float>::min();
+    } else if (m_minz_as_default) {
+      min_val = m_snapped_bbox.min().z();
+    } else {
+      min_val = m_default_value;
+    }
+
+    if (m_use_surface_sampling)
+      renderer.Clear(min_val);
+    else
+      point2grid.Clear(min_val);
+
+    bool has_points = add_points(local_3d_bbox, &renderer, &point2grid, NULL,
+                                 ImageViewRef<float>());
+    if (m_use_surface_sampling)
+      renderer.Flush(); // draw the triangles, if they were deferred
+    if (!has_points){
+      // TODO: Don't include these pixels in the total?
+      { // Lock and update the total number of invalid pixels in this tile.
+        vw::Mutex::Lock lock(*m_count_mutex);
+        // Care here, convert to int64_t before multiplication, to avoid
+        // int32 overflow.
+        (*m_num_invalid_pixels) += std::int64_t(bbox.width())*std::int64_t(bbox.height());
+      }
+      
+      if (m_use_surface_sampling){
+        return prerasterize_type(render_buffer, BBox2i(-bbox_1.min().x(),
+                                                       -bbox_1.min().y(), cols(), rows()));
+      }else{
+        point2grid.normalize(); // set the no-data value
+        return prerasterize_type(d_buffer, BBox2i(-bbox_1.min().x(),
+                                                  -bbox_1.min().y(), cols(), rows()) );
+      }
+    }
+
     if (!m_use_surface_sampling)
       point2grid.normalize();
 
@@ -876,6 +1201,148 @@ namespace asp{
                              BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()));
   }
 
+  ImageView<Vector3f>
+  OrthoRasterizerView::accumulate(BBox2i const& bbox,
+                                  ImageViewRef<float> const& error_texture) const {
+
+    if (m_use_surface_sampling ||
+        (m_filter != asp::f_weighted_average && m_filter != asp::f_mean))
+      vw_throw(ArgumentErr() << "OrthoRasterizerView: Can accumulate the gridded values "
+               << "only for the weighted_average and mean filters.\n");
+
+    BBox2i bbox_1 = bbox;
+    bbox_1.expand((int)ceil(std::max(m_search_radius_factor, 5.0)));
+    BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
+
+    // The errors are gridded in the same way as the heights
+    bool has_error = (error_texture.cols() > 0 && error_texture.rows() > 0);
+    ImageView<double> d_buffer, weights, e_buffer, e_weights;
+    asp::Point2Grid point2grid(bbox_1.width(), bbox_1.height(),
+                               d_buffer, weights,
+                               local_3d_bbox.min().x(), local_3d_bbox.min().y(),
+                               m_spacing, m_default_spacing,
+                               search_radius(), m_sigma_factor,
+                               m_filter, m_percentile);
+    asp::Point2Grid error_grid(bbox_1.width(), bbox_1.height(),
+                               e_buffer, e_weights,
+                               local_3d_bbox.min().x(), local_3d_bbox.min().y(),
+                               m_spacing, m_default_spacing,
+                               search_radius(), m_sigma_factor,
+                               m_filter, m_percentile);
+    point2grid.Clear(0.0);
+    error_grid.Clear(0.0);
+    add_points(local_3d_bbox, NULL, &point2grid, has_error ? &error_grid : NULL,
+               error_texture);
+    point2grid.normalize();
+    error_grid.normalize();
+
+    // Copy the values for the current box. Flip the rows, as is done
+    // for the DEM.
+    ImageView<Vector3f> result(bbox.width(), bbox.height());
+    for (int row = 0; row < result.rows(); row++) {
+      int r = bbox_1.max().y() - 1 - (bbox.min().y() + row);
+      for (int col = 0; col < result.cols(); col++) {
+        int c = bbox.min().x() + col - bbox_1.min().x();
+        result(col, row) = Vector3f(d_buffer(c, r), e_buffer(c, r), weights(c, r));
+      }
+    }
+
+    return result;
+  }
+
+  AccumulatorAggregateView::AccumulatorAggregateView(ImageViewRef<Vector3> const& accum,
+                                                     int factor, Vector2i const& offset,
+                                                     int cols, int rows,
+                                                     int channel, float nodata_value,
+                                                     std::int64_t * num_invalid_pixels,
+                                                     vw::Mutex * count_mutex):
+    m_accum(accum), m_factor(factor), m_offset(offset),
+    m_cols(cols), m_rows(rows), m_channel(channel), m_nodata_value(nodata_value),
+    m_num_invalid_pixels(num_invalid_pixels), m_count_mutex(count_mutex) {
+    
+    if (m_factor < 1)
+      vw_throw(ArgumentErr() << "AccumulatorAggregateView: The factor must be positive.\n");
+    if (m_channel != 0 && m_channel != 1)
+      vw_throw(ArgumentErr() << "AccumulatorAggregateView: The channel must be 0 or 1.\n");
+    if (m_num_invalid_pixels != NULL && m_count_mutex == NULL)
+      vw_throw(ArgumentErr() << "AccumulatorAggregateView: Counting invalid pixels "
+               << "needs a mutex.\n");
+  }
+
+  AccumulatorAggregateView::prerasterize_type
+  AccumulatorAggregateView::prerasterize(BBox2i const& bbox) const {
+
+    // The window of fine grid points for a coarse one is [-h, h]^2
+    int h = m_factor/2;
+    bool even = (m_factor % 2 == 0);
+
+    // Bring in memory the fine grid points needed for this box
+    Vector2i beg = m_offset + m_factor*bbox.min() - Vector2i(h, h);
+    Vector2i end = m_offset + m_factor*(bbox.max() - Vector2i(1, 1)) + Vector2i(h + 1, h + 1);
+    BBox2i fine_box(beg, end);
+    fine_box.crop(bounding_box(m_accum));
+    ImageView<Vector3> fine;
+    if (!fine_box.empty())
+      fine = crop(m_accum, fine_box);
+
+    ImageView<pixel_type> result(bbox.width(), bbox.height());
+    std::int64_t num_unset = 0;
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+
+        Vector2i ctr = m_offset + m_factor*(bbox.min() + Vector2i(col, row));
+        double sum = 0.0, sum_wts = 0.0;
+        for (int dy = -h; dy <= h; dy++) {
+          int y = ctr.y() + dy;
+          if (y < fine_box.min().y() || y >= fine_box.max().y())
+            continue;
+          double wy = (even && (dy == -h || dy == h)) ? 0.5 : 1.0;
+          for (int dx = -h; dx <= h; dx++) {
+            int x = ctr.x() + dx;
+            if (x < fine_box.min().x() || x >= fine_box.max().x())
+              continue;
+            double wx = (even && (dx == -h || dx == h)) ? 0.5 : 1.0;
+            Vector3 const& p = fine(x - fine_box.min().x(), y - fine_box.min().y());
+            double wt = wx*wy*p[2];
+            sum     += wt*p[m_channel];
+            sum_wts += wt;
+          }
+        }
+
+        if (sum_wts > 0) {
+          result(col, row) = pixel_type(sum/sum_wts);
+        } else {
+          result(col, row) = pixel_type(m_nodata_value);
+          num_unset++;
+        }
+      }
+    }
+
+    if (m_num_invalid_pixels != NULL) {
+      vw::Mutex::Lock lock(*m_count_mutex);
+      (*m_num_invalid_pixels) += num_unset;
+    }
+    
+    return prerasterize_type(result, BBox2i(-bbox.min().x(), -bbox.min().y(), cols(), rows()));
+  }
+
+  Vector2i aggregate_offset(BBox3 const& fine_box, double fine_spacing, BBox3 const& box) {
+
+    Vector2 offset((box.min().x() - fine_box.min().x())/fine_spacing,
+                   (fine_box.max().y() - box.max().y())/fine_spacing);
+    Vector2i int_offset((int)round(offset.x()), (int)round(offset.y()));
+
+    // The boxes are snapped to multiples of their grid sizes, so this
+    // should hold up to numerical error, unless the boxes were set
+    // some other way.
+    if (norm_inf(offset - Vector2(int_offset)) > 1e-3)
+      vw_throw(ArgumentErr() << "The grid points of the DEM with bounding box " << box
+               << " are not on the grid of size " << fine_spacing
+               << " of the DEM with bounding box " << fine_box << ".\n");
+    
+    return int_offset;
+  }
+
   // Return the affine georeferencing transform.
   vw::Matrix<double,3,3> OrthoRasterizerView::geo_transform() {
     vw::Matrix<double,3,3> geo_transform;
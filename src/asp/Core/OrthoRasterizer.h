@@ -32,6 +32,10 @@
 #include <vw/Math/BBox.h>
 #include <asp/Core/Point2Grid.h>
 
+namespace vw { namespace stereo {
+  struct SoftwareRenderer;
+}}
+
 namespace asp{
 
   enum OutlierRemovalMethod {NO_OUTLIER_REMOVAL_METHOD, PERCENTILE_OUTLIER_METHOD,
@@ -41,6 +45,15 @@ namespace asp{
 
   typedef std::pair<BBox3, BBox2i> BBoxPair;
 
+  /// Invalidate the points whose height differs by more than
+  /// median_filter_params[1] from the median height in the window of
+  /// size median_filter_params[0] centered at the point.
+  void filter_by_median(ImageView<Vector3> & image, Vector2 const& median_filter_params);
+
+  /// Invalidate the points within erode_len pixels, in each of the row
+  /// and column directions, of an invalid point.
+  void erode_image(ImageView<Vector3> & image, int erode_len);
+
   /// Given a point image and corresponding texture, this class
   /// bins and averages the point cloud on a regular grid over the [x,y]
   /// plane of the point image; producing an evenly sampled ortho-image
@@ -72,17 +85,51 @@ namespace asp{
     std::int64_t * m_num_invalid_pixels; ///< Keep a count of nodata output pixels, needs to be pointer due to VW weirdness.
     vw::Mutex  *m_count_mutex;        ///< A lock for m_num_invalid_pixels, needs to be pointer due to C++ weirdness.
 
-    // We could actually use a quadtree here .. but this should be a
-    // good enough improvement.
     std::vector<BBoxPair> m_point_image_boundaries;
     // These boundaries describe a point cloud 3D boundaries and then
     // their location in the the point cloud image. These boxes are
     // overlapping in the pc image X/Y domain to insure that
     // everything is triangulated.
 
+    // The point cloud block of size m_block_size containing each
+    // boundary, used to group the boundaries when rasterizing.
+    std::vector<BBox2i> m_snapped_blocks;
+
+    // A uniform grid over the x-y extent of the boundaries, for
+    // quickly finding those intersecting an output tile. The indices
+    // of the boundaries overlapping grid cell k are in m_grid_items,
+    // from m_grid_start[k] to m_grid_start[k+1]. Boundaries which are
+    // too large or not finite are kept in m_grid_oversized and are
+    // always checked.
+    BBox2   m_grid_box;
+    int     m_grid_cols, m_grid_rows;
+    Vector2 m_grid_cell_size;
+    std::vector<int> m_grid_start, m_grid_items, m_grid_oversized;
+
+    // Build the above, once the boundaries are known
+    void build_boundary_grid();
+
+    // The range of grid cells overlapping a box, clamped to the grid
+    void grid_cell_range(BBox3 const& box, int & c0, int & c1, int & r0, int & r1) const;
+
+    // Find the indices of the boundaries intersecting the given box
+    void find_boundaries(BBox3 const& box, std::vector<int> & indices) const;
+
     // Function to convert pixel coordinates to the point domain
     BBox3 pixel_to_point_bbox( BBox2 const& px ) const;
 
+    // The radius of the neighborhood of a grid point in which to
+    // search for cloud points
+    double search_radius() const;
+
+    // Add to the renderer or to the grid the points in the cloud
+    // blocks intersecting the given box
+    bool add_points(BBox3 const& local_3d_bbox,
+                    vw::stereo::SoftwareRenderer * renderer,
+                    Point2Grid * point2grid,
+                    Point2Grid * error_grid,
+                    ImageViewRef<float> const& error_texture) const;
+
   public:
     typedef PixelGray<float> pixel_type;
     typedef const PixelGray<float> result_type;
@@ -148,6 +195,15 @@ namespace asp{
     }
     /// \endcond
 
+    /// Grid the cloud over the given pixel box with the weighted
+    /// average or mean filter, and return at each pixel the height,
+    /// the gridded error texture (zero if that one is empty), and the
+    /// sum of weights. The sum of weights is zero where there is no
+    /// data. Such values can be aggregated to coarser grids, see
+    /// AccumulatorAggregateView.
+    ImageView<Vector3f> accumulate(BBox2i const& bbox,
+                                   ImageViewRef<float> const& error_texture) const;
+
     void set_use_alpha          (bool   val) { m_use_alpha       = val; }
     void set_use_minz_as_default(bool   val) { m_minz_as_default = val; }
     void set_default_value      (double val) { m_default_value   = val; }
@@ -193,6 +249,96 @@ namespace asp{
     
   };
 
+  /// Wraps OrthoRasterizerView::accumulate() as an image, so that
+  /// it can be written to disk in one pass over the cloud.
+  class OrthoAccumulatorView: public ImageViewBase<OrthoAccumulatorView> {
+    OrthoRasterizerView const& m_rasterizer;
+    ImageViewRef<float> m_error_texture;
+
+  public:
+    typedef Vector3f pixel_type;
+    typedef const Vector3f result_type;
+    typedef ProceduralPixelAccessor<OrthoAccumulatorView> pixel_accessor;
+
+    OrthoAccumulatorView(OrthoRasterizerView const& rasterizer,
+                         ImageViewRef<float> const& error_texture):
+      m_rasterizer(rasterizer), m_error_texture(error_texture) {}
+
+    inline int32 cols  () const { return m_rasterizer.cols(); }
+    inline int32 rows  () const { return m_rasterizer.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "OrthoAccumulatorView::operator()(...) is not implemented.");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      return prerasterize_type(m_rasterizer.accumulate(bbox, m_error_texture),
+                               BBox2i(-bbox.min().x(), -bbox.min().y(), cols(), rows()));
+    }
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  /// Given the output of OrthoRasterizerView::accumulate() at some
+  /// grid spacing, find the DEM (channel 0) or the error (channel 1)
+  /// at a spacing which is an integer multiple of it, by averaging
+  /// the values, with their weights, over a window of that many fine
+  /// grid points centered at each coarse grid point. For an even
+  /// multiple the window ends get half the weight. The coarse grid
+  /// point (c, r) is at fine grid point offset + factor*(c, r). If
+  /// num_invalid_pixels is not null, the number of no-data pixels in
+  /// the rasterized tiles is added to it.
+  class AccumulatorAggregateView: public ImageViewBase<AccumulatorAggregateView> {
+    ImageViewRef<Vector3> m_accum;
+    int      m_factor;
+    Vector2i m_offset;
+    int      m_cols, m_rows, m_channel;
+    float    m_nodata_value;
+    std::int64_t * m_num_invalid_pixels;
+    vw::Mutex    * m_count_mutex;
+
+  public:
+    typedef PixelGray<float> pixel_type;
+    typedef const PixelGray<float> result_type;
+    typedef ProceduralPixelAccessor<AccumulatorAggregateView> pixel_accessor;
+
+    AccumulatorAggregateView(ImageViewRef<Vector3> const& accum, int factor,
+                             Vector2i const& offset, int cols, int rows,
+                             int channel, float nodata_value,
+                             std::int64_t * num_invalid_pixels = NULL,
+                             vw::Mutex * count_mutex = NULL);
+
+    inline int32 cols  () const { return m_cols; }
+    inline int32 rows  () const { return m_rows; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "AccumulatorAggregateView::operator()(...) is not implemented.");
+      return pixel_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const;
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+  };
+
+  /// The offset, in fine grid points, of the grid point (0, 0) of the
+  /// DEM with the given bounding box, relative to the DEM with the
+  /// bounding box fine_box and grid size fine_spacing, for use with
+  /// AccumulatorAggregateView. The rows go down from the top. Throw
+  /// an error if the coarse grid points are not on the fine grid.
+  Vector2i aggregate_offset(BBox3 const& fine_box, double fine_spacing, BBox3 const& box);
+
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
   void snap_bbox(const double spacing, BBox<double, N> &bbox ) {
@@ -19,16 +19,56 @@
 
 #include <vw/Core/Exception.h>
 #include <vw/Core/FundamentalTypes.h>
+#include <vw/Core/Log.h>
+#include <vw/Core/Thread.h>
 #include <asp/Core/Point2Grid.h>
 #include <vw/Math/Functors.h>
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
 using namespace std;
 using namespace vw;
 
 namespace asp {
-  
+
+namespace {
+
+  // The memory each Point2Grid instance can use to keep the values at
+  // grid nodes. A limit of 0 means no limit. Each instance has its own
+  // budget, rather than all sharing one, so that whether the values
+  // get summarized does not depend on what other threads are doing,
+  // and the output is the same from run to run.
+  size_t    g_val_memory_limit = 0;
+  vw::Mutex g_val_memory_mutex;
+  bool      g_val_memory_warned = false;
+
+  // The weighted value at which the cumulative weight reaches the
+  // given fraction of the total. The values must be sorted.
+  double weighted_quantile(std::vector< std::pair<double, double> > const& vals,
+                           double fraction) {
+    double total = 0.0;
+    for (size_t it = 0; it < vals.size(); it++)
+      total += vals[it].second;
+    double target = fraction * total, sum = 0.0;
+    for (size_t it = 0; it < vals.size(); it++) {
+      sum += vals[it].second;
+      if (sum >= target)
+        return vals[it].first;
+    }
+    return vals.back().first;
+  }
+
+} // end anonymous namespace
+
+void Point2Grid::set_memory_limit_mb(double limit_mb, int num_threads) {
+  if (limit_mb > 0)
+    g_val_memory_limit = size_t(limit_mb * 1024.0 * 1024.0 / std::max(num_threads, 1));
+  else
+    g_val_memory_limit = 0;
+}
+
 // ===========================================================================
 // Class Member Functions
 // ===========================================================================
@@ -41,7 +81,9 @@ Point2Grid::Point2Grid(int width, int height,
   m_width(width), m_height(height),
   m_buffer(buffer), m_weights(weights),
   m_x0(x0), m_y0(y0), m_grid_size(grid_size),
-  m_radius(radius), m_filter(filter), m_percentile(percentile){
+  m_radius(radius), m_radius2(radius*radius), m_inv_d2x(0.0),
+  m_filter(filter), m_percentile(percentile), m_clear_value(0.0), m_add_point(NULL),
+  m_keep_vals(false), m_val_capacity(0){
   
   if (m_grid_size <= 0)
     vw_throw( ArgumentErr() << "Point2Grid: Grid size must be > 0.\n" );
@@ -51,6 +93,16 @@ Point2Grid::Point2Grid(int width, int height,
   if (m_filter == f_percentile && (m_percentile < 0 || m_percentile > 100.0) )  
     vw_throw( ArgumentErr() << "Point2Grid: Expecting the percentile in the range 0.0 to 100.0.\n" );
 
+  switch (m_filter) {
+  case f_weighted_average: m_add_point = &Point2Grid::add_point<f_weighted_average>; break;
+  case f_min:              m_add_point = &Point2Grid::add_point<f_min>;              break;
+  case f_max:              m_add_point = &Point2Grid::add_point<f_max>;              break;
+  case f_mean:             m_add_point = &Point2Grid::add_point<f_mean>;             break;
+  case f_count:            m_add_point = &Point2Grid::add_point<f_count>;            break;
+  case f_stddev:           m_add_point = &Point2Grid::add_point<f_stddev>;           break;
+  default:                 m_add_point = &Point2Grid::add_point<f_median>; // keep all values
+  }
+
   // Stop here if we don't need to create gaussian weights
   if (m_filter != f_weighted_average) 
     return; 
@@ -68,37 +120,64 @@ Point2Grid::Point2Grid(int width, int height,
   if (sigma_factor > 0)
     sigma = sigma_factor/spacing/spacing;
   
-  // Sample the gaussian for speed
-  int num_samples = 1000;
-  m_dx = m_radius/(num_samples - 1.0);
+  // Sample the gaussian for speed. Sample it as a function of the
+  // squared distance, so that no square root is needed per grid node.
+  int num_samples = 8192;
+  m_inv_d2x = (num_samples - 1.0)/m_radius2;
   m_sampled_gauss.resize(num_samples);
   for (int k = 0; k < num_samples; k++){
-    double dist = k*m_dx;
-    m_sampled_gauss[k] = exp(-sigma*dist*dist);
+    double dist2 = k/m_inv_d2x;
+    m_sampled_gauss[k] = exp(-sigma*dist2);
   }
   
 }
 
+Point2Grid::~Point2Grid() {}
+
 void Point2Grid::Clear(const float value) {
+
+  // The value at nodes receiving no points, usually the no-data
+  // value. For the filters accumulating into the buffer, start from
+  // the neutral value instead, and put this back in normalize().
+  m_clear_value = value;
+  double start_value = value;
+  if (m_filter == f_weighted_average || m_filter == f_mean || m_filter == f_stddev)
+    start_value = 0.0;
+  else if (m_filter == f_min)
+    start_value = std::numeric_limits<double>::max();
+  else if (m_filter == f_max)
+    start_value = -std::numeric_limits<double>::max();
+  
   m_buffer.set_size (m_width, m_height);
   m_weights.set_size (m_width, m_height);
   for (int c = 0; c < m_buffer.cols(); c++){
     for (int r = 0; r < m_buffer.rows(); r++){
-      m_buffer (c, r) = value; // usually this is the no-data value
+      m_buffer (c, r) = start_value;
       m_weights(c, r) = 0.0;
     }
   }
 
-  // For these we need to keep all values (in fact, for stddev we could get away with less,
-  // but it is not worth trying so hard).
-  if (m_filter == f_median || m_filter == f_stddev ||
-      m_filter == f_nmad   || m_filter == f_percentile) {
-    m_vals.set_size(m_width, m_height);
-  }
-  
+  // The stddev is found from the sum and sum of squares at each node
+  if (m_filter == f_stddev)
+    m_sum2.assign(size_t(m_width) * m_height, 0.0);
+
+  // For these we need to keep all values
+  m_keep_vals = (m_filter == f_median || m_filter == f_nmad || m_filter == f_percentile);
+  std::vector<NodeVal>().swap(m_node_vals);
+  m_val_capacity = 0;
 }
 
 void Point2Grid::AddPoint(double x, double y, double z){
+  (this->*m_add_point)(x, y, z);
+}
+
+// Add the contribution of a point to all grid nodes within the search
+// radius. The grid rows are contiguous in memory, so loop over nodes
+// row by row, with the squared distance along x found just once per
+// point. The filter is a template parameter, so the inner loops have
+// no branches on it and can be vectorized.
+template <FilterType filter>
+void Point2Grid::add_point(double x, double y, double z){
 
   int minx = std::max( (int)ceil( (x - m_radius - m_x0)/m_grid_size ), 0 );
   int miny = std::max( (int)ceil( (y - m_radius - m_y0)/m_grid_size ), 0 );
@@ -106,103 +185,297 @@ void Point2Grid::AddPoint(double x, double y, double z){
   int maxx = std::min( (int)floor( (x + m_radius - m_x0)/m_grid_size ), m_buffer.cols() - 1 );
   int maxy = std::min( (int)floor( (y + m_radius - m_y0)/m_grid_size ), m_buffer.rows() - 1 );
 
-  // Add the contribution of current point to all grid points within radius
-  for (int ix = minx; ix <= maxx; ix++){
-    for (int iy = miny; iy <= maxy; iy++){
+  int nx = maxx - minx + 1;
+  if (nx <= 0 || miny > maxy)
+    return;
+
+  if ((int)m_dx2.size() < nx)
+    m_dx2.resize(nx);
+  double * dx2 = &m_dx2[0];
+  for (int k = 0; k < nx; k++) {
+    double gx = m_x0 + (minx + k)*m_grid_size;
+    dx2[k] = (x-gx)*(x-gx);
+  }
+
+  for (int iy = miny; iy <= maxy; iy++){
+
+    double gy  = m_y0 + iy*m_grid_size;
+    double dy2 = (y-gy)*(y-gy);
+    if (dy2 > m_radius2)
+      continue;
+    
+    double * buf = &m_buffer (minx, iy);
+    double * wts = &m_weights(minx, iy);
+
+    if (filter == f_weighted_average) {
+      double const* gauss = &m_sampled_gauss[0];
+#pragma omp simd
+      for (int k = 0; k < nx; k++) {
+        double dist2 = dx2[k] + dy2;
+        double wt = (dist2 <= m_radius2) ? gauss[(int)(dist2*m_inv_d2x + 0.5)] : 0.0;
+        buf[k] += z*wt;
+        wts[k] += wt;
+      }
       
-      double gx   = m_x0 + ix*m_grid_size;
-      double gy   = m_y0 + iy*m_grid_size;
-      double dist = sqrt( (x-gx)*(x-gx) + (y-gy)*(y-gy) );
-      if ( dist > m_radius ) continue;
-
-      if (m_filter == f_weighted_average) {
-        double wt = m_sampled_gauss[(int)round(dist/m_dx)];
-        if (wt <= 0)
-          continue;
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z*wt;
-        m_weights(ix, iy) += wt;
-
-      }else if (m_filter == f_mean){
-        if (m_weights(ix, iy) == 0)
-          m_buffer(ix, iy) = 0.0; // set to 0 before incrementing below
-        m_buffer(ix, iy)  += z;
-        m_weights(ix, iy) += 1;
-        
-      }else if (m_filter == f_min){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_buffer(ix, iy) = std::min(m_buffer(ix, iy), z);
+    }else if (filter == f_mean){
+#pragma omp simd
+      for (int k = 0; k < nx; k++) {
+        double in = (dx2[k] + dy2 <= m_radius2) ? 1.0 : 0.0;
+        buf[k] += z*in;
+        wts[k] += in;
+      }
       
-      }else if (m_filter == f_max){
-        if (m_weights(ix, iy) == 0) {
-          m_buffer(ix, iy)  = z; // first time we set the value
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_buffer(ix, iy) = std::max(m_buffer(ix, iy), z);
-        
-      }else if (m_filter == f_count){
-        if (m_weights(ix, iy) == 0) {
-          m_weights(ix, iy) = 1; // mark the fact that the buffer was initialized
-        }else
-          m_weights(ix, iy) += 1;
-        
-      }else if (m_filter == f_stddev || m_filter == f_median ||
-                m_filter == f_nmad   || m_filter == f_percentile){
-        m_vals(ix, iy).push_back(z); // not strictly needed for stddev
+    }else if (filter == f_min){
+#pragma omp simd
+      for (int k = 0; k < nx; k++) {
+        bool in = (dx2[k] + dy2 <= m_radius2);
+        buf[k] = (in && z < buf[k]) ? z : buf[k];
+        wts[k] = in ? 1.0 : wts[k]; // mark the fact that the node got a value
       }
       
+    }else if (filter == f_max){
+#pragma omp simd
+      for (int k = 0; k < nx; k++) {
+        bool in = (dx2[k] + dy2 <= m_radius2);
+        buf[k] = (in && z > buf[k]) ? z : buf[k];
+        wts[k] = in ? 1.0 : wts[k]; // mark the fact that the node got a value
+      }
+      
+    }else if (filter == f_stddev){
+      double * sum2 = &m_sum2[size_t(iy) * m_buffer.cols() + minx];
+#pragma omp simd
+      for (int k = 0; k < nx; k++) {
+        double in = (dx2[k] + dy2 <= m_radius2) ? 1.0 : 0.0;
+        buf[k]  += z*in;
+        sum2[k] += z*z*in;
+        wts[k]  += in;
+      }
+      
+    }else if (filter == f_count){
+#pragma omp simd
+      for (int k = 0; k < nx; k++) 
+        wts[k] += (dx2[k] + dy2 <= m_radius2) ? 1.0 : 0.0;
+      
+    }else{
+      // Keep all values, for the median and other such filters
+      for (int k = 0; k < nx; k++) {
+        if (dx2[k] + dy2 <= m_radius2)
+          add_val(minx + k, iy, z);
+      }
     }
-    
   }
 }
 
 void Point2Grid::normalize(){
+
+  if (m_keep_vals) {
+    normalize_vals();
+    return;
+  }
+  
   for (int c = 0; c < m_buffer.cols(); c++){
     for (int r = 0; r < m_buffer.rows(); r++){
 
+      if (m_filter == f_count) {
+        m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
+        continue;
+      }
+
+      if (m_weights(c, r) <= 0) {
+        m_buffer(c, r) = m_clear_value; // no points contributed
+        continue;
+      }
+      
       if (m_filter == f_weighted_average || m_filter == f_mean) {
-        if (m_weights(c, r) > 0)
-          m_buffer (c, r) /= m_weights(c, r);
+        m_buffer(c, r) /= m_weights(c, r);
+      } else if (m_filter == f_stddev) {
+        double n    = m_weights(c, r);
+        double mean = m_buffer(c, r) / n;
+        double sum2 = m_sum2[size_t(r) * m_buffer.cols() + c];
+        m_buffer(c, r) = sqrt(std::max(sum2/n - mean*mean, 0.0));
+      }
+    }
+  }
 
-      }else if (m_filter == f_count)
-        m_buffer(c, r) = m_weights(c, r); // hence instead of no-data we will have always 0
+  std::vector<double>().swap(m_sum2);
+}
 
-      else if (m_filter == f_stddev){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        vw::math::StdDevAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
-        m_buffer(c, r) = V.value();
+// Find the median, nmad, or percentile at each grid node from the
+// values kept for it. They are sorted by node in place, so no copy of
+// all values is made.
+void Point2Grid::normalize_vals(){
+
+  std::sort(m_node_vals.begin(), m_node_vals.end());
+  
+  std::vector<double> node_vals;
+  std::vector< std::pair<double, double> > weighted_vals;
+  size_t num_vals = m_node_vals.size();
+  size_t beg = 0;
+  while (beg < num_vals) {
+
+    // The values at the current node, and if they were summarized
+    int node = m_node_vals[beg].node;
+    size_t end = beg;
+    bool weighted = false;
+    while (end < num_vals && m_node_vals[end].node == node) {
+      if (m_node_vals[end].wt != 1.0)
+        weighted = true;
+      end++;
+    }
+    int c = node % m_buffer.cols(), r = node / m_buffer.cols();
+
+    if (weighted) {
+      // Approximate the statistic from the weighted summary. The
+      // values are already sorted.
+      weighted_vals.clear();
+      for (size_t it = beg; it < end; it++) 
+        weighted_vals.push_back(std::make_pair(double(m_node_vals[it].val),
+                                               double(m_node_vals[it].wt)));
+      
+      if (m_filter == f_median) {
+        m_buffer(c, r) = weighted_quantile(weighted_vals, 0.5);
+      } else if (m_filter == f_nmad) {
+        double median = weighted_quantile(weighted_vals, 0.5);
+        for (size_t it = 0; it < weighted_vals.size(); it++)
+          weighted_vals[it].first = fabs(weighted_vals[it].first - median);
+        std::sort(weighted_vals.begin(), weighted_vals.end());
+        m_buffer(c, r) = 1.4826 * weighted_quantile(weighted_vals, 0.5);
+      } else if (m_filter == f_percentile) {
+        m_buffer(c, r) = weighted_quantile(weighted_vals, m_percentile/100.0);
       }
       
-      else if (m_filter == f_median){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
+    } else {
+      node_vals.clear();
+      for (size_t it = beg; it < end; it++)
+        node_vals.push_back(m_node_vals[it].val);
+      
+      if (m_filter == f_median){
         vw::math::MedianAccumulator<double> V;
-        for (size_t it = 0; it < m_vals(c, r).size(); it++) 
-          V(m_vals(c, r)[it]);
+        for (size_t it = 0; it < node_vals.size(); it++) 
+          V(node_vals[it]);
         m_buffer(c, r) = V.value();
       }
-
+      
       else if (m_filter == f_nmad){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_nmad(m_vals(c, r));
+        m_buffer(c, r) = vw::math::destructive_nmad(node_vals);
       }
       
       else if (m_filter == f_percentile){
-        if (m_vals(c, r).empty())
-          continue; // nothing to compute
-        m_buffer(c, r) = vw::math::destructive_percentile(m_vals(c, r), m_percentile);
+        m_buffer(c, r) = vw::math::destructive_percentile(node_vals, m_percentile);
       }
-      
     }
+    
+    beg = end;
+  }
+
+  std::vector<NodeVal>().swap(m_node_vals);
+  m_val_capacity = 0;
+}
+
+// Append a value at a grid node, first making sure it fits within the
+// memory limit.
+void Point2Grid::add_val(int ix, int iy, double z) {
+  if (m_node_vals.size() >= m_val_capacity)
+    make_room_for_vals();
+  NodeVal v;
+  v.node = iy * m_buffer.cols() + ix;
+  v.val  = z;
+  v.wt   = 1.0;
+  m_node_vals.push_back(v);
+}
+
+size_t Point2Grid::val_memory_bytes() const {
+  return m_node_vals.capacity() * sizeof(NodeVal);
+}
+
+// The first time, allocate all the memory allowed, so the vector is
+// never reallocated, which would need the old and new memory at once.
+// When that is used up, summarize the values at each node in place.
+void Point2Grid::make_room_for_vals() {
+
+  if (g_val_memory_limit == 0) {
+    m_val_capacity = std::numeric_limits<size_t>::max(); // no limit
+    return;
+  }
+
+  size_t max_vals = g_val_memory_limit / sizeof(NodeVal);
+  if (m_node_vals.capacity() < max_vals) {
+    m_node_vals.reserve(max_vals);
+    m_val_capacity = max_vals;
+    return;
+  }
+
+  compact_vals();
+
+  // Compact again only after a good number of new values are added,
+  // as each compaction sorts all values.
+  if (m_node_vals.size() + max_vals/8 <= max_vals)
+    return;
+
+  // Each node is already summarized about as much as it can be. Go
+  // over the limit rather than fail.
+  {
+    vw::Mutex::Lock lock(g_val_memory_mutex);
+    if (!g_val_memory_warned) {
+      vw_out(WarningMessage) << "Exceeding the memory limit for the values at DEM grid "
+                             << "nodes. Consider decreasing the number of threads or "
+                             << "the tile size.\n";
+      g_val_memory_warned = true;
+    }
+  }
+  m_val_capacity = std::numeric_limits<size_t>::max();
+}
+
+// Replace the values at each node having more than MAX_VALS_PER_NODE
+// of them with that many weighted values. The values are sorted and
+// split into groups of about equal total weight, and each group is
+// replaced by its weighted mean. This is done in place. The output
+// for a node is never longer than its input, so it does not overwrite
+// values not yet read.
+void Point2Grid::compact_vals() {
+
+  std::sort(m_node_vals.begin(), m_node_vals.end());
+
+  size_t num_vals = m_node_vals.size();
+  size_t out = 0, beg = 0;
+  while (beg < num_vals) {
+
+    int node = m_node_vals[beg].node;
+    size_t end = beg;
+    double total = 0.0;
+    while (end < num_vals && m_node_vals[end].node == node) {
+      total += m_node_vals[end].wt;
+      end++;
+    }
+
+    if (end - beg <= size_t(MAX_VALS_PER_NODE)) {
+      for (size_t it = beg; it < end; it++)
+        m_node_vals[out++] = m_node_vals[it];
+      beg = end;
+      continue;
+    }
+
+    double group_wt = total / MAX_VALS_PER_NODE, sum = 0.0, wsum = 0.0, cum = 0.0;
+    int group = 0;
+    for (size_t it = beg; it < end; it++) {
+      double v = m_node_vals[it].val, w = m_node_vals[it].wt;
+      sum  += w * v;
+      wsum += w;
+      cum  += w;
+      if (it + 1 == end || cum >= (group + 1) * group_wt) {
+        NodeVal g;
+        g.node = node;
+        g.val  = sum / wsum;
+        g.wt   = wsum;
+        m_node_vals[out++] = g;
+        sum = 0.0; wsum = 0.0;
+        group++;
+      }
+    }
+    beg = end;
   }
+
+  m_node_vals.resize(out);
 }
   
 } // end namespace asp
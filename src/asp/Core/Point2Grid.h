@@ -24,6 +24,8 @@
 
 #include <vw/Image/ImageView.h>
 
+#include <vector>
+
 namespace asp {
 
   // The type of filter to apply to points within a circular bin.
@@ -42,23 +44,77 @@ namespace asp {
                double grid_size, double min_spacing, double radius,
                double sigma_factor,
                FilterType filter, double percentile);
-    ~Point2Grid(){}
+    ~Point2Grid();
     void Clear    (const float val);
     void AddPoint (double x, double y, double z);
     void normalize();
 
+    /// Limit the memory used to store the values at grid nodes for
+    /// the median, nmad, and percentile filters. The limit is split
+    /// evenly among the given number of threads, and each instance
+    /// gets one share, so the result does not depend on the order in
+    /// which tiles are processed. When the limit is reached, the
+    /// values at each node are summarized by at most
+    /// MAX_VALS_PER_NODE weighted values, which makes these filters
+    /// approximate. A non-positive value means no limit.
+    static void set_memory_limit_mb(double limit_mb, int num_threads);
+
+    /// How many weighted values are kept per grid node when the
+    /// memory limit is reached. The rank error of a quantile is then
+    /// about 1/MAX_VALS_PER_NODE.
+    static const int MAX_VALS_PER_NODE = 256;
+
+    /// The memory currently allocated for the values at grid nodes,
+    /// in bytes.
+    size_t val_memory_bytes() const;
+
   private:
     int m_width, m_height; // DEM dimensions
     vw::ImageView<double> & m_buffer;
     vw::ImageView<double> & m_weights;
-    vw::ImageView< std::vector<double> > m_vals; // when need to keep all individual values
     double     m_x0, m_y0; // lower-left corner
     double     m_grid_size;  // spacing between output DEM pixels
     double     m_radius;   // how far to search for cloud points
-    double     m_dx;       // spacing between samples
-    std::vector<double> m_sampled_gauss;
+    double     m_radius2;  // its square
+    double     m_inv_d2x;  // inverse of the spacing between samples of the squared distance
+    std::vector<double> m_sampled_gauss; // the weight as function of squared distance
     FilterType m_filter;
     double     m_percentile; // The actual value of the percentile to use if in that mode
+    double     m_clear_value; // the value at nodes receiving no points
+
+    // The squared x offsets from a point to the grid columns near it
+    std::vector<double> m_dx2;
+
+    // AddPoint() calls the add_point() instance for the current filter,
+    // so that the filter is not checked for each grid node.
+    typedef void (Point2Grid::*AddPointFun)(double x, double y, double z);
+    AddPointFun m_add_point;
+    template <FilterType filter> void add_point(double x, double y, double z);
+
+    // For the stddev filter, the sum of squares of the values at
+    // each node. The sum and count are kept in the buffer and weights.
+    std::vector<double> m_sum2;
+
+    // When all individual values must be kept, they are appended to
+    // one buffer, tagged by grid node, rather than stored in a vector
+    // per node, which would fragment the heap. The weights are 1 until
+    // the values are summarized to fit within the memory limit.
+    struct NodeVal {
+      int   node;
+      float val, wt;
+      // Order by grid node, and then by value
+      bool operator<(NodeVal const& b) const {
+        return node < b.node || (node == b.node && val < b.val);
+      }
+    };
+    bool                 m_keep_vals;
+    std::vector<NodeVal> m_node_vals;
+    size_t               m_val_capacity; // when to check the memory limit again
+
+    void add_val(int ix, int iy, double z);
+    void make_room_for_vals();
+    void compact_vals();
+    void normalize_vals();
 
   };
 
@@ -32,12 +32,16 @@
 #include <asp/Core/PointUtils.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Settings.h>
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/next.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
 
 using namespace vw;
 using namespace vw::cartography;
 using namespace pdal::filters;
+namespace fs = boost::filesystem;
 
 
 namespace asp{
@@ -69,76 +73,6 @@ namespace asp{
 
   };
 
-  class CsvReader: public BaseReader{
-    std::string  m_csv_file;
-    asp::CsvConv m_csv_conv;
-    bool         m_is_first_line;
-    bool         m_has_valid_point;
-    Vector3      m_curr_point;
-    std::ifstream * m_ifs;
-  public:
-
-    CsvReader(std::string const & csv_file,
-              asp::CsvConv const& csv_conv,
-              GeoReference const& georef)
-      : m_csv_file(csv_file), m_csv_conv(csv_conv),
-        m_is_first_line(true), m_has_valid_point(false) {
-
-      // We will convert from projected space to xyz, unless points
-      // are already in this format.
-      m_has_georef = (m_csv_conv.format != asp::CsvConv::XYZ);
-
-      m_georef      = georef;
-      m_num_points  = asp::csv_file_size(m_csv_file);
-
-      m_ifs = new std::ifstream ( m_csv_file.c_str() );
-      if ( !*m_ifs ) {
-        vw_throw( vw::IOErr() << "Unable to open file \"" << m_csv_file << "\"" );
-      }
-
-      VW_ASSERT(m_csv_conv.csv_format_str != "",
-                ArgumentErr() << "CsvReader: The CSV format was not specified.\n");
-
-    }
-
-    virtual bool ReadNextPoint(){
-
-      std::string line;
-      asp::CsvConv::CsvRecord vals;
-
-      // Keep on reading, until a valid point is hit or the end of the file
-      // is reached.
-      while (1){
-	
-        m_has_valid_point = static_cast<bool>(getline(*m_ifs, line, '\n'));
-        if (!m_has_valid_point) return m_has_valid_point; // reached end of file
-
-        vals = m_csv_conv.parse_csv_line(m_is_first_line, m_has_valid_point, line);
-        if (m_has_valid_point) break;
-      }
-
-      // Will return projected point and height or xyz. We really
-      // prefer projected points, as then the chipper will have an
-      // easier time grouping spatially points close together, as it
-      // operates the first two coordinates.
-      bool return_point_height = true;
-      m_curr_point
-	= m_csv_conv.csv_to_cartesian_or_point_height(vals, m_georef, return_point_height);
-
-      return m_has_valid_point;
-    }
-
-    virtual Vector3 GetPoint(){
-      return m_curr_point;
-    }
-
-    virtual ~CsvReader(){
-      delete m_ifs;
-      m_ifs = NULL;
-    }
-
-  }; // End class CsvReader
-
   void PcdReader::read_header() {
     // Open the file as text
     std::ifstream handle;
@@ -377,6 +311,226 @@ namespace asp{
 
   }; // End class LasOrCsvToTif_Class
 
+  /// Find the number of lines in a CSV file, and the byte offset of
+  /// the start of each chunk of lines_per_chunk lines.
+  std::int64_t csv_chunk_offsets(std::string const& csv_file,
+                                 std::int64_t lines_per_chunk,
+                                 std::vector<std::int64_t> & offsets) {
+
+    std::ifstream ifs(csv_file.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs)
+      vw_throw(vw::IOErr() << "Unable to open file \"" << csv_file << "\"");
+
+    offsets.clear();
+    offsets.push_back(0);
+
+    const int BUF_SIZE = 1 << 20;
+    std::vector<char> buf(BUF_SIZE);
+    std::int64_t num_lines = 0, pos = 0;
+    char last = '\n';
+    while (ifs) {
+      ifs.read(&buf[0], BUF_SIZE);
+      std::int64_t len = ifs.gcount();
+      if (len <= 0)
+        break;
+      const char * beg = &buf[0];
+      const char * end = beg + len;
+      const char * ptr = beg;
+      while ((ptr = static_cast<const char*>(memchr(ptr, '\n', end - ptr))) != NULL) {
+        ptr++;
+        num_lines++;
+        if (num_lines % lines_per_chunk == 0)
+          offsets.push_back(pos + (ptr - beg));
+      }
+      last = buf[len - 1];
+      pos += len;
+    }
+
+    // A last line with no newline at the end
+    if (last != '\n')
+      num_lines++;
+
+    // Do not start a chunk at the end of the file
+    if (offsets.size() > 1 && offsets.back() >= pos)
+      offsets.pop_back();
+
+    return num_lines;
+  }
+
+  /// Create a point cloud image from a LAS or CSV file, with the tile
+  /// of index k, in row-major order, holding the records (for LAS) or
+  /// lines (for CSV) from k*tile_len^2 to (k+1)*tile_len^2. Each tile
+  /// opens the file, seeks to its range, and bins its points with the
+  /// Chipper, so the tiles can be created in parallel. The result does
+  /// not depend on the number of threads.
+  class ChunkedLasOrCsvToTif: public ImageViewBase<ChunkedLasOrCsvToTif> {
+
+    std::string   m_file;
+    bool          m_is_las;
+    asp::CsvConv  m_csv_conv;
+    bool          m_has_georef;
+    GeoReference  m_georef;
+    std::int64_t  m_num_records;
+    std::vector<std::int64_t> m_csv_offsets; // start of each chunk of lines
+    boost::iostreams::mapped_file_source m_csv_map; // the CSV file, mapped in memory
+    int m_rows, m_cols; // These are pixel sizes, not tile counts.
+    int m_tile_len, m_block_size;
+
+    // Read the given range of records from a LAS file
+    void read_las_range(std::int64_t beg, std::int64_t end, PointBuffer & in) const {
+
+      std::ifstream ifs(m_file.c_str(), std::ios::in | std::ios::binary);
+      boost::shared_ptr<liblas::Reader> reader;
+      {
+        // Parsing the header may invoke the geotiff library, which is
+        // not thread-safe, so do it one thread at a time.
+        static vw::Mutex header_mutex;
+        vw::Mutex::Lock lock(header_mutex);
+        liblas::ReaderFactory f;
+        reader.reset(new liblas::Reader(f.CreateWithStream(ifs)));
+      }
+
+      if (!reader->Seek(beg))
+        vw_throw(IOErr() << "Could not seek to point " << beg << " in: " << m_file << "\n");
+
+      for (std::int64_t count = beg; count < end; count++) {
+        if (!reader->ReadNextPoint())
+          break;
+        liblas::Point const& p = reader->GetPoint();
+        in.push_back(Vector3(p.GetX(), p.GetY(), p.GetZ()));
+      }
+    }
+
+    // Read the points from the given chunk of lines of a CSV file. The file
+    // is memory-mapped, so this only parses the text of the chunk.
+    void read_csv_chunk(std::int64_t chunk, GeoReference const& georef,
+                        PointBuffer & in) const {
+
+      if (chunk >= (std::int64_t)m_csv_offsets.size() || !m_csv_map.is_open())
+        return; // past the end of the file
+      
+      const char* beg = m_csv_map.data() + m_csv_offsets[chunk];
+      const char* end = m_csv_map.data() + m_csv_map.size();
+
+      // Only the first line of the file can be the header
+      bool is_first_line = (chunk == 0);
+      std::int64_t lines_per_chunk = std::int64_t(m_tile_len)*m_tile_len;
+      asp::CsvConv::CsvColumns columns;
+      columns.reserve(lines_per_chunk);
+      m_csv_conv.parse_csv_lines(beg, end, is_first_line, lines_per_chunk, columns);
+
+      // Will return projected point and height or xyz. We really
+      // prefer projected points, as then the chipper will have an
+      // easier time grouping spatially points close together, as it
+      // operates the first two coordinates. The chunks are processed
+      // in parallel already, so this is not multi-threaded.
+      bool return_point_height = true;
+      for (size_t it = 0; it < columns.size(); it++)
+        in.push_back(m_csv_conv.csv_to_cartesian_or_point_height(columns.record(it), georef,
+                                                                 return_point_height));
+    }
+
+  public:
+
+    typedef Vector3 pixel_type;
+    typedef Vector3 result_type;
+    typedef ProceduralPixelAccessor<ChunkedLasOrCsvToTif> pixel_accessor;
+
+    ChunkedLasOrCsvToTif(std::string const& file, asp::CsvConv const& csv_conv,
+                         GeoReference const& csv_georef,
+                         int num_rows, int tile_len, int block_size):
+      m_file(file), m_csv_conv(csv_conv), m_has_georef(false),
+      m_num_records(0), m_tile_len(tile_len), m_block_size(block_size) {
+
+      m_is_las = asp::is_las(m_file);
+      if (m_is_las) {
+        std::ifstream ifs(m_file.c_str(), std::ios::in | std::ios::binary);
+        liblas::ReaderFactory f;
+        liblas::Reader reader = f.CreateWithStream(ifs);
+        LasReader las_reader(reader); // to get the georef the same way as before
+        m_num_records = las_reader.m_num_points;
+        m_has_georef  = las_reader.m_has_georef;
+        m_georef      = las_reader.m_georef;
+      } else {
+        VW_ASSERT(m_csv_conv.csv_format_str != "",
+                  ArgumentErr() << "ChunkedLasOrCsvToTif: The CSV format was not specified.\n");
+        // We will convert from projected space to xyz, unless points
+        // are already in this format.
+        m_has_georef  = (m_csv_conv.format != asp::CsvConv::XYZ);
+        m_georef      = csv_georef;
+        m_num_records = csv_chunk_offsets(m_file, std::int64_t(tile_len)*tile_len,
+                                          m_csv_offsets);
+        if (m_num_records > 0)
+          m_csv_map.open(m_file);
+      }
+      
+      int num_row_tiles = std::max(1, (int)ceil(double(num_rows)/tile_len));
+      m_rows = tile_len*num_row_tiles;
+
+      int records_per_row = (int)ceil(double(m_num_records)/m_rows);
+      int num_col_tiles   = std::max(1, (int)ceil(double(records_per_row)/tile_len));
+      m_cols = tile_len*num_col_tiles;
+    }
+
+    inline int32 cols  () const { return m_cols; }
+    inline int32 rows  () const { return m_rows; }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( size_t i, size_t j, size_t p=0 ) const {
+      vw_throw( NoImplErr() << "ChunkedLasOrCsvToTif::operator(...) has not been implemented.\n");
+      return result_type();
+    }
+
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    inline prerasterize_type prerasterize( BBox2i const& bbox ) const{
+
+      std::int64_t num_cols = bbox.width();
+      std::int64_t num_rows = bbox.height();
+
+      VW_ASSERT(bbox.min().x() % m_tile_len == 0 && bbox.min().y() % m_tile_len == 0 &&
+                num_cols == m_tile_len && num_rows == m_tile_len,
+                ArgumentErr() << "ChunkedLasOrCsvToTif: Expecting to be invoked "
+                              << "for one whole tile at a time.\n");
+
+      std::int64_t num_col_tiles = m_cols/m_tile_len;
+      std::int64_t chunk = (bbox.min().y()/m_tile_len)*num_col_tiles + bbox.min().x()/m_tile_len;
+      std::int64_t chunk_len = num_cols*num_rows;
+
+      // Tiles are created in parallel, so use a copy of the
+      // georeference, to not share the projection state.
+      GeoReference georef = m_georef;
+      
+      PointBuffer in;
+      if (m_is_las) {
+        std::int64_t beg = chunk*chunk_len;
+        std::int64_t end = std::min(beg + chunk_len, m_num_records);
+        if (beg < end)
+          read_las_range(beg, end, in);
+      } else {
+        read_csv_chunk(chunk, georef, in);
+      }
+
+      // Take the points just read, and put them in groups by spatial
+      // location, so that later point2dem does not need to read every
+      // input point when writing a given tile, but only certain groups.
+      ImageView<Vector3> Img;
+      Chipper(in, m_block_size, m_has_georef, georef, num_cols, num_rows, Img);
+
+      VW_ASSERT(num_cols == Img.cols() && num_rows == Img.rows(),
+                ArgumentErr() << "ChunkedLasOrCsvToTif: Size mis-match.\n");
+
+      return crop( Img, -bbox.min().x(), -bbox.min().y(), cols(), rows() );
+    }
+
+    template <class DestT>
+    inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+
+  }; // End class ChunkedLasOrCsvToTif
+
 } // namespace asp
 
 //------------------------------------------------------------------------------------------
@@ -562,49 +716,93 @@ bool asp::CsvConv::parse_georef(vw::cartography::GeoReference & georef) const {
 
 asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
                                                      std::string const& line) const {
-  // Parse a CSV file line in given format
-  success = true;
-
-  // Copy the input line into a temporary buffer
-  const int bufSize = 2048;
-  char temp[bufSize];
-  strncpy(temp, line.c_str(), bufSize);
-
-  std::string sep = asp::csv_separator();
-
-  int col_index = -1; // The current column we are reading
-  int num_floats_read = 0;
-  int num_values_read = 0;
+  return parse_csv_line(is_first_line, success, line.data(), line.data() + line.size());
+}
 
+// Parse the characters in [beg, end) of a CSV line in place. The tokens are
+// separated by runs of any of the characters in asp::csv_separator(), as with
+// strtok, but the line is not copied and need not be null-terminated. A token
+// can be put in double quotes, and then it may contain separators. A trailing
+// carriage return, as in files with Windows line endings, is ignored.
+asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool & success,
+                                                     const char* beg, const char* end) const {
+  success = true;
   CsvRecord values;
 
+  // Strip the line ending
+  while (end > beg && (end[-1] == '\n' || end[-1] == '\r'))
+    end--;
+
   // Quietly ignore empty lines, lines with spaces only, and lines starting with comments
-  if (line.empty() || line[0] == '#' || hasSpacesOnly(line)) {
+  const char* pos = beg;
+  while (pos < end && (*pos == ' ' || *pos == '\t'))
+    pos++;
+  if (pos == end || *pos == '#') {
     success = false;
     is_first_line = false;
     return values;
   }
-  
-  char * ptr = temp;
+
+  static const std::string sep = asp::csv_separator();
+  auto is_sep = [](char c) { return memchr(sep.data(), c, sep.size()) != NULL; };
+
+  int col_index = -1; // The current column we are reading
+  int num_floats_read = 0;
+  int num_values_read = 0;
+  pos = beg;
   while (1) {
 
     col_index++; // Increment the column counter
-    const char* token = strtok(ptr, sep.c_str());  // Split line on seperator char
-    ptr = NULL; // After the first call, strtok expects a null pointer as input.
-    if (token == NULL) break; // no more tokens
+
+    // Find the next token
+    while (pos < end && is_sep(*pos))
+      pos++;
+    if (pos == end) break; // no more tokens
+    const char* token = pos;
+    size_t len = 0;
+    if (*pos == '"') {
+      // A quoted token ends at the closing quote. Anything up to the next
+      // separator after that is ignored.
+      token = pos + 1;
+      const char* quote = (const char*)memchr(token, '"', end - token);
+      if (quote == NULL)
+        quote = end;
+      len = quote - token;
+      pos = quote;
+      while (pos < end && !is_sep(*pos))
+        pos++;
+    } else {
+      while (pos < end && !is_sep(*pos))
+        pos++;
+      len = pos - token;
+    }
+
     if (num_values_read >= this->num_fields) break; // read enough values
 
     // Check if this is one of the columns we need to read
-    if (this->col2name.find(col_index) == this->col2name.end())
+    auto it = this->col2name.find(col_index);
+    if (it == this->col2name.end())
       continue;
 
-    if (this->col2name.at(col_index) == "file") // This is a string input
-      values.file = token;
-    else {
-      // Parse the floating point value from the token
-      double val;
-      int flag = sscanf(token, "%lg", &val);
-      if (flag == 0){ // Handle parsing failure
+    if (it->second == "file") { // This is a string input
+      values.file = std::string(token, len);
+    } else {
+      // Parse the floating point value from the token. It is copied first, as
+      // strtod() needs a null-terminated string.
+      const size_t bufSize = 64;
+      char buf[bufSize];
+      std::string long_token;
+      const char* str = buf;
+      if (len < bufSize) {
+        memcpy(buf, token, len);
+        buf[len] = '\0';
+      } else {
+        long_token = std::string(token, len);
+        str = long_token.c_str();
+      }
+      char * str_end = NULL;
+      double val = strtod(str, &str_end);
+      if (str_end == str) { // Handle parsing failure
         success = false;
         break;
       }
@@ -621,8 +819,8 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
 
   if (!success) {
     if (!is_first_line) {
-      // Not the header
-      vw_out () << "Failed to read line: " << line << "\n";
+      // Not the header. Print with one call, as this may be used from several threads.
+      vw_out() << "Failed to read line: " + std::string(beg, end) + "\n";
     }
   }
 
@@ -630,6 +828,51 @@ asp::CsvConv::CsvRecord asp::CsvConv::parse_csv_line(bool & is_first_line, bool
   return values;
 }
 
+void asp::CsvConv::CsvColumns::clear() {
+  for (int i = 0; i < 3; i++)
+    col[i].clear();
+}
+
+void asp::CsvConv::CsvColumns::reserve(size_t n) {
+  for (int i = 0; i < 3; i++)
+    col[i].reserve(n);
+}
+
+void asp::CsvConv::CsvColumns::push_back(CsvRecord const& record) {
+  for (int i = 0; i < 3; i++)
+    col[i].push_back(record.point_data[i]);
+}
+
+void asp::CsvConv::CsvColumns::append(CsvColumns const& other) {
+  for (int i = 0; i < 3; i++)
+    col[i].insert(col[i].end(), other.col[i].begin(), other.col[i].end());
+}
+
+asp::CsvConv::CsvRecord asp::CsvConv::CsvColumns::record(size_t k) const {
+  CsvRecord record;
+  for (int i = 0; i < 3; i++)
+    record.point_data[i] = col[i][k];
+  return record;
+}
+
+const char* asp::CsvConv::parse_csv_lines(const char* beg, const char* end,
+                                          bool is_first_line, std::int64_t max_lines,
+                                          CsvColumns & columns) const {
+  bool success = false;
+  std::int64_t count = 0;
+  while (beg < end && (max_lines < 0 || count < max_lines)) {
+    const char* line_end = (const char*)memchr(beg, '\n', end - beg);
+    if (line_end == NULL)
+      line_end = end; // the last line need not end with a newline
+    CsvRecord record = parse_csv_line(is_first_line, success, beg, line_end);
+    if (success)
+      columns.push_back(record);
+    beg = std::min(line_end + 1, end);
+    count++;
+  }
+  return beg;
+}
+
 // Search for "color = red" and find "red". Return false on failure.
 // Can handle uppercase strings, also "color=red" and "color red".
 bool parse_color(std::string const& line, std::string & color) {
@@ -670,31 +913,154 @@ bool parse_color(std::string const& line, std::string & color) {
 size_t asp::CsvConv::read_csv_file(std::string    const & file_path,
 				   std::list<CsvRecord> & output_list) const {
 
+  std::vector<CsvRecord> records;
+  read_csv_file(file_path, records);
+  output_list.assign(records.begin(), records.end());
+
+  return output_list.size();
+}
+
+namespace {
+
+  // Map a CSV file in memory rather than reading it line by line. Return
+  // false if the file is empty, as then it cannot be mapped.
+  bool map_csv_file(std::string const& file_path,
+                    boost::iostreams::mapped_file_source & file) {
+    if (!fs::exists(file_path))
+      vw_throw(vw::IOErr() << "Unable to open file \"" << file_path << "\"");
+    if (fs::file_size(file_path) == 0)
+      return false;
+    try {
+      file.open(file_path);
+    } catch (const std::exception& e) {
+      vw_throw(vw::IOErr() << "Unable to open file \"" << file_path << "\": " << e.what());
+    }
+    return true;
+  }
+
+  // Split the text of a CSV file into ranges of whole lines. Make a few
+  // ranges per thread for load balancing, but do not bother for small files.
+  // Range r is [range_beg[r], range_beg[r+1]).
+  void csv_line_ranges(const char* data, size_t size, int num_threads,
+                       std::vector<size_t> & range_beg) {
+    const size_t min_range_size = 1024 * 1024;
+    size_t num_ranges = std::min(size_t(4 * num_threads), size / min_range_size);
+    num_ranges = std::max(num_ranges, size_t(1));
+    range_beg.assign(1, 0);
+    for (size_t k = 1; k < num_ranges; k++) {
+      size_t pos = std::max(range_beg.back(), k * (size / num_ranges));
+      const char* newline = (const char*)memchr(data + pos, '\n', size - pos);
+      if (newline == NULL)
+        break;
+      size_t next = (newline - data) + 1;
+      if (next >= size)
+        break;
+      range_beg.push_back(next);
+    }
+    range_beg.push_back(size);
+  }
+
+  // The number of lines in [beg, end), counting a last line with no newline
+  size_t csv_num_lines(const char* beg, const char* end) {
+    size_t num_lines = 0;
+    const char* ptr = beg;
+    while (ptr < end && (ptr = (const char*)memchr(ptr, '\n', end - ptr)) != NULL) {
+      ptr++;
+      num_lines++;
+    }
+    if (beg < end && end[-1] != '\n')
+      num_lines++;
+    return num_lines;
+  }
+
+} // end anonymous namespace
+
+size_t asp::CsvConv::read_csv_file(std::string      const & file_path,
+                                   std::vector<CsvRecord> & records) const {
+
   // Clear output object
-  output_list.clear();
+  records.clear();
+
+  boost::iostreams::mapped_file_source file;
+  if (!map_csv_file(file_path, file))
+    return 0;
+  const char* data = file.data();
+
+  int num_threads = vw_settings().default_num_threads();
+  std::vector<size_t> range_beg;
+  csv_line_ranges(data, file.size(), num_threads, range_beg);
+  size_t num_ranges = range_beg.size() - 1;
+
+  // Parse the ranges in parallel. Only the first line in the file can be a header.
+  std::vector<std::vector<CsvRecord>> range_records(num_ranges);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+  for (size_t r = 0; r < num_ranges; r++) {
+    bool is_first_line = (r == 0);
+    bool success = false;
+    const char* beg       = data + range_beg[r];
+    const char* range_end = data + range_beg[r + 1];
+    while (beg < range_end) {
+      const char* end = (const char*)memchr(beg, '\n', range_end - beg);
+      if (end == NULL)
+        end = range_end;
+      CsvRecord record = parse_csv_line(is_first_line, success, beg, end);
+      if (success)
+        range_records[r].push_back(record);
+      beg = end + 1;
+    }
+  }
 
-  // Open input file
-  std::ifstream file( file_path.c_str() );
-  if (!file)
-    vw_throw(vw::IOErr() << "Unable to open file \"" << file_path << "\"");
+  // Put together the results, in the order of lines in the file
+  size_t num_records = 0;
+  for (size_t r = 0; r < num_ranges; r++)
+    num_records += range_records[r].size();
+  records.reserve(num_records);
+  for (size_t r = 0; r < num_ranges; r++) {
+    records.insert(records.end(), range_records[r].begin(), range_records[r].end());
+    std::vector<CsvRecord>().swap(range_records[r]); // release the memory
+  }
 
-  // Read through all the lines of the input file, parse each line, and build the output list.
-  bool success;
-  bool first_line = true; // TODO(oalexan1): Wipe this variable.
-  std::string line = "";
-  
-  while (std::getline(file, line, '\n')) {
-    
-    CsvRecord new_record = asp::CsvConv::parse_csv_line(first_line, success, line);
-    if (success)
-      output_list.push_back(new_record);
-    
-    first_line = false;
+  return records.size();
+}
+
+size_t asp::CsvConv::read_csv_file(std::string const & file_path,
+                                   CsvColumns        & columns) const {
+
+  columns.clear();
+
+  boost::iostreams::mapped_file_source file;
+  if (!map_csv_file(file_path, file))
+    return 0;
+  const char* data = file.data();
+
+  int num_threads = vw_settings().default_num_threads();
+  std::vector<size_t> range_beg;
+  csv_line_ranges(data, file.size(), num_threads, range_beg);
+  size_t num_ranges = range_beg.size() - 1;
+
+  // Parse the ranges in parallel. The buffers for each range are allocated
+  // upfront, for the number of lines in it.
+  std::vector<CsvColumns> range_columns(num_ranges);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+  for (size_t r = 0; r < num_ranges; r++) {
+    const char* beg = data + range_beg[r];
+    const char* end = data + range_beg[r + 1];
+    range_columns[r].reserve(csv_num_lines(beg, end));
+    bool is_first_line = (r == 0);
+    parse_csv_lines(beg, end, is_first_line, -1, range_columns[r]);
   }
 
-  file.close();
+  // Put together the results, in the order of lines in the file
+  size_t num_records = 0;
+  for (size_t r = 0; r < num_ranges; r++)
+    num_records += range_columns[r].size();
+  columns.reserve(num_records);
+  for (size_t r = 0; r < num_ranges; r++) {
+    columns.append(range_columns[r]);
+    range_columns[r] = CsvColumns(); // release the memory
+  }
 
-  return output_list.size();
+  return columns.size();
 }
 
 size_t asp::CsvConv::read_poly_file(std::string    const & file_path,
@@ -874,6 +1240,36 @@ vw::Vector3 asp::CsvConv::csv_to_cartesian(CsvRecord const& csv,
   return xyz;
 }
 
+void asp::CsvConv::csv_to_cartesian(std::vector<CsvRecord> const& records,
+                                    vw::cartography::GeoReference const& geo,
+                                    std::vector<vw::Vector3> & xyz) const {
+  xyz.resize(records.size());
+  int num_threads = vw_settings().default_num_threads();
+#pragma omp parallel num_threads(num_threads)
+  {
+    // Each thread uses its own copy of the georeference, to not share the
+    // projection state.
+    vw::cartography::GeoReference local_geo = geo;
+#pragma omp for schedule(static)
+    for (size_t it = 0; it < records.size(); it++)
+      xyz[it] = csv_to_cartesian(records[it], local_geo);
+  }
+}
+
+void asp::CsvConv::csv_to_cartesian(CsvColumns const& columns,
+                                    vw::cartography::GeoReference const& geo,
+                                    std::vector<vw::Vector3> & xyz) const {
+  xyz.resize(columns.size());
+  int num_threads = vw_settings().default_num_threads();
+#pragma omp parallel num_threads(num_threads)
+  {
+    vw::cartography::GeoReference local_geo = geo;
+#pragma omp for schedule(static)
+    for (size_t it = 0; it < columns.size(); it++)
+      xyz[it] = csv_to_cartesian(columns.record(it), local_geo);
+  }
+}
+
 // Returns Vector3(lon, lat, height_above_datum)
 vw::Vector3 asp::CsvConv::csv_to_geodetic(CsvRecord const& csv,
                                           vw::cartography::GeoReference const& geo) const {
@@ -989,36 +1385,31 @@ void asp::las_or_csv_to_tif(std::string const& in_file,
   Vector2 original_tile_size = opt->raster_tile_size;
   opt->raster_tile_size = tile_size;
 
-  boost::shared_ptr<asp::BaseReader> reader_ptr;
-  std::ifstream ifs;
-  liblas::ReaderFactory las_reader_factory;
-  boost::shared_ptr<liblas::Reader> laslib_reader_ptr;
-
-  if (asp::is_csv(in_file)){ // CSV
+  if (asp::is_csv(in_file) || asp::is_las(in_file)){ // CSV or LAS
 
-    reader_ptr = boost::shared_ptr<asp::CsvReader>
-      (new asp::CsvReader(in_file, csv_conv, csv_georef));
+    // Each tile reads its own range of the file, so the tiles can be
+    // read and binned in parallel.
+    ImageViewRef<Vector3> Img
+      = asp::ChunkedLasOrCsvToTif(in_file, csv_conv, csv_georef, num_rows,
+                                  TILE_LEN, block_size);
+    vw::cartography::block_write_gdal_image(out_file, Img, *opt,
+                                            TerminalProgressCallback("asp", "\t--> "));
 
   }else if (asp::is_pcd(in_file)){ // PCD
 
-    reader_ptr = boost::shared_ptr<asp::PcdReader>( new asp::PcdReader(in_file) );
+    boost::shared_ptr<asp::BaseReader> reader_ptr
+      = boost::shared_ptr<asp::PcdReader>( new asp::PcdReader(in_file) );
+    ImageViewRef<Vector3> Img
+      = asp::LasOrCsvToTif_Class<ImageView<Vector3>>(reader_ptr.get(), num_rows,
+                                                       TILE_LEN, block_size);
 
-  }else if (asp::is_las(in_file)){ // LAS
-
-    ifs.open(in_file.c_str(), std::ios::in | std::ios::binary);
-    laslib_reader_ptr.reset(new liblas::Reader(las_reader_factory.CreateWithStream(ifs)));
-    reader_ptr = boost::shared_ptr<asp::LasReader>(new asp::LasReader(*laslib_reader_ptr));
+    // Must use a thread only, as we read the input file serially.
+    vw::cartography::write_gdal_image(out_file, Img, *opt,
+                                      TerminalProgressCallback("asp", "\t--> "));
 
   }else
     vw_throw( ArgumentErr() << "Unknown file type: " << in_file << "\n");
 
-  ImageViewRef<Vector3> Img
-    = asp::LasOrCsvToTif_Class<ImageView<Vector3>>(reader_ptr.get(), num_rows,
-                                                     TILE_LEN, block_size);
-
-  // Must use a thread only, as we read the input file serially.
-  vw::cartography::write_gdal_image(out_file, Img, *opt, TerminalProgressCallback("asp", "\t--> ") );
-
   // Restore the original tile size
   opt->raster_tile_size = original_tile_size;
 }
@@ -64,6 +64,19 @@ namespace asp {
       std::string file;
     };
 
+    /// The numeric values read from a CSV file, stored by column. Element k
+    /// of col[i] is point_data[i] of the record for the k-th valid line.
+    /// File names are not kept.
+    struct CsvColumns{
+      std::vector<double> col[3];
+      size_t size() const {return col[0].size();}
+      void clear();
+      void reserve(size_t n);
+      void push_back(CsvRecord const& record);
+      void append(CsvColumns const& other);
+      CsvRecord record(size_t k) const;
+    };
+
 
   public: // Functions
 
@@ -96,9 +109,27 @@ namespace asp {
                               std::string const& line) const;
 
     /// Reads an entire CSV file and stores a record for each line.
-    /// - Intended for use with smaller files.
     size_t read_csv_file(std::string const    & file_path,
                          std::list<CsvRecord> & output_list) const;
+
+    /// Reads an entire CSV file and stores a record for each line, in file
+    /// order. The file is memory-mapped and split at line boundaries into
+    /// ranges which are parsed in parallel.
+    size_t read_csv_file(std::string const      & file_path,
+                         std::vector<CsvRecord> & records) const;
+
+    /// As above, but store the numeric values by column. Use this when the
+    /// file column is not needed, as for point2dem, pc_align and geodiff.
+    size_t read_csv_file(std::string const & file_path,
+                         CsvColumns        & columns) const;
+
+    /// Parse at most max_lines lines (all if max_lines is negative) starting
+    /// at beg, and not going past end, and append the values of the valid
+    /// lines to the columns. The text need not end with a newline. Return a
+    /// pointer past the last line that was parsed.
+    const char* parse_csv_lines(const char* beg, const char* end,
+                                bool is_first_line, std::int64_t max_lines,
+                                CsvColumns & columns) const;
       
     /// Reads an entire CSV file having polygons. Individual
     /// polygons are separated by a newline or some other unexpected text.
@@ -120,6 +151,14 @@ namespace asp {
     vw::Vector3 csv_to_cartesian(CsvRecord const& csv,
                                  vw::cartography::GeoReference const& geo) const;
 
+    /// Convert in parallel a batch of values read from a csv file to Cartesian points.
+    void csv_to_cartesian(std::vector<CsvRecord> const& records,
+                          vw::cartography::GeoReference const& geo,
+                          std::vector<vw::Vector3> & xyz) const;
+    void csv_to_cartesian(CsvColumns const& columns,
+                          vw::cartography::GeoReference const& geo,
+                          std::vector<vw::Vector3> & xyz) const;
+
     /// Convert values read from a csv file using parse_csv_line to a lon/lat/height point.
     vw::Vector3 csv_to_geodetic(CsvRecord const& csv,
                                 vw::cartography::GeoReference const& geo) const;
@@ -165,6 +204,10 @@ namespace asp {
     ///  column type will go.
     static int get_sorted_index_for_name(std::string const& name);
 
+    /// Parse the characters in [beg, end) of a line. This does not copy the line.
+    CsvRecord parse_csv_line(bool & is_first_line, bool & success,
+                             const char* beg, const char* end) const;
+
   }; // End class CsvConv
 
   /// Fetch a chunk of the las file of area TILE_LEN x TILE_LEN,
@@ -234,9 +277,35 @@ namespace asp {
   /// Given a point cloud with n channels, return the first m channels.
   /// We must have 1 <= m <= n <= 6.
   /// If the image was written by subtracting a shift, put that shift back.
+  /// A cloud in the compact format is decoded to doubles.
   template<int m>
   vw::ImageViewRef<vw::Vector<double, m>> read_asp_point_cloud(std::string const& filename);
 
+  /// Decode a pixel of a point cloud saved in the compact format. See
+  /// asp::QuantizePoint. Invalid points become (0, 0, 0). A point is invalid
+  /// if any of its coordinates is no-data, as a valid one never encodes to that.
+  template <int m>
+  struct DequantizePoint: public vw::ReturnFixedType<vw::Vector<double, m>> {
+    vw::Vector3 m_shift;
+    vw::Vector2 m_quanta;
+    DequantizePoint(vw::Vector3 const& shift, vw::Vector2 const& quanta):
+      m_shift(shift), m_quanta(quanta) {}
+    vw::Vector<double, m> operator() (vw::Vector<vw::int32, m> const& pt) const {
+      vw::Vector<double, m> out;
+      for (int it = 0; it < std::min(m, 3); it++) {
+        if (pt[it] == asp::ASP_COMPACT_CLOUD_NODATA)
+          return out;
+      }
+      for (int it = 0; it < m; it++) {
+        if (it < 3)
+          out[it] = pt[it] * m_quanta[0] + m_shift[it];
+        else
+          out[it] = pt[it] * m_quanta[1];
+      }
+      return out;
+    }
+  };
+
   /// Hide these functions from external users
   namespace point_utils_private {
 
@@ -386,6 +455,15 @@ vw::ImageViewRef<vw::Vector<double, m>> read_asp_point_cloud(std::string const&
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
+  // A compact cloud is read with its own integer type, then decoded
+  std::string quanta_str;
+  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_QUANTUM_TAG_STR,
+                                          quanta_str)) {
+    vw::Vector2 quanta = vw::str_to_vec<vw::Vector2>(quanta_str);
+    return vw::per_pixel_filter(vw::read_channels<m, vw::int32>(filename, 0),
+                                DequantizePoint<m>(shift, quanta));
+  }
+
   // Read the first m channels
   vw::ImageViewRef<vw::Vector<double, m>> out_image
     = vw::read_channels<m, double>(filename, 0);
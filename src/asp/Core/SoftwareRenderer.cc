@@ -47,6 +47,8 @@
 #include <asp/Core/SoftwareRenderer.h>
 
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 using namespace vw;
@@ -628,6 +630,120 @@ static void FillTriangle(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c) {
   }
 }
 
+// Floor of a / 2^shift, also for negative a
+inline vw::int64 FloorDiv(vw::int64 a, int shift) {
+  return (a >= 0) ? (a >> shift) : -((-a + (vw::int64(1) << shift) - 1) >> shift);
+}
+
+// Rasterize a triangle with integer edge functions, within the clip
+// rectangle. As in FillTriangle(), pixel (ix, iy) is sampled at the
+// window point (ix + 1, iy + 1). It is drawn if that point is inside
+// the triangle or on its right or top edges, but not if on its left or
+// bottom edges, so pixels on edges shared by two triangles are drawn
+// once. Vertices are snapped to 1/256 of a pixel. The colors are
+// evaluated with the plane equation, and a row of pixels is filled with
+// SIMD.
+static void FillTriangleEdges(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c) {
+
+  // The fixed-point arithmetic would overflow for huge coordinates. Such
+  // triangles do not happen in practice, so just use the scanline code.
+  const double maxCoord = double(1 << 20);
+  const Vertex *v[3] = {a, b, c};
+  for (int i = 0; i < 3; i++) {
+    if (!(std::abs(v[i]->window.x) < maxCoord) || !(std::abs(v[i]->window.y) < maxCoord)) {
+      FillTriangle(gc, a, b, c);
+      return;
+    }
+  }
+
+  const int kSubPixelBits = 8;
+  const double kScale = double(1 << kSubPixelBits);
+  vw::int64 x[3], y[3];
+  for (int i = 0; i < 3; i++) {
+    x[i] = std::lrint(v[i]->window.x * kScale);
+    y[i] = std::lrint(v[i]->window.y * kScale);
+  }
+
+  // The pixels whose sample points are within the triangle bounds. Most
+  // triangles are tiny, so many of them have none.
+  vw::int64 minX = std::min(x[0], std::min(x[1], x[2]));
+  vw::int64 maxX = std::max(x[0], std::max(x[1], x[2]));
+  vw::int64 minY = std::min(y[0], std::min(y[1], y[2]));
+  vw::int64 maxY = std::max(y[0], std::max(y[1], y[2]));
+  int ix0 = std::max(vw::int64(gc->clipX0),     FloorDiv(minX - 1, kSubPixelBits));
+  int ix1 = std::min(vw::int64(gc->clipX1 - 1), FloorDiv(maxX, kSubPixelBits) - 1);
+  int iy0 = std::max(vw::int64(gc->clipY0),     FloorDiv(minY - 1, kSubPixelBits));
+  int iy1 = std::min(vw::int64(gc->clipY1 - 1), FloorDiv(maxY, kSubPixelBits) - 1);
+  if (ix0 > ix1 || iy0 > iy1)
+    return;
+
+  // Make the triangle counter-clockwise, so the interior is to the left of
+  // each edge
+  vw::int64 area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+  if (area == 0)
+    return;
+  if (area < 0) {
+    std::swap(v[1], v[2]);
+    std::swap(x[1], x[2]);
+    std::swap(y[1], y[2]);
+  }
+
+  // Edge i goes from vertex i to vertex i + 1. Its edge function is
+  // positive inside the triangle. Subtract one on the left and bottom
+  // edges, so a sample is drawn if all edge functions are non-negative.
+  vw::int64 edge[3], stepX[3], stepY[3];
+  vw::int64 px0 = vw::int64(ix0 + 1) << kSubPixelBits;
+  vw::int64 py0 = vw::int64(iy0 + 1) << kSubPixelBits;
+  for (int i = 0; i < 3; i++) {
+    int j = (i + 1) % 3;
+    vw::int64 dx = x[j] - x[i], dy = y[j] - y[i];
+    bool inclusive = (dy > 0 || (dy == 0 && dx < 0));
+    edge[i]  = dx * (py0 - y[i]) - dy * (px0 - x[i]) - (inclusive ? 0 : 1);
+    stepX[i] = -dy * (1 << kSubPixelBits);
+    stepY[i] =  dx * (1 << kSubPixelBits);
+  }
+
+  // The color plane
+  double gray = gc->currentFlatColor.r, drdx = 0.0, drdy = 0.0;
+  double ax = v[0]->window.x, ay = v[0]->window.y;
+  if (gc->rasterInfo.modeFlags & eShadeSmooth) {
+    double ux = v[1]->window.x - ax, uy = v[1]->window.y - ay;
+    double wx = v[2]->window.x - ax, wy = v[2]->window.y - ay;
+    double det = ux * wy - uy * wx;
+    if (det == 0.0)
+      return;
+    double dr1 = v[1]->color.r - v[0]->color.r;
+    double dr2 = v[2]->color.r - v[0]->color.r;
+    gray = v[0]->color.r;
+    drdx = (dr1 * wy - dr2 * uy) / det;
+    drdy = (ux * dr2 - wx * dr1) / det;
+  }
+
+  int length = ix1 - ix0 + 1;
+  for (int iy = iy0; iy <= iy1; iy++) {
+    vw::int64 e0 = edge[0], e1 = edge[1], e2 = edge[2];
+    vw::int64 s0 = stepX[0], s1 = stepX[1], s2 = stepX[2];
+    double rowGray = gray + drdx * (ix0 + 1.0 - ax) + drdy * (iy + 1.0 - ay);
+    float *span = &gc->buffer[iy * gc->width + ix0];
+#pragma omp simd
+    for (int k = 0; k < length; k++) {
+      if (((e0 + k * s0) | (e1 + k * s1) | (e2 + k * s2)) >= 0)
+        span[k] = float(rowGray + drdx * k);
+    }
+    for (int i = 0; i < 3; i++)
+      edge[i] += stepY[i];
+  }
+}
+
+// Draw a triangle with the chosen algorithm
+static void DrawTriangle(GraphicsState *gc, Vertex *a, Vertex *b, Vertex *c,
+                         bool useEdgeFunctions) {
+  if (useEdgeFunctions)
+    FillTriangleEdges(gc, a, b, c);
+  else
+    FillTriangle(gc, a, b, c);
+}
+
 inline void
 MapToWindow(Coords &coords,
             const double ndcMap[3][2],
@@ -704,6 +820,10 @@ SoftwareRenderer::SoftwareRenderer(const int width, const int height, float *buf
   graphicsState->clipX1 = m_bufferWidth;
   graphicsState->clipY1 = m_bufferHeight;
   m_graphicsState = graphicsState;
+
+  m_useEdgeFunctions = false;
+  m_deferred = false;
+  m_numThreads = 1;
 }
 
 // Free up resources that are allocated in the constructor
@@ -738,6 +858,7 @@ SoftwareRenderer::Ortho2D(const double left, const double right,
 
 void
 SoftwareRenderer::Clear(const float value) {
+  m_triangles.clear(); // would be overwritten anyway
   int bufferSize = m_bufferWidth * m_bufferHeight;
   for (int i = 0; i < bufferSize; ++i)
     m_buffer[i] = value;
@@ -800,7 +921,20 @@ SoftwareRenderer::DrawPolygon(const int startIndex, const int numVertices) {
                 0.0, 0.0, double(m_bufferWidth), double(m_bufferHeight),
                 vertex2.window);
 
-    FillTriangle((GraphicsState *) m_graphicsState, &vertex0, &vertex1, &vertex2);
+    if (m_deferred) {
+      size_t n = m_triangles.size();
+      m_triangles.resize(n + 3 * kVerticesPerTriangle);
+      float *tri = &m_triangles[n];
+      const Vertex *v[3] = {&vertex0, &vertex1, &vertex2};
+      for (int k = 0; k < kVerticesPerTriangle; k++) {
+        tri[3 * k + 0] = v[k]->window.x;
+        tri[3 * k + 1] = v[k]->window.y;
+        tri[3 * k + 2] = v[k]->color.r;
+      }
+    } else {
+      DrawTriangle((GraphicsState *) m_graphicsState, &vertex0, &vertex1, &vertex2,
+                   m_useEdgeFunctions);
+    }
 
     vertexIndex1 += m_triangleVertexStep;
     vertexIndex2 += m_triangleVertexStep;
@@ -808,3 +942,59 @@ SoftwareRenderer::DrawPolygon(const int startIndex, const int numVertices) {
     colorIndex2 += m_triangleColorStep;
   }
 }
+
+void
+SoftwareRenderer::SetUseEdgeFunctions(const bool useEdgeFunctions) {
+  m_useEdgeFunctions = useEdgeFunctions;
+}
+
+void
+SoftwareRenderer::SetDeferred(const bool deferred, const int numThreads) {
+  if (!deferred)
+    Flush();
+  m_deferred = deferred;
+  m_numThreads = std::max(numThreads, 1);
+}
+
+void
+SoftwareRenderer::Flush() {
+  const int kFloatsPerTriangle = 3 * kVerticesPerTriangle;
+  const int kBandHeight = 32;
+  int numTriangles = m_triangles.size() / kFloatsPerTriangle;
+  if (numTriangles == 0 || m_bufferHeight <= 0)
+    return;
+
+  // Bin the triangles into bands of rows, by the rows they may touch. A
+  // triangle may be in several bands, and it is clipped to each of them.
+  int numBands = (m_bufferHeight + kBandHeight - 1) / kBandHeight;
+  std::vector<std::vector<int>> bands(numBands);
+  for (int t = 0; t < numTriangles; t++) {
+    const float *tri = &m_triangles[t * kFloatsPerTriangle];
+    float minY = std::min(tri[1], std::min(tri[4], tri[7]));
+    float maxY = std::max(tri[1], std::max(tri[4], tri[7]));
+    if (!std::isfinite(minY) || !std::isfinite(maxY))
+      continue;
+    float r0 = std::max(minY - 1.0f, 0.0f);
+    float r1 = std::min(maxY + 1.0f, float(m_bufferHeight - 1));
+    if (r0 > r1)
+      continue;
+    for (int band = int(r0) / kBandHeight; band <= int(r1) / kBandHeight; band++)
+      bands[band].push_back(t);
+  }
+
+  // The bands are disjoint, so they can be drawn in parallel
+  GraphicsState *gc = (GraphicsState *) m_graphicsState;
+#pragma omp parallel for num_threads(m_numThreads) schedule(dynamic, 1)
+  for (int band = 0; band < numBands; band++) {
+    GraphicsState local = *gc;
+    local.clipY0 = std::max(gc->clipY0, band * kBandHeight);
+    local.clipY1 = std::min(gc->clipY1, (band + 1) * kBandHeight);
+    for (size_t it = 0; it < bands[band].size(); it++) {
+      float *tri = &m_triangles[bands[band][it] * kFloatsPerTriangle];
+      Vertex vertex0(&tri[0], tri[2]), vertex1(&tri[3], tri[5]), vertex2(&tri[6], tri[8]);
+      DrawTriangle(&local, &vertex0, &vertex1, &vertex2, m_useEdgeFunctions);
+    }
+  }
+
+  m_triangles.clear();
+}
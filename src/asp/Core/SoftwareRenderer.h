@@ -22,6 +22,8 @@
 #ifndef __VW_STEREO_SOFTWARE_RENDERER_H__
 #define __VW_STEREO_SOFTWARE_RENDERER_H__
 
+#include <vector>
+
 namespace vw {
 namespace stereo {
 
@@ -36,6 +38,23 @@ namespace stereo {
       void SetColorPointer(const int numComponents, float * const colors);
       void DrawPolygon(const int startIndex, const int numVertices);
 
+      // Rasterize triangles with integer edge functions rather than
+      // with the scanline algorithm. This is faster for small triangles.
+      // The results differ from the scanline ones by the coverage of
+      // some pixels on triangle edges and by the rounding of colors.
+      void SetUseEdgeFunctions(const bool useEdgeFunctions);
+
+      // Record the triangles passed to DrawPolygon() rather than
+      // drawing them, until Flush() is called. Then the triangles are
+      // binned into bands of rows, which are rasterized in parallel
+      // with the given number of threads. The triangles in each band are
+      // drawn in order, so the result is the same as when drawing right
+      // away, for any number of threads.
+      void SetDeferred(const bool deferred, const int numThreads = 1);
+
+      // Draw the recorded triangles
+      void Flush();
+
     private:
       int m_numVertexComponents;
       float *m_vertexPointer;
@@ -50,6 +69,10 @@ namespace stereo {
       double m_transformNDC[3][2];
       double m_transformViewport[3][2];
       void *m_graphicsState;
+      bool m_useEdgeFunctions;
+      bool m_deferred;
+      int m_numThreads;
+      std::vector<float> m_triangles; // window x, y, and gray, per vertex
     };
   }
 }
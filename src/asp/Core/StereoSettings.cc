@@ -419,6 +419,8 @@ namespace asp {
        "How much to round the output point cloud values, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10 for Earth and proportionally less for smaller bodies, unless error propagation happens, when it is set by default to 1e-8 meters, to avoid introducing step artifacts in these errors.")
       ("save-double-precision-point-cloud", po::bool_switch(&global.save_double_precision_point_cloud)->default_value(false)->implicit_value(true),
        "Save the final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at twice the storage).")
+      ("compact-point-cloud", po::bool_switch(&global.compact_point_cloud)->default_value(false)->implicit_value(true),
+       "Save the final point cloud as 32-bit integers, storing the offset of each point from the cloud center in multiples of about 1 mm for Earth (or of --point-cloud-rounding-error if coarser), and the triangulation error rounded as for the default format. This has the same uncompressed size as the default format, but compresses much better. The point cloud readers in ASP decode it transparently.")
       
       ("compute-point-cloud-center-only",   po::bool_switch(&global.compute_point_cloud_center_only)->default_value(false)->implicit_value(true),
                                             "Only compute the center of triangulated point cloud and exit.")
@@ -59,3 +59,50 @@ TEST(Bathymetry, BathyStereoModel) {
   EXPECT_NEAR(sin(theta1), water_refraction_index * sin(theta2), 1e-12);
 }
 
+
+// Bend rays at a water surface which is a plane in a local
+// stereographic projection. The faster approach, which reuses the
+// local frame from one ray to the next, must agree with the original one.
+TEST(Bathymetry, CurvedWaterSurface) {
+
+  double water_refraction_index = 1.333;
+  double water_ht = -5.0;
+
+  vw::cartography::GeoReference projection;
+  projection.set_datum(vw::cartography::Datum("WGS_1984"));
+  double proj_lat = 27.0, proj_lon = -78.0;
+  projection.set_stereographic(proj_lat, proj_lon, 1.0);
+  vw::cartography::Datum const& datum = projection.datum();
+
+  // The plane z = water_ht in projected coordinates
+  std::vector<double> plane;
+  plane.push_back(0.0);
+  plane.push_back(0.0);
+  plane.push_back(1.0);
+  plane.push_back(-water_ht);
+
+  Vector3 camCtr = datum.geodetic_to_cartesian(Vector3(proj_lon + 0.5, proj_lat - 0.3, 700000.0));
+  
+  WaterSurfaceFrame frame;
+  for (int it = 0; it < 5; it++) {
+    // Rays for nearby pixels
+    Vector3 ground = datum.geodetic_to_cartesian(Vector3(proj_lon + 0.01 * it,
+                                                         proj_lat + 0.002 * it, 0.0));
+    Vector3 camDir = normalize(ground - camCtr);
+    
+    Vector3 waterCtr1, waterDir1, waterCtr2, waterDir2;
+    bool ans1 = asp::snells_law_curved(camCtr, camDir, plane, projection,
+                                       water_refraction_index, waterCtr1, waterDir1);
+    bool ans2 = asp::snells_law_curved_local(camCtr, camDir, plane, projection,
+                                             water_refraction_index, frame,
+                                             waterCtr2, waterDir2);
+    EXPECT_TRUE(ans1);
+    EXPECT_TRUE(ans2);
+    EXPECT_VECTOR_NEAR(waterCtr1, waterCtr2, 1e-3);
+    EXPECT_VECTOR_NEAR(waterDir1, waterDir2, 1e-6);
+
+    // The new point is on the water surface and on the ray
+    EXPECT_NEAR(datum.cartesian_to_geodetic(waterCtr2)[2], water_ht, 1e-3);
+    EXPECT_NEAR(norm_2(cross_prod(normalize(waterCtr2 - camCtr), camDir)), 0.0, 1e-10);
+  }
+}
@@ -0,0 +1,81 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/BundleAdjustUtils.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( BundleAdjustUtils, PartitionCamerasSpatially ) {
+
+  // Two strips of cameras far from each other, listed interleaved
+  std::vector<Vector3> centers;
+  for (int i = 0; i < 10; i++) {
+    centers.push_back(Vector3(i, 0, 100));
+    centers.push_back(Vector3(i, 1000, 100));
+  }
+
+  std::vector<int> submap_ids;
+  int num_submaps = partition_cameras_spatially(centers, 10, submap_ids);
+  ASSERT_EQ(2, num_submaps);
+  ASSERT_EQ(centers.size(), submap_ids.size());
+  for (size_t icam = 0; icam < centers.size(); icam++)
+    EXPECT_EQ(submap_ids[icam % 2], submap_ids[icam]);
+  EXPECT_NE(submap_ids[0], submap_ids[1]);
+
+  // A single submap when there are few cameras
+  EXPECT_EQ(1, partition_cameras_spatially(centers, 100, submap_ids));
+  for (size_t icam = 0; icam < centers.size(); icam++)
+    EXPECT_EQ(0, submap_ids[icam]);
+}
+
+TEST( BundleAdjustUtils, FindSubmapSeparators ) {
+
+  // Cameras 0 and 1 are in submap 0, cameras 2 and 3 in submap 1.
+  // Point 2 is seen by cameras 1 and 2, so it is a separator point.
+  std::vector<std::vector<int>> cam_points(4);
+  cam_points[0].push_back(0);
+  cam_points[0].push_back(1);
+  cam_points[1].push_back(1);
+  cam_points[1].push_back(2);
+  cam_points[2].push_back(2);
+  cam_points[2].push_back(3);
+  cam_points[3].push_back(3);
+  std::vector<int> submap_ids;
+  submap_ids.push_back(0);
+  submap_ids.push_back(0);
+  submap_ids.push_back(1);
+  submap_ids.push_back(1);
+
+  std::vector<bool> sep_points;
+  std::set<int> sep_cams;
+  find_submap_separators(cam_points, submap_ids, 4, sep_points, sep_cams);
+  ASSERT_EQ(4u, sep_points.size());
+  EXPECT_FALSE(sep_points[0]);
+  EXPECT_FALSE(sep_points[1]);
+  EXPECT_TRUE (sep_points[2]);
+  EXPECT_FALSE(sep_points[3]);
+  ASSERT_EQ(2u, sep_cams.size());
+  EXPECT_TRUE(sep_cams.count(1) > 0);
+  EXPECT_TRUE(sep_cams.count(2) > 0);
+
+  submap_ids.pop_back();
+  EXPECT_THROW(find_submap_separators(cam_points, submap_ids, 4, sep_points, sep_cams),
+               ArgumentErr);
+}
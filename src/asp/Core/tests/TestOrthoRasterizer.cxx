@@ -0,0 +1,316 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/OrthoRasterizer.h>
+#include <vw/Image/Manipulation.h>
+#include <vw/Math/Statistics.h>
+#include <vw/Core/Settings.h>
+
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <random>
+#include <limits>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // The brute force median filter, computing the median of each window
+  void filter_by_median_brute_force(ImageView<Vector3> & image,
+                                    Vector2 const& median_filter_params) {
+    int    half   = median_filter_params[0]/2;
+    double thresh = median_filter_params[1];
+    if (half <= 0 || thresh <= 0)
+      return;
+
+    int nc = image.cols(), nr = image.rows();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    ImageView<Vector3> image_out = copy(image);
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
+        if (boost::math::isnan(image(col, row).z()))
+          continue;
+        std::vector<double> vals;
+        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
+          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
+            if (!boost::math::isnan(image(c, r).z()))
+              vals.push_back(image(c, r).z());
+          }
+        }
+        double median = vw::math::destructive_median(vals);
+        if (fabs(median - image(col, row).z()) > thresh)
+          image_out(col, row).z() = nan;
+      }
+    }
+    image = copy(image_out);
+  }
+
+  // The erosion done as erode_len passes over the 3x3 neighborhoods
+  void erode_image_brute_force(ImageView<Vector3> & image, int erode_len) {
+    int nc = image.cols(), nr = image.rows();
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    for (int pass = 0; pass < erode_len; pass++){
+      ImageView<Vector3> prev = copy(image);
+      for (int col = 0; col < nc; col++){
+        for (int row = 0; row < nr; row++){
+          for (int c = std::max(col-1, 0); c <= std::min(col+1, nc-1); c++){
+            for (int r = std::max(row-1, 0); r <= std::min(row+1, nr-1); r++){
+              if (boost::math::isnan(prev(c, r).z()))
+                image(col, row).z() = nan;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // A random point image with heights from the given distribution,
+  // some spikes, and some invalid points
+  template <class DistT>
+  ImageView<Vector3> random_image(int nc, int nr, DistT & height, double spike,
+                                  std::mt19937 & gen) {
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    ImageView<Vector3> image(nc, nr);
+    for (int col = 0; col < nc; col++){
+      for (int row = 0; row < nr; row++){
+        double z = height(gen);
+        double p = u(gen);
+        if (p < 0.1)
+          z = nan;
+        else if (p < 0.15)
+          z += (u(gen) < 0.5 ? -spike : spike);
+        image(col, row) = Vector3(col, row, z);
+      }
+    }
+    return image;
+  }
+
+  void expect_same_heights(ImageView<Vector3> const& a, ImageView<Vector3> const& b) {
+    ASSERT_EQ(a.cols(), b.cols());
+    ASSERT_EQ(a.rows(), b.rows());
+    for (int col = 0; col < a.cols(); col++){
+      for (int row = 0; row < a.rows(); row++){
+        double za = a(col, row).z(), zb = b(col, row).z();
+        EXPECT_EQ(boost::math::isnan(za), boost::math::isnan(zb));
+        if (!boost::math::isnan(za) && !boost::math::isnan(zb))
+          EXPECT_EQ(za, zb);
+      }
+    }
+  }
+  
+}
+
+// The sliding histogram median must give the same result as the brute
+// force median.
+TEST(OrthoRasterizer, MedianFilter) {
+
+  std::mt19937 gen(7);
+
+  // Continuous heights
+  std::normal_distribution<double> normal(100.0, 3.0);
+  for (int window = 1; window <= 8; window++) {
+    ImageView<Vector3> image = random_image(57, 43, normal, 20.0, gen);
+    ImageView<Vector3> fast = copy(image), slow = copy(image);
+    filter_by_median(fast, Vector2(window, 2.0));
+    filter_by_median_brute_force(slow, Vector2(window, 2.0));
+    expect_same_heights(fast, slow);
+  }
+
+  // Integer heights and an integer threshold, so many heights are
+  // exactly at the threshold from the median, and the quantized median
+  // can't decide. Then the exact median is used.
+  std::uniform_int_distribution<int> integers(0, 4);
+  for (int window = 3; window <= 7; window += 2) {
+    ImageView<Vector3> image = random_image(40, 31, integers, 3.0, gen);
+    ImageView<Vector3> fast = copy(image), slow = copy(image);
+    filter_by_median(fast, Vector2(window, 1.0));
+    filter_by_median_brute_force(slow, Vector2(window, 1.0));
+    expect_same_heights(fast, slow);
+  }
+
+  // A height range too large for the number of bins, so the histogram
+  // bins are clamped, and the exact median is used near the ends.
+  std::normal_distribution<double> wide(0.0, 20.0);
+  for (int window = 3; window <= 9; window += 3) {
+    ImageView<Vector3> image = random_image(45, 38, wide, 1000.0, gen);
+    ImageView<Vector3> fast = copy(image), slow = copy(image);
+    filter_by_median(fast, Vector2(window, 0.01));
+    filter_by_median_brute_force(slow, Vector2(window, 0.01));
+    expect_same_heights(fast, slow);
+  }
+}
+
+// The separable erosion must give the same result as repeated passes
+// of 3x3 erosion.
+TEST(OrthoRasterizer, Erosion) {
+
+  std::mt19937 gen(11);
+  std::normal_distribution<double> normal(100.0, 3.0);
+  for (int erode_len = 0; erode_len <= 5; erode_len++) {
+    for (int trial = 0; trial < 3; trial++) {
+      ImageView<Vector3> image = random_image(37, 29, normal, 0.0, gen);
+      // Sparser invalid points, so that some valid points remain
+      std::uniform_real_distribution<double> u(0.0, 1.0);
+      for (int col = 0; col < image.cols(); col++){
+        for (int row = 0; row < image.rows(); row++){
+          if (boost::math::isnan(image(col, row).z()) && u(gen) < 0.85)
+            image(col, row).z() = 100.0;
+        }
+      }
+      ImageView<Vector3> fast = copy(image), slow = copy(image);
+      erode_image(fast, erode_len);
+      erode_image_brute_force(slow, erode_len);
+      expect_same_heights(fast, slow);
+    }
+  }
+}
+
+// The DEMs aggregated from one gridding at the finest spacing must
+// agree with the DEMs gridded separately at each spacing. The cloud is
+// a plane, sampled on a regular grid, and the search radius does not
+// pass through cloud points, so both approaches reproduce the plane
+// away from the edges. At the finest spacing they must agree
+// everywhere.
+TEST(OrthoRasterizer, DemPyramid) {
+
+  int num = 121;
+  double pc_spacing = 0.5;
+  ImageView<Vector3> points(num, num);
+  for (int col = 0; col < num; col++) {
+    for (int row = 0; row < num; row++) {
+      double x = col * pc_spacing, y = row * pc_spacing;
+      points(col, row) = Vector3(x, y, 0.3*x - 0.2*y + 10.0);
+    }
+  }
+  ImageViewRef<Vector3> point_image = points;
+
+  float nodata = -32768.0;
+  double search_radius_factor = 1.1;
+  ImageViewRef<double> error_image;
+  std::int64_t num_invalid_pixels = 0;
+  vw::Mutex count_mutex;
+  OrthoRasterizerView rasterizer(point_image, select_channel(point_image, 2),
+                                 search_radius_factor, 0.0, false, 16, BBox2(),
+                                 NO_OUTLIER_REMOVAL_METHOD, Vector2(75.0, 3.0),
+                                 error_image, 0.0, BBox3(), 0.0,
+                                 Vector2(0, 0), 0, false, "mean", 1.0,
+                                 &num_invalid_pixels, &count_mutex,
+                                 ProgressCallback::dummy_instance());
+  rasterizer.set_use_alpha(false);
+  rasterizer.set_use_minz_as_default(false);
+  rasterizer.set_default_value(nodata);
+
+  double fine_spacing = 1.0;
+  rasterizer.initialize_spacing(fine_spacing);
+  BBox3 fine_box = rasterizer.bounding_box();
+  ImageView<Vector3f> accum_f = OrthoAccumulatorView(rasterizer, ImageViewRef<float>());
+  ImageView<Vector3> accum(accum_f.cols(), accum_f.rows());
+  for (int col = 0; col < accum.cols(); col++) {
+    for (int row = 0; row < accum.rows(); row++)
+      accum(col, row) = Vector3(accum_f(col, row));
+  }
+
+  for (int factor = 1; factor <= 4; factor++) {
+    double spacing = factor * fine_spacing;
+    rasterizer.initialize_spacing(spacing);
+    BBox3 box = rasterizer.bounding_box();
+    ImageView<PixelGray<float>> direct = rasterizer;
+
+    Vector2i offset = aggregate_offset(fine_box, fine_spacing, box);
+    ImageView<PixelGray<float>> pyramid
+      = AccumulatorAggregateView(accum, factor, offset,
+                                 rasterizer.cols(), rasterizer.rows(), 0, nodata);
+    ASSERT_EQ(direct.cols(), pyramid.cols());
+    ASSERT_EQ(direct.rows(), pyramid.rows());
+
+    int num_compared = 0;
+    for (int col = 0; col < direct.cols(); col++) {
+      for (int row = 0; row < direct.rows(); row++) {
+        if (factor == 1) {
+          EXPECT_EQ(direct(col, row).v(), pyramid(col, row).v());
+          continue;
+        }
+        // The coarse grid point, with rows going down from the top
+        double x = box.min().x() + col * spacing, y = box.max().y() - row * spacing;
+        if (x < 8.0 || x > 52.0 || y < 8.0 || y > 52.0)
+          continue;
+        EXPECT_NEAR(direct(col, row).v(), 0.3*x - 0.2*y + 10.0, 1e-4);
+        EXPECT_NEAR(direct(col, row).v(), pyramid(col, row).v(), 1e-4);
+        num_compared++;
+      }
+    }
+    if (factor > 1)
+      EXPECT_GT(num_compared, 0);
+  }
+
+  // A DEM whose grid points are not on the fine grid
+  BBox3 shifted_box = fine_box;
+  shifted_box.min().x() += 0.5 * fine_spacing;
+  EXPECT_THROW(aggregate_offset(fine_box, fine_spacing, shifted_box), ArgumentErr);
+}
+
+// With --use-surface-sampling, a DEM with fewer tiles than threads is
+// rasterized by bands of rows in parallel. That must not change the result.
+TEST(OrthoRasterizer, SurfaceSamplingThreads) {
+
+  int num = 121;
+  double pc_spacing = 0.5;
+  std::mt19937 gen(3);
+  std::uniform_real_distribution<double> jitter(-0.2, 0.2);
+  ImageView<Vector3> points(num, num);
+  for (int col = 0; col < num; col++) {
+    for (int row = 0; row < num; row++) {
+      double x = col * pc_spacing + jitter(gen), y = row * pc_spacing + jitter(gen);
+      points(col, row) = Vector3(x, y, 5.0 * sin(0.3 * x) + 3.0 * cos(0.2 * y));
+    }
+  }
+  ImageViewRef<Vector3> point_image = points;
+
+  ImageViewRef<double> error_image;
+  std::int64_t num_invalid_pixels = 0;
+  vw::Mutex count_mutex;
+  bool use_surface_sampling = true;
+  OrthoRasterizerView rasterizer(point_image, select_channel(point_image, 2),
+                                 1.1, 0.0, use_surface_sampling, 16, BBox2(),
+                                 NO_OUTLIER_REMOVAL_METHOD, Vector2(75.0, 3.0),
+                                 error_image, 0.0, BBox3(), 0.0,
+                                 Vector2(0, 0), 0, false, "weighted_average", 1.0,
+                                 &num_invalid_pixels, &count_mutex,
+                                 ProgressCallback::dummy_instance());
+  rasterizer.set_use_alpha(false);
+  rasterizer.set_use_minz_as_default(false);
+  rasterizer.set_default_value(-32768.0);
+  rasterizer.initialize_spacing(0.25);
+
+  int orig_num_threads = vw_settings().default_num_threads();
+  vw_settings().set_default_num_threads(1);
+  ImageView<PixelGray<float>> serial = rasterizer;
+  vw_settings().set_default_num_threads(4);
+  ImageView<PixelGray<float>> parallel = rasterizer;
+  vw_settings().set_default_num_threads(orig_num_threads);
+
+  ASSERT_EQ(serial.cols(), parallel.cols());
+  ASSERT_EQ(serial.rows(), parallel.rows());
+  for (int col = 0; col < serial.cols(); col++) {
+    for (int row = 0; row < serial.rows(); row++)
+      EXPECT_EQ(serial(col, row).v(), parallel(col, row).v());
+  }
+}
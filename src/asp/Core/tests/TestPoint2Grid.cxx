@@ -0,0 +1,277 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/Point2Grid.h>
+#include <vw/Core/Stopwatch.h>
+
+#include <random>
+#include <limits>
+#include <cmath>
+#include <thread>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // Grid many random points with the given filter and return the DEM.
+  // Optionally return the most memory used for the values at nodes.
+  ImageView<double> grid_random_points(FilterType filter, size_t * max_bytes = NULL) {
+    ImageView<double> buffer, weights;
+    Point2Grid grid(20, 20, buffer, weights,
+                    0.0, 0.0,  // x0, y0
+                    1.0, 1.0,  // grid size, min spacing
+                    1.5, 0.0,  // radius, sigma factor
+                    filter, 75.0);
+    grid.Clear(-1.0);
+    std::mt19937 gen(3);
+    std::uniform_real_distribution<double> xy(0.0, 20.0);
+    std::normal_distribution<double> z(100.0, 5.0);
+    for (int it = 0; it < 200000; it++) {
+      double x = xy(gen), y = xy(gen);
+      grid.AddPoint(x, y, z(gen));
+      if (max_bytes != NULL)
+        *max_bytes = std::max(*max_bytes, grid.val_memory_bytes());
+    }
+    grid.normalize();
+    return buffer;
+  }
+  
+}
+
+// Compare the gridding with a direct evaluation of each filter at
+// each node, over all points, as Point2Grid did before it visited only
+// the nodes near each point with a tabulated gaussian. Points cover
+// only part of the grid, so the nodes receiving no points are checked
+// as well.
+TEST(Point2Grid, SplattingMatchesDirectEvaluation) {
+
+  int width = 30, height = 25;
+  double x0 = -3.0, y0 = 2.0, grid_size = 0.7, radius = 2.0;
+  double clear_value = -32768.0;
+  
+  std::mt19937 gen(5);
+  std::uniform_real_distribution<double> xd(x0, x0 + 0.6 * width * grid_size);
+  std::uniform_real_distribution<double> yd(y0, y0 + height * grid_size);
+  std::normal_distribution<double> zd(100.0, 5.0);
+  std::vector<Vector3> points;
+  for (int it = 0; it < 5000; it++) {
+    double x = xd(gen), y = yd(gen);
+    points.push_back(Vector3(x, y, zd(gen)));
+  }
+
+  // The default gaussian, as set up in the Point2Grid constructor
+  double sigma = -log(0.25) / grid_size / grid_size;
+  
+  FilterType filters[] = {f_weighted_average, f_min, f_max, f_mean, f_count};
+  for (int it = 0; it < 5; it++) {
+    FilterType filter = filters[it];
+    ImageView<double> buffer, weights;
+    Point2Grid grid(width, height, buffer, weights, x0, y0, grid_size, grid_size,
+                    radius, 0.0, filter, 0.0);
+    grid.Clear(clear_value);
+    for (size_t p = 0; p < points.size(); p++)
+      grid.AddPoint(points[p][0], points[p][1], points[p][2]);
+    grid.normalize();
+
+    int num_empty = 0;
+    for (int c = 0; c < width; c++) {
+      for (int r = 0; r < height; r++) {
+        double gx = x0 + c * grid_size, gy = y0 + r * grid_size;
+        double sum = 0.0, wsum = 0.0, count = 0.0;
+        double min_z = std::numeric_limits<double>::max(), max_z = -min_z;
+        for (size_t p = 0; p < points.size(); p++) {
+          double dist = sqrt((points[p][0] - gx) * (points[p][0] - gx) +
+                             (points[p][1] - gy) * (points[p][1] - gy));
+          if (dist > radius)
+            continue;
+          double z = points[p][2];
+          double wt = (filter == f_weighted_average) ? exp(-sigma * dist * dist) : 1.0;
+          sum   += wt * z;
+          wsum  += wt;
+          count += 1.0;
+          min_z = std::min(min_z, z);
+          max_z = std::max(max_z, z);
+        }
+
+        if (filter == f_count) {
+          EXPECT_EQ(buffer(c, r), count);
+          continue;
+        }
+        
+        if (count == 0) {
+          num_empty++;
+          EXPECT_EQ(buffer(c, r), clear_value);
+          continue;
+        }
+        
+        if (filter == f_weighted_average)
+          EXPECT_NEAR(buffer(c, r), sum / wsum, 5e-3);
+        else if (filter == f_mean)
+          EXPECT_NEAR(buffer(c, r), sum / wsum, 1e-9);
+        else if (filter == f_min)
+          EXPECT_EQ(buffer(c, r), min_z);
+        else if (filter == f_max)
+          EXPECT_EQ(buffer(c, r), max_z);
+      }
+    }
+    if (filter != f_count)
+      EXPECT_GT(num_empty, 0);
+  }
+}
+
+TEST(Point2Grid, QuantilesWithMemoryLimit) {
+
+  FilterType filters[] = {f_median, f_nmad, f_percentile, f_stddev};
+  for (int it = 0; it < 4; it++) {
+
+    // With no memory limit all values are kept
+    Point2Grid::set_memory_limit_mb(0, 1);
+    ImageView<double> exact = grid_random_points(filters[it]);
+
+    // With a small limit, the values at each node get summarized
+    Point2Grid::set_memory_limit_mb(2.0, 1);
+    ImageView<double> approx = grid_random_points(filters[it]);
+
+    for (int c = 0; c < exact.cols(); c++) {
+      for (int r = 0; r < exact.rows(); r++) {
+        EXPECT_NE(exact(c, r), -1.0);
+        EXPECT_NEAR(exact(c, r), approx(c, r), 0.2);
+      }
+    }
+  }
+
+  Point2Grid::set_memory_limit_mb(0, 1);
+}
+
+// Each instance has its own share of the memory limit, so gridding in
+// several threads at once gives the same result as gridding alone.
+TEST(Point2Grid, MemoryLimitIsPerThread) {
+
+  int num_threads = 4;
+  Point2Grid::set_memory_limit_mb(8.0, num_threads);
+  ImageView<double> alone = grid_random_points(f_median);
+
+  std::vector<ImageView<double>> results(num_threads);
+  std::vector<std::thread> threads;
+  for (int it = 0; it < num_threads; it++)
+    threads.push_back(std::thread([&results, it]() {
+          results[it] = grid_random_points(f_median);
+        }));
+  for (int it = 0; it < num_threads; it++)
+    threads[it].join();
+
+  for (int it = 0; it < num_threads; it++) {
+    for (int c = 0; c < alone.cols(); c++) {
+      for (int r = 0; r < alone.rows(); r++)
+        EXPECT_EQ(alone(c, r), results[it](c, r));
+    }
+  }
+  
+  Point2Grid::set_memory_limit_mb(0, 1);
+}
+
+// The memory allocated for the values at grid nodes, including any
+// spare capacity, never goes over the limit. About 1.4 million values
+// are added, which would take over 16 MB if all were kept.
+TEST(Point2Grid, MemoryLimitIsEnforced) {
+
+  double limit_mb = 2.0;
+  Point2Grid::set_memory_limit_mb(limit_mb, 1);
+  FilterType filters[] = {f_median, f_nmad, f_percentile};
+  for (int it = 0; it < 3; it++) {
+    size_t max_bytes = 0;
+    grid_random_points(filters[it], &max_bytes);
+    EXPECT_GT(max_bytes, 0u);
+    EXPECT_LE(max_bytes, size_t(limit_mb * 1024 * 1024));
+  }
+
+  Point2Grid::set_memory_limit_mb(0, 1);
+}
+
+// The stddev is found from the sum and sum of squares at each node,
+// so it is exact and needs no memory for the values.
+TEST(Point2Grid, StdDevIsExact) {
+
+  ImageView<double> buffer, weights;
+  Point2Grid grid(3, 1, buffer, weights, 0.0, 0.0, 1.0, 1.0, 0.5, 0.0, f_stddev, 0.0);
+  grid.Clear(-1.0);
+  double vals[] = {1.0, 2.0, 4.0, 8.0};
+  for (int it = 0; it < 4; it++)
+    grid.AddPoint(1.0, 0.0, vals[it]);
+  EXPECT_EQ(grid.val_memory_bytes(), 0u);
+  grid.normalize();
+
+  // The population standard deviation of the values above
+  double mean = 15.0/4.0, var = 0.0;
+  for (int it = 0; it < 4; it++)
+    var += (vals[it] - mean) * (vals[it] - mean) / 4.0;
+  EXPECT_NEAR(buffer(1, 0), sqrt(var), 1e-12);
+  EXPECT_EQ(buffer(0, 0), -1.0);
+  EXPECT_EQ(buffer(2, 0), -1.0);
+}
+
+// Time the splatting of 2 million points into a 200 x 200 grid with a
+// search radius of 3 grid cells, for each filter. This is disabled by
+// default. Run it with --gtest_also_run_disabled_tests. On one core
+// of an Intel Xeon machine, built with GCC 12 and -O2, the times
+// were, before and after the filter dispatch was hoisted and the
+// inner loops vectorized:
+//   weighted_average 0.57 s -> 0.23 s
+//   mean             0.34 s -> 0.21 s
+//   min              0.32 s -> 0.20 s
+//   max              0.32 s -> 0.20 s
+//   count            0.32 s -> 0.13 s
+//   median           0.89 s -> 0.72 s (with a memory limit of 4 GB)
+// The time to normalize the grid is not included.
+TEST(Point2Grid, DISABLED_SplattingBenchmark) {
+
+  int size = 200, num_points = 2000000;
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> xy(0.0, size);
+  std::normal_distribution<double> zd(100.0, 5.0);
+  std::vector<Vector3> points(num_points);
+  for (int it = 0; it < num_points; it++) {
+    double x = xy(gen), y = xy(gen);
+    points[it] = Vector3(x, y, zd(gen));
+  }
+
+  Point2Grid::set_memory_limit_mb(4096, 1);
+  FilterType filters[] = {f_weighted_average, f_mean, f_min, f_max, f_count, f_median};
+  std::string names[] = {"weighted_average", "mean", "min", "max", "count", "median"};
+  for (int it = 0; it < 6; it++) {
+    ImageView<double> buffer, weights;
+    Point2Grid grid(size, size, buffer, weights, 0.0, 0.0, 1.0, 1.0, 3.0, 0.0,
+                    filters[it], 50.0);
+    grid.Clear(-32768.0);
+
+    vw::Stopwatch sw;
+    sw.start();
+    for (int p = 0; p < num_points; p++)
+      grid.AddPoint(points[p][0], points[p][1], points[p][2]);
+    sw.stop();
+    grid.normalize();
+
+    std::cout << "Splatting with the " << names[it] << " filter: "
+              << sw.elapsed_seconds() << " s\n";
+    EXPECT_NE(buffer(size/2, size/2), -32768.0);
+  }
+
+  Point2Grid::set_memory_limit_mb(0, 1);
+}
@@ -19,6 +19,13 @@
 #include <test/Helpers.h>
 #include <asp/Core/PointUtils.h>
 
+#include <vw/Core/Stopwatch.h>
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
 using namespace vw;
 using namespace asp;
 
@@ -127,6 +134,77 @@ TEST( PointUtils, CsvConv ) {
   
 }
 
+// Quoted fields, Windows line endings, comments, and a file not ending with a newline
+TEST( PointUtils, CsvParser ) {
+
+  CsvConv conv;
+  conv.parse_csv_format("1:file 2:x 3:y 4:z", "");
+  bool is_first_line = false, success = false;
+
+  // A quoted field can contain separators
+  std::string line = "\"my image.tif\", \"1.5\", 2, 3";
+  CsvConv::CsvRecord vals = conv.parse_csv_line(is_first_line, success, line);
+  EXPECT_TRUE(success);
+  EXPECT_EQ("my image.tif", conv.file_from_csv(vals));
+  EXPECT_EQ(Vector3(1.5, 2, 3), vals.point_data);
+
+  // Windows line ending
+  line = "a.tif,4,5,6\r\n";
+  vals = conv.parse_csv_line(is_first_line, success, line);
+  EXPECT_TRUE(success);
+  EXPECT_EQ("a.tif", conv.file_from_csv(vals));
+  EXPECT_EQ(Vector3(4, 5, 6), vals.point_data);
+
+  // Comments, also after spaces, and blank lines are skipped
+  line = "  # 1, 2, 3, 4";
+  conv.parse_csv_line(is_first_line, success, line);
+  EXPECT_FALSE(success);
+  line = " \r";
+  conv.parse_csv_line(is_first_line, success, line);
+  EXPECT_FALSE(success);
+
+  // A whole file, with a header, comments, CRLF line endings, and no
+  // newline at the end. Both ways of reading it must agree.
+  std::string csv_file = "TestPointUtils_CsvParser.csv";
+  {
+    std::ofstream ofs(csv_file.c_str(), std::ios::binary);
+    ofs << "file,x,y,z\r\n"
+        << "# a comment\r\n"
+        << "a.tif,1,2,3\r\n"
+        << "\r\n"
+        << "\"b, c.tif\",4,5,6\r\n"
+        << "d.tif,7,8,9";
+  }
+  std::vector<CsvConv::CsvRecord> records;
+  EXPECT_EQ(3u, conv.read_csv_file(csv_file, records));
+  CsvConv::CsvColumns columns;
+  EXPECT_EQ(3u, conv.read_csv_file(csv_file, columns));
+  remove(csv_file.c_str());
+
+  ASSERT_EQ(3u, records.size());
+  ASSERT_EQ(3u, columns.size());
+  EXPECT_EQ("b, c.tif", records[1].file);
+  EXPECT_EQ("d.tif",    records[2].file);
+  for (size_t it = 0; it < records.size(); it++) {
+    Vector3 expected(3*it + 1, 3*it + 2, 3*it + 3);
+    EXPECT_EQ(expected, records[it].point_data);
+    EXPECT_EQ(expected, columns.record(it).point_data);
+  }
+
+  // Parse at most a given number of lines, as point2dem does for each chunk
+  std::string text = "1,1,2,3\n2,4,5,6\n3,7,8,9";
+  conv.parse_csv_format("1:file 2:x 3:y 4:z", "");
+  columns.clear();
+  const char* pos = conv.parse_csv_lines(text.data(), text.data() + text.size(),
+                                         false, 2, columns);
+  EXPECT_EQ(2u, columns.size());
+  EXPECT_EQ(text.data() + text.find("3,7"), pos);
+  pos = conv.parse_csv_lines(pos, text.data() + text.size(), false, 2, columns);
+  EXPECT_EQ(3u, columns.size());
+  EXPECT_EQ(text.data() + text.size(), pos);
+  EXPECT_EQ(Vector3(7, 8, 9), columns.record(2).point_data);
+}
+
 // Open up an ascii style PCD file and make sure we can read all of the values from it.
 TEST( PointUtils, PcdReader ) {
 
@@ -152,3 +230,147 @@ TEST( PointUtils, PcdReader ) {
 }
 
 
+
+// Encode and decode point cloud pixels in the compact format
+TEST( PointUtils, CompactPointCloud ) {
+
+  Vector3 shift(-2.3e6, -4.5e6, 3.7e6);
+  Vector2 quanta = asp::get_compact_cloud_quanta(shift, 0.0);
+  EXPECT_EQ(1.0/1024.0, quanta[0]);
+  EXPECT_EQ(1.0/1024.0, quanta[1]);
+
+  // With error propagation the rounding error is tiny. The points still
+  // use the default quantum, and the errors are finer.
+  quanta = asp::get_compact_cloud_quanta(shift, 1e-8);
+  EXPECT_EQ(1.0/1024.0, quanta[0]);
+  EXPECT_EQ(quanta[0]/1024.0, quanta[1]);
+
+  asp::QuantizePoint<Vector4> encode(shift, quanta);
+  asp::DequantizePoint<4> decode(shift, quanta);
+
+  // A valid point is recovered to within half a quantum
+  Vector4 pt(-2.31e6 + 0.1234, -4.49e6 + 0.5678, 3.705e6 - 0.91, 0.375);
+  Vector4 out = decode(encode(pt));
+  for (int it = 0; it < 3; it++)
+    EXPECT_NEAR(pt[it], out[it], 0.5 * quanta[0]);
+  EXPECT_NEAR(pt[3], out[3], 0.5 * quanta[1]);
+
+  // Invalid points, points too far from the shift, and NaN points are
+  // no-data in all channels, and decode to zero.
+  Vector4 bad_points[] = {Vector4(0, 0, 0, 1.5), Vector4(1e8, 0, 0, 1.5),
+                          Vector4(shift[0], shift[1], 1e8, 1.5),
+                          Vector4(shift[0], std::numeric_limits<double>::quiet_NaN(),
+                                  shift[2], 1.5)};
+  for (int it = 0; it < 4; it++) {
+    Vector<int32, 4> code = encode(bad_points[it]);
+    for (int jt = 0; jt < 4; jt++)
+      EXPECT_EQ(asp::ASP_COMPACT_CLOUD_NODATA, code[jt]);
+    EXPECT_EQ(Vector4(), decode(code));
+  }
+
+  // No-data in any coordinate makes the point invalid
+  Vector<int32, 4> code = encode(pt);
+  for (int it = 0; it < 3; it++) {
+    Vector<int32, 4> bad_code = code;
+    bad_code[it] = asp::ASP_COMPACT_CLOUD_NODATA;
+    EXPECT_EQ(Vector4(), decode(bad_code));
+  }
+
+  // A large error is clamped, rather than making the point invalid
+  code = encode(Vector4(pt[0], pt[1], pt[2], 1e7));
+  EXPECT_EQ(std::numeric_limits<int32>::max(), code[3]);
+  EXPECT_NEAR(pt[0], decode(code)[0], 0.5 * quanta[0]);
+}
+
+// A synthetic cloud of a surface with some relief, near the given shift,
+// with the triangulation error in the last channel.
+ImageView<Vector4> synthetic_cloud(int cols, int rows, Vector3 const& shift) {
+  ImageView<Vector4> cloud(cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      double x = 0.5 * col, y = 0.5 * row;
+      double z = 40.0 * sin(x / 37.0) + 25.0 * cos(y / 23.0) + 0.01 * ((col * 7 + row * 13) % 5);
+      cloud(col, row) = Vector4(shift[0] + x, shift[1] + y, shift[2] + z,
+                                0.1 + 0.001 * ((col + row) % 50));
+    }
+  }
+  return cloud;
+}
+
+// Write a compact cloud and read it back the way point2dem, pc_align, and the
+// other tools do, with read_asp_point_cloud() and form_point_cloud_composite().
+TEST( PointUtils, CompactPointCloudRead ) {
+
+  Vector3 shift(-2.3e6, -4.5e6, 3.7e6);
+  Vector2 quanta = asp::get_compact_cloud_quanta(shift, 0.0);
+
+  // More rows than columns, so that the composite is not transposed
+  int cols = 40, rows = 60;
+  ImageView<Vector4> cloud = synthetic_cloud(cols, rows, shift);
+  cloud(3, 5) = Vector4(); // invalid
+
+  std::string file = "TestPointUtils_compact-PC.tif";
+  vw::cartography::GeoReference georef;
+  bool has_georef = false;
+  vw::GdalWriteOptions opt;
+  asp::write_compact_gdal_image(file, shift, 0.0, cloud, has_georef, georef, opt);
+
+  ImageView<Vector4> out = asp::read_asp_point_cloud<4>(file);
+  std::vector<std::string> files(1, file);
+  ImageView<Vector3> composite = asp::form_point_cloud_composite<Vector3>(files);
+  remove(file.c_str());
+
+  ASSERT_EQ(cols, out.cols());
+  ASSERT_EQ(rows, out.rows());
+  ASSERT_EQ(cols, composite.cols());
+  ASSERT_EQ(rows, composite.rows());
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < cols; col++) {
+      if (cloud(col, row) == Vector4()) {
+        EXPECT_EQ(Vector4(), out(col, row));
+        EXPECT_EQ(Vector3(), composite(col, row));
+        continue;
+      }
+      for (int it = 0; it < 3; it++) {
+        EXPECT_NEAR(cloud(col, row)[it], out(col, row)[it], 0.5 * quanta[0]);
+        EXPECT_EQ(out(col, row)[it], composite(col, row)[it]);
+      }
+      EXPECT_NEAR(cloud(col, row)[3], out(col, row)[3], 0.5 * quanta[1]);
+    }
+  }
+}
+
+// Compare the file size and the time to read a 4000 x 4000 point cloud in
+// the default format and in the compact format, with the default LZW
+// compression. This is disabled by default. Run it with
+// --gtest_also_run_disabled_tests. Both formats use 4 bytes per
+// channel before compression, and they are decoded to doubles on
+// reading, so the difference is in the compressed size.
+TEST( PointUtils, DISABLED_CompactPointCloudBenchmark ) {
+
+  Vector3 shift(-2.3e6, -4.5e6, 3.7e6);
+  int size = 4000;
+  ImageView<Vector4> cloud = synthetic_cloud(size, size, shift);
+
+  vw::cartography::GeoReference georef;
+  bool has_georef = false, has_nodata = false;
+  vw::GdalWriteOptions opt;
+  std::string float_file = "TestPointUtils_float-PC.tif";
+  std::string compact_file = "TestPointUtils_compact-PC.tif";
+  asp::block_write_approx_gdal_image(float_file, shift, 0.0, cloud, has_georef, georef,
+                                     has_nodata, 0.0, opt);
+  asp::block_write_compact_gdal_image(compact_file, shift, 0.0, cloud, has_georef, georef,
+                                      opt);
+
+  std::string files[] = {float_file, compact_file};
+  for (int it = 0; it < 2; it++) {
+    vw::Stopwatch sw;
+    sw.start();
+    ImageView<Vector4> out = asp::read_asp_point_cloud<4>(files[it]);
+    sw.stop();
+    std::cout << files[it] << ": " << boost::filesystem::file_size(files[it])
+              << " bytes, read in " << sw.elapsed_seconds() << " s\n";
+    EXPECT_NEAR(cloud(size/2, size/2)[2], out(size/2, size/2)[2], 1e-3);
+    remove(files[it].c_str());
+  }
+}
@@ -22,6 +22,7 @@
 #include <asp/Core/SoftwareRenderer.h>
 
 #include <vector>
+#include <cmath>
 
 #include <boost/assign/list_of.hpp>
 #include <boost/assign/std/vector.hpp>
@@ -191,3 +192,76 @@ TEST_F( SoftwareRenderTest, ExtremelyLargeTriangle ) {
 }
 
 #endif
+
+// Render a grid of slightly perturbed quads, with two triangles per quad,
+// as point2dem does with --use-surface-sampling.
+void render_mesh(bool useEdgeFunctions, bool deferred, int numThreads,
+                 ImageView<float> & buffer) {
+  int num = 60, size = 100;
+  std::vector<float> px(num * num), py(num * num), val(num * num);
+  for (int row = 0; row < num; row++) {
+    for (int col = 0; col < num; col++) {
+      int i = row * num + col;
+      px[i]  = 2.0 * col + 0.6 * std::sin(1.7 * i);
+      py[i]  = 2.0 * row + 0.6 * std::cos(2.3 * i);
+      val[i] = 10.0 * std::sin(0.1 * col) + 5.0 * std::cos(0.07 * row);
+    }
+  }
+
+  buffer.set_size(size, size);
+  stereo::SoftwareRenderer renderer(size, size, &buffer(0,0));
+  renderer.Ortho2D(-3.3, size - 3.3, -2.7, size - 2.7);
+  renderer.SetUseEdgeFunctions(useEdgeFunctions);
+  renderer.SetDeferred(deferred, numThreads);
+  std::vector<float> vertices(10), color(5);
+  renderer.SetVertexPointer(2, &vertices[0]);
+  renderer.SetColorPointer(1, &color[0]);
+  renderer.Clear(-100.0);
+
+  for (int row = 0; row < num - 1; row++) {
+    for (int col = 0; col < num - 1; col++) {
+      int ul = row * num + col, ur = ul + 1, ll = ul + num, lr = ll + 1;
+      int corners[5] = {ul, ll, lr, ur, ul};
+      for (int k = 0; k < 5; k++) {
+        vertices[2*k]   = px[corners[k]];
+        vertices[2*k+1] = py[corners[k]];
+        color[k]        = val[corners[k]];
+      }
+      renderer.DrawPolygon(0, 3);
+      renderer.DrawPolygon(2, 3);
+    }
+  }
+  renderer.Flush();
+}
+
+TEST(SoftwareRenderer, DeferredIsBitIdentical) {
+  for (int edges = 0; edges < 2; edges++) {
+    ImageView<float> immediate, deferred;
+    render_mesh(edges, false, 1, immediate);
+    render_mesh(edges, true,  4, deferred);
+    for (int row = 0; row < immediate.rows(); row++) {
+      for (int col = 0; col < immediate.cols(); col++)
+        EXPECT_EQ(immediate(col, row), deferred(col, row)) << col << "," << row;
+    }
+  }
+}
+
+TEST(SoftwareRenderer, EdgeFunctions) {
+  ImageView<float> scanline, edges;
+  render_mesh(false, false, 1, scanline);
+  render_mesh(true,  false, 1, edges);
+
+  // The two algorithms may differ only in which of two triangles draws
+  // a pixel on their shared edge, and in round-off.
+  int num_drawn = 0;
+  for (int row = 0; row < scanline.rows(); row++) {
+    for (int col = 0; col < scanline.cols(); col++) {
+      EXPECT_EQ(scanline(col, row) == -100.0, edges(col, row) == -100.0);
+      if (edges(col, row) == -100.0)
+        continue;
+      num_drawn++;
+      EXPECT_NEAR(scanline(col, row), edges(col, row), 0.1) << col << "," << row;
+    }
+  }
+  EXPECT_GT(num_drawn, 90 * 90);
+}
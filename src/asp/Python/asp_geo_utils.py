@@ -136,6 +136,14 @@ def getImageGeoInfo(imagePath, getStats=True):
     except:
         pass # In most cases this line will not be present
 
+    # Compact point clouds also have the quanta of the stored integers
+    try:
+        pointQuantumLine = asp_string_utils.getLineAfterText(textOutput, 'POINT_QUANTUM=') # Tag name must be synced with C++ code
+        quantumValues    = pointQuantumLine.split(' ')
+        outputDict['point_quantum'] = (float(quantumValues[0]), float(quantumValues[1]))
+    except:
+        pass # Only present for compact point clouds
+
     # TODO: Currently this does not find much information, and there
     #       is another function in image_utils dedicated to returning statistics.
     if getStats:
@@ -466,10 +474,13 @@ def build_vrt(fullImageSize, tileLocs, tilePaths, outputPath):
     num_bands = len(gdalInfo['band_info'])
     data_type = gdalInfo['band_info'][0]['type']
 
-    # This special metadata value is only used for ASP stereo point cloud files!    
-    if 'point_offset' in gdalInfo:
-        f.write("  <Metadata>\n    <MDI key=\"" + 'POINT_OFFSET' + "\">" +
-                gdalInfo['point_offset'][0] + "</MDI>\n  </Metadata>\n")
+    # These special metadata values are only used for ASP stereo point cloud
+    # files. Without POINT_QUANTUM a compact cloud cannot be decoded.
+    for (key, tag) in [('point_offset', 'POINT_OFFSET'), ('point_quantum', 'POINT_QUANTUM')]:
+        if key in gdalInfo:
+            values = " ".join(["%.17g" % v for v in gdalInfo[key]])
+            f.write("  <Metadata>\n    <MDI key=\"" + tag + "\">" +
+                    values + "</MDI>\n  </Metadata>\n")
       
 
     # Write each band
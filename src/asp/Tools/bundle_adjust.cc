@@ -36,6 +36,7 @@
 #include <asp/Core/DataLoader.h>
 
 #include <vw/InterestPoint/Matcher.h>
+#include <vw/Core/ThreadPool.h>
 
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -308,6 +309,96 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
     problem.SetParameterBlockConstant(param_storage.get_camera_ptr(camera_index));
 }
 
+/// Add a constraint to keep a GCP or a point obtained from a DEM close
+/// to its input position. Fix the point if requested.
+void add_gcp_or_dem_residual_block(int ipt, Options const& opt,
+                                   ControlNetwork const& cnet,
+                                   asp::BAParams & param_storage,
+                                   ceres::Problem & problem) {
+
+  Vector3 observation = cnet[ipt].position();
+  Vector3 xyz_sigma   = cnet[ipt].sigma();
+
+  ceres::CostFunction* cost_function;
+  if (!opt.use_llh_error) 
+    cost_function = XYZError::Create(observation, xyz_sigma);
+  else{
+    Vector3 llh_sigma = xyz_sigma;
+    // make lat,lon into lon,lat
+    std::swap(llh_sigma[0], llh_sigma[1]);
+    cost_function = LLHError::Create(observation, llh_sigma, opt.datum);
+  }
+
+  // Don't use the same loss function as for pixels since that one
+  // discounts outliers and the GCP's should never be discounted.
+  // The user an override this for the advanced --heights_from_dem
+  // and --reference-dem options.
+  ceres::LossFunction* loss_function = NULL;
+  if (opt.heights_from_dem != ""      &&
+      opt.heights_from_dem_weight > 0 &&
+      opt.heights_from_dem_robust_threshold > 0) {
+    loss_function = get_loss_function(opt, opt.heights_from_dem_robust_threshold);
+  }else if (opt.ref_dem != "" &&
+      opt.ref_dem_weight > 0  &&
+      opt.ref_dem_robust_threshold > 0) {
+    loss_function = get_loss_function(opt, opt.ref_dem_robust_threshold);
+  }else{
+    loss_function = new ceres::TrivialLoss();
+  }
+  double * point  = param_storage.get_point_ptr(ipt);
+  problem.AddResidualBlock(cost_function, loss_function, point);
+
+  if (opt.fix_gcp_xyz) 
+    problem.SetParameterBlockConstant(point);
+}
+
+/// Add a constraint to keep a camera close to its original parameters.
+void add_camera_weight_residual_block(int icam, Options const& opt,
+                                      asp::BAParams const& orig_parameters,
+                                      asp::BAParams & param_storage,
+                                      ceres::Problem & problem) {
+  double const* orig_cam_ptr = orig_parameters.get_camera_ptr(icam);
+  ceres::CostFunction* cost_function = CamError::Create(orig_cam_ptr, opt.camera_weight);
+
+  // Don't use the same loss function as for pixels since that one discounts
+  //  outliers and the cameras should never be discounted.
+  // TODO(oalexan1): This will prevent convergence in some cases!
+  ceres::LossFunction* loss_function = new ceres::TrivialLoss();
+
+  double * camera  = param_storage.get_camera_ptr(icam);
+  problem.AddResidualBlock(cost_function, loss_function, camera);
+}
+
+/// Add a constraint on how much the camera rotation and translation can change.
+void add_rot_trans_residual_block(int icam, Options const& opt,
+                                  asp::BAParams const& orig_parameters,
+                                  asp::BAParams & param_storage,
+                                  ceres::Problem & problem) {
+  double const* orig_cam_ptr = orig_parameters.get_camera_ptr(icam);
+  ceres::CostFunction* cost_function
+    = RotTransError::Create(orig_cam_ptr, opt.rotation_weight, opt.translation_weight);
+  ceres::LossFunction* loss_function = new ceres::TrivialLoss();
+  double * camera  = param_storage.get_camera_ptr(icam);
+  problem.AddResidualBlock(cost_function, loss_function, camera);
+}
+
+/// Add a triangulation constraint to make a point not move too far.
+void add_tri_residual_block(int ipt, Options const& opt,
+                            asp::BAParams & param_storage,
+                            ceres::Problem & problem) {
+
+  double * point = param_storage.get_point_ptr(ipt);
+
+  // Use as constraint the initially triangulated point
+  Vector3 observation(point[0], point[1], point[2]);
+  double s = 1.0/opt.tri_weight;
+  Vector3 xyz_sigma(s, s, s);
+
+  ceres::CostFunction* cost_function = XYZError::Create(observation, xyz_sigma);
+  ceres::LossFunction* loss_function = get_loss_function(opt, opt.tri_robust_threshold);
+  problem.AddResidualBlock(cost_function, loss_function, point);
+}
+
 /// Add residual block for the error using reference xyz.
 void add_disparity_residual_block(Vector3 const& reference_xyz,
                                   ImageViewRef<DispPixelT> const& interp_disp, 
@@ -420,26 +511,39 @@ void compute_residuals(bool apply_loss_function,
 void compute_mean_residuals_at_xyz(CRNJ & crn,
                                   std::vector<double> const& residuals,
                                   asp::BAParams const& param_storage,
+                                  int num_threads,
                                   // outputs
                                   std::vector<double> & mean_residuals,
                                   std::vector<int>  & num_point_observations) {
 
-  mean_residuals.resize(param_storage.num_points());
-  num_point_observations.resize(param_storage.num_points());
+  mean_residuals.assign(param_storage.num_points(), 0.0);
+  num_point_observations.assign(param_storage.num_points(), 0);
   
   // Observation residuals are stored at the beginning of the residual vector in the 
-  //  same order they were originally added to Ceres.
-  
-  size_t residual_index = 0;
-  // Double loop through cameras and crn entries will give us the correct order
-  for ( size_t icam = 0; icam < param_storage.num_cameras(); icam++ ) {
-    typedef CameraNode<JFeature>::const_iterator crn_iter;
-    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++){
+  //  same order they were originally added to Ceres. Find where the residuals
+  //  for each camera start, so that the cameras can be processed in parallel.
+  typedef CameraNode<JFeature>::const_iterator crn_iter;
+  int num_cameras = param_storage.num_cameras();
+  std::vector<size_t> cam_residual_start(num_cameras + 1, 0);
+  for (int icam = 0; icam < num_cameras; icam++) {
+    size_t count = 0;
+    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) {
+      if (!param_storage.get_point_outlier((**fiter).m_point_id))
+        count += PIXEL_SIZE;
+    }
+    cam_residual_start[icam + 1] = cam_residual_start[icam] + count;
+  }
 
-      // The index of the 3D point
-      int ipt = (**fiter).m_point_id;
+  // Find the error of each observation in parallel, then add these up
+  // per point in a fixed order, so the means do not depend on the
+  // order in which the threads run.
+  std::vector<double> obs_errors(cam_residual_start[num_cameras] / PIXEL_SIZE, 0.0);
+#pragma omp parallel for num_threads(std::max(num_threads, 1)) schedule(dynamic, 1)
+  for (int icam = 0; icam < num_cameras; icam++) {
+    size_t residual_index = cam_residual_start[icam];
+    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++){
 
-      if (param_storage.get_point_outlier(ipt))
+      if (param_storage.get_point_outlier((**fiter).m_point_id))
         continue; // skip outliers
 
       // Get the residual error for this observation
@@ -447,12 +551,20 @@ void compute_mean_residuals_at_xyz(CRNJ & crn,
       double errorY         = residuals[residual_index+1];
       // TODO(oalexan1): Use norm_2 below rather than average. This may
       // change the regressions.
-      double residual_error = (fabs(errorX) + fabs(errorY)) / 2;
+      obs_errors[residual_index / PIXEL_SIZE] = (fabs(errorX) + fabs(errorY)) / 2;
       residual_index += PIXEL_SIZE;
+    }
+  }
 
-      // Update information for this point
+  size_t obs_index = 0;
+  for (int icam = 0; icam < num_cameras; icam++) {
+    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++){
+      int ipt = (**fiter).m_point_id;
+      if (param_storage.get_point_outlier(ipt))
+        continue;
       num_point_observations[ipt] += 1;
-      mean_residuals        [ipt] += residual_error;
+      mean_residuals        [ipt] += obs_errors[obs_index];
+      obs_index++;
     }
   } // End double loop through all the observations
 
@@ -506,27 +618,29 @@ void write_residual_map(std::string const& output_prefix,
   // do not modify the line below.
   file << "# " << opt.datum << std::endl;
   
-  // Now write all the points to the file
-  for (size_t i = 0; i < param_storage.num_points(); i++) {
-
+  // Now write all the points to the file. The conversion to geodetic
+  // coordinates and the formatting are done in parallel.
+  size_t rows_per_block = 100000;
+  asp::write_rows_in_parallel(file, param_storage.num_points(), rows_per_block,
+                              opt.num_threads, [&](size_t i, std::ostream & os) {
     if (param_storage.get_point_outlier(i))
-      continue; // skip outliers
+      return; // skip outliers
     
-      // The final GCC coordinate of this point
-      const double * point = param_storage.get_point_ptr(i);
-      Vector3 xyz(point[0], point[1], point[2]);
+    // The final GCC coordinate of this point
+    const double * point = param_storage.get_point_ptr(i);
+    Vector3 xyz(point[0], point[1], point[2]);
 
-      Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
+    Vector3 llh = opt.datum.cartesian_to_geodetic(xyz);
 
-      std::string comment = "";
-      if (cnet[i].type() == ControlPoint::GroundControlPoint)
-        comment = " # GCP";
-      else if (cnet[i].type() == ControlPoint::PointFromDem)
-        comment = " # from DEM";
+    std::string comment = "";
+    if (cnet[i].type() == ControlPoint::GroundControlPoint)
+      comment = " # GCP";
+    else if (cnet[i].type() == ControlPoint::PointFromDem)
+      comment = " # from DEM";
       
-      file << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
-           << num_point_observations[i] << comment << std::endl;
-  }
+    os << llh[0] <<", "<< llh[1] <<", "<< llh[2] <<", "<< mean_residuals[i] <<", "
+       << num_point_observations[i] << comment << "\n";
+  });
   file.close();
 
 } // End function write_residual_map
@@ -580,10 +694,17 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
     residual_file_reference_xyz.precision(17);
   }
   
-  size_t index = 0;
-  // For each camera, average together all the point observation residuals
-  residual_file << "Mean and median norm of residual error and point count for cameras:\n";
-  for (size_t c = 0; c < param_storage.num_cameras(); c++) {
+  // For each camera, average together all the point observation
+  // residuals. The cameras are processed in parallel, and the raw
+  // residuals are written in the same order as when done serially.
+  size_t num_cameras = param_storage.num_cameras();
+  std::vector<size_t> cam_residual_start(num_cameras + 1, 0);
+  for (size_t c = 0; c < num_cameras; c++)
+    cam_residual_start[c + 1] = cam_residual_start[c] + PIXEL_SIZE * cam_residual_counts[c];
+  std::vector<double> cam_mean_residuals(num_cameras), cam_median_residuals(num_cameras);
+  size_t cams_per_block = 1;
+  asp::write_rows_in_parallel(residual_file_raw_pixels, num_cameras, cams_per_block,
+                              opt.num_threads, [&](size_t c, std::ostream & os) {
     size_t num_this_cam_residuals = cam_residual_counts[c];
     
     // Write header for the raw file
@@ -591,13 +712,14 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
     if (name == "")
       name = opt.image_files[c];
     
-    residual_file_raw_pixels << name << ", " << num_this_cam_residuals << std::endl;
+    os << name << ", " << num_this_cam_residuals << "\n";
 
     // All residuals are for inliers, as we do not even add a residual
     // for an outlier
     
     double mean_residual = 0; // Take average of all pixel coord errors
     std::vector<double> residual_norms;
+    size_t index = cam_residual_start[c];
     for (size_t i = 0; i < num_this_cam_residuals; i++) {
       double ex = residuals[index];
       ++index;
@@ -606,21 +728,30 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
       double residual_norm = std::sqrt(ex * ex + ey * ey);
       mean_residual += residual_norm;
       residual_norms.push_back(residual_norm);
-      residual_file_raw_pixels << ex << ", " << ey << std::endl; // Write ex, ey on raw file
+      os << ex << ", " << ey << "\n"; // Write ex, ey on raw file
     }
-    // Write line for the summary file
     mean_residual /= static_cast<double>(num_this_cam_residuals);
     double median_residual = std::numeric_limits<double>::quiet_NaN();
     if (residual_norms.size() > 0) {
       std::sort(residual_norms.begin(), residual_norms.end());
       median_residual = residual_norms[residual_norms.size()/2];
     }
-    
+    cam_mean_residuals[c]   = mean_residual;
+    cam_median_residuals[c] = median_residual;
+  });
+
+  // Write the lines for the summary file
+  residual_file << "Mean and median norm of residual error and point count for cameras:\n";
+  for (size_t c = 0; c < num_cameras; c++) {
+    std::string name = opt.camera_files[c];
+    if (name == "")
+      name = opt.image_files[c];
     residual_file << name                   << ", "
-                  << mean_residual          << ", "
-                  << median_residual        << ", "
-                  << num_this_cam_residuals << std::endl;
+                  << cam_mean_residuals[c]  << ", "
+                  << cam_median_residuals[c] << ", "
+                  << cam_residual_counts[c] << std::endl;
   }
+  size_t index = cam_residual_start[num_cameras];
   
   residual_file_raw_pixels.close();
   
@@ -708,7 +839,7 @@ void write_residual_logs(std::string const& residual_prefix, bool apply_loss_fun
   std::string map_prefix = residual_prefix + "_pointmap";
   std::vector<double> mean_residuals;
   std::vector<int> num_point_observations;
-  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage,
+  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage, opt.num_threads,
                                 mean_residuals, num_point_observations);
 
   write_residual_map(map_prefix, mean_residuals, num_point_observations,
@@ -752,7 +883,7 @@ int add_to_outliers(ControlNetwork & cnet,
   // Compute the mean residual at each xyz, and how many times that residual is seen
   std::vector<double> mean_residuals;
   std::vector<int   > num_point_observations;
-  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage,
+  compute_mean_residuals_at_xyz(crn,  residuals,  param_storage, opt.num_threads,
                                 // outputs
                                 mean_residuals, num_point_observations);
 
@@ -1007,9 +1138,243 @@ void initial_filter_by_proj_win(Options             & opt,
   }
 }
 
+/// Solve a bundle adjustment problem restricted to a subset of the
+/// cameras. Only observations by these cameras of points flagged in
+/// active_points are used. Cameras in fixed_cams and points flagged in
+/// fixed_points are held constant. The intrinsics are held constant
+/// too, as they may be shared with cameras not in this subset. This is
+/// used by the submap flow, so the full problem never needs to be
+/// solved at once.
+void solve_ba_subproblem(Options                  const& opt,
+                         CRNJ                          & crn,
+                         std::vector<int>         const& cams,
+                         std::vector<bool>        const& active_points,
+                         std::vector<bool>        const& fixed_points,
+                         std::set<int>            const& fixed_cams,
+                         int                             num_threads,
+                         asp::BAParams            const& orig_parameters,
+                         asp::BAParams                 & param_storage) {
+
+  ControlNetwork & cnet = *opt.cnet;
+  ceres::Problem problem;
+
+  std::set<int> used_points;
+  int num_obs = 0;
+  typedef CameraNode<JFeature>::iterator crn_iter;
+  for (size_t cam_it = 0; cam_it < cams.size(); cam_it++) {
+    int icam = cams[cam_it];
+    int num_cam_obs = 0;
+    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++) {
+
+      int ipt = (**fiter).m_point_id;
+      if (param_storage.get_point_outlier(ipt) || !active_points[ipt])
+        continue;
+
+      double* point = param_storage.get_point_ptr(ipt);
+      if (point[0] == 0 && point[1] == 0 && point[2] == 0)
+        continue; // Points at the planet center are flagged in the full passes
+      
+      Vector2 observation = (**fiter).m_location;
+      Vector2 pixel_sigma = (**fiter).m_scale;
+      if (pixel_sigma != pixel_sigma) // nan check
+        pixel_sigma = Vector2(1, 1);
+
+      double p = opt.overlap_exponent;
+      int count = cnet[ipt].size();
+      if (p > 0 && count > 2)
+        pixel_sigma /= pow(count - 1.0, p);
+
+      add_reprojection_residual_block(observation, pixel_sigma, ipt, icam,
+                                      param_storage, opt, problem);
+      if (fixed_points[ipt])
+        problem.SetParameterBlockConstant(point);
+      else
+        used_points.insert(ipt);
+
+      num_cam_obs++;
+    }
+
+    if (num_cam_obs == 0)
+      continue;
+    num_obs += num_cam_obs;
+    
+    double * camera = param_storage.get_camera_ptr(icam);
+    if (fixed_cams.find(icam) != fixed_cams.end()) {
+      problem.SetParameterBlockConstant(camera);
+    } else {
+      if (opt.camera_weight > 0)
+        add_camera_weight_residual_block(icam, opt, orig_parameters, param_storage, problem);
+      if (opt.rotation_weight > 0 || opt.translation_weight > 0)
+        add_rot_trans_residual_block(icam, opt, orig_parameters, param_storage, problem);
+    }
+
+    if (opt.camera_type != BaCameraType_Other) {
+      problem.SetParameterBlockConstant(param_storage.get_intrinsic_center_ptr(icam));
+      problem.SetParameterBlockConstant(param_storage.get_intrinsic_focus_ptr(icam));
+      problem.SetParameterBlockConstant(param_storage.get_intrinsic_distortion_ptr(icam));
+    }
+  }
+
+  if (num_obs == 0)
+    return;
+  
+  // Constraints for the points being optimized
+  for (auto it = used_points.begin(); it != used_points.end(); it++) {
+    int ipt = *it;
+    bool is_gcp = (cnet[ipt].type() == ControlPoint::GroundControlPoint);
+    if (is_gcp)
+      add_gcp_or_dem_residual_block(ipt, opt, cnet, param_storage, problem);
+    else if (opt.tri_weight > 0)
+      add_tri_residual_block(ipt, opt, param_storage, problem);
+  }
+
+  ceres::Solver::Options options;
+  options.gradient_tolerance  = 1e-16;
+  options.function_tolerance  = 1e-16;
+  options.parameter_tolerance = opt.parameter_tolerance;
+  options.max_num_iterations  = opt.num_iterations;
+  options.max_num_consecutive_invalid_steps = std::max(5, opt.num_iterations/5);
+  options.minimizer_progress_to_stdout = false; // submaps may be solved in parallel
+  options.num_threads = num_threads;
+  options.linear_solver_type = ceres::SPARSE_SCHUR;
+  if (cams.size() < 100)
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+  
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &problem, &summary);
+  vw_out() << summary.BriefReport() << "\n";
+}
+
+/// A task for solving one submap in parallel with the others.
+class BaSubmapTask: public vw::Task, private boost::noncopyable {
+  Options             const& m_opt;
+  CRNJ                     & m_crn;
+  std::vector<int>           m_cams;
+  std::vector<bool>   const& m_active_points;
+  std::vector<bool>   const& m_fixed_points;
+  std::set<int>       const& m_fixed_cams;
+  int                        m_num_threads;
+  asp::BAParams       const& m_orig_parameters;
+  asp::BAParams            & m_param_storage;
+public:
+  BaSubmapTask(Options const& opt, CRNJ & crn, std::vector<int> const& cams,
+               std::vector<bool> const& active_points, std::vector<bool> const& fixed_points,
+               std::set<int> const& fixed_cams, int num_threads,
+               asp::BAParams const& orig_parameters, asp::BAParams & param_storage):
+    m_opt(opt), m_crn(crn), m_cams(cams), m_active_points(active_points),
+    m_fixed_points(fixed_points), m_fixed_cams(fixed_cams), m_num_threads(num_threads),
+    m_orig_parameters(orig_parameters), m_param_storage(param_storage) {}
+  
+  void operator()() {
+    solve_ba_subproblem(m_opt, m_crn, m_cams, m_active_points, m_fixed_points,
+                        m_fixed_cams, m_num_threads, m_orig_parameters, m_param_storage);
+  }
+};
+
+/// Solve all submaps, with as many running in parallel as allowed.
+/// Each camera belongs to exactly one submap, and shared points are
+/// held fixed, so the submaps do not write to the same parameters.
+void solve_ba_submaps(Options const& opt, CRNJ & crn,
+                      std::vector<std::vector<int>> const& submap_cams,
+                      std::vector<bool> const& active_points,
+                      std::vector<bool> const& fixed_points,
+                      std::set<int> const& fixed_cams,
+                      asp::BAParams const& orig_parameters,
+                      asp::BAParams & param_storage) {
+
+  int num_submaps = submap_cams.size();
+  int num_parallel = std::max(1, std::min(num_submaps, opt.num_parallel_submaps));
+  if (opt.single_threaded_cameras)
+    num_parallel = 1;
+  int num_threads = std::max(1, opt.num_threads / num_parallel);
+  if (opt.single_threaded_cameras)
+    num_threads = 1;
+
+  FifoWorkQueue queue(num_parallel);
+  for (int isub = 0; isub < num_submaps; isub++) {
+    boost::shared_ptr<BaSubmapTask>
+      task(new BaSubmapTask(opt, crn, submap_cams[isub], active_points, fixed_points,
+                            fixed_cams, num_threads, orig_parameters, param_storage));
+    queue.add_task(task);
+  }
+  queue.join_all();
+}
+
+/// Bundle adjustment with the cameras partitioned into spatially
+/// compact submaps. First the submaps are solved independently, with
+/// points seen in more than one submap held fixed. Then the separator
+/// cameras (those seeing such points) and the separator points are
+/// solved jointly. Lastly, the submaps are solved again with the
+/// separators fixed, to propagate the changes back. Points seen only
+/// within a submap are never optimized jointly with other submaps.
+void do_ba_submaps(Options             & opt,
+                   CRNJ                & crn,
+                   asp::BAParams       & param_storage, 
+                   asp::BAParams const & orig_parameters) {
+
+  ControlNetwork & cnet = *opt.cnet;
+  const int num_cameras = param_storage.num_cameras();
+  const int num_points  = param_storage.num_points();
+
+  // Partition the cameras based on their current centers
+  std::vector<vw::CamPtr> optimized_cams;
+  calcOptimizedCameras(opt, param_storage, optimized_cams);
+  std::vector<Vector3> camera_centers(num_cameras);
+  for (int icam = 0; icam < num_cameras; icam++)
+    camera_centers[icam] = optimized_cams[icam]->camera_center(Vector2());
+  std::vector<int> submap_ids;
+  int num_submaps = asp::partition_cameras_spatially(camera_centers, opt.submap_size,
+                                                     submap_ids);
+  std::vector<std::vector<int>> submap_cams(num_submaps);
+  for (int icam = 0; icam < num_cameras; icam++)
+    submap_cams[submap_ids[icam]].push_back(icam);
+
+  // Separator points are seen in more than one submap. Separator
+  // cameras are those seeing separator points.
+  std::vector<std::vector<int>> cam_points(num_cameras);
+  typedef CameraNode<JFeature>::iterator crn_iter;
+  for (int icam = 0; icam < num_cameras; icam++) {
+    for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++)
+      cam_points[icam].push_back((**fiter).m_point_id);
+  }
+  std::vector<bool> sep_points;
+  std::set<int> sep_cams_set, no_cams;
+  asp::find_submap_separators(cam_points, submap_ids, num_points, sep_points, sep_cams_set);
+  cam_points = std::vector<std::vector<int>>(); // free the memory
+  int num_sep_points = std::count(sep_points.begin(), sep_points.end(), true);
+  std::vector<bool> all_points(num_points, true), no_points(num_points, false);
+  std::vector<int> sep_cams(sep_cams_set.begin(), sep_cams_set.end());
+
+  vw_out() << "Partitioned " << num_cameras << " cameras into " << num_submaps
+           << " submaps, with " << sep_cams.size() << " separator cameras and "
+           << num_sep_points << " separator points.\n";
+
+  vw_out() << "Solving the submaps with the separator points fixed.\n";
+  solve_ba_submaps(opt, crn, submap_cams, all_points, sep_points, no_cams,
+                   orig_parameters, param_storage);
+
+  vw_out() << "Solving the reduced problem over the separators.\n";
+  int num_threads = opt.single_threaded_cameras ? 1 : opt.num_threads;
+  solve_ba_subproblem(opt, crn, sep_cams, sep_points, no_points, no_cams,
+                      num_threads, orig_parameters, param_storage);
+  
+  vw_out() << "Solving the submaps with the separators fixed.\n";
+  solve_ba_submaps(opt, crn, submap_cams, all_points, sep_points, sep_cams_set,
+                   orig_parameters, param_storage);
+
+  // Update the cnet, so that later steps see the optimized points
+  for (int ipt = 0; ipt < num_points; ipt++) {
+    if (param_storage.get_point_outlier(ipt))
+      continue;
+    double const* point = param_storage.get_point_ptr(ipt);
+    cnet[ipt].set_position(Vector3(point[0], point[1], point[2]));
+  }
+}
+
 int do_ba_ceres_one_pass(Options             & opt,
                          CRNJ                & crn,
                          bool                  first_pass,
+                         bool                  use_submaps,
                          asp::BAParams       & param_storage, 
                          asp::BAParams const & orig_parameters,
                          bool                & convergence_reached,
@@ -1171,73 +1536,24 @@ int do_ba_ceres_one_pass(Options             & opt,
     if (cnet[ipt].type() == ControlPoint::GroundControlPoint)
       num_gcp++;
 
-    Vector3 observation = cnet[ipt].position();
-    Vector3 xyz_sigma   = cnet[ipt].sigma();
-
-    ceres::CostFunction* cost_function;
-    if (!opt.use_llh_error) 
-      cost_function = XYZError::Create(observation, xyz_sigma);
-    else{
-      Vector3 llh_sigma = xyz_sigma;
-      // make lat,lon into lon,lat
-      std::swap(llh_sigma[0], llh_sigma[1]);
-      cost_function = LLHError::Create(observation, llh_sigma, opt.datum);
-    }
-
-    // Don't use the same loss function as for pixels since that one
-    // discounts outliers and the GCP's should never be discounted.
-    // The user an override this for the advanced --heights_from_dem
-    // and --reference-dem options.
-    ceres::LossFunction* loss_function = NULL;
-    if (opt.heights_from_dem != ""      &&
-        opt.heights_from_dem_weight > 0 &&
-        opt.heights_from_dem_robust_threshold > 0) {
-      loss_function = get_loss_function(opt, opt.heights_from_dem_robust_threshold);
-    }else if (opt.ref_dem != "" &&
-        opt.ref_dem_weight > 0  &&
-        opt.ref_dem_robust_threshold > 0) {
-      loss_function = get_loss_function(opt, opt.ref_dem_robust_threshold);
-    }else{
-      loss_function = new ceres::TrivialLoss();
-    }
-    double * point  = param_storage.get_point_ptr(ipt);
-    problem.AddResidualBlock(cost_function, loss_function, point);
+    add_gcp_or_dem_residual_block(ipt, opt, cnet, param_storage, problem);
 
     num_gcp_or_dem_residuals++;
-
-    if (opt.fix_gcp_xyz) 
-      problem.SetParameterBlockConstant(point);
   } // End loop through GCP's
 
   // Add camera constraints
   // - Error goes up as cameras move and rotate from their input positions.
   if (opt.camera_weight > 0){
-    for (int icam = 0; icam < num_cameras; icam++){
-      double const* orig_cam_ptr = orig_parameters.get_camera_ptr(icam);
-      ceres::CostFunction* cost_function = CamError::Create(orig_cam_ptr, opt.camera_weight);
-
-      // Don't use the same loss function as for pixels since that one discounts
-      //  outliers and the cameras should never be discounted.
-      // TODO(oalexan1): This will prevent convergence in some cases!
-      ceres::LossFunction* loss_function = new ceres::TrivialLoss();
-
-      double * camera  = param_storage.get_camera_ptr(icam);
-      problem.AddResidualBlock(cost_function, loss_function, camera);
-    } // End loop through cameras.
+    for (int icam = 0; icam < num_cameras; icam++)
+      add_camera_weight_residual_block(icam, opt, orig_parameters, param_storage, problem);
   }
 
   // Finer level control of only rotation and translation.
   // - Error goes up as cameras move and rotate from their input positions.
   // TODO(oalexan1): This will prevent convergence in some cases as there is no attenuation
   if (opt.rotation_weight > 0 || opt.translation_weight > 0){
-    for (int icam = 0; icam < num_cameras; icam++){
-      double const* orig_cam_ptr = orig_parameters.get_camera_ptr(icam);
-      ceres::CostFunction* cost_function
-        = RotTransError::Create(orig_cam_ptr, opt.rotation_weight, opt.translation_weight);
-      ceres::LossFunction* loss_function = new ceres::TrivialLoss();
-      double * camera  = param_storage.get_camera_ptr(icam);
-      problem.AddResidualBlock(cost_function, loss_function, camera);
-    }
+    for (int icam = 0; icam < num_cameras; icam++)
+      add_rot_trans_residual_block(icam, opt, orig_parameters, param_storage, problem);
   }
 
   // TODO(oalexan1): Make this into a function in a separate file,
@@ -1366,17 +1682,7 @@ int do_ba_ceres_one_pass(Options             & opt,
       if (param_storage.get_point_outlier(ipt))
         continue; // skip outliers
       
-      double * point = param_storage.get_point_ptr(ipt);
-
-      // Use as constraint the initially triangulated point
-      Vector3 observation(point[0], point[1], point[2]);
-      double s = 1.0/opt.tri_weight;
-      Vector3 xyz_sigma(s, s, s);
-
-      ceres::CostFunction* cost_function = XYZError::Create(observation, xyz_sigma);
-      ceres::LossFunction* loss_function = get_loss_function(opt, opt.tri_robust_threshold);
-      problem.AddResidualBlock(cost_function, loss_function, point);
-
+      add_tri_residual_block(ipt, opt, param_storage, problem);
       num_tri_residuals++;
     } // End loop through xyz
   } // end adding a triangulation constraint
@@ -1454,15 +1760,26 @@ int do_ba_ceres_one_pass(Options             & opt,
   //  options->minimizer_type = ceres::LINE_SEARCH;
   //}
 
-  vw_out() << "Starting the Ceres optimizer." << std::endl;
-  ceres::Solver::Summary summary;
-  ceres::Solve(options, &problem, &summary);
-  final_cost = summary.final_cost;
-  vw_out() << summary.FullReport() << "\n";
-  if (summary.termination_type == ceres::NO_CONVERGENCE){
-    // Print a clarifying message, so the user does not think that the algorithm failed.
-    vw_out() << "Found a valid solution, but did not reach the actual minimum." << std::endl;
-    convergence_reached = false;
+  if (use_submaps) {
+    // Solve in submaps, each with its own smaller problem. The full
+    // problem is used only to evaluate the residuals. It is still
+    // formed, so memory usage is not reduced.
+    do_ba_submaps(opt, crn, param_storage, orig_parameters);
+    ceres::Problem::EvaluateOptions eval_options;
+    eval_options.num_threads = options.num_threads;
+    problem.Evaluate(eval_options, &final_cost, NULL, NULL, NULL);
+    vw_out() << "Final cost: " << final_cost << "\n";
+  } else {
+    vw_out() << "Starting the Ceres optimizer." << std::endl;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    final_cost = summary.final_cost;
+    vw_out() << summary.FullReport() << "\n";
+    if (summary.termination_type == ceres::NO_CONVERGENCE){
+      // Print a clarifying message, so the user does not think that the algorithm failed.
+      vw_out() << "Found a valid solution, but did not reach the actual minimum." << std::endl;
+      convergence_reached = false;
+    }
   }
 
   // Write the condition files after each pass, as we never know which pass will be the last
@@ -1709,6 +2026,9 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
   if (opt.num_ba_passes <= 0)
     vw_throw(ArgumentErr() << "Error: Expecting at least one bundle adjust pass.\n");
   
+  // For a very large number of cameras, solve the problem in submaps
+  bool use_submaps = (opt.submap_size > 0 && num_cameras > opt.submap_size);
+  
   double final_cost;
   for (int pass = 0; pass < opt.num_ba_passes; pass++) {
 
@@ -1719,7 +2039,7 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
 
     bool first_pass = (pass == 0);
     bool convergence_reached = true; // will change
-    do_ba_ceres_one_pass(opt, crn, first_pass,
+    do_ba_ceres_one_pass(opt, crn, first_pass, use_submaps,
                          param_storage, orig_parameters,
                          convergence_reached, final_cost);
     
@@ -1756,7 +2076,7 @@ void do_ba_ceres(Options & opt, std::vector<Vector3> const& estimated_camera_gcc
     // Do another pass of bundle adjustment.
     bool first_pass = true; // this needs more thinking
     bool convergence_reached = true;
-    do_ba_ceres_one_pass(opt, crn, first_pass,
+    do_ba_ceres_one_pass(opt, crn, first_pass, use_submaps,
                          param_storage, orig_parameters,
                          convergence_reached, final_cost);
     
@@ -2030,6 +2350,10 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "How many interest points to detect in each image (default: automatic determination). It is overridden by --ip-per-tile if provided.")
     ("num-passes",           po::value(&opt.num_ba_passes)->default_value(2),
      "How many passes of bundle adjustment to do, with given number of iterations in each pass. For more than one pass, outliers will be removed between passes using --remove-outliers-params, and re-optimization will take place. Residual files and a copy of the match files with the outliers removed (*-clean.match) will be written to disk.")
+    ("submap-size",          po::value(&opt.submap_size)->default_value(0),
+     "If positive and there are more cameras than this, partition the cameras spatially into submaps of about this many cameras each. Solve the submaps independently, then jointly the cameras and points shared among submaps, then the submaps again. Each solve is then much smaller than the full problem, which reduces the solver time for a very large number of cameras, at the cost of an approximate solution. This does not reduce memory usage, as the full problem is still formed to report the residuals and find outliers. Cannot be used with --solve-intrinsics.")
+    ("num-parallel-submaps", po::value(&opt.num_parallel_submaps)->default_value(4),
+     "How many submaps to solve in parallel with --submap-size. Memory usage grows with this number. The threads given by --threads are divided among the submaps.")
     ("num-random-passes",           po::value(&opt.num_random_passes)->default_value(0),
      "After performing the normal bundle adjustment passes, do this many more passes using the same matches but adding random offsets to the initial parameter values with the goal of avoiding local minima that the optimizer may be getting stuck in.")
     ("remove-outliers-params", 
@@ -2581,6 +2905,21 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                  << "Cannot specify more than one of --transform-cameras-using-gcp, "
                  << "transform-cameras-with-shared-gcp, init-camera-using-gcp.\n");
 
+  if (opt.submap_size > 0) {
+    if (!opt.heights_from_dem.empty() || !opt.ref_dem.empty() ||
+        !opt.reference_terrain.empty())
+      vw_throw(ArgumentErr() << "The option --submap-size cannot be used with "
+               << "--heights-from-dem, --reference-dem, or --reference-terrain.\n");
+    if (opt.num_random_passes > 0)
+      vw_throw(ArgumentErr() << "The option --submap-size cannot be used with "
+               << "--num-random-passes.\n");
+    if (opt.solve_intrinsics)
+      vw_throw(ArgumentErr() << "The option --submap-size cannot be used with "
+               << "--solve-intrinsics.\n");
+    if (opt.num_parallel_submaps <= 0)
+      vw_throw(ArgumentErr() << "The value of --num-parallel-submaps must be positive.\n");
+  }
+  
   return;
 }
 
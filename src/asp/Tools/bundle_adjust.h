@@ -72,7 +72,7 @@ struct Options: public asp::BaBaseOptions {
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list,
     proj_str;
   double semi_major, semi_minor, position_filter_dist;
-  int    num_ba_passes, max_num_reference_points;
+  int    num_ba_passes, max_num_reference_points, submap_size, num_parallel_submaps;
   std::string remove_outliers_params_str;
   std::vector<double> intrinsics_limits;
   boost::shared_ptr<vw::ba::ControlNetwork> cnet;
@@ -104,7 +104,8 @@ struct Options: public asp::BaBaseOptions {
               save_intermediate_cameras(false),
              fix_gcp_xyz(false), solve_intrinsics(false), camera_type(BaCameraType_Other),
              semi_major(0), semi_minor(0), position_filter_dist(-1),
-             num_ba_passes(2), max_num_reference_points(-1),
+             num_ba_passes(2), max_num_reference_points(-1), submap_size(0),
+             num_parallel_submaps(4),
              datum(vw::cartography::Datum(asp::UNSPECIFIED_DATUM, "User Specified Spheroid",
                                           "Reference Meridian", 1, 1, 0)),
              ip_detect_method(0), num_scales(-1), skip_rough_homography(false),
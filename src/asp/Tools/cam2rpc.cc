@@ -24,6 +24,7 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Settings.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Cartography/Datum.h>
 #include <vw/Cartography/GeoReference.h>
@@ -281,26 +282,67 @@ int main( int argc, char *argv[] ) {
       double delta_lon = (ll.max()[0] - ll.min()[0])/double(opt.num_samples);
       double delta_lat = (ll.max()[1] - ll.min()[1])/double(opt.num_samples);
       double delta_ht  = (H[1] - H[0])/double(opt.num_samples);
+
+      // The sample values in each direction. Accumulate them the
+      // same way a nested loop would.
+      std::vector<double> lons, lats, hts;
+      for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon)
+        lons.push_back(lon);
+      for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat)
+        lats.push_back(lat);
+      for (double ht = H[0]; ht <= H[1]; ht += delta_ht)
+        hts.push_back(ht);
+
+      // Project the grid one height layer per thread. Each point has
+      // its own slot, so the results are in the same order as for a
+      // serial loop.
+      int num_lon = lons.size(), num_lat = lats.size(), num_ht = hts.size();
+      int num_grid = num_lon * num_lat * num_ht;
+      std::vector<Vector3> grid_llh(num_grid);
+      std::vector<Vector2> grid_pix(num_grid);
+      std::vector<char>    grid_valid(num_grid, 0);
+
+      int num_threads = vw_settings().default_num_threads();
+      if (!session->supports_multi_threading())
+        num_threads = 1; // ISIS must be single threaded
+      num_threads = std::max(num_threads, 1);
+
       tpc.report_progress(0);
-      for (double lon = ll.min()[0]; lon <= ll.max()[0]; lon += delta_lon) {
-        for (double lat = ll.min()[1]; lat <= ll.max()[1]; lat += delta_lat) {
-          for (double ht = H[0]; ht <= H[1]; ht += delta_ht) {
+      double layer_inc = 1.0 / std::max(num_ht, 1);
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+      for (int iht = 0; iht < num_ht; iht++) {
+        for (int ilon = 0; ilon < num_lon; ilon++) {
+          for (int ilat = 0; ilat < num_lat; ilat++) {
 
-            Vector3 llh(lon, lat, ht);
+            Vector3 llh(lons[ilon], lats[ilat], hts[iht]);
             Vector3 xyz = opt.datum.geodetic_to_cartesian(llh);
 
             // Go back to llh. This is a bugfix for the 360 deg offset problem.
             llh = opt.datum.cartesian_to_geodetic(xyz);
 
-            Vector2 cam_pix = cam->point_to_pixel(xyz);
-            if (image_box.contains(cam_pix)) {
-              all_llh.push_back(llh);
-              all_pixels.push_back(cam_pix);
+            Vector2 cam_pix;
+            try {
+              cam_pix = cam->point_to_pixel(xyz);
+            }catch(...){
+              continue;
             }
 
+            if (image_box.contains(cam_pix)) {
+              int index = (ilon * num_lat + ilat) * num_ht + iht;
+              grid_llh[index]   = llh;
+              grid_pix[index]   = cam_pix;
+              grid_valid[index] = 1;
+            }
           }
         }
-        tpc.report_incremental_progress(inc_amount);
+#pragma omp critical
+        tpc.report_incremental_progress(layer_inc);
+      }
+
+      for (int index = 0; index < num_grid; index++) {
+        if (!grid_valid[index]) continue;
+        all_llh.push_back(grid_llh[index]);
+        all_pixels.push_back(grid_pix[index]);
       }
 
     }else{
@@ -452,12 +494,13 @@ int main( int argc, char *argv[] ) {
     asp::RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
     std::string output_prefix = "";
     vw_out() << "Generating the RPC approximation using " << num_total_pts << " point pairs.\n";
-    asp::gen_rpc(// Inputs
+    double rms_error = asp::gen_rpc(// Inputs
                  opt.penalty_weight, output_prefix,
                  normalized_llh, normalized_pixels,
                  llh_scale, llh_offset, pixel_scale, pixel_offset,
                  // Outputs
                  line_num, line_den, samp_num, samp_den);
+    vw_out() << "RMS error of the RPC fit: " << rms_error << " pixels.\n";
 
     // TODO: Integrate this with aster2asp existing functionality!
     // Have a generic function for saving WV RPC files. 
@@ -25,6 +25,9 @@
 // using the cam1 camera and back-projecting the resulting points into
 // the cam2 camera, then doing this in reverse.
 
+// With --benchmark, instead measure the time per call of the main
+// camera operations, with one and with multiple threads.
+
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 #include <asp/Core/StereoSettings.h>
@@ -32,15 +35,23 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Camera/RPCModel.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/Settings.h>
 #include <asp/Camera/CsmModel.h>
 #include <asp/IsisIO/IsisCameraModel.h>
 
 // Temporary headers
 #include <vw/Camera/CAHVModel.h>
 #include <asp/Camera/LinescanDGModel.h>
+#include <asp/Camera/LinescanUtils.h>
 #include <asp/Camera/Covariance.h>
 #include <vw/Math/LinearAlgebra.h>
 
+// For writing the benchmark results
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <random>
+
 using namespace vw;
 using namespace vw::cartography;
 namespace po = boost::program_options;
@@ -53,7 +64,9 @@ struct Options : vw::GdalWriteOptions {
   int sample_rate; // use one out of these many pixels
   double subpixel_offset, height_above_datum;
   bool enable_correct_velocity_aberration, enable_correct_atmospheric_refraction,
-    print_per_pixel_results, dg_use_csm, dg_vs_csm, test_error_propagation;
+    print_per_pixel_results, dg_use_csm, dg_vs_csm, test_error_propagation, benchmark;
+  int benchmark_num_samples;
+  std::string benchmark_json;
   vw::Vector2 single_pixel;
   
   Options() {}
@@ -94,6 +107,17 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Adjust the cameras using this prefix.")
     ("test-error-propagation", po::bool_switch(&opt.test_error_propagation)->default_value(false)->implicit_value(true),
      "Test computing the stddev (see --propagate-errors). This is an undocumented developer option.")
+    ("benchmark", po::bool_switch(&opt.benchmark)->default_value(false)->implicit_value(true),
+     "Instead of comparing the cameras, measure the time per call of point_to_pixel(), "
+     "pixel_to_vector(), and camera_center(), with one thread and with the number of "
+     "threads set by --threads. For linescan cameras which use the line solver "
+     "for point_to_pixel(), also time that solver and Levenberg-Marquardt separately. "
+     "Only --cam1 is required. If --cam2 is set, it is measured as well.")
+    ("benchmark-num-samples", po::value(&opt.benchmark_num_samples)->default_value(10000),
+     "The number of random pixels at which to time the camera operations.")
+    ("benchmark-json", po::value(&opt.benchmark_json)->default_value(""),
+     "Save the benchmark results to this file, in JSON format. The default is to "
+     "print them on screen.")
     ;  
   general_options.add(vw::GdalWriteOptionsDescription(opt));
   
@@ -110,9 +134,14 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                             positional, positional_desc, usage,
                             allow_unregistered, unregistered);
 
-  if (opt.image_file == "" || opt.cam1_file == "" || opt.cam2_file == "")
+  if (opt.image_file == "" || opt.cam1_file == "" ||
+      (opt.cam2_file == "" && !opt.benchmark))
     vw_throw(ArgumentErr() << "Not all inputs were specified.\n" << usage << general_options);
 
+  if (opt.benchmark && opt.benchmark_num_samples <= 0)
+    vw_throw(ArgumentErr() << "The number of benchmark samples must be positive.\n"
+             << usage << general_options);
+
   if (opt.sample_rate <= 0)
     vw_throw(ArgumentErr() << "The sample rate must be positive.\n" << usage << general_options);
 
@@ -191,6 +220,184 @@ void testErrorPropagation(Options const& opt,
   std::cout << "Horizontal and vertical stddev: " << ans << std::endl;
 }
 
+// The camera operations timed by --benchmark
+enum CameraOp {POINT_TO_PIXEL, PIXEL_TO_VECTOR, CAMERA_CENTER};
+
+// Time a camera operation on the given samples. Return the wall-clock
+// time per call, in nanoseconds. The calls which threw an exception
+// are counted in num_failed. Those are included in the time per call.
+double timeCameraOp(vw::camera::CameraModel const* cam, CameraOp op,
+                    std::vector<Vector2> const& pixels,
+                    std::vector<Vector3> const& points,
+                    int num_threads, int & num_failed) {
+
+  int num_samples = pixels.size();
+  std::vector<double> sink(num_samples, 0.0); // keep the results alive
+
+  int failed = 0;
+  Stopwatch sw;
+  sw.start();
+#pragma omp parallel for num_threads(num_threads) schedule(static) reduction(+:failed)
+  for (int i = 0; i < num_samples; i++) {
+    try {
+      if (op == POINT_TO_PIXEL)
+        sink[i] = cam->point_to_pixel(points[i])[0];
+      else if (op == PIXEL_TO_VECTOR)
+        sink[i] = cam->pixel_to_vector(pixels[i])[0];
+      else
+        sink[i] = cam->camera_center(pixels[i])[0];
+    } catch (...) {
+      failed++;
+    }
+  }
+  sw.stop();
+
+  num_failed = failed;
+
+  return 1e+9 * sw.elapsed_seconds() / std::max(num_samples, 1);
+}
+
+// Time the ground-to-image solvers for linescan cameras, starting from
+// the image center for each point, as point_to_pixel() does. With
+// use_lm, only Levenberg-Marquardt is used, else only the line solver.
+// Return the time per call in nanoseconds. The points for which the
+// solver failed are counted in num_failed.
+double timeLinescanSolver(vw::camera::LinescanModel const* ls_cam, bool use_lm,
+                          std::vector<Vector3> const& points,
+                          Vector2 const& image_size,
+                          int num_threads, int & num_failed) {
+
+  int num_samples = points.size();
+  std::vector<double> sink(num_samples, 0.0); // keep the results alive
+
+  int failed = 0;
+  Stopwatch sw;
+  sw.start();
+#pragma omp parallel for num_threads(num_threads) schedule(static) reduction(+:failed)
+  for (int i = 0; i < num_samples; i++) {
+    Vector2 pix = image_size / 2.0;
+    bool success = false;
+    try {
+      if (use_lm)
+        success = asp::linescanPointToPixelLM(*ls_cam, points[i], -1, pix);
+      else
+        success = asp::linescanPointToPixel(*ls_cam, points[i], pix);
+    } catch (...) {}
+    if (!success)
+      failed++;
+    sink[i] = pix[0];
+  }
+  sw.stop();
+
+  num_failed = failed;
+
+  return 1e+9 * sw.elapsed_seconds() / std::max(num_samples, 1);
+}
+
+// Time point_to_pixel(), pixel_to_vector(), and camera_center() for a
+// camera at random pixels, and at the points where the rays through
+// those pixels meet the datum. The same random seed is used each
+// time, so results can be compared across runs.
+nlohmann::json benchmarkCamera(Options const& opt, std::string const& cam_file,
+                               std::string const& session_name,
+                               bool supports_multi_threading,
+                               vw::cartography::Datum const& datum,
+                               vw::camera::CameraModel const* cam,
+                               int image_cols, int image_rows) {
+
+  double major_axis = datum.semi_major_axis() + opt.height_above_datum;
+  double minor_axis = datum.semi_minor_axis() + opt.height_above_datum;
+
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> col_dist(0.0, std::max(image_cols - 1, 0));
+  std::uniform_real_distribution<double> row_dist(0.0, std::max(image_rows - 1, 0));
+
+  std::vector<Vector2> pixels;
+  std::vector<Vector3> points;
+  int num_attempts = 0;
+  while (int(pixels.size()) < opt.benchmark_num_samples &&
+         num_attempts < 10 * opt.benchmark_num_samples) {
+    num_attempts++;
+    Vector2 pix(col_dist(gen), row_dist(gen));
+    Vector3 xyz;
+    try {
+      xyz = vw::cartography::datum_intersection(major_axis, minor_axis,
+                                                cam->camera_center(pix),
+                                                cam->pixel_to_vector(pix));
+    } catch (...) {
+      continue;
+    }
+    if (xyz == Vector3()) // the ray missed the datum
+      continue;
+    pixels.push_back(pix);
+    points.push_back(xyz);
+  }
+
+  if (pixels.empty())
+    vw_throw(ArgumentErr() << "Could not find any pixels whose rays intersect the datum "
+             << "for camera: " << cam_file << "\n");
+
+  int num_threads = vw_settings().default_num_threads();
+  if (!supports_multi_threading)
+    num_threads = 1; // ISIS must be single threaded
+  num_threads = std::max(num_threads, 1);
+
+  nlohmann::json result;
+  result["camera"]       = cam_file;
+  result["session"]      = session_name;
+  result["num_samples"]  = int(pixels.size());
+  result["num_threads"]  = num_threads;
+
+  std::string op_names[] = {"point_to_pixel", "pixel_to_vector", "camera_center"};
+  CameraOp ops[] = {POINT_TO_PIXEL, PIXEL_TO_VECTOR, CAMERA_CENTER};
+  for (int it = 0; it < 3; it++) {
+    int single_failed = 0, multi_failed = 0;
+    double single_ns = timeCameraOp(cam, ops[it], pixels, points, 1, single_failed);
+    double multi_ns  = timeCameraOp(cam, ops[it], pixels, points, num_threads,
+                                    multi_failed);
+    if (single_failed > 0 || multi_failed > 0)
+      vw_out(WarningMessage) << op_names[it] << " failed for "
+                             << std::max(single_failed, multi_failed) << " out of "
+                             << pixels.size() << " samples for camera: " << cam_file
+                             << ". The timings include the failed calls.\n";
+
+    // The wall-clock time per call with multiple threads should be
+    // the single-threaded time divided by the number of threads.
+    double efficiency = single_ns / (num_threads * std::max(multi_ns, 1e-300));
+
+    nlohmann::json op_result;
+    op_result["single_thread_ns_per_call"] = single_ns;
+    op_result["multi_thread_ns_per_call"]  = multi_ns;
+    op_result["scaling_efficiency"]        = efficiency;
+    op_result["single_thread_num_failed"]  = single_failed;
+    op_result["multi_thread_num_failed"]   = multi_failed;
+    result[op_names[it]] = op_result;
+  }
+
+  // For the linescan models which use the line solver in
+  // point_to_pixel(), compare it with Levenberg-Marquardt.
+  vw::camera::LinescanModel const* ls_cam
+    = dynamic_cast<vw::camera::LinescanModel const*>(vw::camera::unadjusted_model(cam));
+  if (ls_cam != NULL) {
+    Vector2 image_size(image_cols, image_rows);
+    std::string solver_names[] = {"line_solver", "lm_solver"};
+    double solver_ns[2];
+    for (int it = 0; it < 2; it++) {
+      bool use_lm = (it == 1);
+      int num_failed = 0;
+      solver_ns[it] = timeLinescanSolver(ls_cam, use_lm, points, image_size,
+                                         1, num_failed);
+      nlohmann::json solver_result;
+      solver_result["single_thread_ns_per_call"] = solver_ns[it];
+      solver_result["single_thread_num_failed"]  = num_failed;
+      result[solver_names[it]] = solver_result;
+    }
+    result["line_solver_speedup"] = solver_ns[1] / std::max(solver_ns[0], 1e-300);
+  }
+
+  return result;
+}
+
 int main(int argc, char *argv[]) {
 
   Options opt;
@@ -215,18 +422,22 @@ int main(int argc, char *argv[]) {
                                                            use_sphere_for_non_earth);
     vw_out() << "Datum: " << datum << std::endl;
 
-    // Load cam2
+    // Load cam2. When benchmarking, it is optional.
     std::string default_session2 = opt.session2; // save it before it changes
-    SessionPtr cam2_session(asp::StereoSessionFactory::create
-                           (opt.session2, // may change
-                            opt,
-                            opt.image_file, opt.image_file,
-                            opt.cam2_file, opt.cam2_file,
-                            out_prefix));
-    boost::shared_ptr<vw::camera::CameraModel> cam2_model
-      = cam2_session->camera_model(opt.image_file, opt.cam2_file);
-
-    if (opt.session1 == opt.session2 && (default_session1 == "" || default_session2 == "")) 
+    SessionPtr cam2_session;
+    boost::shared_ptr<vw::camera::CameraModel> cam2_model;
+    if (opt.cam2_file != "") {
+      cam2_session.reset(asp::StereoSessionFactory::create
+                         (opt.session2, // may change
+                          opt,
+                          opt.image_file, opt.image_file,
+                          opt.cam2_file, opt.cam2_file,
+                          out_prefix));
+      cam2_model = cam2_session->camera_model(opt.image_file, opt.cam2_file);
+    }
+
+    if (!opt.benchmark && opt.session1 == opt.session2 &&
+        (default_session1 == "" || default_session2 == "")) 
       vw_throw(ArgumentErr() << "The session names for both cameras "
                << "were guessed as: '" << opt.session1 << "'. It is suggested that they be "
                << "explicitly specified using --session1 and --session2.\n");
@@ -256,6 +467,27 @@ int main(int argc, char *argv[]) {
     }
 
     vw_out() << "Image dimensions: " << image_cols << ' ' << image_rows << std::endl;
+
+    if (opt.benchmark) {
+      nlohmann::json results;
+      results.push_back(benchmarkCamera(opt, opt.cam1_file, opt.session1,
+                                        cam1_session->supports_multi_threading(),
+                                        datum, cam1_model.get(), image_cols, image_rows));
+      if (cam2_model)
+        results.push_back(benchmarkCamera(opt, opt.cam2_file, opt.session2,
+                                          cam2_session->supports_multi_threading(),
+                                          datum, cam2_model.get(), image_cols, image_rows));
+
+      if (opt.benchmark_json != "") {
+        vw::create_out_dir(opt.benchmark_json);
+        vw_out() << "Writing: " << opt.benchmark_json << std::endl;
+        std::ofstream ofs(opt.benchmark_json.c_str());
+        ofs << results.dump(2) << std::endl;
+      } else {
+        vw_out() << results.dump(2) << std::endl;
+      }
+      return 0;
+    }
     
     bool single_pix = !std::isnan(opt.single_pixel[0]) && !std::isnan(opt.single_pixel[1]);
 
@@ -259,13 +259,15 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   GeoReference csv_georef = dem_georef;
   csv_conv.parse_georef(csv_georef);
 
-  std::list<asp::CsvConv::CsvRecord> csv_records;
-  typedef std::list<asp::CsvConv::CsvRecord>::const_iterator RecordIter;
-  csv_conv.read_csv_file(csv_file, csv_records);
+  asp::CsvConv::CsvColumns csv_columns;
+  csv_conv.read_csv_file(csv_file, csv_columns);
+  std::vector<Vector3> csv_xyz;
+  csv_conv.csv_to_cartesian(csv_columns, csv_georef, csv_xyz);
+  csv_columns = asp::CsvConv::CsvColumns(); // not needed anymore
   
   std::vector<Vector3> csv_llh;
-  for (RecordIter iter = csv_records.begin(); iter != csv_records.end(); iter++) {
-    Vector3 xyz = csv_conv.csv_to_cartesian(*iter, csv_georef);
+  for (size_t it = 0; it < csv_xyz.size(); it++) {
+    Vector3 const& xyz = csv_xyz[it];
     if (xyz == Vector3() || xyz != xyz)
       continue; // invalid point
     Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz); // use the dem's datum
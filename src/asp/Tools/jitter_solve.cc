@@ -39,6 +39,7 @@
 #include <asp/Sessions/StereoSessionFactory.h>
 #include <asp/Sessions/CameraUtils.h>
 #include <asp/Camera/CsmModel.h>
+#include <asp/Camera/SampleTable.h>
 #include <asp/Camera/BundleAdjustCamera.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
@@ -754,47 +755,19 @@ void normalizeQuaternions(UsgsAstroLsSensorModel * ls_model) {
   }
 }
   
-// Get quaternions. This duplicates the UsgsAstroLsSensorModel function as that one is private
-// TODO(oalexan1): Move this to a new CsmModelUtils.cc file and
-// call it from here and from LinescanDGModel.cc.
-void interpQuaternions(UsgsAstroLsSensorModel * ls_model, double time,
-                      double q[4]) {
+// The Lagrange interpolation order for positions and quaternions. This
+// follows UsgsAstroLsSensorModel.
+int interpOrder(UsgsAstroLsSensorModel const* ls_model) {
   int nOrder = 8;
   if (ls_model->m_platformFlag == 0)
     nOrder = 4;
-  int nOrderQuat = nOrder;
-  if (ls_model->m_numQuaternions/4 < 6 && nOrder == 8)
-    nOrderQuat = 4;
-  
-  lagrangeInterp(ls_model->m_numQuaternions / 4, &ls_model->m_quaternions[0],
-                 ls_model->m_t0Quat, ls_model->m_dtQuat, time, 4, nOrderQuat, q);
-}
-
-// Get positions. Based on the UsgsAstroLsSensorModel code.
-// TODO(oalexan1): Move this to a new CsmModelUtils.cc.
-void interpPositions(UsgsAstroLsSensorModel * ls_model, double time,
-                     double pos[3]) {
-  int nOrder = 8;
-  if (ls_model->m_platformFlag == 0)
-    nOrder = 4;
-  
-  // TODO(oalexan1): What if the number of positions is < 4.
-  lagrangeInterp(ls_model->m_numPositions / 3, &ls_model->m_positions[0],
-                 ls_model->m_t0Ephem, ls_model->m_dtEphem,
-                 time, 3, nOrder, pos);
+  return nOrder;
 }
-
-// Get positions. Based on the UsgsAstroLsSensorModel code.
-// TODO(oalexan1): Move this to a new CsmModelUtils.cc file and
-void interpVelocities(UsgsAstroLsSensorModel * ls_model, double time,
-                  double vel[3]) {
-  int nOrder = 8;
-  if (ls_model->m_platformFlag == 0)
-    nOrder = 4;
-  double sensPosNom[3];
-  lagrangeInterp(ls_model->m_numPositions / 3, &ls_model->m_velocities[0],
-                 ls_model->m_t0Ephem, ls_model->m_dtEphem,
-                 time, 3, nOrder, vel);
+int quatInterpOrder(UsgsAstroLsSensorModel const* ls_model) {
+  int nOrderQuat = interpOrder(ls_model);
+  if (ls_model->m_numQuaternions/4 < 6 && nOrderQuat == 8)
+    nOrderQuat = 4;
+  return nOrderQuat;
 }
 
 // Calc the time of first image line, last image line, elapsed time
@@ -943,12 +916,17 @@ void resampleModel(Options const& opt, UsgsAstroLsSensorModel * ls_model) {
     double numLinesPerPosition = (numLines - 1.0) * currDtEphem / elapsed_time;
     vw_out() << "Resampled number of lines per position: "
              << numLinesPerPosition << "\n";
+    asp::UniformSampleTable pos_table(numOldMeas, NUM_XYZ_PARAMS, &ls_model->m_positions[0],
+                                      ls_model->m_t0Ephem, ls_model->m_dtEphem);
+    asp::UniformSampleTable vel_table(numOldMeas, NUM_XYZ_PARAMS, &ls_model->m_velocities[0],
+                                      ls_model->m_t0Ephem, ls_model->m_dtEphem);
+    int nOrder = interpOrder(ls_model);
     std::vector<double> positions(NUM_XYZ_PARAMS * numNewMeas, 0);
     std::vector<double> velocities(NUM_XYZ_PARAMS * numNewMeas, 0);
     for (int ipos = 0; ipos < numNewMeas; ipos++) {
       double time = ls_model->m_t0Ephem + ipos * currDtEphem;
-      interpPositions(ls_model, time, &positions[NUM_XYZ_PARAMS * ipos]);
-      interpVelocities(ls_model, time, &velocities[NUM_XYZ_PARAMS * ipos]);
+      pos_table.lagrange(time, nOrder, &positions[NUM_XYZ_PARAMS * ipos]);
+      vel_table.lagrange(time, nOrder, &velocities[NUM_XYZ_PARAMS * ipos]);
     }
     
     // Overwrite in the model. Time of first tabulated position does not change.
@@ -981,10 +959,13 @@ void resampleModel(Options const& opt, UsgsAstroLsSensorModel * ls_model) {
     double numLinesPerOrientation = (numLines - 1.0) * currDtQuat / elapsed_time;
     vw_out() << "Resampled number of lines per orientation: "
              << numLinesPerOrientation << "\n";
+    asp::UniformSampleTable quat_table(numOldMeas, NUM_QUAT_PARAMS, &ls_model->m_quaternions[0],
+                                       ls_model->m_t0Quat, ls_model->m_dtQuat);
+    int nOrderQuat = quatInterpOrder(ls_model);
     std::vector<double> quaternions(NUM_QUAT_PARAMS * numNewMeas, 0);
     for (int ipos = 0; ipos < numNewMeas; ipos++) {
       double time = ls_model->m_t0Quat + ipos * currDtQuat;
-      interpQuaternions(ls_model, time, &quaternions[NUM_QUAT_PARAMS * ipos]);
+      quat_table.lagrange(time, nOrderQuat, &quaternions[NUM_QUAT_PARAMS * ipos]);
     }
     
     // Overwrite in the model. Time of first tabulated orientation does not change.
@@ -1021,74 +1002,132 @@ void calcAnchorPoints(Options                              const & opt,
     vw::vw_throw(vw::ArgumentErr() << "Expecting a positive number of anchor points.\n");
 
   int extra = opt.num_anchor_points_extra_lines;
-    
+
+  // Each anchor point requires intersecting a ray with the DEM, which
+  // is expensive, so this is done in parallel. A task is a column of
+  // bins for a given camera. Within a column, the intersection for
+  // each bin is seeded with the one for the previous bin. The results
+  // are appended in the same order as when done serially.
+  struct AnchorColumn {
+    int icam, binx;
+    std::vector<Vector2> pix;
+    std::vector<Vector3> xyz;
+  };
+  
   int num_cams = ls_models.size();
+  std::vector<double> bin_lens(num_cams);
+  std::vector<AnchorColumn> columns;
   for (int icam = 0; icam < num_cams; icam++) {
-
     // Use int64 and double to avoid int32 overflow
     std::int64_t numLines   = ls_models[icam]->m_nLines;
     std::int64_t numSamples = ls_models[icam]->m_nSamples;
     double area = double(numSamples) * double(numLines + 2 * extra);
     double bin_len = sqrt(area/double(opt.num_anchor_points));
     bin_len = std::max(bin_len, 1.0);
+    bin_lens[icam] = bin_len;
     int lenx = ceil(double(numSamples) / bin_len); lenx = std::max(1, lenx);
+    for (int binx = 0; binx <= lenx; binx++) {
+      AnchorColumn column;
+      column.icam = icam;
+      column.binx = binx;
+      columns.push_back(column);
+    }
+  }
+
+  int num_threads = opt.num_threads;
+  if (opt.single_threaded_cameras)
+    num_threads = 1;
+  num_threads = std::max(num_threads, 1);
+  
+  int num_columns = columns.size();
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+  for (int col_it = 0; col_it < num_columns; col_it++) {
+
+    AnchorColumn & column = columns[col_it]; // alias
+    int icam = column.icam;
+    double bin_len = bin_lens[icam];
+    std::int64_t numLines   = ls_models[icam]->m_nLines;
+    std::int64_t numSamples = ls_models[icam]->m_nSamples;
     int leny = ceil(double(numLines + 2 * extra) / bin_len); leny = std::max(1, leny);
 
-    std::int64_t numAnchorPoints = 0;
-    for (int binx = 0; binx <= lenx; binx++) {
-      double posx = binx * bin_len;
-      for (int biny = 0; biny <= leny; biny++) {
-        double posy = biny * bin_len - extra;
-        
-        if (posx > numSamples - 1 || posy < -extra || posy > numLines - 1 + extra) 
-          continue;
-        
-        Vector2 pix(posx, posy);
-        Vector3 xyz_guess(0, 0, 0);
-        
-        bool treat_nodata_as_zero = false;
-        bool has_intersection = false;
-        double height_error_tol = 0.001; // 1 mm should be enough
-        double max_abs_tol      = 1e-14; // abs cost fun change b/w iterations
-        double max_rel_tol      = 1e-14;
-        int num_max_iter        = 50;   // Using many iterations can be very slow
-          
+    double posx = column.binx * bin_len;
+    Vector3 prev_xyz(0, 0, 0); // the intersection for the previous bin, if any
+    for (int biny = 0; biny <= leny; biny++) {
+      double posy = biny * bin_len - extra;
+      
+      if (posx > numSamples - 1 || posy < -extra || posy > numLines - 1 + extra) 
+        continue;
+      
+      Vector2 pix(posx, posy);
+      
+      bool treat_nodata_as_zero = false;
+      bool has_intersection = false;
+      double height_error_tol = 0.001; // 1 mm should be enough
+      double max_abs_tol      = 1e-14; // abs cost fun change b/w iterations
+      double max_rel_tol      = 1e-14;
+      int num_max_iter        = 50;   // Using many iterations can be very slow
+
+      // Exceptions must not escape the parallel loop, so skip a sample
+      // for which any of the camera or DEM operations fails
+      try {
+        Vector3 cam_ctr = opt.camera_models[icam]->camera_center(pix);
+        Vector3 cam_dir = opt.camera_models[icam]->pixel_to_vector(pix);
+        Vector3 xyz_guess = prev_xyz;
         Vector3 dem_xyz = vw::cartography::camera_pixel_to_dem_xyz
-          (opt.camera_models[icam]->camera_center(pix),
-           opt.camera_models[icam]->pixel_to_vector(pix),
-           interp_acnhor_dem, anchor_georef, treat_nodata_as_zero, has_intersection,
+          (cam_ctr, cam_dir, interp_acnhor_dem, anchor_georef,
+           treat_nodata_as_zero, has_intersection,
            height_error_tol, max_abs_tol, max_rel_tol, num_max_iter, xyz_guess);
 
+        // If the seed from the neighboring bin did not work, start from scratch 
+        if (!has_intersection && prev_xyz != Vector3(0, 0, 0)) {
+          xyz_guess = Vector3(0, 0, 0);
+          dem_xyz = vw::cartography::camera_pixel_to_dem_xyz
+            (cam_ctr, cam_dir, interp_acnhor_dem, anchor_georef,
+             treat_nodata_as_zero, has_intersection,
+             height_error_tol, max_abs_tol, max_rel_tol, num_max_iter, xyz_guess);
+        }
+        
         if (!has_intersection) 
           continue;
 
-        Vector2 pix_out;
-        try {
-          pix_out = opt.camera_models[icam]->point_to_pixel(dem_xyz);
-        } catch (...) {
-          continue;
-        }
-        
+        Vector2 pix_out = opt.camera_models[icam]->point_to_pixel(dem_xyz);
         if (norm_2(pix - pix_out) > 10 * height_error_tol)
           continue; // this is likely a bad point
 
-        pixel_vec[icam].push_back(pix);
-        weight_vec[icam].push_back(opt.anchor_weight);
-        isAnchor_vec[icam].push_back(1);
-
-        // Create a shared_ptr as we need a pointer per the api to use later
-        xyz_vec[icam].push_back(boost::shared_ptr<Vector3>(new Vector3()));
-        Vector3 & xyz = *xyz_vec[icam].back().get(); // alias to the element we just made
-        xyz = dem_xyz; // copy the value, but the pointer does not change
-        xyz_vec_ptr[icam].push_back(&xyz[0]); // keep the pointer to the first element
-        numAnchorPoints++;
-      }   
+        prev_xyz = dem_xyz;
+        column.pix.push_back(pix);
+        column.xyz.push_back(dem_xyz);
+      } catch (...) {
+        continue;
+      }
     }
+  }
 
+  // Append the results in order
+  std::vector<std::int64_t> numAnchorPoints(num_cams, 0);
+  for (int col_it = 0; col_it < num_columns; col_it++) {
+    AnchorColumn const& column = columns[col_it]; // alias
+    int icam = column.icam;
+    for (size_t it = 0; it < column.pix.size(); it++) {
+      pixel_vec[icam].push_back(column.pix[it]);
+      weight_vec[icam].push_back(opt.anchor_weight);
+      isAnchor_vec[icam].push_back(1);
+
+      // Create a shared_ptr as we need a pointer per the api to use later
+      xyz_vec[icam].push_back(boost::shared_ptr<Vector3>(new Vector3()));
+      Vector3 & xyz = *xyz_vec[icam].back().get(); // alias to the element we just made
+      xyz = column.xyz[it]; // copy the value, but the pointer does not change
+      xyz_vec_ptr[icam].push_back(&xyz[0]); // keep the pointer to the first element
+      numAnchorPoints[icam]++;
+    }
+  }
+
+  for (int icam = 0; icam < num_cams; icam++) {
     vw_out() << std::endl;
     vw_out() << "Image file: " << opt.image_files[icam] << std::endl;
-    vw_out() << "Lines and samples: " << numLines << ' ' << numSamples << std::endl;
-    vw_out() << "Num anchor points per image: " << numAnchorPoints     << std::endl;
+    vw_out() << "Lines and samples: " << ls_models[icam]->m_nLines << ' '
+             << ls_models[icam]->m_nSamples << std::endl;
+    vw_out() << "Num anchor points per image: " << numAnchorPoints[icam] << std::endl;
   }   
 }
 
@@ -86,10 +86,11 @@ struct Options : vw::GdalWriteOptions {
   int         erode_len;
   std::string csv_format_str, csv_proj4_str, filter;
   double      search_radius_factor, sigma_factor, default_grid_size_multiplier;
+  double      filter_memory_limit_mb;
   bool        use_surface_sampling;
   bool        has_las_or_csv_or_pcd;
   Vector2i    max_output_size;
-  bool        input_is_projected;
+  bool        input_is_projected, cache_projected_cloud, dem_pyramid;
 
   // Output
   std::string out_prefix, output_file_type;
@@ -102,8 +103,10 @@ struct Options : vw::GdalWriteOptions {
     remove_outliers_with_pct(true), use_tukey_outlier_removal(false),
     max_valid_triangulation_error(0),
     erode_len(0), search_radius_factor(0), sigma_factor(0),
-    default_grid_size_multiplier(1.0), use_surface_sampling(false),
-    has_las_or_csv_or_pcd(false), max_output_size(9999999, 9999999), input_is_projected(false){}
+    default_grid_size_multiplier(1.0), filter_memory_limit_mb(4096.0),
+    use_surface_sampling(false),
+    has_las_or_csv_or_pcd(false), max_output_size(9999999, 9999999), input_is_projected(false),
+    cache_projected_cloud(false), dem_pyramid(false){}
 };
 
 void parse_input_clouds_textures(std::vector<std::string> const& files,
@@ -405,6 +408,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     ("csv-format",     po::value(&opt.csv_format_str)->default_value(""), asp::csv_opt_caption().c_str())
     ("csv-proj4",      po::value(&opt.csv_proj4_str)->default_value(""), "The PROJ.4 string to use to interpret the entries in input CSV files, if those files contain Easting and Northing fields. If not specified, --t_srs will be used.")
     ("filter",      po::value(&opt.filter)->default_value("weighted_average"), "The filter to apply to the heights of the cloud points within a given circular neighborhood when gridding (its radius is controlled via --search-radius-factor). Options: weighted_average (default), min, max, mean, median, stddev, count (number of points), nmad (= 1.4826 * median(abs(X - median(X)))), n-pct (where n is a real value between 0 and 100, for example, 80-pct, meaning, 80th percentile). Except for the default, the name of the filter will be added to the obtained DEM file name, e.g., output-min-DEM.tif.")
+    ("filter-memory-limit-mb", po::value(&opt.filter_memory_limit_mb)->default_value(4096.0),
+     "The memory limit, in MB, for storing the heights of the cloud points at each DEM grid node, for the median, nmad, and n-pct filters. The limit is split evenly among the threads. If a thread needs more, the heights at each node are summarized by a few hundred weighted values, which makes these filters approximate. Set to 0 for no limit.")
     ("rounding-error", po::value(&opt.rounding_error)->default_value(asp::APPROX_ONE_MM),
      "How much to round the output DEM and errors, in meters (more rounding means less precision but potentially smaller size on disk). The inverse of a power of 2 is suggested. Default: 1/2^10.")
     ("search-radius-factor", po::value(&opt.search_radius_factor)->default_value(0.0),
@@ -418,7 +423,11 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Use the older algorithm, interpret the point cloud as a surface made up of triangles and interpolate into it (prone to aliasing).")
     ("fsaa",   po::value<int>(&opt.fsaa)->default_value(1),            "Oversampling amount to perform antialiasing (obsolete).")
     ("no-dem", po::bool_switch(&opt.no_dem)->default_value(false), "Skip writing a DEM.")
-    ("input-is-projected", po::bool_switch(&opt.input_is_projected)->default_value(false), "Input data is already in projected coordinates.");
+    ("input-is-projected", po::bool_switch(&opt.input_is_projected)->default_value(false), "Input data is already in projected coordinates.")
+    ("cache-projected-cloud", po::bool_switch(&opt.cache_projected_cloud)->default_value(false),
+     "Save the projected point cloud to a temporary file before creating the DEM, so that each point is read and projected only once, rather than for every output tile it contributes to. The file stores each point as three doubles, and the intersection error as a fourth one, if used, so it takes 24 or 32 bytes per point before compression. It is deleted at the end.")
+    ("dem-pyramid", po::bool_switch(&opt.dem_pyramid)->default_value(false),
+     "When multiple DEM spacings are set, grid the cloud only at the finest one, and create the coarser DEMs and intersection error images by aggregating the gridded heights and errors with their weights. Each spacing must be an integer multiple of the finest. Only the weighted_average and mean filters are supported.");
 
   general_options.add(manipulation_options);
   general_options.add(projection_options);
@@ -444,6 +453,9 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
   std::vector<std::string> input_files = vm["input-files"].as< std::vector<std::string> >();
   parse_input_clouds_textures(input_files, usage, general_options, opt);
 
+  asp::Point2Grid::set_memory_limit_mb(opt.filter_memory_limit_mb,
+                                       vw_settings().default_num_threads());
+
   if (opt.median_filter_params[0] < 0 || opt.median_filter_params[1] < 0){
     vw_throw(ArgumentErr() << "The parameters for median-based filtering "
                             << "must be non-negative.\n" << usage << general_options);
@@ -489,6 +501,25 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
                             << "output DEM resolution must be set.\n");
   }
 
+  if (opt.dem_pyramid) {
+    double finest = *std::min_element(opt.dem_spacing.begin(), opt.dem_spacing.end());
+    if (finest <= 0.0)
+      vw_throw(ArgumentErr() << "All DEM spacings must be set when using --dem-pyramid.\n");
+    for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+      double ratio = opt.dem_spacing[i]/finest;
+      if (std::abs(ratio - round(ratio)) > 1e-6*ratio)
+        vw_throw(ArgumentErr() << "With --dem-pyramid, each DEM spacing must be an "
+                 << "integer multiple of the finest one.\n");
+    }
+    if (opt.filter != "weighted_average" && opt.filter != "mean")
+      vw_throw(ArgumentErr() << "The --dem-pyramid option works only with the "
+               << "weighted_average and mean filters.\n");
+    if (opt.use_surface_sampling || opt.do_ortho || opt.propagate_errors || opt.do_normalize)
+      vw_throw(ArgumentErr() << "The --dem-pyramid option cannot be used with "
+               << "--use-surface-sampling, --orthoimage, --propagate-errors, "
+               << "or --normalize.\n");
+  }
+
   if (opt.out_prefix.empty())
     opt.out_prefix = asp::prefix_from_pointcloud_filename(opt.pointcloud_files[0]);
 
@@ -685,6 +716,20 @@ namespace asp{
                                                   ErrorToNED(georef));
   }
 
+  /// Append the triangulation error to a point, so that both can be
+  /// saved to the same file.
+  struct AppendErrorFunc: public ReturnFixedType<Vector4> {
+    Vector4 operator()(Vector3 const& point, double error) const {
+      return Vector4(point[0], point[1], point[2], error);
+    }
+  };
+  template <class ImageT, class ErrorT>
+  BinaryPerPixelView<ImageT, ErrorT, AppendErrorFunc>
+  inline append_error(ImageViewBase<ImageT> const& points, ImageViewBase<ErrorT> const& errors) {
+    return BinaryPerPixelView<ImageT, ErrorT, AppendErrorFunc>(points.impl(), errors.impl(),
+                                                               AppendErrorFunc());
+  }
+
   /// Write an image to disk while handling some common options.
   template<class ImageT>
   void save_image(Options& opt, ImageT img, GeoReference const& georef,
@@ -834,30 +879,14 @@ namespace asp{
 
 } // end namespace asp
 
-void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
-                               Options& opt,
-                               cartography::GeoReference& georef,
-                               ImageViewRef<double> const& error_image,
-                               double estim_max_error,
-                               std::int64_t * num_invalid_pixels) {
-
-  vw_out() << "\t-- Starting DEM rasterization --\n";
-  vw_out() << "\t--> DEM spacing: " <<     rasterizer.spacing() << " pt/px\n";
-  vw_out() << "\t             or: " << 1.0/rasterizer.spacing() << " px/pt\n";
+/// Set the georeference of the output DEM for the current spacing,
+/// and turn off the rounding of heights for small bodies.
+void set_output_georef(asp::OrthoRasterizerView & rasterizer,
+                       Options& opt,
+                       cartography::GeoReference& georef) {
 
-  // TODO: Maybe put a warning or check here if the size is too big
-
-  // Now we are ready to specify the affine transform.
   georef.set_transform(rasterizer.geo_transform());
 
-  // If the user requested FSAA, we temporarily increase the
-  // resolution, apply a blur, then resample to the original
-  // resolution. This results in a DEM with less antialiasing.  Note
-  // that the georef above is set with the spacing before resolution
-  // is increased, which will be the final spacing as well.
-  if (opt.fsaa > 1)
-    rasterizer.set_spacing(rasterizer.spacing() / double(opt.fsaa));
-
   // If the user specified the ULLR .. update the georeference
   // transform here. The generate_fsaa_raster will be responsible
   // for making sure we have the correct pixel crop.
@@ -883,6 +912,63 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
       georef.datum().semi_minor_axis() <= asp::MIN_RADIUS_FOR_ROUNDING) {
     opt.rounding_error = 0.0;
   }
+}
+
+/// Fill holes in the DEM if requested, and save it. Return its size.
+Vector2i fill_holes_and_save_dem(Options& opt, ImageViewRef<PixelGray<float>> dem,
+                                 cartography::GeoReference const& georef) {
+
+  Vector2 tile_size(vw_settings().default_tile_size(),
+                    vw_settings().default_tile_size());
+
+  int hole_fill_len = opt.dem_hole_fill_len;
+  if (hole_fill_len > 0){
+    // Note that we first cache the tiles of the rasterized DEM, and
+    // fill holes later. This greatly improves the performance.
+    dem = apply_mask
+      (vw::fill_holes_grass(create_mask
+                             (block_cache(dem, tile_size, opt.num_threads),
+                              opt.nodata_value),
+                             hole_fill_len),
+       opt.nodata_value);
+  }
+
+  // Stop the program if it is going to create too large a DEM, this will cause a crash.
+  Vector2i dem_size = bounding_box(dem).size();
+  vw_out()<< "Creating output file that is " << dem_size << " px.\n";
+  if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
+    vw_throw(ArgumentErr()
+              << "Requested DEM size is too large, max allowed output size is "
+              << opt.max_output_size << " pixels.\n");
+
+  asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+
+  return dem_size;
+}
+
+void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
+                               Options& opt,
+                               cartography::GeoReference& georef,
+                               ImageViewRef<double> const& error_image,
+                               double estim_max_error,
+                               std::int64_t * num_invalid_pixels) {
+
+  vw_out() << "\t-- Starting DEM rasterization --\n";
+  vw_out() << "\t--> DEM spacing: " <<     rasterizer.spacing() << " pt/px\n";
+  vw_out() << "\t             or: " << 1.0/rasterizer.spacing() << " px/pt\n";
+
+  // TODO: Maybe put a warning or check here if the size is too big
+
+  // Now we are ready to specify the affine transform.
+  set_output_georef(rasterizer, opt, georef);
+
+  // If the user requested FSAA, we temporarily increase the
+  // resolution, apply a blur, then resample to the original
+  // resolution. This results in a DEM with less antialiasing.  Note
+  // that the georef above is set with the spacing before resolution
+  // is increased, which will be the final spacing as well.
+  if (opt.fsaa > 1)
+    rasterizer.set_spacing(rasterizer.spacing() / double(opt.fsaa));
 
   ImageViewRef<PixelGray<float>> rasterizer_fsaa
     = generate_fsaa_raster(rasterizer, opt);
@@ -897,27 +983,7 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
       = asp::round_image_pixels_skip_nodata(rasterizer_fsaa, opt.rounding_error,
                                             opt.nodata_value);
 
-    int hole_fill_len = opt.dem_hole_fill_len;
-    if (hole_fill_len > 0){
-      // Note that we first cache the tiles of the rasterized DEM, and
-      // fill holes later. This greatly improves the performance.
-      dem = apply_mask
-        (vw::fill_holes_grass(create_mask
-                               (block_cache(dem, tile_size, opt.num_threads),
-                                opt.nodata_value),
-                               hole_fill_len),
-         opt.nodata_value);
-    }
-
-    // Stop the program if it is going to create too large a DEM, this will cause a crash.
-    Vector2i dem_size = bounding_box(dem).size();
-    vw_out()<< "Creating output file that is " << dem_size << " px.\n";
-    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
-      vw_throw(ArgumentErr()
-                << "Requested DEM size is too large, max allowed output size is "
-                << opt.max_output_size << " pixels.\n");
-
-    asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
+    Vector2i dem_size = fill_holes_and_save_dem(opt, dem, georef);
     sw2.stop();
     vw_out(DebugMessage,"asp") << "DEM render time: " << sw2.elapsed_seconds() << ".\n";
 
@@ -1119,6 +1185,160 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
 } // End do_software_rasterization
 
 
+/// Project the point cloud in one streaming pass and save the
+/// projected points to a temporary tif, together with the
+/// triangulation error, if available. The outputs are then rasterized
+/// from this file. Otherwise each point is read from disk and
+/// projected again for every output tile it contributes to, which,
+/// given the search radius, median filter, and erosion, can happen
+/// several times per point.
+void cache_projected_cloud(Options & opt,
+                           ImageViewRef<Vector3> & proj_points,
+                           ImageViewRef<double> & error_image,
+                           std::vector<std::string> & tmp_tifs) {
+
+  std::string cache_file = opt.out_prefix + "-tmp-proj.tif";
+  vw_out() << "Writing the projected point cloud: " << cache_file << "\n";
+  vw::create_out_dir(cache_file);
+  tmp_tifs.push_back(cache_file); // so we can wipe it later
+
+  bool has_georef = false, has_nodata = false;
+  GeoReference georef;
+  double nodata = 0.0;
+  TerminalProgressCallback tpc("asp", "\t--> ");
+  bool has_error = (error_image.cols() > 0 && error_image.rows() > 0);
+  if (has_error) {
+    vw::cartography::block_write_gdal_image
+      (cache_file, asp::append_error(proj_points, error_image),
+       has_georef, georef, has_nodata, nodata, opt, tpc);
+    ImageViewRef<Vector4> cache = asp::read_asp_point_cloud<4>(cache_file);
+    proj_points = select_channels<3, 4, double>(cache, 0);
+    error_image = select_channel(cache, 3);
+  } else {
+    vw::cartography::block_write_gdal_image(cache_file, proj_points,
+                                            has_georef, georef, has_nodata, nodata,
+                                            opt, tpc);
+    proj_points = asp::read_asp_point_cloud<3>(cache_file);
+  }
+}
+
+/// Grid the cloud once, at the finest spacing, and save at each grid
+/// point the height, the intersection error, and the sum of weights
+/// to a temporary file. Then create the DEM and error image for each
+/// spacing by aggregating these values over blocks of grid points,
+/// rather than gridding the cloud again.
+void do_dem_pyramid(asp::OrthoRasterizerView& rasterizer,
+                    Options& opt,
+                    cartography::GeoReference& georef,
+                    ImageViewRef<double> const& error_image) {
+
+  // The intersection error is gridded along with the heights, if it
+  // is a scalar. Use the error image that was already read, if any.
+  ImageViewRef<float> error_texture;
+  bool do_error = opt.do_error;
+  if (do_error) {
+    int num_channels = asp::num_channels(opt.pointcloud_files);
+    if (num_channels == 4 || (num_channels == 6 && asp::has_stddev(opt.pointcloud_files))) {
+      if (error_image.cols() > 0 && error_image.rows() > 0)
+        error_texture = channel_cast<float>(error_image);
+      else
+        error_texture = channel_cast<float>(asp::point_cloud_error_image(opt.pointcloud_files));
+    } else {
+      vw_out() << "With --dem-pyramid, the intersection error can be gridded only "
+               << "when it is a scalar.\n";
+      do_error = false;
+    }
+  }
+
+  double fine_spacing = *std::min_element(opt.dem_spacing.begin(), opt.dem_spacing.end());
+  rasterizer.initialize_spacing(fine_spacing);
+  BBox3 fine_box = rasterizer.bounding_box();
+
+  std::string accum_file = opt.out_prefix + "-tmp-accum.tif";
+  vw_out() << "\t-- Starting DEM rasterization --\n";
+  vw_out() << "\t--> DEM spacing: " << fine_spacing << " pt/px\n";
+  vw_out() << "Writing: " << accum_file << "\n";
+  {
+    bool has_georef = false, has_nodata = false;
+    GeoReference accum_georef;
+    double nodata = 0.0;
+    TerminalProgressCallback tpc("asp", "\t--> ");
+    vw::cartography::block_write_gdal_image(accum_file,
+                                            asp::OrthoAccumulatorView(rasterizer,
+                                                                      error_texture),
+                                            has_georef, accum_georef, has_nodata, nodata,
+                                            opt, tpc);
+  }
+  ImageViewRef<Vector3> accum = vw::read_channels<3, double>(accum_file, 0);
+
+  std::string base_out_prefix = opt.out_prefix;
+  for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
+
+    double spacing = opt.dem_spacing[i];
+    int factor = (int)round(spacing/fine_spacing);
+    rasterizer.initialize_spacing(spacing);
+
+    // The grid point (0, 0) at this spacing, in units of fine grid points
+    Vector2i offset = asp::aggregate_offset(fine_box, fine_spacing,
+                                            rasterizer.bounding_box());
+
+    // Same naming convention as for do_software_rasterization_multi_spacing()
+    if (i == 0)
+      opt.out_prefix = base_out_prefix;
+    else
+      opt.out_prefix = base_out_prefix + "_" + vw::num_to_str(i);
+
+    set_output_georef(rasterizer, opt, georef);
+    vw_out() << "\t--> Aggregating to DEM spacing: " << spacing << " pt/px\n";
+
+    if (!opt.no_dem) {
+      std::int64_t num_invalid_pixels = 0;
+      vw::Mutex count_mutex;
+      ImageViewRef<PixelGray<float>> dem
+        = asp::round_image_pixels_skip_nodata
+        (asp::AccumulatorAggregateView(accum, factor, offset,
+                                       rasterizer.cols(), rasterizer.rows(),
+                                       0, opt.nodata_value,
+                                       &num_invalid_pixels, &count_mutex),
+         opt.rounding_error, opt.nodata_value);
+      Vector2i dem_size = fill_holes_and_save_dem(opt, dem, georef);
+
+      // This is before any hole-filling, as for the regular DEM
+      double num_total_pixels = double(dem_size[0])*double(dem_size[1]);
+      double invalid_ratio = double(num_invalid_pixels) / num_total_pixels;
+      vw_out() << "Percentage of valid pixels: " << 100.0*(1.0 - invalid_ratio) << "%\n";
+    }
+
+    if (do_error) {
+      // Fill the same holes as in the DEM, so the valid pixels of the
+      // two agree.
+      ImageViewRef<PixelGray<float>> error
+        = asp::AccumulatorAggregateView(accum, factor, offset,
+                                        rasterizer.cols(), rasterizer.rows(),
+                                        1, opt.nodata_value);
+      int hole_fill_len = opt.dem_hole_fill_len;
+      if (hole_fill_len > 0) {
+        Vector2 tile_size(vw_settings().default_tile_size(),
+                          vw_settings().default_tile_size());
+        error = apply_mask
+          (vw::fill_holes_grass(create_mask
+                                 (block_cache(error, tile_size, opt.num_threads),
+                                  opt.nodata_value),
+                                 hole_fill_len),
+           opt.nodata_value);
+      }
+      save_image(opt, asp::round_image_pixels_skip_nodata(error, opt.rounding_error,
+                                                          opt.nodata_value),
+                 georef, hole_fill_len, "IntersectionErr");
+    }
+  }
+
+  opt.out_prefix = base_out_prefix; // Restore the original value
+  
+  if (fs::exists(accum_file))
+    fs::remove(accum_file);
+}
+
 // Wrapper for do_software_rasterization that goes through all spacing values
 void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_points,
                                              Options& opt,
@@ -1162,6 +1382,11 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
   rasterizer.set_use_minz_as_default(false);
   rasterizer.set_default_value(opt.nodata_value);
 
+  if (opt.dem_pyramid) {
+    do_dem_pyramid(rasterizer, opt, georef, error_image);
+    return;
+  }
+
   std::string base_out_prefix = opt.out_prefix;
 
   // Call the function for each dem spacing
@@ -1323,6 +1548,12 @@ int main(int argc, char *argv[]) {
       }
     }
 
+    // Project each point only once, rather than for every tile it is
+    // needed in. This also reads the error image just once. This is
+    // optional, as it needs as much disk space as the cloud itself.
+    if (!opt.input_is_projected && opt.cache_projected_cloud)
+      cache_projected_cloud(opt, proj_points, error_image, tmp_tifs);
+
     // TODO(oalexan1): The proj box estimation should happen even when
     // we don't have the intersection error, such as when reading a
     // las or csv file.
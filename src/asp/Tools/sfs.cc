@@ -601,6 +601,17 @@ namespace vw { namespace camera {
       return;
     }
 
+    // With the RPC approximation, project many points at once, which
+    // is faster than doing it one point at a time. Return false, and
+    // do nothing, if the RPC approximation is not used.
+    bool points_to_pixels(std::vector<Vector3> const& xyz,
+                          std::vector<Vector2> & pix) const{
+      if (m_use_semi_approx || !m_use_rpc_approximation)
+        return false;
+      m_rpc_model->points_to_pixels(xyz, pix);
+      return true;
+    }
+    
     // We have tabulated point_to_pixel at the mean dem height.
     // Look-up point_to_pixel for the current point by first
     // intersecting the ray from the current point to the camera
@@ -2074,7 +2085,8 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
                                     double             & ground_weight,
                                     const double       * reflectance_model_coeffs,
                                     SlopeErrEstim      * slopeErrEstim = NULL,
-                                    HeightErrEstim     * heightErrEstim = NULL) {
+                                    HeightErrEstim     * heightErrEstim = NULL,
+                                    Vector2      const * cam_pix = NULL) {
 
   // Set output values
   reflectance = 0.0; reflectance.invalidate();
@@ -2141,7 +2153,11 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
   Vector2 pix;
   Vector3 cameraPosition;
   try {
-    pix = camera->point_to_pixel(base);
+    // Use the projection of the center grid point if it was precomputed
+    if (cam_pix != NULL)
+      pix = *cam_pix;
+    else
+      pix = camera->point_to_pixel(base);
     
     // Need camera center only for Lunar Lambertian
     if (global_params.reflectanceType != LAMBERT)
@@ -2311,9 +2327,33 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
     }
   }
 
+  // With the RPC approximation, project the grid points of each DEM
+  // column into the camera all at once
+  ApproxCameraModel const* approx_cam = dynamic_cast<ApproxCameraModel const*>(camera);
+  std::vector<Vector3> col_points;
+  std::vector<Vector2> col_pixels;
+  
   bool use_pq = (pq.cols() > 0 && pq.rows() > 0);
   for (int col = 1; col < dem.cols() - 1; col += sample_col_rate) {
+
+    bool have_pixels = false;
+    if (approx_cam != NULL) {
+      col_points.clear();
+      for (int row = 1; row < dem.rows() - 1; row += sample_row_rate) {
+        Vector2 lonlat = geo.pixel_to_lonlat(Vector2(col, row));
+        col_points.push_back(geo.datum().geodetic_to_cartesian
+                             (Vector3(lonlat[0], lonlat[1], dem(col, row))));
+      }
+      have_pixels = approx_cam->points_to_pixels(col_points, col_pixels);
+    }
+    
+    int count = 0;
     for (int row = 1; row < dem.rows() - 1; row += sample_row_rate) {
+
+      Vector2 const* cam_pix = NULL;
+      if (have_pixels)
+        cam_pix = &col_pixels[count];
+      count++;
       
       double pval = 0, qval = 0;
       if (use_pq) {
@@ -2333,7 +2373,8 @@ void computeReflectanceAndIntensity(ImageView<double> const& dem,
                                      ground_weight(col, row),
                                      reflectance_model_coeffs,
                                      slopeErrEstim,
-                                     heightErrEstim);
+                                     heightErrEstim,
+                                     cam_pix);
     }
   }
   
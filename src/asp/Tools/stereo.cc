@@ -893,6 +893,13 @@ namespace asp {
       vw_throw(ArgumentErr() << "The entries of subpixel-kernel must be odd numbers.\n");
     }
 
+    if (stereo_settings().compact_point_cloud &&
+        (stereo_settings().save_double_precision_point_cloud ||
+         stereo_settings().skip_point_cloud_center_comp))
+      vw_throw(ArgumentErr() << "The option --compact-point-cloud stores points relative "
+               << "to the cloud center, so it cannot be used with "
+               << "--save-double-precision-point-cloud or --skip-point-cloud-center-comp.\n");
+
     // Check SGM-related settings.
 
     vw::stereo::CorrelationAlgorithm stereo_alg
@@ -67,6 +67,8 @@ class StereoTriangulation:
   OUTPUT_CLOUD_TYPE             m_cloud_type;
   ImageViewRef<PixelMask<float>> m_left_aligned_bathy_mask;
   ImageViewRef<PixelMask<float>> m_right_aligned_bathy_mask;
+  // Each tile gets its own, as it caches data and is not thread-safe
+  boost::shared_ptr<asp::CovariancePropagator> m_cov_propagator;
 
   typedef typename DispImageType::pixel_type DPixelT;
 
@@ -104,6 +106,10 @@ public:
         vw_throw( ArgumentErr() << "In multi-view triangulation, all disparities "
                   << "must have the same dimensions.\n" );
     }
+
+    if (stereo_settings().propagate_errors && m_camera_ptrs.size() >= 2)
+      m_cov_propagator.reset(new asp::CovariancePropagator(m_datum, m_camera_ptrs[0],
+                                                           m_camera_ptrs[1]));
   }
 
   inline int32 cols  () const { return m_disparity_maps[0].cols(); }
@@ -147,9 +153,7 @@ public:
           // index starts from 0).
           result[3] = errLen;
           subvector(result, 4, 2)
-            = asp::propagateCovariance(subvector(result, 0, 3),
-                                       m_datum, m_camera_ptrs[0], m_camera_ptrs[1],
-                                       pixVec[0], pixVec[1]);
+            = (*m_cov_propagator)(subvector(result, 0, 3), pixVec[0], pixVec[1]);
         }
         
         // Filter by triangulation error, if desired
@@ -412,6 +416,24 @@ void save_point_cloud(Vector3 const& shift, ImageT const& point_cloud,
     keywords["BAND6"] = "VerticalStdDev";
   }
 
+  if (stereo_settings().compact_point_cloud && norm_2(shift) > 0) {
+    if (opt.session->supports_multi_threading())
+      asp::block_write_compact_gdal_image
+        (point_cloud_file, shift,
+         stereo_settings().point_cloud_rounding_error,
+         point_cloud, has_georef, georef,
+         opt, TerminalProgressCallback("asp", "\t--> Triangulating: "),
+         keywords);
+    else
+      asp::write_compact_gdal_image
+        (point_cloud_file, shift,
+         stereo_settings().point_cloud_rounding_error,
+         point_cloud, has_georef, georef,
+         opt, TerminalProgressCallback("asp", "\t--> Triangulating: "),
+         keywords);
+    return;
+  }
+
   if (opt.session->supports_multi_threading()){
     asp::block_write_approx_gdal_image
       (point_cloud_file, shift,